@@ -0,0 +1,334 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Microbenchmarks of the hot kernels of a reduction step and of the solvers.
+ *
+ * Usage: bench_kernels [output file]
+ *
+ * Writes one JSON object per line (to stdout if no output file is given):
+ *   {"benchmark": "...", "ops": ..., "ns_per_op": ..., "gb_per_s": ...}
+ * where gb_per_s counts the bytes of samples (or transform entries) touched per operation. The
+ * problem sizes are fixed (n = MAX_N, q = 101), so runs on the same machine are comparable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+
+#include "memory_utils.h"
+#include "lwe_instance.h"
+#include "bkw_step_parameters.h"
+#include "position_values_2_category_index.h"
+#include "storage_file_utilities.h"
+#include "storage_writer.h"
+#include "storage_reader.h"
+#include "workplace_localization.h"
+#include "solve_fwht.h"
+#include "bkw_metrics.h"
+#ifdef BENCH_FFT
+#include "solve_fft_internal.h"
+#endif
+
+#define BENCH_Q 101
+#define BENCH_ALPHA 0.005
+#define BENCH_NUM_SAMPLES (1 << 16)
+#define BENCH_NUM_LOOKUPS (1 << 20)
+#define BENCH_MIN_SECONDS 0.2 /* each benchmark is repeated until it has run for at least this long */
+
+#define TAU 6.283185307179586476925286766559005768394338798750211641949 /* M_PI is not part of C11 */
+
+static FILE *out;
+static volatile u64 sink; /* keeps the results of the timed loops alive */
+
+static void report(const char *name, u64 ops, double seconds, double bytesPerOp)
+{
+    double ns = seconds * 1e9 / ops;
+    fprintf(out, "{\"benchmark\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"gb_per_s\": %.3f}\n",
+            name, (unsigned long long)ops, ns, bytesPerOp ? bytesPerOp / ns : 0.0);
+    fflush(out);
+}
+
+/* category index of all samples, for one step of each sorting method */
+static void benchCategoryIndex(lweInstance *lwe, lweSample *samples)
+{
+    bkwStepParameters par[5];
+    const char *names[5] = {"category_index_plain_bkw_2", "category_index_plain_bkw_3", "category_index_lms_3", "category_index_smooth_lms_3", "category_index_coded_bkw_3"};
+    MEMSET(par, 0, sizeof(par));
+    for (int k=0; k<5; k++)
+    {
+        par[k].startIndex = 0;
+        par[k].numPositions = k == 0 ? 2 : 3;
+        par[k].selection = LF2;
+    }
+    par[0].sorting = plainBKW;
+    par[1].sorting = plainBKW;
+    par[2].sorting = LMS;
+    par[2].sortingPar.LMS.p = 15;
+    par[3].sorting = smoothLMS;
+    par[3].sortingPar.smoothLMS.p = 21;
+    par[3].sortingPar.smoothLMS.p1 = 38;
+    par[3].sortingPar.smoothLMS.p2 = 21;
+    par[3].sortingPar.smoothLMS.prev_p1 = -1;
+    par[4].sorting = codedBKW;
+    par[4].sortingPar.CodedBKW.ct = blockCode_31;
+
+    for (int k=0; k<5; k++)
+    {
+        categoryIndexer ci;
+        if (categoryIndexerInitialize(&ci, lwe, &par[k]))
+        {
+            fprintf(stderr, "could not initialize the category indexer for %s\n", names[k]);
+            continue;
+        }
+        u64 ops = 0, sum = 0;
+        double begin = bkwMetricsNow(), seconds;
+        do
+        {
+            for (int i=0; i<BENCH_NUM_SAMPLES; i++)
+            {
+                sum += categoryIndexerSampleIndex(&ci, &samples[i]);
+            }
+            ops += BENCH_NUM_SAMPLES;
+            seconds = bkwMetricsNow() - begin;
+        }
+        while (seconds < BENCH_MIN_SECONDS);
+        sink += sum;
+        report(names[k], ops, seconds, LWE_SAMPLE_SIZE_IN_BYTES);
+        categoryIndexerFree(&ci);
+    }
+}
+
+/* combination of adjacent samples, as in the inner loop of a reduction step */
+static void benchSampleCombine(lweInstance *lwe, lweSample *samples)
+{
+    int n = lwe->n, q = lwe->q;
+    lweSample dst;
+    for (int add=0; add<2; add++)
+    {
+        u64 ops = 0;
+        double begin = bkwMetricsNow(), seconds;
+        do
+        {
+            for (int i=0; i<BENCH_NUM_SAMPLES-1; i++)
+            {
+                if (add)
+                {
+                    lweSampleAdd(&dst, &samples[i], &samples[i+1], n, q);
+                }
+                else
+                {
+                    lweSampleSubtract(&dst, &samples[i], &samples[i+1], n, q);
+                }
+                sink += dst.sumWithError;
+            }
+            ops += BENCH_NUM_SAMPLES-1;
+            seconds = bkwMetricsNow() - begin;
+        }
+        while (seconds < BENCH_MIN_SECONDS);
+        report(add ? "sample_add" : "sample_subtract", ops, seconds, 3 * LWE_SAMPLE_SIZE_IN_BYTES);
+    }
+}
+
+/* storage writer, insertion followed by the flushes to file (done by storageWriterFree) */
+static void benchStorageWriter(lweInstance *lwe, lweSample *samples, const char *folderName)
+{
+    bkwStepParameters par;
+    MEMSET(&par, 0, sizeof(par));
+    par.sorting = plainBKW;
+    par.startIndex = 0;
+    par.numPositions = 2;
+    par.selection = LF2;
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, lwe, &par))
+    {
+        fprintf(stderr, "could not initialize the category indexer of the storage writer\n");
+        return;
+    }
+    u64 categoryCapacity = 4 * BENCH_NUM_SAMPLES / ci.numCategories + 1;
+    u64 ops = 0;
+    double begin = bkwMetricsNow(), seconds;
+    do
+    {
+        deleteStorageFolder(folderName, 1, 1, 1);
+        storageWriter sw;
+        if (storageWriterInitialize(&sw, folderName, lwe, &par, categoryCapacity))
+        {
+            fprintf(stderr, "could not initialize the storage writer in %s\n", folderName);
+            categoryIndexerFree(&ci);
+            return;
+        }
+        int status;
+        for (int i=0; i<BENCH_NUM_SAMPLES; i++)
+        {
+            u64 categoryIndex = categoryIndexerSampleIndex(&ci, &samples[i]);
+            lweSample *dst = storageWriterAddSample(&sw, categoryIndex, &status);
+            if (dst)
+            {
+                MEMCPY(dst, &samples[i], LWE_SAMPLE_SIZE_IN_BYTES);
+            }
+        }
+        storageWriterFree(&sw);
+        ops += BENCH_NUM_SAMPLES;
+        seconds = bkwMetricsNow() - begin;
+    }
+    while (seconds < BENCH_MIN_SECONDS);
+    report("storage_writer_add_and_flush", ops, seconds, LWE_SAMPLE_SIZE_IN_BYTES);
+    categoryIndexerFree(&ci);
+}
+
+/* storage reader, a full pass over the folder written by benchStorageWriter */
+static void benchStorageReader(const char *folderName)
+{
+    u64 ops = 0;
+    double begin = bkwMetricsNow(), seconds;
+    do
+    {
+        storageReader sr;
+        if (storageReaderInitialize(&sr, folderName))
+        {
+            fprintf(stderr, "could not initialize the storage reader in %s\n", folderName);
+            return;
+        }
+        lweSample *buf1, *buf2;
+        u64 numSamplesInBuf1, numSamplesInBuf2;
+        while (storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2))
+        {
+            ops += numSamplesInBuf1 + numSamplesInBuf2;
+        }
+        storageReaderFree(&sr);
+        seconds = bkwMetricsNow() - begin;
+    }
+    while (seconds < BENCH_MIN_SECONDS && ops);
+    report("storage_reader_next_category_pair", ops, seconds, LWE_SAMPLE_SIZE_IN_BYTES);
+}
+
+/* in-place fast Walsh-Hadamard transform, ops are transform entries */
+static void benchFWHT(void)
+{
+    const int logSizes[3] = {10, 16, 20};
+    for (int k=0; k<3; k++)
+    {
+        int size = 1 << logSizes[k];
+        fwhtEntry *data = MALLOC(size * sizeof(fwhtEntry));
+        for (int i=0; i<size; i++)
+        {
+            data[i] = i % 7 - 3;
+        }
+        u64 ops = 0;
+        double begin = bkwMetricsNow(), seconds;
+        do
+        {
+            FWHT(data, size);
+            ops += size;
+            seconds = bkwMetricsNow() - begin;
+        }
+        while (seconds < BENCH_MIN_SECONDS);
+        sink += (u64)data[0];
+        char name[64];
+        sprintf(name, "fwht_2^%d", logSizes[k]);
+        report(name, ops, seconds, logSizes[k] * 2 * sizeof(fwhtEntry)); /* log2(size) passes, each reading and writing every entry */
+        FREE(data);
+    }
+}
+
+#ifdef BENCH_FFT
+/* accumulation of the samples into the input of a 3-position fft */
+static void benchFFTAccumulate(lweInstance *lwe, lweSample *samples)
+{
+    int q = lwe->q, fftPositions = 3;
+    u64 size = (u64)q * q * q;
+    fftw_complex *in = fftw_malloc(size * sizeof(fftw_complex));
+    fftw_complex *roots = fftw_malloc(q * sizeof(fftw_complex));
+    for (int k=0; k<q; k++)
+    {
+        roots[k] = cexp(TAU*I*k/q);
+    }
+    MEMSET(in, 0, size * sizeof(fftw_complex));
+    short solution[MAX_N];
+    MEMSET(solution, 0, sizeof(solution));
+    int numSolvedCoordinates = lwe->n - fftPositions;
+    u64 ops = 0;
+    double begin = bkwMetricsNow(), seconds;
+    do
+    {
+        fftAccumulateSamples(lwe, samples, BENCH_NUM_SAMPLES, solution, numSolvedCoordinates, in, roots, fftPositions);
+        ops += BENCH_NUM_SAMPLES;
+        seconds = bkwMetricsNow() - begin;
+    }
+    while (seconds < BENCH_MIN_SECONDS);
+    sink += (u64)creal(in[0]);
+    report("fft_accumulate_3", ops, seconds, LWE_SAMPLE_SIZE_IN_BYTES + sizeof(fftw_complex));
+    fftw_free(roots);
+    fftw_free(in);
+}
+#endif
+
+/* generation of new samples with Gaussian errors */
+static void benchSampleGeneration(lweInstance *lwe, lweSample *samples)
+{
+    u64 ops = 0;
+    double begin = bkwMetricsNow(), seconds;
+    do
+    {
+        for (int i=0; i<BENCH_NUM_SAMPLES; i++)
+        {
+            lwe->newInPlaceRandomSample(&samples[i], lwe->n, lwe->q, lwe->sigma, &lwe->rnd, lwe->s);
+        }
+        ops += BENCH_NUM_SAMPLES;
+        seconds = bkwMetricsNow() - begin;
+    }
+    while (seconds < BENCH_MIN_SECONDS);
+    report("gaussian_sample_generation", ops, seconds, LWE_SAMPLE_SIZE_IN_BYTES);
+}
+
+int main(int argc, char *argv[])
+{
+    out = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    lweInstance lwe;
+    lweInit(&lwe, MAX_N, BENCH_Q, BENCH_ALPHA);
+    lweSample *samples = MALLOC(BENCH_NUM_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
+
+    benchSampleGeneration(&lwe, samples); /* also provides the samples of the other benchmarks */
+    benchCategoryIndex(&lwe, samples);
+    benchSampleCombine(&lwe, samples);
+
+    char folderName[512];
+    sprintf(folderName, "%s/bench_kernels", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A);
+    benchStorageWriter(&lwe, samples, folderName);
+    benchStorageReader(folderName);
+    deleteStorageFolder(folderName, 1, 1, 1);
+
+    benchFWHT();
+#ifdef BENCH_FFT
+    benchFFTAccumulate(&lwe, samples);
+#endif
+
+    FREE(samples);
+    lweDestroy(&lwe);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
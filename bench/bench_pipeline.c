@@ -0,0 +1,238 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* End-to-end benchmark of a complete reduction and solving run.
+ *
+ * Usage: bench_pipeline [key=value ...]
+ *
+ *   n=10 q=101 alpha=0.01    instance of the standard plan (n at most MAX_N)
+ *   samples=10000            number of initial samples, generated with addSamplesToSampleFile
+ *   plan=<file>              run a plan file (see pipeline.h) instead of the standard plan,
+ *                            samples= still overrides its number of initial samples
+ *   trials=3                 number of runs, each on a new instance
+ *   output=<file>            JSON lines output (default stdout, the log of the run goes to stdout as well)
+ *
+ * The standard plan is that of test_pipeline_smooth_lms_fwht_bruteforce_10_101_01 scaled to n and q:
+ * smooth LMS steps of 2 positions with p and p1 scaled by q/101, fwht on the reduced positions and
+ * bruteforce on the last 2 (or 3) positions. Larger instances need MAX_N and MAX_NUM_SAMPLES to be
+ * configured accordingly (the smooth LMS steps size their storage on MAX_NUM_SAMPLES).
+ *
+ * For every stage of every trial one line with wall time, bytes read and written and peak resident
+ * set size is written, then one line per trial with the total time and whether the secret was found,
+ * and a last line with the success rate over all trials.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory_utils.h"
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "random_utils.h"
+#include "storage_file_utilities.h"
+#include "workplace_localization.h"
+#include "bkw_metrics.h"
+#include "pipeline.h"
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE "unknown"
+#endif
+
+/* the plan of test_pipeline_smooth_lms_fwht_bruteforce_10_101_01 for n and q */
+static int standardPlan(pipelinePlan *plan, int n, int q, double alpha, u64 numSamples)
+{
+    MEMSET(plan, 0, sizeof(pipelinePlan));
+    plan->n = n;
+    plan->q = q;
+    plan->alpha = alpha;
+    plan->numInitialSamples = numSamples;
+    plan->storageRoom = 4.0 / 3;
+    plan->numSteps = (n - 2) / 2;
+    if (plan->numSteps < 1 || plan->numSteps > PIPELINE_MAX_STEPS)
+    {
+        return 1; /* n out of range */
+    }
+    short p = (short)round(21.0 * q / 101), p1 = (short)round(38.0 * q / 101);
+    for (int i=0; i<plan->numSteps; i++)
+    {
+        bkwStepParameters *step = &plan->step[i];
+        step->sorting = smoothLMS;
+        step->startIndex = 2*i;
+        step->numPositions = 2;
+        step->selection = LF2;
+        step->sortingPar.smoothLMS.p = p;
+        step->sortingPar.smoothLMS.p1 = p1;
+        step->sortingPar.smoothLMS.p2 = p;
+        step->sortingPar.smoothLMS.prev_p1 = i == 0 ? -1 : p1;
+    }
+    plan->solver = pipelineSolverFwhtBruteForce;
+    plan->bruteForcePositions = n - 2 * plan->numSteps;
+    plan->deleteIntermediates = 1;
+    return 0;
+}
+
+/* removes the folders left by a run (the intermediate folders are deleted by the pipeline) */
+static void deleteRun(const pipelinePlan *plan)
+{
+    char folderName[512];
+    sprintf(folderName, "%s/original", plan->folderName);
+    deleteStorageFolder(folderName, 1, 1, 1);
+    for (int s=0; s<plan->numSteps; s++)
+    {
+        sprintf(folderName, "%s/step_%02d", plan->folderName, s);
+        deleteStorageFolder(folderName, 1, 1, 1);
+    }
+    sprintf(folderName, "%s/step_final", plan->folderName);
+    deleteStorageFolder(folderName, 1, 1, 1);
+    rmdir(plan->folderName);
+}
+
+/* compares the solution with the secret of the original samples */
+static int solutionIsCorrect(const pipelinePlan *plan, const u8 *binarySolution, const short *bfSolution)
+{
+    char folderName[512];
+    sprintf(folderName, "%s/original", plan->folderName);
+    lweInstance lwe;
+    if (lweParametersFromFile(&lwe, folderName))
+    {
+        return 0;
+    }
+    int fwhtPositions = plan->n - plan->zeroPositions - plan->bruteForcePositions;
+    int numBinary = fwhtPositions + (plan->solver == pipelineSolverFwhtHybrid ? plan->bruteForcePositions : 0);
+    int correct = 1;
+    for (int i=0; i<numBinary; i++)
+    {
+        short s = lwe.s[plan->zeroPositions + i];
+        u8 real = s < lwe.q/2 ? s % 2 : (s+1) % 2;
+        correct &= binarySolution[i] == real;
+    }
+    for (int i=0; plan->solver == pipelineSolverFwhtBruteForce && i<plan->bruteForcePositions; i++)
+    {
+        correct &= bfSolution[i] == lwe.s[plan->zeroPositions + fwhtPositions + i];
+    }
+    lweDestroy(&lwe);
+    return correct;
+}
+
+int main(int argc, char *argv[])
+{
+    time_t start = time(NULL);
+    srand(time(NULL));
+    randomUtilRandomize();
+
+    int n = MAX_N < 10 ? MAX_N : 10, q = 101, trials = 3;
+    double alpha = 0.01;
+    u64 numSamples = 0;
+    const char *planFileName = NULL, *outputFileName = NULL;
+    for (int i=1; i<argc; i++)
+    {
+        char *eq = strchr(argv[i], '=');
+        if (!eq)
+        {
+            printf("usage: %s [n=..] [q=..] [alpha=..] [samples=..] [plan=..] [trials=..] [output=..]\n", argv[0]);
+            return 1;
+        }
+        *eq = 0;
+        const char *value = eq + 1;
+        if (!strcmp(argv[i], "n"))
+            n = atoi(value);
+        else if (!strcmp(argv[i], "q"))
+            q = atoi(value);
+        else if (!strcmp(argv[i], "alpha"))
+            alpha = atof(value);
+        else if (!strcmp(argv[i], "samples"))
+            numSamples = strtoull(value, NULL, 10);
+        else if (!strcmp(argv[i], "plan"))
+            planFileName = value;
+        else if (!strcmp(argv[i], "trials"))
+            trials = atoi(value);
+        else if (!strcmp(argv[i], "output"))
+            outputFileName = value;
+        else
+        {
+            printf("unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    pipelinePlan plan;
+    if (planFileName)
+    {
+        int ret = pipelinePlanFromFile(planFileName, &plan);
+        if (ret)
+        {
+            printf("error %d when reading plan file %s\n", ret, planFileName);
+            return 1;
+        }
+        if (numSamples)
+        {
+            plan.numInitialSamples = numSamples;
+        }
+    }
+    else if (n > MAX_N || standardPlan(&plan, n, q, alpha, numSamples ? numSamples : 10000))
+    {
+        printf("no standard plan for n = %d (MAX_N = %d)\n", n, MAX_N);
+        return 1;
+    }
+    plan.verify = 0; /* the background verification would be timed as well */
+    plan.metricsStreamFileName[0] = 0;
+    sprintf(plan.folderName, "%s/bench_pipeline_%d_%d", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A, plan.n, plan.q);
+
+    FILE *out = outputFileName ? fopen(outputFileName, "w") : stdout;
+    if (!out)
+    {
+        printf("could not open %s\n", outputFileName);
+        return 1;
+    }
+    fprintf(out, "{\"event\": \"run\", \"build\": \"%s\", \"max_n\": %d, \"n\": %d, \"q\": %d, \"alpha\": %f, \"samples\": %llu, \"steps\": %d, \"trials\": %d}\n",
+            BENCH_BUILD_TYPE, MAX_N, plan.n, plan.q, plan.alpha, (unsigned long long)plan.numInitialSamples, plan.numSteps, trials);
+
+    int numSuccesses = 0;
+    u8 binarySolution[MAX_N];
+    short bfSolution[MAX_N];
+    pipelineStageStatistics stats[PIPELINE_MAX_STEPS + 1];
+    for (int t=0; t<trials; t++)
+    {
+        deleteRun(&plan);
+        double begin = bkwMetricsNow();
+        int ret = pipelineRun(&plan, binarySolution, bfSolution, stats, start);
+        double seconds = bkwMetricsNow() - begin;
+        int success = !ret && solutionIsCorrect(&plan, binarySolution, bfSolution);
+        numSuccesses += success;
+        for (int s=0; s<=plan.numSteps && !ret; s++)
+        {
+            fprintf(out, "{\"event\": \"stage\", \"trial\": %d, \"stage\": %d, \"seconds\": %.6f, \"samples_out\": %llu, \"bytes_read\": %llu, \"bytes_written\": %llu, \"peak_rss_bytes\": %llu}\n",
+                    t, s, stats[s].seconds, (unsigned long long)stats[s].numSamplesOut, (unsigned long long)stats[s].numBytesRead,
+                    (unsigned long long)stats[s].numBytesWritten, (unsigned long long)stats[s].peakRssBytes);
+        }
+        fprintf(out, "{\"event\": \"trial\", \"trial\": %d, \"error\": %d, \"seconds\": %.6f, \"success\": %d}\n", t, ret, seconds, success);
+        fflush(out);
+    }
+    deleteRun(&plan);
+
+    fprintf(out, "{\"event\": \"summary\", \"trials\": %d, \"successes\": %d, \"success_rate\": %.3f}\n", trials, numSuccesses, trials ? (double)numSuccesses / trials : 0.0);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    timeStamp(start);
+    printf("Done!\n");
+    return 0;
+}
@@ -34,6 +34,7 @@
 #include "workplace_localization.h"
 #include "iterator_samples.h"
 #include "verify_samples.h"
+#include "storage_writer.h"
 #include "config_bkw.h"
 // #include "Python.h" // needs to be included before any standard headers, also make sure to add Python37.dll (or whichever version you need to use) to project
 #include "bkw_step_parameters.h"
@@ -68,6 +69,7 @@ int main(int argc, char* argv[])
     time_t start = time(NULL);
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     lweInstance lwe;
     int n, ret;
@@ -155,7 +157,6 @@ int main(int argc, char* argv[])
     switch (ret)
     {
     case 0: /* transition computed ok */
-        printSampleVerificationOfSortedFolder(sortedFolderName, start, &bkwStepPar[0]); /* verify sorted samples */
         break;
     case 1: /* sorting unnecessary (destination folder already exists) */
         timeStamp(start);
@@ -203,7 +204,6 @@ int main(int argc, char* argv[])
         switch (ret)
         {
         case 0: /* reduction computed ok */
-            printSampleVerificationOfSortedFolder(dstFolderName, start, &bkwStepPar[i+1]); /* verify samples in destination folder */
             break;
         case 100: /* reduction step unnecessary (destination folder already exists) */
             timeStamp(start);
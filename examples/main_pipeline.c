@@ -0,0 +1,75 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "random_utils.h"
+#include "pipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**************************************************************************
+ * Main: run the plan given on the command line (see pipeline.h for the format)
+ **************************************************************************/
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        printf("usage: %s <plan file>\n", argv[0]);
+        return 1;
+    }
+
+    time_t start = time(NULL);
+    srand(time(NULL));
+    randomUtilRandomize();
+
+    pipelinePlan plan;
+    int ret = pipelinePlanFromFile(argv[1], &plan);
+    if (ret)
+    {
+        timeStamp(start);
+        printf("error %d when reading plan file %s\n", ret, argv[1]);
+        return 1;
+    }
+
+    int fwhtPositions = plan.n - plan.zeroPositions - plan.bruteForcePositions;
+    u8 binarySolution[MAX_N];
+    short bfSolution[MAX_N];
+    ret = pipelineRun(&plan, binarySolution, bfSolution, NULL, start);
+    if (ret)
+    {
+        timeStamp(start);
+        printf("error %d in pipeline\n", ret);
+        return 1;
+    }
+
+    timeStamp(start);
+    printf("Binary Solution Found (");
+    for (int i=0; i<fwhtPositions + (plan.solver == pipelineSolverFwhtHybrid ? plan.bruteForcePositions : 0); i++)
+        printf("%hhu ", binarySolution[i]);
+    if (plan.solver == pipelineSolverFwhtBruteForce)
+    {
+        printf("- ");
+        for (int i=0; i<plan.bruteForcePositions; i++)
+            printf("%hi ", bfSolution[i]);
+    }
+    printf(")\n");
+
+    timeStamp(start);
+    printf("Done!\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "planner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**************************************************************************
+ * Main: search a plan for an instance within a budget and write it as a
+ * plan file for main_pipeline (see planner.h for the cost model)
+ **************************************************************************/
+int main(int argc, char* argv[])
+{
+    if (argc < 7)
+    {
+        printf("usage: %s <n> <q> <alpha> <samples> <run folder> <plan file> [max RAM GB] [max disk GB] [max hours]\n", argv[0]);
+        return 1;
+    }
+
+    time_t start = time(NULL);
+    int n = atoi(argv[1]), q = atoi(argv[2]);
+    double alpha = atof(argv[3]);
+    u64 numSamples = strtoull(argv[4], NULL, 10);
+    plannerBudget budget;
+    budget.maxRamBytes = argc > 7 ? atof(argv[7]) * 1024 * 1024 * 1024 : 0;
+    budget.maxDiskBytes = argc > 8 ? atof(argv[8]) * 1024 * 1024 * 1024 : 0;
+    budget.maxSeconds = argc > 9 ? atof(argv[9]) * 3600 : 0;
+
+    pipelinePlan plan;
+    plannerEstimate est;
+    int ret = plannerSearch(n, q, alpha, numSamples, &budget, &plan, &est);
+    if (ret)
+    {
+        timeStamp(start);
+        printf("error %d, no plan found\n", ret);
+        return 1;
+    }
+
+    for (int s=0; s<est.numStages; s++)
+    {
+        const plannerStageEstimate *st = &est.stage[s];
+        timeStamp(start);
+        printf("Stage %02d: %llu categories, %.0f -> %.0f samples (%.0f%% full), %.1f MB on disk, %.1f MB RAM, noise variance %.1f, %.1f s\n",
+               s, (unsigned long long)st->numCategories, st->numSamplesIn, st->numSamplesOut, 100 * st->fill, st->diskBytes / (1024 * 1024), st->ramBytes / (1024 * 1024), st->noiseVariance, st->seconds);
+    }
+    timeStamp(start);
+    printf("Solver: %d zero, %d fwht and %d bruteforce positions, %.0f samples needed (bias %g), %.1f s\n",
+           plan.zeroPositions, n - plan.zeroPositions - plan.bruteForcePositions, plan.bruteForcePositions, est.numSamplesNeeded, est.bias, est.solverSeconds);
+    timeStamp(start);
+    printf("Total: %.1f s, peak %.1f MB RAM and %.1f MB disk\n", est.seconds, est.peakRamBytes / (1024 * 1024), est.peakDiskBytes / (1024 * 1024));
+
+    snprintf(plan.folderName, sizeof(plan.folderName), "%s", argv[5]);
+    if (pipelinePlanToFile(argv[6], &plan))
+    {
+        timeStamp(start);
+        printf("could not write plan file %s\n", argv[6]);
+        return 1;
+    }
+    timeStamp(start);
+    printf("plan written to %s\n", argv[6]);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef BKW_METRICS_H
+#define BKW_METRICS_H
+#include "platform_types.h"
+#include "storage_reader.h"
+#include "storage_writer.h"
+#include "unnatural_selection.h"
+
+/* Per-step performance counters. A step (or solver) run is bracketed by bkwMetricsBegin and
+   bkwMetricsEnd on the calling thread; the storage readers and writers and the unnatural selection
+   filters of that thread add their counters when they are freed. Other threads (such as a
+   background verification) are not counted.
+
+   The counters of a reduction step are written as a JSON object to metrics.json in the destination
+   folder, those of a solver run to solver_metrics.json in the solved folder. If a stream file is
+   open, every storage writer flush and every completed step is also appended to it as one JSON
+   line, so that a long run can be followed while it proceeds. */
+
+typedef struct
+{
+    char stage[512]; /* destination (or solved) folder */
+    double beginSeconds;
+    double seconds; /* wall-clock duration */
+    /* pair combination */
+    u64 numPairsConsidered; /* pairs rejected by unnatural selection plus pairs passed to the storage writer */
+    u64 numUnnaturalSelectionRejects;
+    u64 numZeroColumnRejects;
+    /* storage writer */
+    u64 numWriterDiscardsCacheFull; /* storageWriterHasRoom status 2 */
+    u64 numWriterDiscardsCategoryFull; /* storageWriterHasRoom status 3 */
+    u64 numDuplicatesDiscarded;
+    u64 numSamplesWritten;
+    u64 numFlushes;
+    u64 numFlushBytes;
+    double flushSeconds;
+    /* storage reader */
+    u64 numReaderBytes;
+    double readerStallSeconds; /* time spent waiting for file reads */
+    /* solver */
+    double solverAccumulateSeconds; /* summed over the solver threads */
+    double solverTransformSeconds; /* summed over the solver threads */
+    /* process */
+    u64 peakRssBytes; /* peak resident set size of the process so far, taken at the end */
+} bkwMetrics;
+
+double bkwMetricsNow(void); /* monotonic clock, in seconds */
+
+void bkwMetricsBegin(bkwMetrics *m, const char *stage); /* resets m and makes it the current metrics of the calling thread */
+void bkwMetricsEnd(bkwMetrics *m); /* stops counting into m, streams it if a stream file is open */
+bkwMetrics *bkwMetricsCurrent(void); /* NULL outside of bkwMetricsBegin/bkwMetricsEnd */
+const bkwMetrics *bkwMetricsLast(void); /* the metrics last ended on the calling thread (stage is empty if none) */
+
+/* add the counters of a component to the current metrics of the calling thread, if any (called on free) */
+void bkwMetricsAddStorageReader(const storageReader *sr);
+void bkwMetricsAddStorageWriter(const storageWriter *sw);
+void bkwMetricsAddUnnaturalSelection(const unnaturalSelectionFilter *us);
+void bkwMetricsAddSolverSeconds(bkwMetrics *m, double accumulateSeconds, double transformSeconds); /* thread-safe, m may be NULL */
+
+int bkwMetricsToFile(const bkwMetrics *m, const char *fileName);
+
+/* stream file, shared by all threads */
+int bkwMetricsStreamOpen(const char *fileName); /* appends to the file if it exists */
+void bkwMetricsStreamClose(void);
+void bkwMetricsStreamFlush(const storageWriter *sw, double duration); /* one line per storage writer flush */
+
+#endif
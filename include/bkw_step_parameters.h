@@ -20,7 +20,8 @@
 #include "lwe_sorting.h"
 #include "lwe_sample_selection.h"
 
-#define MAX_LMS_POSITIONS 6
+#define MAX_PLAIN_BKW_POSITIONS 10
+#define MAX_LMS_POSITIONS 10
 #define MAX_CODED_BKW_POSITIONS 4
 #define MAX_SMOOTH_LMS_POSITIONS 10
 
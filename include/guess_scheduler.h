@@ -0,0 +1,58 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef GUESS_SCHEDULER_H
+#define GUESS_SCHEDULER_H
+
+#include "platform_types.h"
+#include "config_bkw.h"
+
+/* number of best candidates kept (and reported) by the brute-force solvers */
+#define SOLVER_TOP_K_CANDIDATES 5
+
+/* abort the guessing as soon as a candidate score is this many standard deviations above
+ * the expected maximum score of a wrong guess (0 disables early termination) */
+#define SOLVER_EARLY_ABORT_SIGMAS 0
+
+typedef struct
+{
+    u64 guess; /* index of the brute-force guess */
+    u64 index; /* position of the maximum in the transform computed for the guess */
+    double score; /* value of the maximum */
+} guessCandidate;
+
+/* The scheduler hands out ranges of guess indices [0, numGuesses) to worker threads.
+ * Each worker owns the state returned by workerInit (typically its transform table),
+ * evaluates one guess at a time and steals half of the remaining range of another
+ * worker when its own range is exhausted. */
+typedef struct
+{
+    int numThreads; /* number of worker threads (0 = number of online processors) */
+    int topK; /* number of best candidates to keep */
+    double earlyAbortThreshold; /* stop all workers when a score reaches this value (0 = never) */
+    void *ctx; /* shared (read-only) solver data */
+    void *(*workerInit)(void *ctx); /* may return NULL (e.g. out of memory), the guesses are then evaluated by the other workers */
+    double (*evaluate)(void *ctx, void *workerState, u64 guess, u64 *index);
+    void (*workerFree)(void *ctx, void *workerState);
+} guessScheduler;
+
+int guessSchedulerRun(guessScheduler *gs, u64 numGuesses, guessCandidate *candidates, int *numCandidates, int *earlyAborted);
+
+void guessCandidateInsert(guessCandidate *list, int *len, int k, guessCandidate *c);
+double guessSchedulerSignificanceThreshold(double variance, double numHypotheses, double sigmas);
+void guessIndexToDigits(u64 guess, int base, int len, int *digits);
+
+#endif
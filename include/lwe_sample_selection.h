@@ -22,10 +22,10 @@ typedef enum
 {
     LF1, // linear pairs columns combination
     LF2, // all pairs columns combination
+    LSH_LF2, // pairs in the same or neighbouring LSH buckets on the unnatural selection positions (smooth LMS only)
 #if 0
     LF1, // linear column combination
     LF2_unnaturalSelection, // all pairs columns combination, but with an over-production, saving only a "best" fraction
-    LSH_LF2 // all pairs in LSH wedges
 #endif
     numSelectionMethods
 } selectionMethod;
@@ -0,0 +1,91 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "bkw_step_parameters.h"
+#include <time.h>
+
+#define PIPELINE_MAX_STEPS 32
+
+/*
+ * A plan file describes a complete run, one "key = value" per line (lines starting with # are comments):
+ *
+ *   folder = <folder of the run, the step folders are created in it>
+ *   n = 10
+ *   q = 101
+ *   alpha = 0.01
+ *   samples = 10000          (number of initial samples, generated if the run has no original samples)
+ *   storage_room = 1.34      (capacity of the first sorted folder, relative to the number of initial samples)
+ *   step = Smooth LMS [2 positions, start index=0, p=21, p1=38, p2=21, prev_p1=-1, meta_skipped=0, unnatural_selection=0, unnatural_selection_start_index=0]
+ *   selection = LF2          (of the preceding step)
+ *   solver = fwht_bruteforce (fwht, fwht_bruteforce or fwht_hybrid)
+ *   zero_positions = 0
+ *   bruteforce_positions = 2
+ *   delete_intermediates = 1 (delete each step folder as soon as the next step has consumed it)
+ *   verify = 1               (verify a sample of the samples as the step folders are written)
+ *   verify_folders = 0       (verify each stage folder completely, in the background while the next stage runs)
+ *   metrics_stream = <file>  (optional, append the metrics of each flush and stage to the file as they complete)
+ *
+ * The steps use the format of bkwStepParametersAsString. The samples are multiplied by 2 when sorted
+ * for the first step and the last step writes the unsorted samples that the solver reads. Each
+ * reduction step writes its metrics to its folder (see bkw_metrics.h).
+ */
+
+typedef enum
+{
+    pipelineSolverFwht,
+    pipelineSolverFwhtBruteForce,
+    pipelineSolverFwhtHybrid,
+    numPipelineSolvers
+} pipelineSolver;
+
+typedef struct
+{
+    char folderName[256];
+    int n;
+    int q;
+    double alpha;
+    u64 numInitialSamples;
+    double storageRoom;
+    int numSteps;
+    bkwStepParameters step[PIPELINE_MAX_STEPS];
+    pipelineSolver solver;
+    int zeroPositions;
+    int bruteForcePositions;
+    int deleteIntermediates;
+    int verify;
+    int verifyFolders;
+    char metricsStreamFileName[256];
+} pipelinePlan;
+
+/* stage 0 sorts the initial samples, stage i < numSteps performs step i-1 and stage numSteps the last step */
+typedef struct
+{
+    int skipped; /* stage had been completed by an earlier run */
+    double seconds;
+    u64 numSamplesOut;
+    u64 numBytesRead; /* from the stage metrics (see bkw_metrics.h) */
+    u64 numBytesWritten;
+    u64 peakRssBytes; /* peak resident set size of the process at the end of the stage */
+} pipelineStageStatistics;
+
+int pipelinePlanFromFile(const char *fileName, pipelinePlan *plan);
+int pipelinePlanToFile(const char *fileName, const pipelinePlan *plan); /* the folder line is omitted if the plan has no folder */
+int pipelineRun(pipelinePlan *plan, u8 *binarySolution, short *bfSolution, pipelineStageStatistics *stats, time_t start);
+
+#endif
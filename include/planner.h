@@ -0,0 +1,96 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "pipeline.h"
+
+/*
+ * Cost model and search for the parameters of a pipeline plan (see pipeline.h).
+ *
+ * For every stage of a plan the model predicts the number of categories (num_categories), the
+ * number of samples that the stage reads and writes (sample growth of LF1 and LF2 on adjacent
+ * category pairs, capped by the destination storage of the step as sized by the reduction steps),
+ * the expected load of the destination storage, its size on disk, the memory of the storage writer
+ * and reader, and the noise of the samples: the error variance doubles in every step and each
+ * reduced position keeps the variance of its rounding (p^2/6 for categories of width p), which
+ * doubles in the later steps. The solver needs about PLANNER_SAMPLE_FACTOR * ln(hypotheses) / bias^2
+ * samples, with bias = exp(-2 pi^2 V / q^2) for the final noise V on the fwht positions.
+ *
+ * The search covers smooth LMS plans without meta categories and unnatural selection: for each
+ * selection (LF1, LF2), number of bruteforce positions and rounding noise target, the steps are
+ * built greedily from the front, each taking as many positions as the category budget allows with
+ * the finest p1 that fits, and the positions that end up exactly reduced become zero positions.
+ * The plan with the lowest predicted run time that fits the budget and is predicted to succeed is
+ * returned.
+ *
+ * The time constants are rough throughputs of bench_pipeline and bench_kernels, to be adjusted to
+ * the machine at hand.
+ */
+
+#ifndef PLANNER_SECONDS_PER_SAMPLE
+#define PLANNER_SECONDS_PER_SAMPLE 4e-7 /* reduction stage, per sample read plus per sample written */
+#endif
+#ifndef PLANNER_SECONDS_PER_SOLVER_SAMPLE
+#define PLANNER_SECONDS_PER_SOLVER_SAMPLE 2e-8 /* accumulation of one sample into the fwht table */
+#endif
+#ifndef PLANNER_SECONDS_PER_FWHT_BUTTERFLY
+#define PLANNER_SECONDS_PER_FWHT_BUTTERFLY 5e-10 /* per entry and pass of the transform */
+#endif
+#ifndef PLANNER_SAMPLE_FACTOR
+#define PLANNER_SAMPLE_FACTOR 1.0 /* calibrated on the test instances (n = 10, q = 101) */
+#endif
+#define PLANNER_MAX_BRUTE_FORCE_POSITIONS 3
+
+typedef struct
+{
+    double maxSeconds; /* 0 for no limit */
+    double maxRamBytes; /* 0 for no limit */
+    double maxDiskBytes; /* 0 for no limit */
+} plannerBudget;
+
+/* stage 0 sorts the initial samples, stage i < numSteps performs step i-1 and stage numSteps the last step */
+typedef struct
+{
+    u64 numCategories; /* of the destination (0 for the last stage, which writes unsorted samples) */
+    double numSamplesIn;
+    double numSamplesOut;
+    double fill; /* expected load of the destination storage */
+    double diskBytes; /* destination sample file */
+    double ramBytes;
+    double noiseVariance; /* of the samples written, error and rounding of the fwht positions */
+    double seconds;
+} plannerStageEstimate;
+
+typedef struct
+{
+    int numStages;
+    plannerStageEstimate stage[PIPELINE_MAX_STEPS + 1];
+    double numSamplesNeeded; /* by the solver */
+    double bias;
+    double solverSeconds;
+    double solverRamBytes;
+    double seconds; /* total, reduction and solving */
+    double peakRamBytes;
+    double peakDiskBytes; /* the original samples, and the source and destination of the largest stage */
+    int success; /* enough samples for the solver */
+} plannerEstimate;
+
+int plannerEstimatePlan(const pipelinePlan *plan, plannerEstimate *est);
+int plannerSearch(int n, int q, double alpha, u64 numInitialSamples, const plannerBudget *budget, pipelinePlan *plan, plannerEstimate *est);
+
+#endif
@@ -17,8 +17,88 @@
 #ifndef POSITION_VALUES_2_CATEGORY_INDEX
 #define POSITION_VALUES_2_CATEGORY_INDEX
 #include "bkw_step_parameters.h"
+#include "syndrome_decoding.h"
 
-/* position values to index value */
+/* Plain BKW category indices are looked up in a q*q table of u32 (q < 2^16, so q^2 categories
+   always fit) as long as the table is small enough to stay in cache, otherwise they are
+   computed arithmetically, which is cheaper than a cache miss. */
+#ifndef PLAIN_BKW_TABLE_MAX_BYTES
+#define PLAIN_BKW_TABLE_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+int plain_bkw_use_table(int q);
+
+/* Category layout: a category is either a singleton (combined only with itself) or paired
+   with the next category, which holds the additive inverses of its position values.
+   With LMS and an even number of values c per position there are 2^numPositions singletons. */
+#define MAX_NUM_SINGLETON_CATEGORIES (1 << MAX_LMS_POSITIONS)
+
+int singleton_categories(lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 *singletons);
+u8 *singletonBitmapCreate(u64 numCategories, const u64 *singletons, int numSingletons);
+
+static inline int singletonBitmapTest(const u8 *bitmap, u64 categoryIndex)
+{
+    return (bitmap[categoryIndex >> 3] >> (categoryIndex & 7)) & 1;
+}
+
+/* Category indexer of one bkw step. All lookup tables are built once by categoryIndexerInitialize,
+   after which the indexer is read-only and may be shared between threads. */
+typedef struct
+{
+    int q;
+    int n;
+    bkwStepParameters bkwStepPar;
+    u64 numCategories;
+    u32 *plainTable; /* plain BKW, q*q entries, index p1*q + p2 (NULL: computed arithmetically) */
+    u16 *digitMap; /* LMS, q entries: position value to digit in [0, c) */
+    int c; /* generic (LMS and plain BKW except 2 and 3 positions): number of digit values per position */
+    u64 radixPower[MAX_LMS_POSITIONS]; /* c^i */
+    u64 singletons[MAX_NUM_SINGLETON_CATEGORIES]; /* categories that are not paired with their neighbour */
+    int numSingletons;
+    u8 *singletonBitmap; /* one bit per category, set for singletons */
+    syndromeDecodingTable syndromeTable; /* coded BKW */
+} categoryIndexer;
+
+int categoryIndexerInitialize(categoryIndexer *ci, lweInstance *lwe, bkwStepParameters *bkwStepPar);
+void categoryIndexerFree(categoryIndexer *ci);
+u64 categoryIndexerIndex(const categoryIndexer *ci, const short *a); /* a points to the value of position startIndex */
+u64 categoryIndexerSampleIndex(const categoryIndexer *ci, lweSample *sample);
+int categoryIndexerIsSingleton(const categoryIndexer *ci, u64 categoryIndex);
+
+/* For convenience in smooth LMS with meta categories */
+short positionSmoothLMSMap(short pn, int q, int q_, int p, int c);
+
+/* Sub-buckets of a category. Plain BKW with 3 positions and smooth LMS with meta categories
+   leave the last (one or two) positions out of the category index; the next step combines
+   samples that also match on these. The storage writer therefore keeps the samples of each
+   such category ordered by their sub-bucket, so that readers find every sub-bucket as a
+   contiguous range of the category. */
+typedef struct
+{
+    int q;
+    int q_;
+    int numSubBuckets; /* 0 if the samples within a category are not ordered */
+    int numKeyPositions; /* 1 or 2 */
+    int position[2];
+    int p[2]; /* smooth LMS reduction per key position (0 for plain BKW) */
+    int c[2]; /* number of values per key position */
+} subBucketIndexer;
+
+int subBucketIndexerInitialize(subBucketIndexer *sbi, lweInstance *lwe, bkwStepParameters *bkwStepPar);
+void subBucketIndexerLocate(const subBucketIndexer *sbi, lweSample *category, u64 numSamples, lweSample **subBucket, int *numSamplesInSubBucket); /* category must be ordered by sub-bucket */
+
+static inline int subBucketIndexerKey(const subBucketIndexer *sbi, lweSample *sample)
+{
+    int key = 0;
+    for (int i=sbi->numKeyPositions-1; i>=0; i--)
+    {
+        int pn = columnValue(sample, sbi->position[i]);
+        key = key * sbi->c[i] + (sbi->p[i] ? positionSmoothLMSMap(pn, sbi->q, sbi->q_, sbi->p[i], sbi->c[i]) : pn);
+    }
+    return key;
+}
+
+/* position values to index value (these share one internal indexer, not thread-safe) */
 u64 position_values_2_category_index(lweInstance *lwe, lweSample *sample, bkwStepParameters *bkwStepPar);
 u64 position_values_2_category_index_from_partial_sample(lweInstance *lwe, short *a, bkwStepParameters *bkwStepPar);
 
@@ -40,9 +120,6 @@ u64 position_values_2_category_index_smooth_lms(lweInstance *lwe, bkwStepParamet
 /* smooth LMS with meta categories*/
 u64 position_values_2_category_index_smooth_lms_meta(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn);
 
-/* For convenience in smooth LMS with meta categories */
-short positionSmoothLMSMap(short pn, int q, int q_, int p, int c);
-
 /* coded BKW 2 */
 u64 position_values_2_category_index_coded_bkw(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn);
 
@@ -0,0 +1,61 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+#include <stddef.h>
+#include <time.h>
+#include "platform_types.h"
+
+/* Bump allocator for temporary structures of the reduction steps (the sub-bucket arrays of a meta
+   category pair). Allocation moves a pointer, and everything is released at once by a reset after
+   each category pair, or by a rewind to an earlier mark. An arena is a local of the step that owns
+   it, so it is never shared between threads. */
+
+/* set to 1 to print the peak scratch usage at the end of each reduction step */
+#ifndef SCRATCH_ARENA_REPORT_PEAK
+#define SCRATCH_ARENA_REPORT_PEAK 0
+#endif
+
+typedef struct
+{
+    u8 *base;
+    size_t capacity; /* in bytes */
+    size_t used;
+    size_t peak; /* largest used since initialization */
+} scratchArena;
+
+int scratchArenaInitialize(scratchArena *sa, size_t capacity);
+void scratchArenaFree(scratchArena *sa);
+void *scratchArenaAlloc(scratchArena *sa, size_t numBytes); /* max_align_t aligned, NULL if the arena is exhausted */
+void scratchArenaReport(const scratchArena *sa, const char *stepName, time_t start); /* prints the peak usage if SCRATCH_ARENA_REPORT_PEAK is set */
+
+static inline void scratchArenaReset(scratchArena *sa)
+{
+    sa->used = 0;
+}
+
+static inline size_t scratchArenaMark(const scratchArena *sa)
+{
+    return sa->used;
+}
+
+static inline void scratchArenaRewind(scratchArena *sa, size_t mark)
+{
+    sa->used = mark;
+}
+
+#endif
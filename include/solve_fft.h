@@ -17,11 +17,23 @@
 #ifndef SOLVE_FFT_H
 #define SOLVE_FFT_H
 
+#include "platform_types.h"
+
 #define FFT_SOLVER_SINGLE_PRECISION 0
 #define FFT_SOLVER_DOUBLE_PRECISION 1
 
+/* memory used by solve_fft_search_hybrid for the compact form of the samples (fft index, sum with error and brute-force coefficients) */
+#define FFT_HYBRID_SAMPLES_MEMORY_BUDGET_IN_BYTES ((u64)1024*1024*1024)
+
+/* memory used by the fft input/output arrays of the solve_fft_search_hybrid workers (each worker owns one pair), 0 for half
+   of the physical memory. fewer than SOLVER_NUM_THREADS workers are started if their arrays do not fit, but at least one */
+#ifndef FFT_HYBRID_GRIDS_MEMORY_BUDGET_IN_BYTES
+#define FFT_HYBRID_GRIDS_MEMORY_BUDGET_IN_BYTES 0
+#endif
+
 //void test_fft_solver(const char *srcFolder);
 int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordinates, int fftPositions, int doublePrecision);
 int solve_fft_search_hybrid(const char *srcFolder, short *solution, int numSolvedCoordinates, int fftPositions, int bruteForcePositions, int doublePrecision);
+void fftPlanCacheClear(void); /* destroys the cached fft plans, call when no fft is running */
 
 #endif
@@ -0,0 +1,35 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SOLVE_FFT_INTERNAL_H
+#define SOLVE_FFT_INTERNAL_H
+
+/* fftw-dependent parts of the fft solver, shared with the kernel benchmarks (not part of solve_fft.h,
+   so that users of the solver do not need the fftw headers) */
+
+#include "lwe_instance.h"
+#include <complex.h> /* for fftw3 */
+#include "fftw3.h"
+
+/* Planner flags of the cached fft plans (FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT).
+ * Planning is done once per transform size and the wisdom is saved to LOCAL_FFTW_WISDOM_FILE_PATH,
+ * so the cost of a more thorough planner is only paid on the first run. */
+#define FFT_PLANNER_FLAGS FFTW_MEASURE
+
+/* adds roots[b - <a, solution> on the solved positions] to in[index of the fft positions] for each sample */
+void fftAccumulateSamples(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftw_complex *in, const fftw_complex *roots, int fftPositions);
+
+#endif
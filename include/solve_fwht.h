@@ -31,6 +31,17 @@
 #define MIN_STORAGE_WRITER_CACHE_LOAD_PERCENTAGE_BEFORE_FLUSH 25
 #define READ_BUFFER_CAPACITY_IN_SAMPLES (APPROXIMATE_SIZE_IN_BYTES_OF_READ_BUFFER / LWE_SAMPLE_SIZE_IN_BYTES)
 
+/* memory used for the guess tables that solve_fwht_search_bruteforce fills in a single pass over the samples */
+#define BRUTEFORCE_GUESS_TABLES_MEMORY_BUDGET_IN_BYTES ((u64)1024*1024*1024)
+
+#ifdef USE_SOFT_INFORMATION
+typedef double fwhtEntry;
+#else
+typedef long fwhtEntry;
+#endif
+
+void FWHT(fwhtEntry *data, int size); /* in-place fast Walsh-Hadamard transform, size is a power of two */
+u64 sample_to_int(short *input, int len, int q);
 int retrieve_full_secret(short *full_secret, int n_iterations, int n, int q, u8 binary_secret[][n]);
 
 #ifdef USE_SOFT_INFORMATION
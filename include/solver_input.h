@@ -0,0 +1,80 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SOLVER_INPUT_H
+#define SOLVER_INPUT_H
+
+#include <stdio.h>
+#include "lwe_instance.h"
+
+/* The solver-input file stores one 8-byte record per sample instead of a full lweSample:
+ * the packed solver index (FWHT parity bits or FFT base-q index) in the low bits and b in the high 16 bits */
+#define SOLVER_INPUT_INDEX_BITS 48
+#define SOLVER_INPUT_INDEX_MASK ((((u64)1) << SOLVER_INPUT_INDEX_BITS) - 1)
+
+typedef u64 solverInputRecord;
+
+typedef enum
+{
+    solverInputFwht, /* index bit i is the parity of position startIndex+i (as in sample_to_int) */
+    solverInputFft, /* index is the base-q number of positions startIndex, ..., startIndex+numPositions-1 (first position most significant) */
+    numSolverInputTypes
+} solverInputType;
+
+typedef struct
+{
+    solverInputType type;
+    int startIndex; /* first position in the index */
+    int numPositions; /* number of positions in the index */
+} solverInputParameters;
+
+typedef struct
+{
+    FILE *f;
+    solverInputParameters par;
+    int q;
+    u64 numRecords;
+} solverInputWriter;
+
+static inline solverInputRecord solverInputRecordPack(u64 index, short b)
+{
+    return (index & SOLVER_INPUT_INDEX_MASK) | (((u64)(unsigned short)b) << SOLVER_INPUT_INDEX_BITS);
+}
+
+static inline u64 solverInputRecordIndex(solverInputRecord r)
+{
+    return r & SOLVER_INPUT_INDEX_MASK;
+}
+
+static inline short solverInputRecordB(solverInputRecord r)
+{
+    return (short)(r >> SOLVER_INPUT_INDEX_BITS);
+}
+
+const char *solverInputTypeAsString(solverInputType type);
+u64 solverInputIndex(lweSample *sample, solverInputParameters *par, int q);
+
+/* solver-input file */
+int solverInputParametersFromFile(const char *folderName, solverInputParameters *par, u64 *numRecords);
+FILE *fopenSolverInput(const char *folderName, const char *mode);
+u64 freadSolverInput(FILE *f, solverInputRecord *buf, u64 numRecords);
+
+/* writer used by the final reduction steps */
+int solverInputWriterInitialize(solverInputWriter *siw, const char *folderName, solverInputParameters *par, int q);
+void solverInputWriterAddSample(solverInputWriter *siw, lweSample *sample);
+int solverInputWriterClose(solverInputWriter *siw, const char *folderName);
+
+#endif
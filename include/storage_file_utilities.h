@@ -27,19 +27,40 @@
 void parameterFileName(char *paramFileName, const char *folderName); /* parameter file name from folder name */
 void samplesFileName(char *samplesFileName, const char *folderName); /* samples file name from folder name */
 void samplesInfoFileName(char *samplesInfoFileName, const char *folderName); /* samples info file name from folder name */
+void metricsFileName(char *metricsFileName, const char *folderName); /* metrics file name of a reduction step from folder name */
+void solverMetricsFileName(char *solverMetricsFileName, const char *folderName); /* metrics file name of a solver run from folder name */
+void completeMarkerFileName(char *completeMarkerFileName, const char *folderName); /* completion marker file name from folder name */
 
 /* lwe instance folders */
 int newStorageFolderWithGivenLweInstance(lweInstance *lwe, const char *folderName); /* creates folder with parameter file (with given parameters) and an empty samples and samples info file */
 int newStorageFolder(lweInstance *lwe, const char *folderName, int n, int q, double alpha); /* generates new lwe parameters, creates folder with parameter file and an empty samples and samples info file */
 int deleteStorageFolder(const char *folderName, int deleteParFile, int deleteSampleInfoFile, int deleteSamples); /* deletes folder, including parameter and samples file */
+int completeMarkerToFile(const char *folderName); /* marks a folder whose samples and sample info are final as complete */
+int folderIsComplete(const char *folderName); /* non-zero if the folder has been marked as complete */
 
 /* parameter file */
 int parametersToFile(lweInstance *lwe, const char *folderName);
 int lweParametersFromFile(lweInstance *lwe, const char *folderName);
 
+/* lazy secret reduction: a reduced folder holds no samples of its own, they are read from a base
+   folder and transformed on the fly, a -> 2^numReductions * a and b -> b - a * t (see transition_reduce_secret) */
+typedef struct
+{
+    int numReductions; /* 0 if the folder holds its own samples */
+    short t[MAX_N];
+    char baseFolderName[512];
+} secretReduction;
+
+int secretReductionToFile(const char *folderName, secretReduction *r); /* appends the reduction to the parameter file */
+int secretReductionFromFile(const char *folderName, secretReduction *r); /* numReductions is 0 if the parameter file has no reduction */
+const char *secretReductionSampleFolder(const char *folderName, secretReduction *r); /* folder that holds the samples */
+void secretReductionApply(lweInstance *lwe, const secretReduction *r, lweSample *samples, u64 numSamples);
+
 /* sample info file */
-int sampleInfoToFile(const char *folderName, bkwStepParameters *bkwStepPar, u64 numCategories, u64 categoryCapacity, u64 numTotalSamples, u64 *numSamplesPerCategory);
+int sampleInfoToFile(const char *folderName, bkwStepParameters *bkwStepPar, u64 numCategories, u64 categoryCapacity, u64 numTotalSamples, u64 *singletons, int numSingletons, u64 *numSamplesPerCategory, u64 *categoryOffsets);
 int sampleInfoFromFile(const char *folderName, bkwStepParameters *bkwStepPar, u64 *numCategories, u64 *categoryCapacity, u64 *numTotalSamples, u64 *numSamplesPerCategory);
+int sampleInfoCategoryOffsetsFromFile(const char *folderName, u64 numCategories, u64 *categoryOffsets);
+int sampleInfoSingletonsFromFile(const char *folderName, u64 *singletons, int *numSingletons);
 
 /* samples file */
 FILE *fopenSamples(const char *folderName, const char *mode);
@@ -57,6 +78,7 @@ int convertTUDarmstadtProblemInstanceToNativeFormat(lweInstance *lwe, const char
 void destinationFileName(char *destFileName, const char *folderName);/* destination numbers file name from folder name */
 u64 fileSize(FILE *fp);
 void fileExtend(FILE *fp, u64 size);
+int fileTruncate(FILE *fp, u64 size);
 
 /* possibly superfluous utilities */
 int folderExists(const char *folderPath);
@@ -30,18 +30,18 @@ typedef struct
     lweSample *minibuf; /* mini buffer for one category, used when a category pair is split between two (big) buffer reads */
     bkwStepParameters srcBkwStepPar; /* bkw step parameters */
     u64 numCategories; /* total number of categories */
-    u64 categoryCapacity; /* how many samples a category can contain (fixed size for each folder) */
+    u64 categoryCapacity; /* how many samples the largest category can contain */
+    u64 *categoryOffset; /* category i holds samples [categoryOffset[i], categoryOffset[i+1]) of the sample file */
     u64 *numSamplesPerCategory; /* counter array to keep track of the number of stored samples in each category */
     u64 indexOfFirstCategoryInBuffer; /* index of the first category that currently resides in the sample buffer */
     u64 numCategoriesInBuffer; /* number of categories that have currently been read into the sample buffer */
-    u64 bufferCapacityNumCategories; /* maximum number of categories that the sample buffer can hold */
+    u64 bufferCapacityNumSamples; /* maximum number of samples that the sample buffer can hold (at least three categories) */
     u64 currentCategoryIndex; /* state of the storage reader, indicates which category (index) that is next to be output (sequentially, starting at zero) */
-    /* used for LMS only */
-    int c;
-//  u64 *numSingletonCategories;
-//  u64 *singletonCategoryIndices;
+    u8 *singletonBitmap; /* one bit per category, set for singletons (all other categories are paired with the next one) */
     /* stats for testing purposes only */
     u64 totalNumCategoriesReadFromFile;
+    u64 totalNumBytesReadFromFile;
+    double readSeconds; /* time spent waiting for file reads */
 } storageReader;
 
 int storageReaderInitialize(storageReader *sr, const char *srcFolderName);
@@ -17,8 +17,10 @@
 #ifndef STORAGE_WRITER_H
 #define STORAGE_WRITER_H
 #include "bkw_step_parameters.h"
+#include "position_values_2_category_index.h"
 #include "config_compiler.h"
 #include<stdio.h>
+#include <pthread.h>
 
 /*
   this macro is used to set the size of the storage writer cache.
@@ -35,6 +37,63 @@
 /* a file writer buffer is temporarily used when flushing the content of the storage writer to file */
 #define APPROXIMATE_SIZE_IN_BYTES_OF_FILE_WRITER_BUFFER (512 * 1024 * 1024)
 
+/*
+  if set to 1, the categories are stored back to back on the last flush (when the storage writer is freed),
+  and the sample info file records the offset of each category. the sample file then holds only the samples
+  written instead of room for the capacity of every category, and readers do not read the empty slots.
+  if set to 0, every category keeps its room on file, as in folders written by older versions.
+ */
+#ifndef STORAGE_WRITER_DENSE_CATEGORIES
+#define STORAGE_WRITER_DENSE_CATEGORIES 1
+#endif
+
+/*
+  if set to 1, samples whose (column, b) already exists in the destination category are discarded when
+  the storage writer is flushed. each category keeps a set of 32-bit fingerprints of its samples,
+  which costs 8 bytes per sample slot on file. a fingerprint collision may discard a distinct
+  sample with probability about categoryCapacityFile / 2^32.
+ */
+#ifndef STORAGE_WRITER_DEDUPLICATION
+#define STORAGE_WRITER_DEDUPLICATION 0
+#endif
+
+/*
+  every STORAGE_WRITER_VERIFICATION_RATE-th sample written to file on flush is verified (sum, hash and category),
+  which replaces re-reading the destination folder to verify it. 0 (the default) disables the check.
+  the tests, the examples and the pipeline (verify option) turn it on at run time with storageWriterSetDefaultVerification,
+  using STORAGE_WRITER_SAMPLED_VERIFICATION_RATE.
+  if STORAGE_WRITER_BACKGROUND_VERIFICATION is set to 1, the selected samples are handed over in batches
+  of STORAGE_WRITER_VERIFICATION_BATCH_SIZE samples to a background thread, so flushing does not wait for them.
+ */
+#ifndef STORAGE_WRITER_VERIFICATION_RATE
+#define STORAGE_WRITER_VERIFICATION_RATE 0
+#endif
+#define STORAGE_WRITER_SAMPLED_VERIFICATION_RATE 16
+#ifndef STORAGE_WRITER_BACKGROUND_VERIFICATION
+#define STORAGE_WRITER_BACKGROUND_VERIFICATION 0
+#endif
+#define STORAGE_WRITER_VERIFICATION_BATCH_SIZE 4096
+
+typedef struct
+{
+    lweInstance *lwe; /* must outlive the storage writer */
+    categoryIndexer indexer; /* private, the verifier may run in its own thread */
+    u64 rate;
+    u64 next; /* position of the next sample to verify in the samples currently being flushed */
+    int background;
+    lweSample *batch[2];
+    u64 *batchCategory[2];
+    u64 batchSize[2];
+    int current; /* batch being filled */
+    int verifying; /* batch being verified by the thread */
+    int threadRunning;
+    pthread_t thread;
+    u64 numSamplesVerified;
+    u64 numIncorrectSums;
+    u64 numIncorrectHashes;
+    u64 numIncorrectCategoryClassifications;
+} storageWriterVerifier;
+
 typedef struct
 {
     char dstFolderName[512];
@@ -42,21 +101,44 @@ typedef struct
     lweSample *buf;
     bkwStepParameters *bkwStepPar;
     u64 numCategories;
+    u64 singletons[MAX_NUM_SINGLETON_CATEGORIES]; /* singleton categories, recorded in the sample info file */
+    int numSingletons;
     u64 categoryCapacityBuf;
     u64 *numStoredBuf;
-    u64 categoryCapacityFile;
+    u64 categoryCapacityFile; /* capacity of the largest category on file */
+    u64 *categoryOffsetFile; /* category i holds samples [categoryOffsetFile[i], categoryOffsetFile[i+1]) of the file */
     u64 *numStoredFile;
-    u64 numCategoriesInFileWritingBuffer;
+    u64 fileWritingBufferCapacity; /* num samples, at least one category */
     lweSample *fileWritingBuffer;
+    subBucketIndexer subBuckets; /* samples within a category are kept ordered by sub-bucket (if any) */
+    lweSample *subBucketSortBuffer; /* samples appended to a category in one flush, NULL if there are no sub-buckets */
+    u64 *subBucketCounts; /* counting sort of the appended samples, numSubBuckets + 1 entries */
+    u32 *fingerprints; /* per category open addressing set of sample fingerprints, NULL if deduplication is off */
+    u64 fingerprintSlotsPerCategory; /* power of two */
+    storageWriterVerifier *verifier; /* NULL if sampled verification is off */
     /* stats for testing purposes only */
     u64 totalNumSamplesProcessedByStorageWriter; /* num items added to storage writer, including those that were discarded for lack of room */
     u64 totalNumSamplesCurrentlyInStorageWriter; /* num items currently in storage writer cache (in memory) */
     u64 totalNumSamplesWrittenToFile; /* num items currently written to file */
     u64 totalNumSamplesAddedToStorageWriter; /* num items in storage writer, counting both cache and on file */
+    u64 totalNumDuplicatesDiscarded; /* num items discarded on flush as duplicates of samples in the same category */
+    u64 totalNumSamplesVerified; /* num items verified on flush (available after storageWriterFree) */
+    u64 totalNumVerificationErrors; /* num incorrect sums, hashes and category classifications found */
+    u64 totalNumSamplesDiscardedCacheFull; /* num items not added, no room in cache (storageWriterHasRoom status 2) */
+    u64 totalNumSamplesDiscardedCategoryFull; /* num items not added, category full (storageWriterHasRoom status 3) */
+    u64 totalNumSamplesReturned; /* num items returned with storageWriterUndoAddSample (zero columns) */
+    u64 numFlushes;
+    u64 totalNumBytesFlushed; /* num bytes written to file on flush */
+    double flushSeconds;
 } storageWriter;
 
 int storageWriterInitialize(storageWriter *dsh, const char *dstFolderName, lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 categoryCapacityFile);
+int storageWriterInitializeWithCapacities(storageWriter *sw, const char *dstFolderName, lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 categoryCapacityFile, const u64 *categoryCapacities);
 int storageWriterFree(storageWriter *dsh);
+int storageWriterEnableDeduplication(storageWriter *sw);
+int storageWriterEnableVerification(storageWriter *sw, lweInstance *lwe, u64 rate, int background);
+void storageWriterSetDefaultVerification(u64 rate, int background); /* for the writers initialized from now on, call before starting any reduction */
+void storageWriterGetDefaultVerification(u64 *rate, int *background);
 
 int storageWriterHasRoom(storageWriter *dsh, u64 categoryIndex);
 lweSample *storageWriterAddSample(storageWriter *dsh, u64 categoryIndex, int *storageWriterCategoryIsFull);
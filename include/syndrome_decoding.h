@@ -44,10 +44,25 @@ typedef struct
     short t4;
 } intquad;
 
+/* syndrome decoding table of one code, read from file into memory */
+typedef struct
+{
+    int q; /* -1 if no table is loaded */
+    codingType ct;
+    union
+    {
+        intpair *_2;
+        inttriplet *_3;
+        intquad *_4;
+    } table;
+} syndromeDecodingTable;
+
 //void load_syndrome_table_21(int q);
 //void load_syndrome_table_31(int q);
 //void load_syndrome_table_41(int q);
 int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNotExist);
+int syndrome_decoding_table_read(syndromeDecodingTable *sdt, int q, codingType ct, int generateIfFileDoesNotExist);
+void syndrome_decoding_table_free(syndromeDecodingTable *sdt);
 void freeSyndromeTables(void);
 
 int generate_syndrome_decoding_table(int q, codingType ct);
@@ -59,5 +74,8 @@ int is_code_word_4_1(int q, int a1, int a2, int a3, int a4);
 void closest_code_word_2_1(int *c1, int *c2, int q, int a1, int a2);
 void closest_code_word_3_1(int *c1, int *c2, int *c3, int q, int a1, int a2, int a3);
 void closest_code_word_4_1(int *c1, int *c2, int *c3, int *c4, int q, int a1, int a2, int a3, int a4);
+void closest_code_word_2_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int q, int a1, int a2);
+void closest_code_word_3_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int *c3, int q, int a1, int a2, int a3);
+void closest_code_word_4_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int *c3, int *c4, int q, int a1, int a2, int a3, int a4);
 
 #endif
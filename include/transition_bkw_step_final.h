@@ -18,8 +18,10 @@
 #define SRC_FILE_BASED_LWE_TRANSITION_BKW_STEP_CODED_BKW_FINAL_H_
 
 #include "bkw_step_parameters.h"
+#include "solver_input.h"
 #include <time.h>
 
 int transition_bkw_step_final(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, u64 *numSamplesStored, time_t start);
+int transition_bkw_step_final_with_solver_input(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, solverInputParameters *solverInputPar, u64 *numSamplesStored, time_t start);
 
 #endif /* SRC_FILE_BASED_LWE_TRANSITION_BKW_STEP_CODED_BKW_FINAL_H_ */
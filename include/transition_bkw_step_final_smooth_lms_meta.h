@@ -18,8 +18,10 @@
 #define SRC_FILE_BASED_LWE_TRANSITION_BKW_STEP_FINAL_SMOOTH_LMS_META_H_
 
 #include "bkw_step_parameters.h"
+#include "solver_input.h"
 #include <time.h>
 
 int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, u64 *numSamplesStored, time_t start);
+int transition_bkw_step_final_smooth_lms_meta_with_solver_input(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, solverInputParameters *solverInputPar, u64 *numSamplesStored, time_t start);
 
 #endif /* SRC_FILE_BASED_LWE_TRANSITION_BKW_STEP_FINAL_SMOOTH_LMS_META_H_ */
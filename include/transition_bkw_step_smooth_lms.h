@@ -20,6 +20,21 @@
 #include "bkw_step_parameters.h"
 #include <time.h>
 
+/*
+  if non-zero, a pilot pass combines the samples of about SMOOTH_LMS_PILOT_PERCENTAGE percent of the source
+  category pairs before each smooth LMS step, and the destination categories get capacities proportional to the
+  resulting occupancy histogram (same total) instead of the same capacity. the pilot does not apply the unnatural
+  selection filter, so LSH_LF2 steps are sized as LF2 steps. 0 disables the pilot pass.
+ */
+#ifndef SMOOTH_LMS_PILOT_PERCENTAGE
+#define SMOOTH_LMS_PILOT_PERCENTAGE 0
+#endif
+/* weight of the uniform prior added to the pilot histogram, in percent of its mean count per category */
+#ifndef SMOOTH_LMS_PILOT_PRIOR_PERCENTAGE
+#define SMOOTH_LMS_PILOT_PRIOR_PERCENTAGE 25
+#endif
+
+int smoothLmsPilotCapacities(const char *srcFolderName, bkwStepParameters *dstBkwStepPar, int percentage, u64 totalCapacity, u64 *capacities);
 int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, u64 *numSamplesStored, time_t start);
 
 #endif /* TRANSITION_BKW_STEP_SMOOTH_LMS_H */
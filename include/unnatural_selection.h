@@ -0,0 +1,93 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef UNNATURAL_SELECTION_H
+#define UNNATURAL_SELECTION_H
+#include "platform_types.h"
+#include "lwe_instance.h"
+#include "bkw_step_parameters.h"
+
+/* Unnatural selection pre-filter for smooth LMS steps. The centred coefficients of the selection
+   positions are computed once per category pair and stored position-major, so that the squared
+   norms of one sample combined with a block of partners are evaluated in a loop over the partners
+   that the compiler vectorises. Pairs are rejected before any category index is computed.
+
+   For the LSH_LF2 selection method the samples are also bucketed on a grid with cells of width
+   equal to the selection threshold over the last hashed selection positions. Only pairs in the
+   same or neighbouring cells are then checked, instead of all pairs of a category. */
+
+/* number of partners evaluated per block (the block norms stay in L1 cache) */
+#ifndef UNNATURAL_SELECTION_BLOCK_SIZE
+#define UNNATURAL_SELECTION_BLOCK_SIZE 1024
+#endif
+
+/* number of selection positions hashed for LSH_LF2, each one triples the number of neighbouring buckets */
+#ifndef LSH_LF2_HASH_POSITIONS
+#define LSH_LF2_HASH_POSITIONS 2
+#endif
+#if LSH_LF2_HASH_POSITIONS < 1 || LSH_LF2_HASH_POSITIONS > 4
+#error "LSH_LF2_HASH_POSITIONS must be in 1..4"
+#endif
+#define LSH_LF2_MAX_NEIGHBOUR_BUCKETS (LSH_LF2_HASH_POSITIONS == 1 ? 3 : LSH_LF2_HASH_POSITIONS == 2 ? 9 : LSH_LF2_HASH_POSITIONS == 3 ? 27 : 81)
+
+typedef struct
+{
+    int q;
+    int startIndex; /* first selection position */
+    int numPositions; /* number of selection positions */
+    u64 limit; /* pairs with squared norm >= limit are rejected */
+    int useU32; /* squared norms of all pairs fit in 32 bits */
+    int capacity; /* max number of loaded samples */
+    int numSamples; /* currently loaded samples */
+    short *centred; /* centred[p * capacity + i] is position startIndex + p of sample i */
+    u32 *norm; /* squared norms of the current block */
+    u8 *accept; /* result of the last unnaturalSelectionFilterPairs call */
+    lweSample **sample; /* loaded samples */
+    /* LSH_LF2 buckets */
+    int cellWidth;
+    int numCells; /* cells per hashed position */
+    int numHashPositions; /* the last numHashPositions selection positions are hashed */
+    u64 *key; /* bucket key of each loaded sample, in non-decreasing order within a bucketed load */
+    /* stats */
+    u64 numPairsRejected; /* over all unnaturalSelectionFilterPairs calls */
+} unnaturalSelectionFilter;
+
+int unnaturalSelectionInitialize(unnaturalSelectionFilter *us, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, u64 capacity);
+void unnaturalSelectionFree(unnaturalSelectionFilter *us);
+
+/* appends samples to the filter, samples are numbered in the order they are loaded */
+void unnaturalSelectionLoad(unnaturalSelectionFilter *us, lweSample *samples, int numSamples);
+
+/* appends samples to the filter ordered by bucket key, so that each bucket is a range of indices */
+void unnaturalSelectionLoadBucketed(unnaturalSelectionFilter *us, lweSample *samples, int numSamples);
+
+/* writes the keys of the bucket of loaded sample i (of its additive inverse if negate) and of its
+   neighbouring buckets, returns their number (at most LSH_LF2_MAX_NEIGHBOUR_BUCKETS) */
+int unnaturalSelectionNeighbourBuckets(const unnaturalSelectionFilter *us, int i, int negate, u64 *keys);
+
+/* the range [begin, end) of indices with the given key within a bucketed load [loadBegin, loadEnd) */
+void unnaturalSelectionBucketRange(const unnaturalSelectionFilter *us, int loadBegin, int loadEnd, u64 key, int *begin, int *end);
+
+/* returns accept, where accept[j - jBegin] for jBegin <= j < jEnd tells whether the combination
+   (subtraction or addition) of loaded samples i and j passes the selection */
+const u8 *unnaturalSelectionFilterPairs(unnaturalSelectionFilter *us, int i, int jBegin, int jEnd, int add);
+
+static inline void unnaturalSelectionReset(unnaturalSelectionFilter *us)
+{
+    us->numSamples = 0;
+}
+
+#endif
@@ -17,10 +17,12 @@
 #ifndef VERIFY_SAMPLES_H
 #define VERIFY_SAMPLES_H
 #include "bkw_step_parameters.h"
+#include "position_values_2_category_index.h"
 
 void verifyOneSampleSorted(lweInstance *lwe, lweSample *sample, bkwStepParameters *bkwStepPar, u64 *numIncorrectSums, u64 *numIncorrectHashes, u64 expectedCategoryIndex, u64 *numIncorrectCategoryClassifications, int printOnError);
+void verifyOneSampleSortedWithIndexer(lweInstance *lwe, lweSample *sample, const categoryIndexer *ci, u64 *numIncorrectSums, u64 *numIncorrectHashes, u64 expectedCategoryIndex, u64 *numIncorrectCategoryClassifications, int printOnError); /* thread-safe */
 
 int verifyUnsortedSamples(const char *folderName, u64 *numSamplesProcessed, u64 *numIncorrectSums, u64 *numIncorrectHashes, int printOnError);
-int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u64 *totalNumSamplesProcessed, u64 *numIncorrectSums, u64 *numIncorrectHashes, u64 *numIncorrectCategoryClassifications, int printOnError);
+int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u64 *totalNumSamplesProcessed, u64 *numIncorrectSums, u64 *numIncorrectHashes, u64 *numIncorrectCategoryClassifications, int printOnError); /* thread-safe */
 
 #endif
@@ -0,0 +1,226 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "bkw_metrics.h"
+#include "memory_utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+static _Thread_local bkwMetrics *current; /* metrics of the step run by this thread */
+static _Thread_local bkwMetrics last; /* metrics of the step that this thread ended last */
+
+static FILE *stream;
+static pthread_mutex_t streamLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t solverLock = PTHREAD_MUTEX_INITIALIZER;
+
+double bkwMetricsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bkwMetricsBegin(bkwMetrics *m, const char *stage)
+{
+    MEMSET(m, 0, sizeof(bkwMetrics));
+    strncpy(m->stage, stage, sizeof(m->stage) - 1);
+    m->beginSeconds = bkwMetricsNow();
+    current = m;
+}
+
+/* writes str as a quoted JSON string, stages are folder paths and may contain any character */
+static void printJsonString(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for (const unsigned char *c = (const unsigned char *)str; *c; ++c)
+    {
+        switch (*c)
+        {
+        case '"': fputs("\\\"", f); break;
+        case '\\': fputs("\\\\", f); break;
+        case '\n': fputs("\\n", f); break;
+        case '\r': fputs("\\r", f); break;
+        case '\t': fputs("\\t", f); break;
+        default:
+            if (*c < 0x20)
+            {
+                fprintf(f, "\\u%04x", *c);
+            }
+            else
+            {
+                fputc(*c, f);
+            }
+        }
+    }
+    fputc('"', f);
+}
+
+/* writes the counters as the members of a JSON object (without braces) */
+static void printMembers(FILE *f, const bkwMetrics *m, const char *separator)
+{
+    fprintf(f, "\"stage\": ");
+    printJsonString(f, m->stage);
+    fprintf(f, ",%s", separator);
+    fprintf(f, "\"seconds\": %.6f,%s", m->seconds, separator);
+    fprintf(f, "\"pairs_considered\": %" PRIu64 ",%s", m->numPairsConsidered, separator);
+    fprintf(f, "\"unnatural_selection_rejects\": %" PRIu64 ",%s", m->numUnnaturalSelectionRejects, separator);
+    fprintf(f, "\"zero_column_rejects\": %" PRIu64 ",%s", m->numZeroColumnRejects, separator);
+    fprintf(f, "\"writer_discards_cache_full\": %" PRIu64 ",%s", m->numWriterDiscardsCacheFull, separator);
+    fprintf(f, "\"writer_discards_category_full\": %" PRIu64 ",%s", m->numWriterDiscardsCategoryFull, separator);
+    fprintf(f, "\"duplicates_discarded\": %" PRIu64 ",%s", m->numDuplicatesDiscarded, separator);
+    fprintf(f, "\"samples_written\": %" PRIu64 ",%s", m->numSamplesWritten, separator);
+    fprintf(f, "\"flushes\": %" PRIu64 ",%s", m->numFlushes, separator);
+    fprintf(f, "\"flush_bytes\": %" PRIu64 ",%s", m->numFlushBytes, separator);
+    fprintf(f, "\"flush_seconds\": %.6f,%s", m->flushSeconds, separator);
+    fprintf(f, "\"reader_bytes\": %" PRIu64 ",%s", m->numReaderBytes, separator);
+    fprintf(f, "\"reader_stall_seconds\": %.6f,%s", m->readerStallSeconds, separator);
+    fprintf(f, "\"solver_accumulate_seconds\": %.6f,%s", m->solverAccumulateSeconds, separator);
+    fprintf(f, "\"solver_transform_seconds\": %.6f,%s", m->solverTransformSeconds, separator);
+    fprintf(f, "\"peak_rss_bytes\": %" PRIu64, m->peakRssBytes);
+}
+
+void bkwMetricsEnd(bkwMetrics *m)
+{
+    m->seconds = bkwMetricsNow() - m->beginSeconds;
+    struct rusage usage;
+    m->peakRssBytes = getrusage(RUSAGE_SELF, &usage) ? 0 : (u64)usage.ru_maxrss * 1024; /* ru_maxrss is in kilobytes */
+    if (current == m)
+    {
+        current = NULL;
+    }
+    last = *m;
+    pthread_mutex_lock(&streamLock);
+    if (stream)
+    {
+        fprintf(stream, "{\"event\": \"stage\", ");
+        printMembers(stream, m, " ");
+        fprintf(stream, "}\n");
+        fflush(stream);
+    }
+    pthread_mutex_unlock(&streamLock);
+}
+
+bkwMetrics *bkwMetricsCurrent(void)
+{
+    return current;
+}
+
+const bkwMetrics *bkwMetricsLast(void)
+{
+    return &last;
+}
+
+void bkwMetricsAddStorageReader(const storageReader *sr)
+{
+    if (current)
+    {
+        current->numReaderBytes += sr->totalNumBytesReadFromFile;
+        current->readerStallSeconds += sr->readSeconds;
+    }
+}
+
+void bkwMetricsAddStorageWriter(const storageWriter *sw)
+{
+    if (current)
+    {
+        current->numPairsConsidered += sw->totalNumSamplesProcessedByStorageWriter;
+        current->numZeroColumnRejects += sw->totalNumSamplesReturned;
+        current->numWriterDiscardsCacheFull += sw->totalNumSamplesDiscardedCacheFull;
+        current->numWriterDiscardsCategoryFull += sw->totalNumSamplesDiscardedCategoryFull;
+        current->numDuplicatesDiscarded += sw->totalNumDuplicatesDiscarded;
+        current->numSamplesWritten += sw->totalNumSamplesWrittenToFile;
+        current->numFlushes += sw->numFlushes;
+        current->numFlushBytes += sw->totalNumBytesFlushed;
+        current->flushSeconds += sw->flushSeconds;
+    }
+}
+
+void bkwMetricsAddUnnaturalSelection(const unnaturalSelectionFilter *us)
+{
+    if (current)
+    {
+        current->numPairsConsidered += us->numPairsRejected;
+        current->numUnnaturalSelectionRejects += us->numPairsRejected;
+    }
+}
+
+/* called by the worker threads of a solver, which do not see the current metrics of the solver thread */
+void bkwMetricsAddSolverSeconds(bkwMetrics *m, double accumulateSeconds, double transformSeconds)
+{
+    pthread_mutex_lock(&solverLock);
+    if (m)
+    {
+        m->solverAccumulateSeconds += accumulateSeconds;
+        m->solverTransformSeconds += transformSeconds;
+    }
+    pthread_mutex_unlock(&solverLock);
+}
+
+int bkwMetricsToFile(const bkwMetrics *m, const char *fileName)
+{
+    FILE *f = fopen(fileName, "w");
+    if (!f)
+    {
+        return 1; /* could not create metrics file */
+    }
+    fprintf(f, "{\n    ");
+    printMembers(f, m, "\n    ");
+    fprintf(f, "\n}\n");
+    fclose(f);
+    return 0;
+}
+
+int bkwMetricsStreamOpen(const char *fileName)
+{
+    pthread_mutex_lock(&streamLock);
+    if (stream)
+    {
+        fclose(stream);
+    }
+    stream = fopen(fileName, "a");
+    pthread_mutex_unlock(&streamLock);
+    return stream ? 0 : 1; /* 1 if the stream file could not be opened */
+}
+
+void bkwMetricsStreamClose(void)
+{
+    pthread_mutex_lock(&streamLock);
+    if (stream)
+    {
+        fclose(stream);
+        stream = NULL;
+    }
+    pthread_mutex_unlock(&streamLock);
+}
+
+void bkwMetricsStreamFlush(const storageWriter *sw, double duration)
+{
+    pthread_mutex_lock(&streamLock);
+    if (stream)
+    {
+        fprintf(stream, "{\"event\": \"flush\", \"stage\": ");
+        printJsonString(stream, sw->dstFolderName);
+        fprintf(stream, ", \"duration\": %.6f, \"flushes\": %" PRIu64 ", \"flush_bytes\": %" PRIu64 ", \"flush_seconds\": %.6f, \"samples_written\": %" PRIu64 "}\n",
+                duration, sw->numFlushes, sw->totalNumBytesFlushed, sw->flushSeconds, sw->totalNumSamplesWrittenToFile);
+        fflush(stream);
+    }
+    pthread_mutex_unlock(&streamLock);
+}
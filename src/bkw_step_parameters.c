@@ -60,8 +60,7 @@ char *bkwStepParametersAsString(char *str, bkwStepParameters *bkwStepPar)
     {
 
     case plainBKW:
-        if (bkwStepPar->numPositions != 2 &&
-                bkwStepPar->numPositions != 3)
+        if (bkwStepPar->numPositions < 1 || bkwStepPar->numPositions > MAX_PLAIN_BKW_POSITIONS)
         {
             ASSERT_ALWAYS("unspported number of positions for plain BKW");
             return NULL;
@@ -127,8 +126,7 @@ int bkwStepParametersFromString(const char *str, bkwStepParameters *bkwStepPar)
 
     case plainBKW:
         sscanf(p, "[%d positions, start index=%d]", &bkwStepPar->numPositions, &bkwStepPar->startIndex);
-        if (bkwStepPar->numPositions != 2 &&
-                bkwStepPar->numPositions != 3)
+        if (bkwStepPar->numPositions < 1 || bkwStepPar->numPositions > MAX_PLAIN_BKW_POSITIONS)
         {
             ASSERT_ALWAYS("unspported number of positions for plain BKW");
             return 0; /* error in additional parameters */
@@ -189,8 +187,13 @@ u64 num_categories(lweInstance *lwe, bkwStepParameters *bkwStepPar)
         {
             return lwe->q * lwe->q;    /* for 3-position plain BKW we use meta categories, which discards the last position value */
         }
-        ASSERT_ALWAYS("unspported number of positions for plain BKW");
-        break;
+        ASSERT(1 <= bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_PLAIN_BKW_POSITIONS, "unsupported number of positions for plain BKW");
+        numCategories = 1; /* other numbers of positions use the generic mixed-radix layout */
+        for (int i=0; i<bkwStepPar->numPositions; i++)
+        {
+            numCategories *= lwe->q;
+        }
+        return numCategories;
     case LMS:
         ASSERT(2 <= bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_LMS_POSITIONS, "unsupported number of positions for LMS");
         if (bkwStepPar->numPositions < 2 || bkwStepPar->numPositions > MAX_LMS_POSITIONS)
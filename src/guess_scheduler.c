@@ -0,0 +1,312 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "guess_scheduler.h"
+#include "memory_utils.h"
+#include "assert_utils.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    u64 begin; /* next guess to be evaluated by the owner */
+    u64 end; /* end of the range owned by the worker (shrinks when stolen from) */
+} workerRange;
+
+typedef struct
+{
+    guessScheduler *gs;
+    workerRange *ranges;
+    int numWorkers;
+    atomic_int stop;
+    atomic_int numWithState; /* workers whose workerInit succeeded */
+    pthread_mutex_t resultLock;
+    guessCandidate *candidates; /* global top-k, sorted by decreasing score */
+    int numCandidates;
+    int earlyAborted;
+} schedulerState;
+
+typedef struct
+{
+    schedulerState *state;
+    int id;
+} workerArg;
+
+static int candidateIsBetter(guessCandidate *a, guessCandidate *b)
+{
+    if (a->score != b->score)
+    {
+        return a->score > b->score;
+    }
+    return a->guess < b->guess;
+}
+
+/* Insert c into the list of (at most k) best candidates, which is ordered by decreasing score.
+ * Ties are broken by the lowest guess index so that the result does not depend on the thread interleaving */
+void guessCandidateInsert(guessCandidate *list, int *len, int k, guessCandidate *c)
+{
+    int pos = *len;
+    while (pos > 0 && candidateIsBetter(c, &list[pos-1]))
+    {
+        pos--;
+    }
+    if (pos >= k)
+    {
+        return;
+    }
+    int last = *len < k ? *len : k-1;
+    for (int i=last; i>pos; i--)
+    {
+        list[i] = list[i-1];
+    }
+    list[pos] = *c;
+    if (*len < k)
+    {
+        (*len)++;
+    }
+}
+
+/* take the next guess from the own range, return 0 if the range is exhausted */
+static int takeOwnGuess(workerRange *r, u64 *guess)
+{
+    int ret = 0;
+    pthread_mutex_lock(&r->lock);
+    if (r->begin < r->end)
+    {
+        *guess = r->begin++;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/* steal the upper half of the largest remaining range, return 0 if there is no work left */
+static int stealGuesses(schedulerState *state, int id)
+{
+    for (;;)
+    {
+        int victim = -1;
+        u64 largest = 0;
+        for (int i=0; i<state->numWorkers; i++)
+        {
+            workerRange *r = &state->ranges[i];
+            pthread_mutex_lock(&r->lock);
+            u64 remaining = r->end > r->begin ? r->end - r->begin : 0;
+            pthread_mutex_unlock(&r->lock);
+            if (i != id && remaining > largest)
+            {
+                largest = remaining;
+                victim = i;
+            }
+        }
+        if (victim < 0)
+        {
+            return 0;
+        }
+        u64 begin = 0, end = 0;
+        workerRange *v = &state->ranges[victim];
+        pthread_mutex_lock(&v->lock);
+        if (v->end > v->begin)
+        {
+            u64 mid = v->begin + (v->end - v->begin) / 2;
+            begin = mid;
+            end = v->end;
+            v->end = mid;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (begin < end)
+        {
+            workerRange *own = &state->ranges[id];
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+        /* the victim finished its range in the meantime, look again */
+    }
+}
+
+static void *workerMain(void *arg)
+{
+    schedulerState *state = ((workerArg*)arg)->state;
+    int id = ((workerArg*)arg)->id;
+    guessScheduler *gs = state->gs;
+
+    void *workerState = gs->workerInit ? gs->workerInit(gs->ctx) : NULL;
+    if (gs->workerInit && !workerState)
+    {
+        return NULL; /* no state for this worker, its range is stolen by the others */
+    }
+    atomic_fetch_add(&state->numWithState, 1);
+    guessCandidate local[gs->topK];
+    int numLocal = 0;
+
+    u64 guess;
+    while (!atomic_load(&state->stop))
+    {
+        if (!takeOwnGuess(&state->ranges[id], &guess))
+        {
+            if (!stealGuesses(state, id))
+            {
+                break;
+            }
+            continue;
+        }
+        guessCandidate c;
+        c.guess = guess;
+        c.index = 0;
+        c.score = gs->evaluate(gs->ctx, workerState, guess, &c.index);
+        guessCandidateInsert(local, &numLocal, gs->topK, &c);
+        if (gs->earlyAbortThreshold > 0 && c.score >= gs->earlyAbortThreshold)
+        {
+            atomic_store(&state->stop, 1);
+            pthread_mutex_lock(&state->resultLock);
+            state->earlyAborted = 1;
+            pthread_mutex_unlock(&state->resultLock);
+        }
+    }
+
+    /* reduce the local candidates into the global top-k */
+    pthread_mutex_lock(&state->resultLock);
+    for (int i=0; i<numLocal; i++)
+    {
+        guessCandidateInsert(state->candidates, &state->numCandidates, gs->topK, &local[i]);
+    }
+    pthread_mutex_unlock(&state->resultLock);
+
+    if (gs->workerFree)
+    {
+        gs->workerFree(gs->ctx, workerState);
+    }
+    return NULL;
+}
+
+/* Evaluate the guesses 0, ..., numGuesses-1 in parallel and return the topK best candidates
+ * (sorted by decreasing score) in candidates, which must have room for gs->topK entries.
+ * Return 0 on success. */
+int guessSchedulerRun(guessScheduler *gs, u64 numGuesses, guessCandidate *candidates, int *numCandidates, int *earlyAborted)
+{
+    ASSERT(gs && gs->evaluate, "no guess evaluation function");
+    ASSERT(gs->topK >= 1, "at least one candidate must be kept");
+
+    int numWorkers = gs->numThreads;
+    if (numWorkers <= 0)
+    {
+        long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = numProcessors > 0 ? (int)numProcessors : 1;
+    }
+    if ((u64)numWorkers > numGuesses)
+    {
+        numWorkers = numGuesses > 0 ? (int)numGuesses : 1;
+    }
+
+    schedulerState state;
+    state.gs = gs;
+    state.numWorkers = numWorkers;
+    atomic_init(&state.stop, 0);
+    atomic_init(&state.numWithState, 0);
+    state.candidates = candidates;
+    state.numCandidates = 0;
+    state.earlyAborted = 0;
+    state.ranges = MALLOC(numWorkers * sizeof(workerRange));
+    workerArg *args = MALLOC(numWorkers * sizeof(workerArg));
+    pthread_t *threads = MALLOC(numWorkers * sizeof(pthread_t));
+    if (!state.ranges || !args || !threads)
+    {
+        FREE(state.ranges);
+        FREE(args);
+        FREE(threads);
+        return 1; /* could not allocate scheduler state */
+    }
+    pthread_mutex_init(&state.resultLock, NULL);
+
+    /* split the guesses evenly, stealing takes care of the imbalance */
+    for (int i=0; i<numWorkers; i++)
+    {
+        pthread_mutex_init(&state.ranges[i].lock, NULL);
+        state.ranges[i].begin = numGuesses * i / numWorkers;
+        state.ranges[i].end = numGuesses * (i+1) / numWorkers;
+        args[i].state = &state;
+        args[i].id = i;
+    }
+
+    int ret = 0;
+    int numStarted = 1;
+    for (int i=1; i<numWorkers; i++)
+    {
+        if (pthread_create(&threads[i], NULL, workerMain, &args[i]))
+        {
+            ret = 2; /* could not create worker thread, remaining work is stolen by the others */
+            break;
+        }
+        numStarted++;
+    }
+    workerMain(&args[0]); /* the calling thread is worker 0 */
+    for (int i=1; i<numStarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i=0; i<numWorkers; i++)
+    {
+        pthread_mutex_destroy(&state.ranges[i].lock);
+    }
+    pthread_mutex_destroy(&state.resultLock);
+    FREE(state.ranges);
+    FREE(args);
+    FREE(threads);
+
+    *numCandidates = state.numCandidates;
+    if (earlyAborted)
+    {
+        *earlyAborted = state.earlyAborted;
+    }
+    if (!atomic_load(&state.numWithState))
+    {
+        return 3; /* no worker could be initialized, no guess evaluated */
+    }
+    return ret;
+}
+
+/* Score that a candidate must reach to be considered significant. Wrong guesses give
+ * approximately normally distributed scores with the given variance, so the largest of
+ * numHypotheses of them is about sqrt(2*ln(numHypotheses)) standard deviations. */
+double guessSchedulerSignificanceThreshold(double variance, double numHypotheses, double sigmas)
+{
+    if (sigmas <= 0 || variance <= 0)
+    {
+        return 0; /* early termination disabled */
+    }
+    double expectedMax = numHypotheses > 1 ? sqrt(2 * log(numHypotheses)) : 0;
+    return sqrt(variance) * (expectedMax + sigmas);
+}
+
+/* Write guess index in base 'base' to digits, most significant digit first
+ * (the last position varies fastest, as in the sequential guess enumeration) */
+void guessIndexToDigits(u64 guess, int base, int len, int *digits)
+{
+    for (int i=len-1; i>=0; i--)
+    {
+        digits[i] = guess % base;
+        guess /= base;
+    }
+}
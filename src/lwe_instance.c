@@ -51,15 +51,26 @@ int chi(double sigma, rand_ctx *rnd)
 #endif
 }
 
-/* compute a simple hash value for a column
+/* compute the linear hash of a column (rows startRow to n-1), see columnHashAdd
+ * the random coefficients are fixed, so hashes stored in sample files stay valid
  * zero column corresponds to hash value zero */
-u64 bkwColumnComputeHash(lweSample *sample, int n, int startRow)
+u64 bkwColumnComputeHash(lweSample *sample, int n, int q, int startRow)
 {
+    int w = columnHashLaneBits(q);
+    int numLanes = 64 / w;
     u64 h = 0;
-    for (int i=startRow; i<n; i++)
+    for (int j=0; j<numLanes; j++)
     {
-        h = (h << 13) + columnValue(sample,i); /* shift up some and add */
-        h = (h ^ (h >> 48)) & ((u64)0x00FFFFFFFFFFFFFF); /* add 16 hi bits to lo end */
+        u64 lane = 0;
+        for (int i=startRow; i<n; i++)
+        {
+            u64 x = (u64)0x9E3779B97F4A7C15 * (j * MAX_N + i + 1); /* splitmix64 of (lane, row) */
+            x = (x ^ (x >> 30)) * (u64)0xBF58476D1CE4E5B9;
+            x = (x ^ (x >> 27)) * (u64)0x94D049BB133111EB;
+            x = x ^ (x >> 31);
+            lane = (lane + columnValue(sample, i) * (x % q)) % q;
+        }
+        h |= lane << (64 - w * (j + 1));
     }
     return h;
 }
@@ -120,7 +131,7 @@ static lweSample *newRandomSample(int n, int q, double sigma, rand_ctx *rnd, sho
     sample->error = err; // store error only
     sum = (sum + err + q) % q;
     sample->sumWithError = sum; // store sum a_i*s_i + error
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0); // compute hash
+    sample->col.hash = bkwColumnComputeHash(sample, n, q, 0); // compute hash
     return sample;
 }
 
@@ -141,7 +152,7 @@ static void newInPlaceRandomSample(lweSample *sample, int n, int q, double sigma
     sample->error = err; // store error only
     sum = (sum + err + q) % q;
     sample->sumWithError = sum; // store sum a_i*s_i + error
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0); // compute hash
+    sample->col.hash = bkwColumnComputeHash(sample, n, q, 0); // compute hash
 }
 
 static void freeSample(lweSample *sample)
@@ -0,0 +1,514 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pipeline.h"
+#include "storage_file_utilities.h"
+#include "storage_writer.h"
+#include "transition_times2_modq.h"
+#include "transition_bkw_step.h"
+#include "transition_bkw_step_final.h"
+#include "verify_samples.h"
+#include "solve_fwht.h"
+#include "bkw_metrics.h"
+#include "memory_utils.h"
+#include "log_utils.h"
+#include "string_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static const char *selection_label[numSelectionMethods] =
+{
+    "LF1",
+    "LF2",
+    "LSH_LF2"
+};
+
+static const char *solver_label[numPipelineSolvers] =
+{
+    "fwht",
+    "fwht_bruteforce",
+    "fwht_hybrid"
+};
+
+static int labelIndex(const char **labels, int numLabels, const char *str)
+{
+    for (int i=0; i<numLabels; i++)
+    {
+        if (!strcmp(labels[i], str))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* remove leading and trailing white space */
+static char *trim(char *str)
+{
+    str += strspn(str, " \t");
+    int len = strlen(str);
+    while (len > 0 && (str[len-1] == ' ' || str[len-1] == '\t' || str[len-1] == '\r' || str[len-1] == '\n'))
+    {
+        str[--len] = 0;
+    }
+    return str;
+}
+
+int pipelinePlanFromFile(const char *fileName, pipelinePlan *plan)
+{
+    MEMSET(plan, 0, sizeof(pipelinePlan));
+    plan->storageRoom = 4.0 / 3; /* about 25% storage room for sorted samples */
+    plan->verify = 1;
+
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+    {
+        return 1; /* could not open plan file */
+    }
+    char line[1024];
+    int ret = 0;
+    while (!ret && fgets(line, sizeof(line), f))
+    {
+        char *key = trim(line);
+        if (!*key || *key == '#')
+        {
+            continue;
+        }
+        char *eq = strchr(key, '=');
+        if (!eq)
+        {
+            ret = 2; /* malformed line */
+            break;
+        }
+        *eq = 0;
+        char *value = trim(eq + 1);
+        key = trim(key);
+
+        if (!strcmp(key, "folder"))
+        {
+            strncpy(plan->folderName, value, sizeof(plan->folderName) - 1);
+        }
+        else if (!strcmp(key, "n"))
+        {
+            plan->n = atoi(value);
+        }
+        else if (!strcmp(key, "q"))
+        {
+            plan->q = atoi(value);
+        }
+        else if (!strcmp(key, "alpha"))
+        {
+            plan->alpha = atof(value);
+        }
+        else if (!strcmp(key, "samples"))
+        {
+            plan->numInitialSamples = strtoull(value, NULL, 10);
+        }
+        else if (!strcmp(key, "storage_room"))
+        {
+            plan->storageRoom = atof(value);
+        }
+        else if (!strcmp(key, "step"))
+        {
+            if (plan->numSteps == PIPELINE_MAX_STEPS || !bkwStepParametersFromString(value, &plan->step[plan->numSteps]))
+            {
+                ret = 3; /* too many steps or malformed step */
+                break;
+            }
+            plan->step[plan->numSteps++].selection = LF2;
+        }
+        else if (!strcmp(key, "selection"))
+        {
+            int selection = labelIndex(selection_label, numSelectionMethods, value);
+            if (!plan->numSteps || selection < 0)
+            {
+                ret = 3; /* no preceding step or unknown selection */
+                break;
+            }
+            plan->step[plan->numSteps-1].selection = selection;
+        }
+        else if (!strcmp(key, "solver"))
+        {
+            int solver = labelIndex(solver_label, numPipelineSolvers, value);
+            if (solver < 0)
+            {
+                ret = 2; /* unknown solver */
+                break;
+            }
+            plan->solver = solver;
+        }
+        else if (!strcmp(key, "zero_positions"))
+        {
+            plan->zeroPositions = atoi(value);
+        }
+        else if (!strcmp(key, "bruteforce_positions"))
+        {
+            plan->bruteForcePositions = atoi(value);
+        }
+        else if (!strcmp(key, "delete_intermediates"))
+        {
+            plan->deleteIntermediates = atoi(value);
+        }
+        else if (!strcmp(key, "verify"))
+        {
+            plan->verify = atoi(value);
+        }
+        else if (!strcmp(key, "verify_folders"))
+        {
+            plan->verifyFolders = atoi(value);
+        }
+        else if (!strcmp(key, "metrics_stream"))
+        {
+            strncpy(plan->metricsStreamFileName, value, sizeof(plan->metricsStreamFileName) - 1);
+        }
+        else
+        {
+            ret = 2; /* unknown key */
+        }
+    }
+    fclose(f);
+    if (ret)
+    {
+        return ret;
+    }
+
+    /* check that the plan is complete */
+    int fwhtPositions = plan->n - plan->zeroPositions - plan->bruteForcePositions;
+    if (!plan->folderName[0] || plan->n < 1 || plan->n > MAX_N || plan->q < 2 || plan->alpha <= 0 || !plan->numSteps ||
+        plan->zeroPositions < 0 || plan->bruteForcePositions < 0 || fwhtPositions < 1 || fwhtPositions > MAX_FWHT ||
+        (plan->solver != pipelineSolverFwht && plan->bruteForcePositions < 1))
+    {
+        return 4; /* incomplete or inconsistent plan */
+    }
+    return 0;
+}
+
+int pipelinePlanToFile(const char *fileName, const pipelinePlan *plan)
+{
+    FILE *f = fopen(fileName, "w");
+    if (!f)
+    {
+        return 1; /* could not create plan file */
+    }
+    if (plan->folderName[0])
+    {
+        fprintf(f, "folder = %s\n", plan->folderName);
+    }
+    fprintf(f, "n = %d\nq = %d\nalpha = %g\nsamples = %" PRIu64 "\nstorage_room = %g\n", plan->n, plan->q, plan->alpha, plan->numInitialSamples, plan->storageRoom);
+    for (int i=0; i<plan->numSteps; i++)
+    {
+        char str[1024];
+        fprintf(f, "step = %s\n", bkwStepParametersAsString(str, (bkwStepParameters *)&plan->step[i]));
+        fprintf(f, "selection = %s\n", selection_label[plan->step[i].selection]);
+    }
+    fprintf(f, "solver = %s\nzero_positions = %d\nbruteforce_positions = %d\n", solver_label[plan->solver], plan->zeroPositions, plan->bruteForcePositions);
+    fprintf(f, "delete_intermediates = %d\nverify = %d\nverify_folders = %d\n", plan->deleteIntermediates, plan->verify, plan->verifyFolders);
+    if (plan->metricsStreamFileName[0])
+    {
+        fprintf(f, "metrics_stream = %s\n", plan->metricsStreamFileName);
+    }
+    fclose(f);
+    return 0;
+}
+
+/* background verification of the folder written by a stage while the next stage reads it */
+typedef struct
+{
+    int pending;
+    int threaded;
+    pthread_t thread;
+    char folderName[256];
+    bkwStepParameters *par; /* NULL for unsorted samples */
+    u64 numSamples;
+    u64 numIncorrectSums;
+    u64 numIncorrectHashes;
+    u64 numIncorrectCategoryClassifications;
+} verificationJob;
+
+static void *verificationMain(void *arg)
+{
+    verificationJob *job = arg;
+    job->numIncorrectCategoryClassifications = 0;
+    if (job->par)
+    {
+        verifySortedSamples(job->folderName, job->par, &job->numSamples, &job->numIncorrectSums, &job->numIncorrectHashes, &job->numIncorrectCategoryClassifications, 0);
+    }
+    else
+    {
+        verifyUnsortedSamples(job->folderName, &job->numSamples, &job->numIncorrectSums, &job->numIncorrectHashes, 0);
+    }
+    return NULL;
+}
+
+static void verificationStart(verificationJob *job, const char *folderName, bkwStepParameters *par)
+{
+    strncpy(job->folderName, folderName, sizeof(job->folderName) - 1);
+    job->folderName[sizeof(job->folderName) - 1] = 0;
+    job->par = par;
+    job->pending = 1;
+    job->threaded = !pthread_create(&job->thread, NULL, verificationMain, job);
+    if (!job->threaded)
+    {
+        verificationMain(job); /* verify in this thread instead */
+    }
+}
+
+static void verificationFinish(verificationJob *job, time_t start)
+{
+    if (!job->pending)
+    {
+        return;
+    }
+    if (job->threaded)
+    {
+        pthread_join(job->thread, NULL);
+    }
+    job->pending = 0;
+
+    char s[256];
+    timeStamp(start);
+    if (!job->numIncorrectSums && !job->numIncorrectHashes && !job->numIncorrectCategoryClassifications)
+    {
+        printf("all %s samples in %s verified ok\n", sprintf_u64_delim(s, job->numSamples), job->folderName);
+        return;
+    }
+    printf("%s samples in %s verified, %" PRIu64 " incorrect sums, %" PRIu64 " incorrect hashes, %" PRIu64 " incorrect category classifications\n",
+           sprintf_u64_delim(s, job->numSamples), job->folderName, job->numIncorrectSums, job->numIncorrectHashes, job->numIncorrectCategoryClassifications);
+}
+
+static double wallClockSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* folder written by stage s (the original samples for s = -1) */
+static void stageFolderName(char *folderName, const pipelinePlan *plan, int s)
+{
+    if (s < 0)
+    {
+        sprintf(folderName, "%s/original", plan->folderName);
+    }
+    else if (s < plan->numSteps)
+    {
+        sprintf(folderName, "%s/step_%02d", plan->folderName, s);
+    }
+    else
+    {
+        sprintf(folderName, "%s/step_final", plan->folderName);
+    }
+}
+
+static int runStages(pipelinePlan *plan, u8 *binarySolution, short *bfSolution, pipelineStageStatistics *stats, time_t start)
+{
+    char srcFolderName[512], dstFolderName[512];
+
+    /* initial samples */
+    mkdir(plan->folderName, 0777);
+    stageFolderName(srcFolderName, plan, -1);
+    int numStages = plan->numSteps + 1;
+    int firstStage = 0;
+    if (!folderIsComplete(srcFolderName))
+    {
+        if (folderExists(srcFolderName) && deleteStorageFolder(srcFolderName, 1, 1, 1))
+        {
+            return 1; /* could not remove incomplete folder of initial samples */
+        }
+        lweInstance lwe;
+        if (newStorageFolder(&lwe, srcFolderName, plan->n, plan->q, plan->alpha))
+        {
+            return 1; /* could not create folder for initial samples */
+        }
+        lweDestroy(&lwe);
+        addSamplesToSampleFile(srcFolderName, plan->numInitialSamples, start);
+        if (completeMarkerToFile(srcFolderName))
+        {
+            return 1; /* could not mark initial samples as complete */
+        }
+    }
+    else
+    {
+        /* resume after the last stage that has been completed, new initial samples invalidate all stages */
+        for (int s=numStages-1; s>=0; s--)
+        {
+            stageFolderName(dstFolderName, plan, s);
+            if (folderIsComplete(dstFolderName))
+            {
+                firstStage = s + 1;
+                break;
+            }
+        }
+    }
+    u64 minDestinationStorageCapacityInSamples = plan->storageRoom * numSamplesInSampleFile(srcFolderName);
+
+    verificationJob job;
+    job.pending = 0;
+    for (int s=0; s<numStages; s++)
+    {
+        pipelineStageStatistics st = { .skipped = s < firstStage };
+        stageFolderName(srcFolderName, plan, s - 1);
+        stageFolderName(dstFolderName, plan, s);
+        if (!st.skipped)
+        {
+            /* left behind by an interrupted run (or stale), the stage starts from scratch */
+            if (folderExists(dstFolderName))
+            {
+                timeStamp(start);
+                printf("removing incomplete folder %s\n", dstFolderName);
+                if (deleteStorageFolder(dstFolderName, 1, 1, 1))
+                {
+                    verificationFinish(&job, start);
+                    timeStamp(start);
+                    printf("could not remove folder %s\n", dstFolderName);
+                    return 2; /* error in reduction stage */
+                }
+            }
+            int ret;
+            double begin = wallClockSeconds();
+            timeStamp(start);
+            if (s == 0)
+            {
+                printf("Stage %02d: multiply times 2 mod q and sort samples, %s -> %s\n", s, srcFolderName, dstFolderName);
+                ret = transition_times2_modq(srcFolderName, dstFolderName, minDestinationStorageCapacityInSamples, &plan->step[0], start);
+                sampleInfoFromFile(dstFolderName, NULL, NULL, NULL, &st.numSamplesOut, NULL);
+            }
+            else if (s < plan->numSteps)
+            {
+                printf("Stage %02d: %s reduction at positions %d to %d, %s -> %s\n", s, sortingAsString(plan->step[s-1].sorting), plan->step[s-1].startIndex, plan->step[s-1].startIndex + plan->step[s-1].numPositions - 1, srcFolderName, dstFolderName);
+                ret = transition_bkw_step(srcFolderName, dstFolderName, &plan->step[s-1], &plan->step[s], &st.numSamplesOut, start);
+            }
+            else
+            {
+                printf("Stage %02d: last %s reduction at positions %d to %d, %s -> %s\n", s, sortingAsString(plan->step[s-1].sorting), plan->step[s-1].startIndex, plan->step[s-1].startIndex + plan->step[s-1].numPositions - 1, srcFolderName, dstFolderName);
+                ret = transition_bkw_step_final(srcFolderName, dstFolderName, &plan->step[s-1], &st.numSamplesOut, start);
+            }
+            st.seconds = wallClockSeconds() - begin;
+            const bkwMetrics *m = bkwMetricsLast();
+            if (!strcmp(m->stage, dstFolderName))
+            {
+                st.numBytesRead = m->numReaderBytes;
+                st.numBytesWritten = m->numFlushBytes;
+                st.peakRssBytes = m->peakRssBytes;
+            }
+            if (ret || completeMarkerToFile(dstFolderName))
+            {
+                verificationFinish(&job, start);
+                timeStamp(start);
+                printf("error %d in stage %d\n", ret, s);
+                return 2; /* error in reduction stage */
+            }
+        }
+
+        /* the source folder is consumed */
+        verificationFinish(&job, start);
+        if (plan->deleteIntermediates && s > 0 && folderExists(srcFolderName))
+        {
+            deleteStorageFolder(srcFolderName, 1, 1, 1);
+            timeStamp(start);
+            printf("deleted folder %s\n", srcFolderName);
+        }
+        if (plan->verifyFolders && !st.skipped)
+        {
+            verificationStart(&job, dstFolderName, s < plan->numSteps ? &plan->step[s] : NULL);
+        }
+
+        if (!st.skipped)
+        {
+            char s1[256];
+            timeStamp(start);
+            printf("Stage %02d: %s samples in %.2f seconds (%.0f samples per second)\n", s, sprintf_u64_delim(s1, st.numSamplesOut), st.seconds, st.seconds > 0 ? st.numSamplesOut / st.seconds : 0);
+        }
+        if (stats)
+        {
+            stats[s] = st;
+        }
+    }
+
+    /* solving phase */
+    stageFolderName(srcFolderName, plan, plan->numSteps);
+    int fwhtPositions = plan->n - plan->zeroPositions - plan->bruteForcePositions;
+    int ret;
+    timeStamp(start);
+    printf("Solving phase - %s on %s\n", solver_label[plan->solver], srcFolderName);
+    switch (plan->solver)
+    {
+#ifdef USE_SOFT_INFORMATION
+    case pipelineSolverFwht:
+        ret = solve_fwht_search(srcFolderName, binarySolution, plan->zeroPositions, fwhtPositions, plan->alpha * plan->q, start);
+        break;
+    case pipelineSolverFwhtBruteForce:
+        ret = solve_fwht_search_bruteforce(srcFolderName, binarySolution, bfSolution, plan->zeroPositions, plan->bruteForcePositions, fwhtPositions, plan->alpha * plan->q, start);
+        break;
+#else
+    case pipelineSolverFwht:
+        ret = solve_fwht_search(srcFolderName, binarySolution, plan->zeroPositions, fwhtPositions, start);
+        break;
+    case pipelineSolverFwhtBruteForce:
+        ret = solve_fwht_search_bruteforce(srcFolderName, binarySolution, bfSolution, plan->zeroPositions, plan->bruteForcePositions, fwhtPositions, start);
+        break;
+    case pipelineSolverFwhtHybrid:
+        ret = solve_fwht_search_hybrid(srcFolderName, binarySolution, plan->zeroPositions, plan->bruteForcePositions, fwhtPositions, start);
+        break;
+#endif
+    default:
+        ret = -1; /* solver not available */
+    }
+    verificationFinish(&job, start);
+    if (ret)
+    {
+        timeStamp(start);
+        printf("error %d in solver\n", ret);
+        return 3; /* error in solver */
+    }
+    return 0;
+}
+
+/* Run all the stages of the plan and then the solver. The solver writes the binary secret on the fwht
+ * positions (followed by the bruteforce positions for the hybrid solver) to binarySolution and, for the
+ * bruteforce solver, the values of the bruteforce positions to bfSolution. A stage marks its destination
+ * folder as complete when it succeeds, and a run resumes after the last complete stage (also when the
+ * intermediate folders have been deleted); the folder of an interrupted stage is removed and the stage
+ * is run again. If stats is not NULL, it receives numSteps+1 stage statistics. */
+int pipelineRun(pipelinePlan *plan, u8 *binarySolution, short *bfSolution, pipelineStageStatistics *stats, time_t start)
+{
+    int streaming = plan->metricsStreamFileName[0] && !bkwMetricsStreamOpen(plan->metricsStreamFileName);
+    if (plan->metricsStreamFileName[0] && !streaming)
+    {
+        timeStamp(start);
+        printf("*** could not open metrics stream %s\n", plan->metricsStreamFileName);
+    }
+    u64 verificationRate;
+    int backgroundVerification;
+    storageWriterGetDefaultVerification(&verificationRate, &backgroundVerification);
+    if (plan->verify)
+    {
+        storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
+    }
+    int ret = runStages(plan, binarySolution, bfSolution, stats, start);
+    storageWriterSetDefaultVerification(verificationRate, backgroundVerification);
+    if (streaming)
+    {
+        bkwMetricsStreamClose();
+    }
+    return ret;
+}
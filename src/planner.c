@@ -0,0 +1,404 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "planner.h"
+#include "config_bkw.h"
+#include "memory_utils.h"
+#include "storage_reader.h"
+#include "storage_writer.h"
+#include "solve_fwht.h"
+#include <math.h>
+
+#define PI 3.14159265358979323846
+#define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+/* destination storage of a reduction step, in samples, as sized by the transition of the source sorting */
+static double stepCapacityInSamples(const bkwStepParameters *srcStep, double numSrcSamples)
+{
+    switch (srcStep->sorting)
+    {
+    case smoothLMS:
+        return srcStep->sortingPar.smoothLMS.meta_skipped ? (double)MAX_NUM_SAMPLES * 4 / 3 : (double)MAX_NUM_SAMPLES * 5 / 4;
+    case LMS:
+        return numSrcSamples * 4 / 3;
+    default:
+        return (double)MAX_NUM_SAMPLES * 4 / 3;
+    }
+}
+
+/* E[min(X, cap)] for X Poisson distributed with mean lambda */
+static double poissonMin(double lambda, double cap)
+{
+    if (lambda <= 0)
+    {
+        return 0;
+    }
+    if (cap > lambda + 10 * sqrt(lambda) + 20)
+    {
+        return lambda;
+    }
+    if (lambda > 1000)
+    {
+        return MIN(lambda, cap);
+    }
+    double pk = exp(-lambda), below = 0, sum = 0;
+    for (int k=0; k<cap; k++)
+    {
+        sum += k * pk;
+        below += pk;
+        pk *= lambda / (k + 1);
+    }
+    return sum + cap * (1 - below);
+}
+
+/* samples produced from numSamples samples in numCategories categories, combined within adjacent category pairs */
+static double samplesProduced(selectionMethod selection, double numSamples, double numCategories)
+{
+    double k = 2 * numSamples / numCategories; /* mean number of samples in a category pair */
+    if (selection == LF1)
+    {
+        return numCategories / 2 * (k - 1 + exp(-k));
+    }
+    return numSamples * numSamples / numCategories; /* LF2, all pairs */
+}
+
+/* variance of the rounding of a position reduced into categories of width w */
+static double roundingVariance(int w)
+{
+    return (double)w * w / 6;
+}
+
+/* residual variances of the positions after the combination of the samples sorted by step */
+static int combineStep(const bkwStepParameters *step, int n, int q, double *r)
+{
+    for (int j=0; j<n; j++)
+    {
+        r[j] *= 2;
+    }
+    int start = step->startIndex, end = step->startIndex + step->numPositions;
+    switch (step->sorting)
+    {
+    case plainBKW:
+        for (int j=start; j<end && j<n; j++)
+        {
+            r[j] = 0;
+        }
+        return 0;
+    case LMS:
+        for (int j=start; j<end && j<n; j++)
+        {
+            r[j] = roundingVariance(step->sortingPar.LMS.p);
+        }
+        return 0;
+    case smoothLMS:
+        for (int j=start; j<end && j<n; j++)
+        {
+            int first = j == start && step->sortingPar.smoothLMS.prev_p1 != -1;
+            r[j] = roundingVariance(first ? step->sortingPar.smoothLMS.p2 : step->sortingPar.smoothLMS.p);
+        }
+        if (end < n && !step->sortingPar.smoothLMS.meta_skipped && step->sortingPar.smoothLMS.p1 < q)
+        {
+            r[end] = roundingVariance(step->sortingPar.smoothLMS.p1);
+        }
+        return 0;
+    default:
+        return 1; /* no rounding model for this sorting */
+    }
+}
+
+/* final residual variances of all positions */
+static int planResiduals(const pipelinePlan *plan, double *r)
+{
+    for (int j=0; j<plan->n; j++)
+    {
+        r[j] = (double)plan->q * plan->q / 12; /* uniform */
+    }
+    for (int s=0; s<plan->numSteps; s++)
+    {
+        if (combineStep(&plan->step[s], plan->n, plan->q, r))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int plannerEstimatePlan(const pipelinePlan *plan, plannerEstimate *est)
+{
+    MEMSET(est, 0, sizeof(plannerEstimate));
+    int n = plan->n, q = plan->q;
+    int fwhtPositions = n - plan->zeroPositions - plan->bruteForcePositions;
+    if (n < 1 || n > MAX_N || !plan->numSteps || plan->numSteps > PIPELINE_MAX_STEPS || fwhtPositions < 1 || fwhtPositions > MAX_FWHT)
+    {
+        return 1; /* inconsistent plan */
+    }
+    lweInstance lwe; /* num_categories only needs n and q */
+    MEMSET(&lwe, 0, sizeof(lweInstance));
+    lwe.n = n;
+    lwe.q = q;
+    double sigma2 = (plan->alpha * q) * (plan->alpha * q);
+    double sampleBytes = LWE_SAMPLE_SIZE_IN_BYTES;
+    double r[MAX_N];
+    for (int j=0; j<n; j++)
+    {
+        r[j] = (double)q * q / 12;
+    }
+
+    /* stage 0, sorting of the initial samples */
+    double originalBytes = plan->numInitialSamples * sampleBytes;
+    plannerStageEstimate *st = &est->stage[0];
+    st->numCategories = num_categories(&lwe, (bkwStepParameters *)&plan->step[0]);
+    double capacity = ceil(plan->storageRoom * plan->numInitialSamples / st->numCategories);
+    st->numSamplesIn = plan->numInitialSamples;
+    st->numSamplesOut = st->numCategories * poissonMin(st->numSamplesIn / st->numCategories, capacity);
+    st->fill = st->numSamplesOut / (st->numCategories * capacity);
+    st->diskBytes = st->numCategories * capacity * sampleBytes;
+    st->noiseVariance = sigma2;
+    double diskSum = originalBytes + st->diskBytes;
+    est->peakDiskBytes = diskSum;
+
+    /* reduction stages */
+    double errorVariance = sigma2;
+    for (int s=1; s<=plan->numSteps; s++)
+    {
+        const bkwStepParameters *srcStep = &plan->step[s-1];
+        plannerStageEstimate *src = &est->stage[s-1];
+        st = &est->stage[s];
+        st->numSamplesIn = src->numSamplesOut;
+        double produced = samplesProduced(srcStep->selection, st->numSamplesIn, src->numCategories);
+        if (s < plan->numSteps)
+        {
+            st->numCategories = num_categories(&lwe, (bkwStepParameters *)&plan->step[s]);
+            capacity = ceil(stepCapacityInSamples(srcStep, st->numSamplesIn) / st->numCategories);
+            double stored = st->numCategories * poissonMin(produced / st->numCategories, capacity);
+            st->numSamplesOut = MIN(stored, st->numCategories * capacity * EARLY_ABORT_LOAD_LIMIT_PERCENTAGE / 100);
+            st->fill = st->numSamplesOut / (st->numCategories * capacity);
+            st->diskBytes = st->numCategories * capacity * sampleBytes;
+        }
+        else
+        {
+            st->numSamplesOut = MIN(produced, src->numCategories * ceil(src->diskBytes / sampleBytes / src->numCategories)); /* at most the source capacity */
+            st->fill = 1;
+            st->diskBytes = st->numSamplesOut * sampleBytes;
+        }
+        if (combineStep(srcStep, n, q, r))
+        {
+            return 2; /* unsupported sorting */
+        }
+        errorVariance *= 2;
+        st->noiseVariance = errorVariance;
+        for (int j=plan->zeroPositions; j<plan->zeroPositions+fwhtPositions; j++)
+        {
+            st->noiseVariance += r[j] <= (double)q * q / 12 ? r[j] * sigma2 : 0; /* unreduced positions are guessed */
+        }
+        st->seconds = (st->numSamplesIn + st->numSamplesOut) * PLANNER_SECONDS_PER_SAMPLE;
+        st->ramBytes = MIN(APPROXIMATE_SIZE_IN_BYTES_OF_FILE_READER_BUFFER, src->diskBytes) + 2 * sizeof(u64) * (double)src->numCategories;
+        if (s < plan->numSteps)
+        {
+            st->ramBytes += MIN(STORAGE_WRITER_CACHE_SIZE_IN_BYTES, st->diskBytes) + MIN(APPROXIMATE_SIZE_IN_BYTES_OF_FILE_WRITER_BUFFER, st->diskBytes) + 2 * sizeof(u64) * (double)st->numCategories;
+        }
+        diskSum = plan->deleteIntermediates ? originalBytes + src->diskBytes + st->diskBytes : diskSum + st->diskBytes;
+        est->peakDiskBytes = MAX(est->peakDiskBytes, diskSum);
+    }
+    est->stage[0].seconds = (est->stage[0].numSamplesIn + est->stage[0].numSamplesOut) * PLANNER_SECONDS_PER_SAMPLE;
+    est->stage[0].ramBytes = MIN(STORAGE_WRITER_CACHE_SIZE_IN_BYTES, est->stage[0].diskBytes) + MIN(APPROXIMATE_SIZE_IN_BYTES_OF_FILE_WRITER_BUFFER, est->stage[0].diskBytes);
+    est->numStages = plan->numSteps + 1;
+
+    /* solver */
+    const plannerStageEstimate *last = &est->stage[plan->numSteps];
+    double numFinalSamples = last->numSamplesOut;
+    double tableBytes = ldexp(sizeof(fwhtEntry), fwhtPositions);
+    double numGuesses = 1, numHypotheses = ldexp(1, fwhtPositions);
+    if (plan->solver == pipelineSolverFwhtBruteForce)
+    {
+        numGuesses = pow(2 * round(plan->alpha * q * 3) + 1, plan->bruteForcePositions);
+    }
+    else if (plan->solver == pipelineSolverFwhtHybrid)
+    {
+        numGuesses = ldexp(1, plan->bruteForcePositions);
+    }
+    numHypotheses *= numGuesses;
+    double numTables = MIN(numGuesses, MAX(1, floor(BRUTEFORCE_GUESS_TABLES_MEMORY_BUDGET_IN_BYTES / tableBytes)));
+    est->solverRamBytes = numTables * tableBytes + MIN(APPROXIMATE_SIZE_IN_BYTES_OF_READ_BUFFER, last->diskBytes);
+    est->solverSeconds = numGuesses * (numFinalSamples * PLANNER_SECONDS_PER_SOLVER_SAMPLE + fwhtPositions * ldexp(PLANNER_SECONDS_PER_FWHT_BUTTERFLY, fwhtPositions));
+    est->bias = exp(-2 * PI * PI * last->noiseVariance / ((double)q * q));
+    est->numSamplesNeeded = PLANNER_SAMPLE_FACTOR * log(numHypotheses) / (est->bias * est->bias);
+    est->success = numFinalSamples >= est->numSamplesNeeded;
+
+    est->seconds = est->solverSeconds;
+    est->peakRamBytes = est->solverRamBytes;
+    for (int s=0; s<est->numStages; s++)
+    {
+        est->seconds += est->stage[s].seconds;
+        est->peakRamBytes = MAX(est->peakRamBytes, est->stage[s].ramBytes);
+    }
+    return 0;
+}
+
+/* smallest p1 for which the step has at most maxCategories categories, 0 if none */
+static int finestP1(lweInstance *lwe, bkwStepParameters *step, u64 maxCategories)
+{
+    step->sortingPar.smoothLMS.p1 = lwe->q;
+    if (num_categories(lwe, step) > maxCategories)
+    {
+        return 0;
+    }
+    int lo = 1, hi = lwe->q; /* num_categories decreases with p1, hi fits */
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        step->sortingPar.smoothLMS.p1 = mid;
+        if (num_categories(lwe, step) <= maxCategories)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* greedy smooth LMS steps over the first numReduced positions in numSteps steps, the rounding of
+   step i aims at a variance of rho / 2^(numSteps-1-i) so that all steps add the same final noise;
+   returns the number of steps built, or -1 if the positions cannot be covered */
+static int buildSteps(pipelinePlan *plan, int numReduced, int numSteps, double rho, u64 maxCategories, selectionMethod selection)
+{
+    int n = plan->n, q = plan->q;
+    lweInstance lwe;
+    MEMSET(&lwe, 0, sizeof(lweInstance));
+    lwe.n = n;
+    lwe.q = q;
+    int pos = 0, prevP1 = -1, i;
+    for (i=0; i<numSteps && pos<numReduced; i++)
+    {
+        int remaining = numReduced - pos;
+        int lastStep = i == numSteps - 1;
+        int p = (int)round(sqrt(6 * rho / ldexp(1, numSteps - 1 - i)));
+        p = MAX(1, MIN(p, q));
+        bkwStepParameters *step = &plan->step[i];
+        MEMSET(step, 0, sizeof(bkwStepParameters));
+        step->sorting = smoothLMS;
+        step->startIndex = pos;
+        step->selection = selection;
+        step->sortingPar.smoothLMS.p = p;
+        step->sortingPar.smoothLMS.p2 = p;
+        step->sortingPar.smoothLMS.prev_p1 = prevP1;
+        int numPositions = 0, p1 = 0;
+        for (int ni=MIN(MAX_SMOOTH_LMS_POSITIONS, remaining); ni>=2 && !numPositions; ni--)
+        {
+            if ((lastStep && ni != remaining) || remaining - ni == 1)
+            {
+                continue;
+            }
+            step->numPositions = ni;
+            if (pos + ni == n || ni == remaining) /* nothing left to reduce partially */
+            {
+                step->sortingPar.smoothLMS.p1 = q;
+                p1 = num_categories(&lwe, step) <= maxCategories ? q : 0;
+            }
+            else
+            {
+                p1 = finestP1(&lwe, step, maxCategories);
+            }
+            numPositions = p1 ? ni : 0;
+        }
+        if (!numPositions)
+        {
+            return -1; /* no step fits the category budget */
+        }
+        step->numPositions = numPositions;
+        step->sortingPar.smoothLMS.p1 = p1;
+        pos += numPositions;
+        prevP1 = p1;
+    }
+    return pos == numReduced ? i : -1;
+}
+
+int plannerSearch(int n, int q, double alpha, u64 numInitialSamples, const plannerBudget *budget, pipelinePlan *plan, plannerEstimate *est)
+{
+    if (n < 3 || n > MAX_N || !(q & 1))
+    {
+        return 1; /* unsupported instance */
+    }
+    const selectionMethod selections[2] = {LF1, LF2};
+    const double samplesPerCategory[7] = {1, 1.5, 2, 3, 4, 6, 8};
+    int found = 0;
+    pipelinePlan candidate;
+    plannerEstimate candidateEst;
+    for (int sel=0; sel<2; sel++)
+    {
+        for (int bf=0; bf<=PLANNER_MAX_BRUTE_FORCE_POSITIONS && bf<=n-2; bf++)
+        {
+            int numReduced = n - bf;
+            for (int k=0; k<7; k++)
+            {
+                double numSamples = MIN((double)numInitialSamples, (double)MAX_NUM_SAMPLES);
+                u64 maxCategories = (u64)MAX(2, numSamples / samplesPerCategory[k]);
+                for (double rho=1; rho<(double)q*q; rho*=1.5)
+                {
+                    for (int t=1; t<=PIPELINE_MAX_STEPS; t++)
+                    {
+                        MEMSET(&candidate, 0, sizeof(pipelinePlan));
+                        candidate.n = n;
+                        candidate.q = q;
+                        candidate.alpha = alpha;
+                        candidate.numInitialSamples = numInitialSamples;
+                        candidate.storageRoom = 4.0 / 3;
+                        candidate.deleteIntermediates = 1;
+                        candidate.verify = 1;
+                        int numSteps = buildSteps(&candidate, numReduced, t, rho, maxCategories, selections[sel]);
+                        if (numSteps > 0 && numSteps < t)
+                        {
+                            break; /* more steps are not needed */
+                        }
+                        if (numSteps != t)
+                        {
+                            continue;
+                        }
+                        candidate.numSteps = numSteps;
+                        candidate.bruteForcePositions = bf;
+                        candidate.solver = bf ? pipelineSolverFwhtBruteForce : pipelineSolverFwht;
+
+                        /* the leading exactly reduced positions need not be guessed */
+                        double r[MAX_N];
+                        planResiduals(&candidate, r);
+                        while (candidate.zeroPositions < numReduced - 1 && r[candidate.zeroPositions] == 0)
+                        {
+                            candidate.zeroPositions++;
+                        }
+                        if (plannerEstimatePlan(&candidate, &candidateEst) || !candidateEst.success ||
+                            (budget->maxSeconds && candidateEst.seconds > budget->maxSeconds) ||
+                            (budget->maxRamBytes && candidateEst.peakRamBytes > budget->maxRamBytes) ||
+                            (budget->maxDiskBytes && candidateEst.peakDiskBytes > budget->maxDiskBytes))
+                        {
+                            continue;
+                        }
+                        if (!found || candidateEst.seconds < est->seconds)
+                        {
+                            *plan = candidate;
+                            *est = candidateEst;
+                            found = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return found ? 0 : 2; /* 2 if no plan fits the budget */
+}
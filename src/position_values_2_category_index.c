@@ -21,13 +21,13 @@
 #include "syndrome_decoding.h"
 #include <math.h>
 
-/* plain BKW with 2 positions */
+/* the functions without a categoryIndexer parameter share one lazily (re)built indexer,
+   they are kept for convenience (tests, verification) but are not thread-safe */
+static categoryIndexer legacyIndexer;
+static int legacyIndexerBuilt = 0;
+static const categoryIndexer *legacyCategoryIndexer(lweInstance *lwe, bkwStepParameters *bkwStepPar);
 
-static struct
-{
-    int q;
-    u64 **table;
-} lookup_plain_bkw_2_positions;
+/* plain BKW with 2 positions */
 
 static u64 internal_position_values_2_category_index_plain_bkw(int q, int p1, int p2)
 {
@@ -70,59 +70,25 @@ static u64 internal_position_values_2_category_index_plain_bkw(int q, int p1, in
     ASSERT_ALWAYS("Case not handled!\n");
 }
 
-static void generate_table_plain_bkw_2_positions(int q)
+/* cost model: a table lookup costs one memory access, which is only cheaper than the
+   arithmetic (a few compares and multiplications) if the table stays in cache */
+int plain_bkw_use_table(int q)
 {
-    if (lookup_plain_bkw_2_positions.q == q)
-    {
-        return; /* table already generated */
-    }
-    lookup_plain_bkw_2_positions.table = MALLOC(q * sizeof(u64*));
-    ASSERT(lookup_plain_bkw_2_positions.table, "memory allocation failed");
-    for (int i=0; i<q; i++)
-    {
-        lookup_plain_bkw_2_positions.table[i] = MALLOC(q * sizeof(u64));
-        ASSERT(lookup_plain_bkw_2_positions.table[i], "memory allocation failed");
-        for (int j=0; j<q; j++)
-        {
-            lookup_plain_bkw_2_positions.table[i][j] = internal_position_values_2_category_index_plain_bkw(q, i, j);
-        }
-    }
-    lookup_plain_bkw_2_positions.q = q;
+    return (u64)q * q * sizeof(u32) <= PLAIN_BKW_TABLE_MAX_BYTES;
 }
 
 void free_table_plain_bkw_2_positions(void)
 {
-    if (lookup_plain_bkw_2_positions.q == -1)
+    if (legacyIndexerBuilt)
     {
-        return; /* no table */
+        categoryIndexerFree(&legacyIndexer);
+        legacyIndexerBuilt = 0;
     }
-    for (int i=0; i<lookup_plain_bkw_2_positions.q; i++)
-    {
-        FREE(lookup_plain_bkw_2_positions.table[i]);
-    }
-    FREE(lookup_plain_bkw_2_positions.table);
-    lookup_plain_bkw_2_positions.table = NULL;
-    lookup_plain_bkw_2_positions.q = -1;
 }
 
 u64 position_values_2_category_index_plain_bkw(int q, short *a)
 {
-    int p1 = a[0]; /* not passing sample so not using columnValue() */
-    int p2 = a[1]; /* not passing sample so not using columnValue() */
-    /* use lookup table if available */
-    if (lookup_plain_bkw_2_positions.table && lookup_plain_bkw_2_positions.q == q)   /* remove check for q for increased speed (is check superfluous)? */
-    {
-        return lookup_plain_bkw_2_positions.table[p1][p2];
-    }
-    /* if not, try to generate lookup table */
-    generate_table_plain_bkw_2_positions(q);
-    /* now try to use lookup table again */
-    if (lookup_plain_bkw_2_positions.table && lookup_plain_bkw_2_positions.q == q)
-    {
-        return lookup_plain_bkw_2_positions.table[p1][p2];
-    }
-    /* if usage and generation of lookup table fails, use old school calculation */
-    return internal_position_values_2_category_index_plain_bkw(q, p1, p2);
+    return internal_position_values_2_category_index_plain_bkw(q, a[0], a[1]); /* not passing sample so not using columnValue() */
 }
 
 void category_index_2_position_values_plain_bkw(int q, u64 category_index, short *a)
@@ -166,511 +132,85 @@ void category_index_2_position_values_plain_bkw(int q, u64 category_index, short
 
 /* LMS */
 
-static struct
-{
-    int numPositions;
-    int c;
-    u64 *table;
-    /* we need to keep track of which categories that are singletons.
-       if c is odd, then the only singleton category is at index 0 (zero).
-       if c is even there are 2^(numPositions) singleton categories
-    */
-    int *singletonCategoryIndices;
-} lookup_lms;
-
-/* 1 position */
-static u64 *createLMStableLevel1(int c)
-{
-    u64 *indexTable1 = MALLOC(c * sizeof(u64));
-    indexTable1[0] = 0;
-
-    /* The new solution */
-    for (int p1 = 1; 2*p1 <= c; p1++)
-    {
-        indexTable1[p1] = 2*p1 - 1;
-    }
-
-    for (int p1 = c/2 + 1; p1 < c; p1++)
-    {
-        indexTable1[p1] = 2*(c - p1);
-    }
-
-    return indexTable1;
-}
-
-/* 2 positions */
-static u64 *createLMStableLevel2(int c)
-{
-    u64 *indexTable1 = createLMStableLevel1(c); /* Index table for 1 position */
-    u64 *indexTable2 = MALLOC(c*c * sizeof(u64));
-
-    /* The trivial positions with p2 = 0 */
-    for (int p1 = 0; p1 < c; p1++)
-    {
-        indexTable2[p1] = indexTable1[p1];
-    }
-
-    /* The positions with small p2 values */
-    for (int p2 = 1; p2*2 < c; p2++)
-    {
-        for (int p1 = 0; p1 < c; p1++)
-        {
-            int curPos = p1 + p2*c; /* Current position in the index table */
-            indexTable2[curPos] = (2*p2 - 1)*c + 2*indexTable1[p1];
-        }
-    }
-
-    /* Add an extra part in the cases where q is even */
-    int qHalf = c/2;
-    if (qHalf*2 == c)
-    {
-        for (int p1 = 0; p1 < c; p1++)
-        {
-            int curPos = p1 + qHalf*c; /* Current position in the index table */
-            indexTable2[curPos] = (2*qHalf - 1)*c + indexTable1[p1];
-        }
-    }
-
-
-    /* The positions with large p2 values */
-    for (int p2 = c/2 + 1; p2 < c; p2++)
-    {
-        for (int p1 = 0; p1 < c; p1++)
-        {
-            int curPos = p1 + p2*c; /* Current position in the index table */
-            indexTable2[curPos] = (2*(c - p2) - 1)*c + 1 + 2*indexTable1[(c - p1)%c];
-        }
-    }
-
-    FREE(indexTable1);
-    return indexTable2;
-}
-
-/* 3 positions */
-static u64 *createLMStableLevel3(int c)
-{
-    u64 *indexTable2 = createLMStableLevel2(c); /* Index table for 2 positions */
-    u64 *indexTable3 = MALLOC(c*c*c * sizeof(u64));
-
-    /* The trivial positions with p3 = 0 */
-    for (int p2 = 0; p2 < c; p2++)
-    {
-        for (int p1 = 0; p1 < c; p1++)
-        {
-            int curPos = p1 + p2*c;
-            indexTable3[curPos] = indexTable2[curPos];
-        }
-    }
-
-    /* The positions with small p3 values */
-    for (int p3 = 1; p3*2 < c; p3++)
-    {
-        for (int p2 = 0; p2 < c; p2++)
-        {
-            for (int p1 = 0; p1 < c; p1++)
-            {
-                int oldPos = p1 + p2*c; /* Position in previous index table */
-                int curPos = oldPos + p3*c*c; /* Current position in the index table */
-                indexTable3[curPos] = (2*p3 - 1)*c*c + 2*indexTable2[oldPos];
-            }
-        }
-    }
-
-    /* Add an extra part in the cases where q is even */
-    int qHalf = c/2;
-    if (qHalf*2 == c)
-    {
-        for (int p2 = 0; p2 < c; p2++)
-        {
-            for (int p1 = 0; p1 < c; p1++)
-            {
-                int oldPos = p1 + p2*c; /* Position in previous index table */
-                int curPos = oldPos + qHalf*c*c; /* Current position in the index table */
-                indexTable3[curPos] = (2*qHalf - 1)*c*c + indexTable2[oldPos];
-            }
-        }
-    }
-
-    /* The positions with large p3 values */
-    for (int p3 = c/2 + 1; p3 < c; p3++)
-    {
-        for (int p2 = 0; p2 < c; p2++)
-        {
-            for (int p1 = 0; p1 < c; p1++)
-            {
-                int oldPos = p1 + p2*c; /* Position in previous index table */
-                int oldPosInverted = (c - p1)%c + ((c - p2)%c) * c; /* Position in previous index table */
-                int curPos = oldPos + p3*c*c; /* Current position in the index table */
-                indexTable3[curPos] = (2*(c - p3) - 1)*c*c + 1 + 2*indexTable2[oldPosInverted];
-            }
-        }
-    }
-
-    FREE(indexTable2);
-    return indexTable3;
-}
-
-/* 4 positions */
-static u64 *createLMStableLevel4(int c)
+/* Generic mixed-radix category index of numPositions digits t[i] in [0, c), t[numPositions-1] most
+   significant. Recursively, with C = c^(k-1) and t' the k-1 lower digits,
+     t_k = 0:        I_k = I_(k-1)(t')
+     0 < 2t_k < c:   I_k = (2t_k - 1)C + 2I_(k-1)(t')
+     2t_k = c:       I_k = (c - 1)C + I_(k-1)(t')              (c even)
+     2t_k > c:       I_k = (2(c - t_k) - 1)C + 1 + 2I_(k-1)(-t')
+   so that the additive inverse of the digits of category 2i+1 lies in category 2i+2. The recursion
+   is evaluated top down, keeping track of the accumulated factor 2 and of the digit negation.
+   The position values a[i] are mapped to digits by map (NULL: the values are the digits). */
+static inline u64 mixedRadixCategoryIndex(const u16 *map, const u64 *radixPower, int c, int numPositions, const short *a)
 {
-    u64 *indexTable3 = createLMStableLevel3(c); /* Index table for 3 positions */
-    u64 *indexTable4 = MALLOC(c*c*c*c * sizeof(u64));
-
-    /* The trivial positions with p4 = 0 */
-    for (int p3 = 0; p3 < c; p3++)
+    u64 index = 0, mult = 1;
+    int negate = 0;
+    for (int k = numPositions - 1; k > 0; k--)
     {
-        for (int p2 = 0; p2 < c; p2++)
+        int t = map ? map[a[k]] : a[k];
+        if (negate && t)
         {
-            for (int p1 = 0; p1 < c; p1++)
-            {
-                int curPos = p1 + p2*c + p3*c*c;
-                indexTable4[curPos] = indexTable3[curPos];
-            }
+            t = c - t;
         }
-    }
-
-    /* The positions with small p4 values */
-    for (int p4 = 1; p4*2 < c; p4++)
-    {
-        for (int p3 = 0; p3 < c; p3++)
+        if (t == 0)
         {
-            for (int p2 = 0; p2 < c; p2++)
-            {
-                for (int p1 = 0; p1 < c; p1++)
-                {
-                    int oldPos = p1 + p2*c + p3*c*c; /* Position in previous index table */
-                    int curPos = oldPos + p4*c*c*c; /* Current position in the index table */
-                    indexTable4[curPos] = (2*p4 - 1)*c*c*c + 2*indexTable3[oldPos];
-                }
-            }
+            continue;
         }
-    }
-
-    /* Add an extra part in the cases where q is even */
-    int qHalf = c/2;
-    if (qHalf*2 == c)
-    {
-        for (int p3 = 0; p3 < c; p3++)
+        if (2*t < c)
         {
-            for (int p2 = 0; p2 < c; p2++)
-            {
-                for (int p1 = 0; p1 < c; p1++)
-                {
-                    int oldPos = p1 + p2*c + p3*c*c; /* Position in previous index table */
-                    int curPos = oldPos + qHalf*c*c*c; /* Current position in the index table */
-                    indexTable4[curPos] = (2*qHalf - 1)*c*c*c + indexTable3[oldPos];
-                }
-            }
+            index += mult * (2*t - 1) * radixPower[k];
+            mult *= 2;
         }
-    }
-
-    /* The positions with large p4 values */
-    for (int p4 = c/2 + 1; p4 < c; p4++)
-    {
-        for (int p3 = 0; p3 < c; p3++)
+        else if (2*t == c)
         {
-            for (int p2 = 0; p2 < c; p2++)
-            {
-                for (int p1 = 0; p1 < c; p1++)
-                {
-                    int oldPos = p1 + p2*c + p3*c*c; /* Position in previous index table */
-                    int oldPosInverted = (c - p1)%c + ((c - p2)%c) * c + ((c - p3)%c) * c*c; /* Position in previous index table */
-                    int curPos = oldPos + p4*c*c*c; /* Current position in the index table */
-                    indexTable4[curPos] = (2*(c - p4) - 1)*c*c*c + 1 + 2*indexTable3[oldPosInverted];
-                }
-            }
+            index += mult * (c - 1) * radixPower[k];
         }
-    }
-
-    FREE(indexTable3);
-    return indexTable4;
-}
-
-/* 5 positions */
-static u64 *createLMStableLevel5(int c)
-{
-    u64 *indexTable4 = createLMStableLevel4(c); /* Index table for 4 positions */
-    u64 *indexTable5 = MALLOC(c*c*c*c*c * sizeof(u64));
-
-    /* The trivial positions with p5 = 0 */
-    for (int p4 = 0; p4 < c; p4++)
-    {
-        for (int p3 = 0; p3 < c; p3++)
-        {
-            for (int p2 = 0; p2 < c; p2++)
-            {
-                for (int p1 = 0; p1 < c; p1++)
-                {
-                    int curPos = p1 + p2*c + p3*c*c + p4*c*c*c;
-                    indexTable5[curPos] = indexTable4[curPos];
-                }
-            }
-        }
-    }
-
-    /* The positions with small p5 values */
-    for (int p5 = 1; p5*2 < c; p5++)
-    {
-        for (int p4 = 0; p4 < c; p4++)
-        {
-            for (int p3 = 0; p3 < c; p3++)
-            {
-                for (int p2 = 0; p2 < c; p2++)
-                {
-                    for (int p1 = 0; p1 < c; p1++)
-                    {
-                        int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c; /* Position in previous index table */
-                        int curPos = oldPos + p5*c*c*c*c; /* Current position in the index table */
-                        indexTable5[curPos] = (2*p5 - 1)*c*c*c*c + 2*indexTable4[oldPos];
-                    }
-                }
-            }
-        }
-    }
-
-    /* Add an extra part in the cases where q is even */
-    int qHalf = c/2;
-    if (qHalf*2 == c)
-    {
-        for (int p4 = 0; p4 < c; p4++)
+        else
         {
-            for (int p3 = 0; p3 < c; p3++)
-            {
-                for (int p2 = 0; p2 < c; p2++)
-                {
-                    for (int p1 = 0; p1 < c; p1++)
-                    {
-                        int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c; /* Position in previous index table */
-                        int curPos = oldPos + qHalf*c*c*c*c; /* Current position in the index table */
-                        indexTable5[curPos] = (2*qHalf - 1)*c*c*c*c + indexTable4[oldPos];
-                    }
-                }
-            }
+            index += mult * ((2*(c - t) - 1) * radixPower[k] + 1);
+            mult *= 2;
+            negate = !negate;
         }
     }
-
-    /* The positions with large p5 values */
-    for (int p5 = c/2 + 1; p5 < c; p5++)
+    int t = map ? map[a[0]] : a[0];
+    if (negate && t)
     {
-        for (int p4 = 0; p4 < c; p4++)
-        {
-            for (int p3 = 0; p3 < c; p3++)
-            {
-                for (int p2 = 0; p2 < c; p2++)
-                {
-                    for (int p1 = 0; p1 < c; p1++)
-                    {
-                        int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c; /* Position in previous index table */
-                        int oldPosInverted = (c - p1)%c + ((c - p2)%c) * c + ((c - p3)%c) * c*c + ((c - p4)%c) * c*c*c; /* Position in previous index table */
-                        int curPos = oldPos + p5*c*c*c*c; /* Current position in the index table */
-                        indexTable5[curPos] = (2*(c - p5) - 1)*c*c*c*c + 1 + 2*indexTable4[oldPosInverted];
-                    }
-                }
-            }
-        }
+        t = c - t;
     }
-
-    FREE(indexTable4);
-    return indexTable5;
+    return index + mult * (t == 0 ? 0 : 2*t <= c ? 2*t - 1 : 2*(c - t));
 }
 
-/* 6 positions */
-static u64 *createLMStableLevel6(int c)
-{
-    u64 *indexTable5 = createLMStableLevel5(c); /* Index table for 5 positions */
-    u64 *indexTable6 = MALLOC(c*c*c*c*c*c * sizeof(u64));
+/* specialised for small numbers of positions, so that the compiler unrolls the digit loop */
+#define MIXED_RADIX_CASE(N) case N: return mixedRadixCategoryIndex(map, radixPower, c, N, a)
 
-    /* The trivial positions with p6 = 0 */
-    for (int p5 = 0; p5 < c; p5++)
-    {
-        for (int p4 = 0; p4 < c; p4++)
-        {
-            for (int p3 = 0; p3 < c; p3++)
-            {
-                for (int p2 = 0; p2 < c; p2++)
-                {
-                    for (int p1 = 0; p1 < c; p1++)
-                    {
-                        int curPos = p1 + p2*c + p3*c*c + p4*c*c*c + p5*c*c*c*c;
-                        indexTable6[curPos] = indexTable5[curPos];
-                    }
-                }
-            }
-        }
-    }
-
-    /* The positions with small p6 values */
-    for (int p6 = 1; p6*2 < c; p6++)
-    {
-        for (int p5 = 0; p5 < c; p5++)
-        {
-            for (int p4 = 0; p4 < c; p4++)
-            {
-                for (int p3 = 0; p3 < c; p3++)
-                {
-                    for (int p2 = 0; p2 < c; p2++)
-                    {
-                        for (int p1 = 0; p1 < c; p1++)
-                        {
-                            int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c + p5*c*c*c*c; /* Position in previous index table */
-                            int curPos = oldPos + p6*c*c*c*c*c; /* Current position in the index table */
-                            indexTable6[curPos] = (2*p6 - 1)*c*c*c*c*c + 2*indexTable5[oldPos];
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    /* Add an extra part in the cases where q is even */
-    int qHalf = c/2;
-    if (qHalf*2 == c)
-    {
-        for (int p5 = 0; p5 < c; p5++)
-        {
-            for (int p4 = 0; p4 < c; p4++)
-            {
-                for (int p3 = 0; p3 < c; p3++)
-                {
-                    for (int p2 = 0; p2 < c; p2++)
-                    {
-                        for (int p1 = 0; p1 < c; p1++)
-                        {
-                            int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c + p5*c*c*c*c; /* Position in previous index table */
-                            int curPos = oldPos + qHalf*c*c*c*c*c; /* Current position in the index table */
-                            indexTable6[curPos] = (2*qHalf - 1)*c*c*c*c*c + indexTable5[oldPos];
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    /* The positions with large p6 values */
-    for (int p6 = c/2 + 1; p6 < c; p6++)
-    {
-        for (int p5 = 0; p5 < c; p5++)
-        {
-            for (int p4 = 0; p4 < c; p4++)
-            {
-                for (int p3 = 0; p3 < c; p3++)
-                {
-                    for (int p2 = 0; p2 < c; p2++)
-                    {
-                        for (int p1 = 0; p1 < c; p1++)
-                        {
-                            int oldPos = p1 + p2*c + p3*c*c + p4*c*c*c + p5*c*c*c*c; /* Position in previous index table */
-                            int oldPosInverted = (c - p1)%c + ((c - p2)%c) * c + ((c - p3)%c) * c*c + ((c - p4)%c) * c*c*c + + ((c - p5)%c) * c*c*c*c; /* Position in previous index table */
-                            int curPos = oldPos + p6*c*c*c*c*c; /* Current position in the index table */
-                            indexTable6[curPos] = (2*(c - p6) - 1)*c*c*c*c*c + 1 + 2*indexTable5[oldPosInverted];
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    FREE(indexTable5);
-    return indexTable6;
-}
-
-/* BKW with LMS steps */
-static u64 *createLMStable(int q, int p, int numPositions)
+static u64 mixedRadixCategoryIndexN(const u16 *map, const u64 *radixPower, int c, int numPositions, const short *a)
 {
-    int c = q/p + 1; /* The number of possible values for each position */
     switch (numPositions)
     {
-    case 1:
-        return createLMStableLevel1(c);
-    case 2:
-        return createLMStableLevel2(c);
-    case 3:
-        return createLMStableLevel3(c);
-    case 4:
-        return createLMStableLevel4(c);
-    case 5:
-        return createLMStableLevel5(c);
-    case 6:
-        return createLMStableLevel6(c);
-    }
-    ASSERT_ALWAYS("unsupported parameter numPositions");
-    return NULL; /* Unsupported value for b */
-}
-
-static void generate_table_lms(int q, int p, int numPositions)
-{
-    int c = q/p + 1;
-    if (lookup_lms.table && lookup_lms.c == c && lookup_lms.numPositions == numPositions)
-    {
-        return; /* table already built */
-    }
-    if (lookup_lms.table)
-    {
-        FREE(lookup_lms.table);
-        lookup_lms.table = NULL;
-        lookup_lms.numPositions = 0;
-        lookup_lms.c = 0;
-        if (lookup_lms.singletonCategoryIndices)
-        {
-            FREE(lookup_lms.singletonCategoryIndices);
-            lookup_lms.singletonCategoryIndices = NULL;
-        }
-    }
-    lookup_lms.table = createLMStable(q, p, numPositions);
-    if (lookup_lms.table)
-    {
-        lookup_lms.numPositions = numPositions;
-        lookup_lms.c = c;
-        if ((lookup_lms.c & 1) == 0)   // if c is even
-        {
-            lookup_lms.singletonCategoryIndices = MALLOC((1 << numPositions) * sizeof(int));
-            ASSERT(lookup_lms.singletonCategoryIndices, "allocation failed");
-            /* usage of locals lwe and bkwStepPar is not pretty,
-               so perhaps change the API for position_values_2_category_index_lms?
-               */
-            /* ugliness start */
-            lweInstance lwe;
-            bkwStepParameters bkwStepPar;
-            lwe.q = q;
-            bkwStepPar.sorting = LMS;
-            bkwStepPar.sortingPar.LMS.p = p;
-            bkwStepPar.numPositions = numPositions;
-            /* ugliness end */
-            short *pn = MALLOC(numPositions * sizeof(short));
-            for (u32 i = 0; i < (u32)(1) << numPositions; i++)
-            {
-//        short pn[MAX_LMS_POSITIONS];
-                ASSERT(numPositions <= MAX_LMS_POSITIONS, "insufficient size for pn");
-                for (u32 j = 0; j < (u32)numPositions; j++)
-                {
-                    pn[j] = ((i >> j) & 1) == 0 ? 0 : q/2;
-                }
-                lookup_lms.singletonCategoryIndices[i] = position_values_2_category_index_lms(&lwe, &bkwStepPar, pn);
-            }
-            FREE(pn);
-        }
-        else     /* c is odd */
-        {
-            lookup_lms.singletonCategoryIndices = MALLOC((1 << numPositions) * sizeof(int));
-            ASSERT(lookup_lms.singletonCategoryIndices, "allocation failed");
-            for (u32 i = 0; i < (u32)(1) << numPositions; i++)
-            {
-                lookup_lms.singletonCategoryIndices[i] = 0;
-            }
-        }
-        return;
+        MIXED_RADIX_CASE(1);
+        MIXED_RADIX_CASE(2);
+        MIXED_RADIX_CASE(3);
+        MIXED_RADIX_CASE(4);
+        MIXED_RADIX_CASE(5);
+        MIXED_RADIX_CASE(6);
+    default:
+        return mixedRadixCategoryIndex(map, radixPower, c, numPositions, a);
     }
-    ASSERT_ALWAYS("could not create table");
 }
 
-/* the number of singleton categories in [a,b) */
+/* the number of singleton categories in [a,b) of the last LMS step indexed through the legacy functions */
 int num_lms_singletons_in_category_interval(int a, int b)
 {
     int numSingletonsInInterval = 0;
-    for (int i=0; i<1<<lookup_lms.numPositions; i++)
+    if (!legacyIndexerBuilt || legacyIndexer.bkwStepPar.sorting != LMS)
+    {
+        ASSERT_ALWAYS("LMS singleton table not built");
+        return 0;
+    }
+    for (int i=0; i<legacyIndexer.numSingletons; i++)
     {
-        int singletonIndex = lookup_lms.singletonCategoryIndices[i];
-        if (a <= singletonIndex && singletonIndex < b)
+        u64 singletonIndex = legacyIndexer.singletons[i];
+        if ((u64)a <= singletonIndex && singletonIndex < (u64)b)
         {
             numSingletonsInInterval++;
         }
@@ -684,19 +224,12 @@ int is_lms_singleton(u64 categoryIndex)
     {
         return 1;
     }
-    if (!lookup_lms.singletonCategoryIndices)
+    if (!legacyIndexerBuilt || legacyIndexer.bkwStepPar.sorting != LMS)
     {
         ASSERT_ALWAYS("LMS singleton table not built");
         return 0;
     }
-    for (int i=0; i<1<<lookup_lms.numPositions; i++)
-    {
-        if (categoryIndex == (u64)lookup_lms.singletonCategoryIndices[i])
-        {
-            return 1;
-        }
-    }
-    return 0;
+    return categoryIndexerIsSingleton(&legacyIndexer, categoryIndex);
 }
 
 int is_smooth_lms_singleton(u64 categoryIndex, u64 numCategories)
@@ -743,173 +276,23 @@ int is_singleton(bkwStepParameters *bkwStepPar, u64 categoryIndex, u64 numCatego
     return -1;
 }
 
-/* ACCESSING INDICES FROM LMS TABLES */
-
-/* The plain cases */
-#if 0
-/* 1 position */
-static u64 positionValuesFromTablePlain1(u64 *table, short p1, int q)
-{
-    return table[p1];
-}
-
-/* 2 positions */
-static u64 positionValuesFromTablePlain2(u64 *table, short p1, short p2, int q)
-{
-    return table[p1 + p2*q];
-}
-
-/* 3 positions */
-static u64 positionValuesFromTablePlain3(u64 *table, short p1, short p2, short p3, int q)
-{
-    return table[p1 + p2*q + p3*q*q];
-}
-
-/* 4 positions */
-static u64 positionValuesFromTablePlain4(u64 *table, short p1, short p2, short p3, short p4, int q)
-{
-    return table[p1 + p2*q + p3*q*q + p4*q*q*q];
-}
-
-/* 5 positions */
-static u64 positionValuesFromTablePlain5(u64 *table, short p1, short p2, short p3, short p4, short p5, int q)
-{
-    return table[p1 + p2*q + p3*q*q + p4*q*q*q + p5*q*q*q*q];
-}
-
-/* 6 positions */
-static u64 positionValuesFromTablePlain6(u64 *table, short p1, short p2, short p3, short p4, short p5, short p6, int q)
-{
-    return table[p1 + p2*q + p3*q*q + p4*q*q*q + p5*q*q*q*q + p6*q*q*q*q*q];
-}
-#endif
-static u64 positionValuesFromTablePlain(u64 *table, int numPositions, short *t, int c)
-{
-    ASSERT(0 < numPositions && numPositions <= MAX_LMS_POSITIONS, "unexpected parameter numPositions");
-    u64 index = t[numPositions - 1];
-    for (int i=numPositions-2; i>=0; i--)
-    {
-        index = c * index + t[i];
-    }
-    return table[index];
-}
-
-/* makes an LMS mapping of pi using q and p as moduli */
-static int positionLMSMap(short pi, int q, int p)
-{
-    pi += p/2;
-    pi /= p;
-
-    int c = q/p + 1;
-    if (pi == c)
-    {
-        pi -= c;
-    }
-
-    return pi;
-}
-#if 0
-/* 1 position */
-static u64 positionValuesFromTableLMS1(u64 *table, short p1, int q, int p)
-{
-    short t1 = (p1, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain1(table, t1, c);
-}
-
-/* 2 positions */
-static u64 positionValuesFromTableLMS2(u64 *table, short p1, short p2, int q, int p)
-{
-    short t1 = positionLMSMap(p1, q, p);
-    short t2 = positionLMSMap(p2, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain2(table, t1, t2, c);
-}
-
-/* 3 positions */
-static u64 positionValuesFromTableLMS3(u64 *table, short p1, short p2, short p3, int q, int p)
-{
-    short t1 = positionLMSMap(p1, q, p);
-    short t2 = positionLMSMap(p2, q, p);
-    short t3 = positionLMSMap(p3, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain3(table, t1, t2, t3, c);
-}
-
-/* 4 positions */
-static u64 positionValuesFromTableLMS4(u64 *table, short p1, short p2, short p3, short p4, int q, int p)
-{
-    short t1 = positionLMSMap(p1, q, p);
-    short t2 = positionLMSMap(p2, q, p);
-    short t3 = positionLMSMap(p3, q, p);
-    short t4 = positionLMSMap(p4, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain4(table, t1, t2, t3, t4, c);
-}
-
-/* 5 positions */
-static u64 positionValuesFromTableLMS5(u64 *table, short p1, short p2, short p3, short p4, short p5, int q, int p)
+/* makes an LMS mapping of pi using q and p as moduli */
+static int positionLMSMap(short pi, int q, int p)
 {
-    short t1 = positionLMSMap(p1, q, p);
-    short t2 = positionLMSMap(p2, q, p);
-    short t3 = positionLMSMap(p3, q, p);
-    short t4 = positionLMSMap(p4, q, p);
-    short t5 = positionLMSMap(p5, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain5(table, t1, t2, t3, t4, t5, c);
-}
+    pi += p/2;
+    pi /= p;
 
-/* 6 positions */
-static u64 positionValuesFromTableLMS6(u64 *table, short p1, short p2, short p3, short p4, short p5, short p6, int q, int p)
-{
-    short t1 = positionLMSMap(p1, q, p);
-    short t2 = positionLMSMap(p2, q, p);
-    short t3 = positionLMSMap(p3, q, p);
-    short t4 = positionLMSMap(p4, q, p);
-    short t5 = positionLMSMap(p5, q, p);
-    short t6 = positionLMSMap(p6, q, p);
-    short c = q/p + 1;
-    return positionValuesFromTablePlain6(table, t1, t2, t3, t4, t5, t6, c);
-}
-#endif
-static u64 positionValuesFromTableLMS(u64 *table, int q, int p, int numPositions, short *pn)
-{
-    short t[MAX_LMS_POSITIONS];
-    ASSERT(0 < numPositions && numPositions <= MAX_LMS_POSITIONS, "unexpected parameter numPositions");
-    for (int i=0; i<numPositions; i++)
+    int c = q/p + 1;
+    if (pi == c)
     {
-        t[i] = positionLMSMap(pn[i], q, p);
+        pi -= c;
     }
-    int c = q/p + 1;
-    return positionValuesFromTablePlain(table, numPositions, t, c);
-}
 
+    return pi;
+}
 u64 position_values_2_category_index_lms(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
 {
-    int q = lwe->q;
-    int p = dstBkwStepPar->sortingPar.LMS.p;
-    int numPositions = dstBkwStepPar->numPositions;
-
-    /* use lookup table if available */
-    int c = q/p + 1;
-    if (lookup_lms.table && lookup_lms.c == c && lookup_lms.numPositions == numPositions)   /* remove check increased speed (if check can be made superfluous) */
-    {
-        u64 cat = positionValuesFromTableLMS(lookup_lms.table, q, p, numPositions, pn);
-        ASSERT(cat < num_categories(lwe, dstBkwStepPar), "category index calculated incorrectly");
-        return cat;
-    }
-    /* if not, try to generate lookup table */
-    generate_table_lms(q, p, numPositions);
-    /* now try to use lookup table again */
-    if (lookup_lms.table && lookup_lms.c == c && lookup_lms.numPositions == numPositions)
-    {
-        u64 cat = positionValuesFromTableLMS(lookup_lms.table, q, p, numPositions, pn);
-        ASSERT(cat < num_categories(lwe, dstBkwStepPar), "category index calculated incorrectly");
-        return cat;
-    }
-    /* if this did not work, throw failure */
-    ASSERT_ALWAYS("index lms error");
-    return -1;
+    return categoryIndexerIndex(legacyCategoryIndexer(lwe, dstBkwStepPar), pn);
 }
 
 /* Smooth LMS */
@@ -1040,77 +423,16 @@ short positionSmoothLMSMap(short pn, int q, int q_, int p, int c)
     }
 }
 
-u64 position_values_2_category_index_smooth_lms(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
-{
-    int q = lwe->q;
-    int Ni = dstBkwStepPar->numPositions;
-    short p = dstBkwStepPar->sortingPar.smoothLMS.p;
-    short p1 = dstBkwStepPar->sortingPar.smoothLMS.p1;
-    short p2;
-    u64 index_cat = 0;
-
-    short t[MAX_SMOOTH_LMS_POSITIONS+1];
-    int c[MAX_SMOOTH_LMS_POSITIONS+1];
-    int q_;
-
-    /* Differentiate the first step for general steps */
-    if (dstBkwStepPar->sortingPar.smoothLMS.prev_p1 == -1)   // first step
-    {
-        q_ = q%2 == 1 ? (q+1)/2 : q/2;
-        for(int i = 0; i < Ni; i++)
-        {
-            c[i] = ((2*q_-1) % p) == 0 ? ((2*q_-1) / p) : ((2*q_-1) / p) + 1;
-            t[i] = positionSmoothLMSMap(pn[i], q, q_, p, c[i]);
-        }
-        c[Ni] = ((2*q_-1) % p1) == 0 ? ((2*q_-1) / p1) : ((2*q_-1) / p1) + 1;
-        t[Ni] = positionSmoothLMSMap(pn[Ni], q, q_, p1, c[Ni]);
-        index_cat = positionValuesToCategoryGeneralized(Ni+1, t, c);
-    }
-    else if (dstBkwStepPar->startIndex + Ni == lwe->n)     // last step
-    {
-        p2 = dstBkwStepPar->sortingPar.smoothLMS.p2;
-        q_= dstBkwStepPar->sortingPar.smoothLMS.prev_p1;
-        c[0] = ((2*q_-1) % p2) == 0 ? ((2*q_-1) / p2) : ((2*q_-1) / p2) + 1;
-        t[0] = positionSmoothLMSMap(pn[0], q, q_, p2, c[0]);
-        q_ = q%2 == 1 ? (q+1)/2 : q/2;
-        for(int i = 1; i < Ni; i++)
-        {
-            c[i] = ((2*q_-1) % p) == 0 ? ((2*q_-1) / p) : ((2*q_-1) / p) + 1;
-            t[i] = positionSmoothLMSMap(pn[i], q, q_, p, c[i]);
-        }
-        index_cat = positionValuesToCategoryGeneralized(Ni, t, c);
-    }
-    else      // middle steps
-    {
-        p2 = dstBkwStepPar->sortingPar.smoothLMS.p2;
-        q_= dstBkwStepPar->sortingPar.smoothLMS.prev_p1;
-        c[0] = ((2*q_-1) % p2) == 0 ? ((2*q_-1) / p2) : ((2*q_-1) / p2) + 1;
-        t[0] = positionSmoothLMSMap(pn[0], q, q_, p2, c[0]);
-        q_ = q%2 == 1 ? (q+1)/2 : q/2;
-        for(int i = 1; i < Ni; i++)
-        {
-            c[i] = ((2*q_-1) % p) == 0 ? ((2*q_-1) / p) : ((2*q_-1) / p) + 1;
-            t[i] = positionSmoothLMSMap(pn[i], q, q_, p, c[i]);
-        }
-        c[Ni] = ((2*q_-1) % p1) == 0 ? ((2*q_-1) / p1) : ((2*q_-1) / p1) + 1;
-        t[Ni] = positionSmoothLMSMap(pn[Ni], q, q_, p1, c[Ni]);
-        index_cat = positionValuesToCategoryGeneralized(Ni+1, t, c);
-    }
-    return index_cat;
-}
-
 /* TODO Switch notation from Ni to ni */
 /* TODO implement lookup table to speedup */
 /* TODO simplify to not calculate unnecessary stuff not needed when skipping the last positions*/
-/* Smooth LMS mapping where we skip some position(s) at the end */
-u64 position_values_2_category_index_smooth_lms_meta(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
+/* Smooth LMS mapping where we skip meta_skipped position(s) at the end (0 for plain smooth LMS) */
+static u64 smoothLmsCategoryIndex(int q, int n, const bkwStepParameters *dstBkwStepPar, const short *pn, short meta_skipped)
 {
-    int q = lwe->q;
     int Ni = dstBkwStepPar->numPositions;
     short p = dstBkwStepPar->sortingPar.smoothLMS.p;
     short p1 = dstBkwStepPar->sortingPar.smoothLMS.p1;
     short p2;
-    short meta_skipped = dstBkwStepPar->sortingPar.smoothLMS.meta_skipped; /* Number of positions to skip when dividing samples into metacategories */
     u64 index_cat = 0;
 
     short t[MAX_SMOOTH_LMS_POSITIONS+1];
@@ -1130,7 +452,7 @@ u64 position_values_2_category_index_smooth_lms_meta(lweInstance *lwe, bkwStepPa
         t[Ni] = positionSmoothLMSMap(pn[Ni], q, q_, p1, c[Ni]);
         index_cat = positionValuesToCategoryGeneralized(Ni+1-meta_skipped, t, c);
     }
-    else if (dstBkwStepPar->startIndex + Ni == lwe->n)     // last step
+    else if (dstBkwStepPar->startIndex + Ni == n)     // last step
     {
         p2 = dstBkwStepPar->sortingPar.smoothLMS.p2;
         q_= dstBkwStepPar->sortingPar.smoothLMS.prev_p1;
@@ -1163,25 +485,35 @@ u64 position_values_2_category_index_smooth_lms_meta(lweInstance *lwe, bkwStepPa
     return index_cat;
 }
 
+u64 position_values_2_category_index_smooth_lms(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
+{
+    return smoothLmsCategoryIndex(lwe->q, lwe->n, dstBkwStepPar, pn, 0);
+}
+
+u64 position_values_2_category_index_smooth_lms_meta(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
+{
+    return smoothLmsCategoryIndex(lwe->q, lwe->n, dstBkwStepPar, pn, dstBkwStepPar->sortingPar.smoothLMS.meta_skipped); /* Number of positions to skip when dividing samples into metacategories */
+}
+
 /* Coded BKW */
 
-static u64 positionValuesFromTableCodedBKW(int q, codingType ct, short *t)
+static u64 positionValuesFromTableCodedBKW(const syndromeDecodingTable *sdt, int q, codingType ct, const short *t)
 {
     int c1, c2, c3, c4;
     switch(ct)
     {
     case blockCode_21:
-        closest_code_word_2_1(&c1, &c2, q, t[0], t[1]);
+        closest_code_word_2_1_from_table(sdt, &c1, &c2, q, t[0], t[1]);
         return c1;
     case blockCode_31:
-        closest_code_word_3_1(&c1, &c2, &c3, q, t[0], t[1], t[2]);
+        closest_code_word_3_1_from_table(sdt, &c1, &c2, &c3, q, t[0], t[1], t[2]);
         return c1;
     case blockCode_41:
-        closest_code_word_4_1(&c1, &c2, &c3, &c4, q, t[0], t[1], t[2], t[3]);
+        closest_code_word_4_1_from_table(sdt, &c1, &c2, &c3, &c4, q, t[0], t[1], t[2], t[3]);
         return c1;
     case concatenatedCode_21_21:
-        closest_code_word_2_1(&c1, &c2, q, t[0], t[1]);
-        closest_code_word_2_1(&c3, &c4, q, t[2], t[3]);
+        closest_code_word_2_1_from_table(sdt, &c1, &c2, q, t[0], t[1]);
+        closest_code_word_2_1_from_table(sdt, &c3, &c4, q, t[2], t[3]);
         return c1 + q*c3;
     default:
         ASSERT_ALWAYS("codedBKW parameters set not implemented!");
@@ -1191,89 +523,412 @@ static u64 positionValuesFromTableCodedBKW(int q, codingType ct, short *t)
 
 u64 position_values_2_category_index_coded_bkw(lweInstance *lwe, bkwStepParameters *dstBkwStepPar, short *pn)
 {
-    int q = lwe->q;
-    codingType ct = dstBkwStepPar->sortingPar.CodedBKW.ct;
+    return categoryIndexerIndex(legacyCategoryIndexer(lwe, dstBkwStepPar), pn);
+}
+
+u64 position_values_2_category_index(lweInstance *lwe, lweSample *sample, bkwStepParameters *bkwStepPar)
+{
+    return categoryIndexerSampleIndex(legacyCategoryIndexer(lwe, bkwStepPar), sample);
+}
 
-    /* use syndrome lookup table if available */
-    if (is_syndrome_decoding_table_loaded(q, ct))   /* remove check increased speed (if check can be made superfluous) */
+u64 position_values_2_category_index_from_partial_sample(lweInstance *lwe, short *a, bkwStepParameters *bkwStepPar)
+{
+    return categoryIndexerIndex(legacyCategoryIndexer(lwe, bkwStepPar), a);
+}
+
+/* CATEGORY INDEXER */
+
+/* singleton categories of the sortings that do not need any tables */
+static int tableFreeSingletons(bkwStepParameters *bkwStepPar, u64 numCategories, u64 *singletons)
+{
+    switch (bkwStepPar->sorting)
     {
-        u64 cat = positionValuesFromTableCodedBKW(q, ct, pn);
-        ASSERT(cat < num_categories(lwe, dstBkwStepPar), "category index calculated incorrectly");
-        return cat;
+    case plainBKW:
+    case codedBKW:
+        singletons[0] = 0;
+        return 1;
+    case smoothLMS:
+        if (numCategories & 1)
+        {
+            singletons[0] = 0;
+            return 1;
+        }
+        return 0;
+    default:
+        return 0;
     }
+}
 
-    /* if not, try to load it into memory from existing file */
-    load_syndrome_decoding_table(q, ct, 1 /* generate if non-existing */);
-    if (is_syndrome_decoding_table_loaded(q, ct))
+/* LMS singleton categories: if c is odd, then the only singleton category is at index 0 (zero),
+   if c is even there are 2^(numPositions) singleton categories (all positions 0 or q/2) */
+static int lmsSingletons(const categoryIndexer *ci, u64 *singletons)
+{
+    int numPositions = ci->bkwStepPar.numPositions;
+    int c = ci->c;
+    int numSingletons = (c & 1) ? 1 : 1 << numPositions;
+    for (int i = 0; i < numSingletons; i++)
     {
-        u64 cat = positionValuesFromTableCodedBKW(q, ct, pn);
-        ASSERT(cat < num_categories(lwe, dstBkwStepPar), "category index calculated incorrectly");
-        return cat;
+        short pn[MAX_LMS_POSITIONS];
+        for (int j = 0; j < numPositions; j++)
+        {
+            pn[j] = (c & 1) || ((i >> j) & 1) == 0 ? 0 : ci->q/2;
+        }
+        singletons[i] = categoryIndexerIndex(ci, pn);
     }
+    return numSingletons;
+}
 
-    /* if this did not work, throw failure */
-    ASSERT_ALWAYS("index coded bkw error, failed to load/create syndrome decoding table");
-    return -1;
+/* Write the singleton category indices of a bkw step to singletons (room for
+   MAX_NUM_SINGLETON_CATEGORIES entries) and return their number, -1 on failure */
+int singleton_categories(lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 *singletons)
+{
+    if (bkwStepPar->sorting != LMS)
+    {
+        return tableFreeSingletons(bkwStepPar, num_categories(lwe, bkwStepPar), singletons);
+    }
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, lwe, bkwStepPar))
+    {
+        return -1;
+    }
+    MEMCPY(singletons, ci.singletons, ci.numSingletons * sizeof(u64));
+    int numSingletons = ci.numSingletons;
+    categoryIndexerFree(&ci);
+    return numSingletons;
 }
 
-u64 position_values_2_category_index(lweInstance *lwe, lweSample *sample, bkwStepParameters *bkwStepPar)
+u8 *singletonBitmapCreate(u64 numCategories, const u64 *singletons, int numSingletons)
 {
+    u8 *bitmap = CALLOC((numCategories + 7) / 8, sizeof(u8));
+    if (!bitmap)
+    {
+        return NULL;
+    }
+    for (int i=0; i<numSingletons; i++)
+    {
+        ASSERT(singletons[i] < numCategories, "singleton category out of range");
+        bitmap[singletons[i] >> 3] |= 1 << (singletons[i] & 7);
+    }
+    return bitmap;
+}
+
+/* the singleton categories are located once, so that testing a category is a bitmap lookup */
+static int findSingletons(categoryIndexer *ci)
+{
+    if (ci->bkwStepPar.sorting == LMS)
+    {
+        ci->numSingletons = lmsSingletons(ci, ci->singletons);
+    }
+    else
+    {
+        ci->numSingletons = tableFreeSingletons(&ci->bkwStepPar, ci->numCategories, ci->singletons);
+    }
+    ci->singletonBitmap = singletonBitmapCreate(ci->numCategories, ci->singletons, ci->numSingletons);
+    return ci->singletonBitmap == NULL;
+}
+
+/* digit powers of the generic mixed-radix layout, fails if the category index would overflow */
+static int initializeRadixPowers(categoryIndexer *ci, int c)
+{
+    ci->c = c;
+    ci->radixPower[0] = 1;
+    for (int i=1; i<ci->bkwStepPar.numPositions; i++)
+    {
+        ci->radixPower[i] = ci->radixPower[i-1] * c;
+    }
+    if (ci->radixPower[ci->bkwStepPar.numPositions-1] > (u64)-1 / c)
+    {
+        ASSERT_ALWAYS("too many categories for a 64-bit category index");
+        return 1;
+    }
+    return 0;
+}
+
+/* Build the category indexer of a bkw step. All lookup tables are built here, after which the
+   indexer is read-only and can be shared by any number of threads. Return 0 on success. */
+int categoryIndexerInitialize(categoryIndexer *ci, lweInstance *lwe, bkwStepParameters *bkwStepPar)
+{
+    ci->q = lwe->q;
+    ci->n = lwe->n;
+    ci->bkwStepPar = *bkwStepPar;
+    ci->numCategories = num_categories(lwe, bkwStepPar);
+    ci->plainTable = NULL;
+    ci->digitMap = NULL;
+    ci->c = 0;
+    ci->numSingletons = 0;
+    ci->singletonBitmap = NULL;
+    ci->syndromeTable.q = -1;
+    ci->syndromeTable.table._2 = NULL;
+
+    int q = ci->q;
     switch (bkwStepPar->sorting)
     {
     case plainBKW:
-        if (bkwStepPar->numPositions == 2)
+        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_PLAIN_BKW_POSITIONS, "unsupported parameter set (plain BKW)");
+        if (findSingletons(ci))
         {
-            return position_values_2_category_index_plain_bkw(lwe->q, sample->col.a + bkwStepPar->startIndex); /* calculate destination category */
+            return 1; /* could not allocate singleton bitmap */
         }
-        if (bkwStepPar->numPositions == 3)
+        if (bkwStepPar->numPositions != 2 && bkwStepPar->numPositions != 3)
         {
-            return position_values_2_category_index_plain_bkw(lwe->q, sample->col.a + bkwStepPar->startIndex); /* calculate destination category, same as for 2-position case as third position value is suppressed */
+            return initializeRadixPowers(ci, q);
         }
-        break;
+        if (!plain_bkw_use_table(q))
+        {
+            return 0; /* category index computed without table */
+        }
+        ci->plainTable = MALLOC((u64)q * q * sizeof(u32));
+        if (!ci->plainTable)
+        {
+            categoryIndexerFree(ci);
+            return 1; /* could not allocate plain BKW table */
+        }
+        for (int i=0; i<q; i++)
+        {
+            for (int j=0; j<q; j++)
+            {
+                ci->plainTable[i*q + j] = (u32)internal_position_values_2_category_index_plain_bkw(q, i, j);
+            }
+        }
+        return 0;
     case LMS:
         ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_LMS_POSITIONS, "unsupported parameter set (LMS)");
-        return position_values_2_category_index_lms(lwe, bkwStepPar, sample->col.a + bkwStepPar->startIndex);
-    case smoothLMS:
-        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_SMOOTH_LMS_POSITIONS, "unsupported parameter set (smooth LMS)");
-        if (bkwStepPar->sortingPar.smoothLMS.meta_skipped == 0)   /* Don't combine categories into metacategories */
+        ci->digitMap = MALLOC(q * sizeof(u16));
+        if (!ci->digitMap || initializeRadixPowers(ci, q/bkwStepPar->sortingPar.LMS.p + 1))
+        {
+            categoryIndexerFree(ci);
+            return 2; /* could not create LMS digit map */
+        }
+        for (int i=0; i<q; i++)
+        {
+            ci->digitMap[i] = positionLMSMap(i, q, bkwStepPar->sortingPar.LMS.p);
+        }
+        if (findSingletons(ci))
         {
-            return position_values_2_category_index_smooth_lms(lwe, bkwStepPar, sample->col.a + bkwStepPar->startIndex);
+            categoryIndexerFree(ci);
+            return 2; /* could not allocate singleton bitmap */
         }
-        else   /* Combine categories into metacategories */
+        return 0;
+    case smoothLMS:
+        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_SMOOTH_LMS_POSITIONS, "unsupported parameter set (smooth LMS)");
+        if (findSingletons(ci))
         {
-            return position_values_2_category_index_smooth_lms_meta(lwe, bkwStepPar, sample->col.a + bkwStepPar->startIndex);
+            return 2; /* could not allocate singleton bitmap */
         }
+        return 0; /* category index computed without tables */
     case codedBKW:
         ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_CODED_BKW_POSITIONS, "unsupported parameter set (coded BKW)");
-        return position_values_2_category_index_coded_bkw(lwe, bkwStepPar, sample->col.a + bkwStepPar->startIndex);
+        if (syndrome_decoding_table_read(&ci->syndromeTable, q, bkwStepPar->sortingPar.CodedBKW.ct, 1 /* generate if non-existing */))
+        {
+            return 3; /* failed to load/create syndrome decoding table */
+        }
+        if (findSingletons(ci))
+        {
+            categoryIndexerFree(ci);
+            return 2; /* could not allocate singleton bitmap */
+        }
+        return 0;
     default:
         ASSERT_ALWAYS("unsupported parameter set (default)");
-        return -1;
     }
-    ASSERT_ALWAYS("unsupported parameter set (unknown)");
-    return -1;
+    return 4; /* unsupported sorting */
 }
 
-u64 position_values_2_category_index_from_partial_sample(lweInstance *lwe, short *a, bkwStepParameters *bkwStepPar)
+void categoryIndexerFree(categoryIndexer *ci)
 {
-    switch (bkwStepPar->sorting)
+    FREE(ci->plainTable);
+    FREE(ci->digitMap);
+    FREE(ci->singletonBitmap);
+    syndrome_decoding_table_free(&ci->syndromeTable);
+    ci->plainTable = NULL;
+    ci->digitMap = NULL;
+    ci->singletonBitmap = NULL;
+    ci->numSingletons = 0;
+}
+
+/* category index from the values a[0], ..., a[numPositions-1] of the step positions */
+u64 categoryIndexerIndex(const categoryIndexer *ci, const short *a)
+{
+    const bkwStepParameters *par = &ci->bkwStepPar;
+    u64 cat;
+    switch (par->sorting)
     {
     case plainBKW:
-        ASSERT(bkwStepPar->numPositions == 2 || bkwStepPar->numPositions == 3, "unsupported parameter set (plain BKW)");
-        return position_values_2_category_index_plain_bkw(lwe->q, a); /* calculate destination category */
+        if (ci->c)
+        {
+            return mixedRadixCategoryIndexN(NULL, ci->radixPower, ci->c, par->numPositions, a);
+        }
+        /* for 3 positions the third position value is suppressed (meta categories) */
+        if (ci->plainTable)
+        {
+            return ci->plainTable[a[0]*ci->q + a[1]];
+        }
+        return internal_position_values_2_category_index_plain_bkw(ci->q, a[0], a[1]);
     case LMS:
-        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_LMS_POSITIONS, "unsupported parameter set (LMS)");
-        return position_values_2_category_index_lms(lwe, bkwStepPar, a);
+        cat = mixedRadixCategoryIndexN(ci->digitMap, ci->radixPower, ci->c, par->numPositions, a);
+        ASSERT(cat < ci->numCategories, "category index calculated incorrectly");
+        return cat;
     case smoothLMS:
-        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_SMOOTH_LMS_POSITIONS, "unsupported parameter set (smooth LMS)");
-        return position_values_2_category_index_smooth_lms(lwe, bkwStepPar, a);
+        return smoothLmsCategoryIndex(ci->q, ci->n, par, a, par->sortingPar.smoothLMS.meta_skipped);
     case codedBKW:
-        ASSERT(0 < bkwStepPar->numPositions && bkwStepPar->numPositions <= MAX_CODED_BKW_POSITIONS, "unsupported parameter set (coded BKW)");
-        return position_values_2_category_index_coded_bkw(lwe, bkwStepPar, a);
+        cat = positionValuesFromTableCodedBKW(&ci->syndromeTable, ci->q, par->sortingPar.CodedBKW.ct, a);
+        ASSERT(cat < ci->numCategories, "category index calculated incorrectly");
+        return cat;
     default:
         ASSERT_ALWAYS("unsupported parameter set (default)");
-        return -1;
     }
-    ASSERT_ALWAYS("unsupported parameter set (unknown)");
     return -1;
 }
+
+u64 categoryIndexerSampleIndex(const categoryIndexer *ci, lweSample *sample)
+{
+    return categoryIndexerIndex(ci, sample->col.a + ci->bkwStepPar.startIndex);
+}
+
+int categoryIndexerIsSingleton(const categoryIndexer *ci, u64 categoryIndex)
+{
+    return singletonBitmapTest(ci->singletonBitmap, categoryIndex);
+}
+
+static int sameStepParameters(const bkwStepParameters *a, const bkwStepParameters *b)
+{
+    if (a->sorting != b->sorting || a->startIndex != b->startIndex || a->numPositions != b->numPositions)
+    {
+        return 0;
+    }
+    switch (a->sorting)
+    {
+    case LMS:
+        return a->sortingPar.LMS.p == b->sortingPar.LMS.p;
+    case smoothLMS:
+        return a->sortingPar.smoothLMS.p == b->sortingPar.smoothLMS.p &&
+               a->sortingPar.smoothLMS.p1 == b->sortingPar.smoothLMS.p1 &&
+               a->sortingPar.smoothLMS.p2 == b->sortingPar.smoothLMS.p2 &&
+               a->sortingPar.smoothLMS.prev_p1 == b->sortingPar.smoothLMS.prev_p1 &&
+               a->sortingPar.smoothLMS.meta_skipped == b->sortingPar.smoothLMS.meta_skipped;
+    case codedBKW:
+        return a->sortingPar.CodedBKW.ct == b->sortingPar.CodedBKW.ct;
+    default:
+        return 1;
+    }
+}
+
+/* (re)build the shared indexer of the legacy functions if the step parameters changed */
+static const categoryIndexer *legacyCategoryIndexer(lweInstance *lwe, bkwStepParameters *bkwStepPar)
+{
+    if (legacyIndexerBuilt && legacyIndexer.q == lwe->q && legacyIndexer.n == lwe->n && sameStepParameters(&legacyIndexer.bkwStepPar, bkwStepPar))
+    {
+        return &legacyIndexer;
+    }
+    free_table_plain_bkw_2_positions();
+    if (categoryIndexerInitialize(&legacyIndexer, lwe, bkwStepPar))
+    {
+        ASSERT_ALWAYS("could not build category index tables");
+        exit(1);
+    }
+    legacyIndexerBuilt = 1;
+    return &legacyIndexer;
+}
+
+int subBucketIndexerInitialize(subBucketIndexer *sbi, lweInstance *lwe, bkwStepParameters *bkwStepPar)
+{
+    int q = lwe->q;
+    sbi->q = q;
+    sbi->q_ = q%2 == 1 ? (q+1)/2 : q/2;
+    sbi->numSubBuckets = 0;
+    sbi->numKeyPositions = 0;
+
+    if (bkwStepPar->sorting == plainBKW && bkwStepPar->numPositions == 3)
+    {
+        /* meta categories on the first two positions, sub-buckets on the third */
+        sbi->numKeyPositions = 1;
+        sbi->position[0] = bkwStepPar->startIndex + 2;
+        sbi->p[0] = 0;
+        sbi->c[0] = q;
+        sbi->numSubBuckets = q;
+        return 0;
+    }
+    if (bkwStepPar->sorting != smoothLMS || bkwStepPar->sortingPar.smoothLMS.meta_skipped == 0)
+    {
+        return 0; /* no sub-buckets */
+    }
+
+    int meta_skipped = bkwStepPar->sortingPar.smoothLMS.meta_skipped;
+    if (meta_skipped > 2)
+    {
+        return 1; /* unsupported number of skipped positions */
+    }
+    int p = bkwStepPar->sortingPar.smoothLMS.p;
+    int p1 = bkwStepPar->sortingPar.smoothLMS.p1;
+    int q_ = sbi->q_;
+    int cMidPosition = ((2*q_-1) % p) == 0 ? ((2*q_-1) / p) : ((2*q_-1) / p) + 1;
+    int cLastPosition, pLast;
+    int lastPos = bkwStepPar->startIndex + bkwStepPar->numPositions; /* the additional position reduced with p1 */
+    if (lastPos == lwe->n)   /* last step of smooth LMS */
+    {
+        lastPos--;
+        pLast = p;
+        cLastPosition = cMidPosition;
+    }
+    else
+    {
+        pLast = p1;
+        cLastPosition = ((2*q_-1) % p1) == 0 ? ((2*q_-1) / p1) : ((2*q_-1) / p1) + 1;
+    }
+
+    if (meta_skipped == 1)
+    {
+        sbi->numKeyPositions = 1;
+        sbi->position[0] = lastPos;
+        sbi->p[0] = pLast;
+        sbi->c[0] = cLastPosition;
+        sbi->numSubBuckets = cLastPosition;
+    }
+    else     /* sub-bucket index is last position category * cMidPosition + second to last position category */
+    {
+        sbi->numKeyPositions = 2;
+        sbi->position[0] = lastPos - 1;
+        sbi->p[0] = p;
+        sbi->c[0] = cMidPosition;
+        sbi->position[1] = lastPos;
+        sbi->p[1] = pLast;
+        sbi->c[1] = cLastPosition;
+        sbi->numSubBuckets = cMidPosition * cLastPosition;
+    }
+    return 0;
+}
+
+/* finds the sub-buckets of a category ordered by the storage writer; each run of equal keys is
+   delimited by a binary search, so no sample is moved and only the first sample of a run and
+   the probed samples are looked at */
+void subBucketIndexerLocate(const subBucketIndexer *sbi, lweSample *category, u64 numSamples, lweSample **subBucket, int *numSamplesInSubBucket)
+{
+    for (int i=0; i<sbi->numSubBuckets; i++)
+    {
+        subBucket[i] = category;
+        numSamplesInSubBucket[i] = 0;
+    }
+    u64 i = 0;
+    while (i < numSamples)
+    {
+        int key = subBucketIndexerKey(sbi, &category[i]);
+        ASSERT(key < sbi->numSubBuckets, "sub-bucket index out of range");
+        ASSERT(numSamplesInSubBucket[key] == 0, "category not ordered by sub-bucket");
+        u64 lo = i + 1, hi = numSamples;
+        while (lo < hi)
+        {
+            u64 mid = lo + (hi - lo) / 2;
+            if (subBucketIndexerKey(sbi, &category[mid]) <= key)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        subBucket[key] = &category[i];
+        numSamplesInSubBucket[key] = lo - i;
+        i = lo;
+    }
+}
@@ -0,0 +1,74 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "scratch_arena.h"
+#include "memory_utils.h"
+#include "log_utils.h"
+#include "string_utils.h"
+#include <stdio.h>
+
+#define SCRATCH_ARENA_ALIGNMENT _Alignof(max_align_t)
+
+int scratchArenaInitialize(scratchArena *sa, size_t capacity)
+{
+    sa->capacity = (capacity + SCRATCH_ARENA_ALIGNMENT - 1) / SCRATCH_ARENA_ALIGNMENT * SCRATCH_ARENA_ALIGNMENT;
+    sa->used = 0;
+    sa->peak = 0;
+    sa->base = MALLOC(sa->capacity);
+    if (!sa->base)
+    {
+        sa->capacity = 0;
+        return 1; /* allocation failed */
+    }
+    return 0;
+}
+
+void scratchArenaFree(scratchArena *sa)
+{
+    FREE(sa->base);
+    sa->base = NULL;
+    sa->capacity = 0;
+    sa->used = 0;
+}
+
+void *scratchArenaAlloc(scratchArena *sa, size_t numBytes)
+{
+    size_t size = (numBytes + SCRATCH_ARENA_ALIGNMENT - 1) / SCRATCH_ARENA_ALIGNMENT * SCRATCH_ARENA_ALIGNMENT;
+    if (size > sa->capacity - sa->used)
+    {
+        return NULL; /* arena exhausted */
+    }
+    void *p = sa->base + sa->used;
+    sa->used += size;
+    if (sa->used > sa->peak)
+    {
+        sa->peak = sa->used;
+    }
+    return p;
+}
+
+void scratchArenaReport(const scratchArena *sa, const char *stepName, time_t start)
+{
+#if SCRATCH_ARENA_REPORT_PEAK
+    char s1[256], s2[256];
+    timeStamp(start);
+    printf("%s: peak scratch usage %s of %s bytes\n", stepName, sprintf_u64_delim(s1, sa->peak), sprintf_u64_delim(s2, sa->capacity));
+#else
+    (void)sa;
+    (void)stepName;
+    (void)start;
+#endif
+}
@@ -15,6 +15,8 @@
  */
 
 #include "solve_fft.h"
+#include "solve_fft_internal.h"
+#include "guess_scheduler.h"
 #include "lwe_instance.h"
 #include "storage_reader.h"
 #include "storage_file_utilities.h"
@@ -24,203 +26,311 @@
 #include <complex.h> /* for fftw3 */
 #include "fftw3.h" /* for FFT */
 #include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "workplace_localization.h"
 
 #define MIN(x,y) ((x)<(y)?(x):(y))
 
 #define TAU 6.283185307179586476925286766559005768394338798750211641949
 
-/* double-precision case */
-static void processOneCategory(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftw_complex *in, int fftPositions)
+/* index of the sample in the fft input function, the first position is the most significant */
+static inline u64 fftSampleIndex(lweSample *sample, int startIndex, int fftPositions, int q)
 {
-    int q = lwe->q;
-    int n = lwe->n;
-    ASSERT(0 <= numSolvedCoordinates && numSolvedCoordinates <= n, "Bad parameter numSolvedCoordinates!\n");
-    int startIndex = n - numSolvedCoordinates - fftPositions;
+    u64 currentIndex = 0;
+    for (int j=0; j<fftPositions; j++)
+    {
+        int p = columnValue(sample, startIndex + j);
+        ASSERT(0 <= p && p < q, "unexpected position value");
+        currentIndex = q * currentIndex + p;
+    }
+    return currentIndex;
+}
 
-    /* process all samples */
-    for (u64 i=0; i<numSamples; i++)
+/* sum with error minus the contribution of the solved positions n-numSolvedCoordinates, ..., n-1, modulo q */
+static inline int fftSampleSe(lweSample *sample, short *solution, int numSolvedCoordinates, int n, int q)
+{
+    /* plain multiply-accumulate over contiguous shorts, vectorised by the compiler */
+    const short *a = sample->col.a + n - numSolvedCoordinates;
+    const short *s = solution + n - numSolvedCoordinates;
+    u64 solvedSum = 0;
+    for (int j=0; j<numSolvedCoordinates; j++)
     {
-        lweSample *sample = &buf[i];
+        solvedSum += (u64)(a[j] * s[j]);
+    }
+    return (sumWithError(sample) + q - (int)(solvedSum % q)) % q;
+}
 
-        /* find function value (index) to update */
-        int p1, p2, p3;
-        u64 currentIndex;
-        switch (fftPositions)
+/* table of the q-th roots of unity, roots[k] = exp(2*pi*i*k/q) */
+static fftw_complex *unitRootTable(int q)
+{
+    fftw_complex *roots = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * q);
+    if (roots)
+    {
+        for (int k=0; k<q; k++)
         {
-        case 1:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            currentIndex = p1;
-            ASSERT(0 <= currentIndex && currentIndex < q, "unexpected value");
-            break;
-        case 2:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            currentIndex = q * p1 + p2;
-            ASSERT(0 <= currentIndex && currentIndex < q * q, "unexpected value");
-            break;
-        case 3:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            p3 = columnValue(sample, startIndex + 2);
-            ASSERT(0 <= p3 && p3 < q, "unexpected p3");
-            currentIndex = q * (q * p1 + p2) + p3;
-            ASSERT(0 <= currentIndex && currentIndex < q * q * q, "unexpected value");
-            break;
-        default:
-            ASSERT_ALWAYS("More than 3 positions not supported for fft solving");
-            exit(1);
+            roots[k] = cexp(TAU*I*k/q);
         }
+    }
+    return roots;
+}
 
-        /* compute partial sum for solved part */
-        u64 solvedSum = 0;
-        for (int j=n-numSolvedCoordinates; j<n; j++)
+static fftwf_complex *unitRootTableSingle(int q)
+{
+    fftwf_complex *roots = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * q);
+    if (roots)
+    {
+        for (int k=0; k<q; k++)
         {
-            solvedSum += columnValue(sample, j) * solution[j];
+            roots[k] = cexp(TAU*I*k/q);
         }
-        solvedSum = solvedSum % q;
+    }
+    return roots;
+}
 
-        u64 se = sumWithError(sample);
-        se = (se - solvedSum) % q;
+/* double-precision case */
+void fftAccumulateSamples(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftw_complex *in, const fftw_complex *roots, int fftPositions)
+{
+    int q = lwe->q;
+    int n = lwe->n;
+    ASSERT(0 <= numSolvedCoordinates && numSolvedCoordinates <= n, "Bad parameter numSolvedCoordinates!\n");
+    ASSERT(1 <= fftPositions && fftPositions <= 3, "More than 3 positions not supported for fft solving");
+    int startIndex = n - numSolvedCoordinates - fftPositions;
 
-#if 0
-        /* update function value (index) to update */
-        int p1 = columnValue(sample, startIndex);
-        u64 currentIndex = p1;
-        ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-        if (fftPositions >= 2)
-        {
-            int p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            currentIndex = q * currentIndex + p2;
-        }
-        if (fftPositions >= 3)
-        {
-            int p3 = columnValue(sample, startIndex + 2);
-            ASSERT(0 <= p3 && p3 < q, "unexpected p3");
-            currentIndex = q * currentIndex + p3;
-        }
-#endif
+    /* process all samples */
+    for (u64 i=0; i<numSamples; i++)
+    {
+        lweSample *sample = &buf[i];
+        int se = fftSampleSe(sample, solution, numSolvedCoordinates, n, q);
 
         /* update fft input function */
-        fftw_complex toAdd = cexp(TAU*I*se/q);
-        in[currentIndex] += toAdd;
+        in[fftSampleIndex(sample, startIndex, fftPositions, q)] += roots[se];
     }
 }
 
 /* single-precision case */
-static void processOneCategorySingle(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftwf_complex *in, int fftPositions)
+static void processOneCategorySingle(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftwf_complex *in, const fftwf_complex *roots, int fftPositions)
 {
     int q = lwe->q;
     int n = lwe->n;
     ASSERT(0 <= numSolvedCoordinates && numSolvedCoordinates <= n, "Bad parameter numSolvedCoordinates!\n");
+    ASSERT(1 <= fftPositions && fftPositions <= 3, "More than 3 positions not supported for fft solving");
     int startIndex = n - numSolvedCoordinates - fftPositions;
 
     /* process all samples */
     for (u64 i=0; i<numSamples; i++)
     {
         lweSample *sample = &buf[i];
+        int se = fftSampleSe(sample, solution, numSolvedCoordinates, n, q);
 
-        /* find function value (index) to update */
-        int p1, p2, p3;
-        u64 currentIndex;
-        switch (fftPositions)
+        /* update fft input function */
+        in[fftSampleIndex(sample, startIndex, fftPositions, q)] += roots[se];
+    }
+}
+
+/* the fftw planner is not thread-safe, plan execution is */
+static pthread_mutex_t plannerLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Plans are created once per (q, number of dimensions, precision, number of threads) and cached.
+ * They are planned on the first caller's arrays, before these are filled (see prepareFft), and
+ * executed on any caller's arrays with fftw_execute_dft, which is allowed since all arrays come
+ * from fftw_malloc. No planning scratch arrays are allocated. When the cache is full, the least
+ * recently used plan that is not being executed is destroyed to make room for a new one. */
+#define FFT_PLAN_CACHE_CAPACITY 16
+
+typedef struct
+{
+    int q;
+    int rank;
+    int precision;
+    int numThreads;
+    fftw_plan p;
+    fftwf_plan pS;
+    u64 lastUse; /* value of planCacheClock when the plan was last handed out */
+    int numUsers; /* callers between fftPlanCacheGet and fftPlanCacheRelease, the plan is not evicted while non-zero */
+} fftPlanCacheEntry;
+
+static fftPlanCacheEntry planCache[FFT_PLAN_CACHE_CAPACITY];
+static int planCacheSize = 0;
+static u64 planCacheClock = 0;
+static int wisdomImported = 0;
+
+static void fftWisdomFileName(char *fileName, int precision)
+{
+    sprintf(fileName, "%s%s", LOCAL_FFTW_WISDOM_FILE_PATH, precision == FFT_SOLVER_SINGLE_PRECISION ? ".f" : "");
+}
+
+/* must be called with plannerLock held */
+static void importWisdom(void)
+{
+    char fileName[512];
+    if (wisdomImported)
+    {
+        return;
+    }
+    wisdomImported = 1;
+#if FFT_NUM_THREADS > 1
+    fftw_init_threads();
+    fftwf_init_threads();
+#endif
+    fftWisdomFileName(fileName, FFT_SOLVER_DOUBLE_PRECISION);
+    fftw_import_wisdom_from_filename(fileName); /* no wisdom file yet is fine */
+    fftWisdomFileName(fileName, FFT_SOLVER_SINGLE_PRECISION);
+    fftwf_import_wisdom_from_filename(fileName);
+}
+
+/* must be called with plannerLock held */
+static void destroyPlans(fftPlanCacheEntry *e)
+{
+    if (e->p)
+    {
+        fftw_destroy_plan(e->p);
+    }
+    if (e->pS)
+    {
+        fftwf_destroy_plan(e->pS);
+    }
+}
+
+/* slot for a new plan, a free one or the least recently used plan that is not in use (NULL if all are in use) - must be called with plannerLock held */
+static fftPlanCacheEntry *planCacheSlot(void)
+{
+    if (planCacheSize < FFT_PLAN_CACHE_CAPACITY)
+    {
+        return &planCache[planCacheSize];
+    }
+    fftPlanCacheEntry *lru = NULL;
+    for (int i=0; i<planCacheSize; i++)
+    {
+        if (!planCache[i].numUsers && (!lru || planCache[i].lastUse < lru->lastUse))
         {
-        case 1:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            currentIndex = p1;
-            ASSERT(0 <= currentIndex && currentIndex < q, "unexpected value");
-            break;
-        case 2:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            currentIndex = q * p1 + p2;
-            ASSERT(0 <= currentIndex && currentIndex < q * q, "unexpected value");
-            break;
-        case 3:
-            p1 = columnValue(sample, startIndex);
-            ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-            p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            p3 = columnValue(sample, startIndex + 2);
-            ASSERT(0 <= p3 && p3 < q, "unexpected p3");
-            currentIndex = q * (q * p1 + p2) + p3;
-            ASSERT(0 <= currentIndex && currentIndex < q * q * q, "unexpected value");
-            break;
-        default:
-            ASSERT_ALWAYS("More than 3 positions not supported for fft solving");
-            exit(1);
+            lru = &planCache[i];
         }
+    }
+    return lru;
+}
 
-        /* compute partial sum for solved part */
-        u64 solvedSum = 0;
-        for (int j=n-numSolvedCoordinates; j<n; j++)
+/* return the cached plan for a q x ... x q (rank dimensions) transform, create it on in/out with the given planner flags if needed (NULL on failure).
+   the plan stays valid until the matching fftPlanCacheRelease */
+static fftPlanCacheEntry *fftPlanCacheGet(int q, int rank, int precision, int numThreads, void *in, void *out, unsigned flags)
+{
+    fftPlanCacheEntry *e = NULL;
+    pthread_mutex_lock(&plannerLock);
+    for (int i=0; i<planCacheSize; i++)
+    {
+        if (planCache[i].q == q && planCache[i].rank == rank && planCache[i].precision == precision && planCache[i].numThreads == numThreads)
         {
-            solvedSum += columnValue(sample, j) * solution[j];
+            e = &planCache[i];
+            break;
         }
-        solvedSum = solvedSum % q;
-
-        u64 se = sumWithError(sample);
-        se = (se - solvedSum) % q;
-
-        fftwf_complex toAdd = cexp(TAU*I*se/q);
-        in[currentIndex] += toAdd;
     }
+    fftPlanCacheEntry *slot = e ? NULL : planCacheSlot();
+    if (slot)
+    {
+        importWisdom();
+        int dims[3] = { q, q, q };
+        char fileName[512];
+        fftPlanCacheEntry entry = { q, rank, precision, numThreads, NULL, NULL, 0, 0 };
+        if (precision == FFT_SOLVER_DOUBLE_PRECISION)
+        {
+#if FFT_NUM_THREADS > 1
+            fftw_plan_with_nthreads(numThreads);
+#endif
+            entry.p = fftw_plan_dft(rank, dims, in, out, FFTW_FORWARD, flags);
+            fftWisdomFileName(fileName, precision);
+            fftw_export_wisdom_to_filename(fileName);
+        }
+        else
+        {
+#if FFT_NUM_THREADS > 1
+            fftwf_plan_with_nthreads(numThreads);
+#endif
+            entry.pS = fftwf_plan_dft(rank, dims, in, out, FFTW_FORWARD, flags);
+            fftWisdomFileName(fileName, precision);
+            fftwf_export_wisdom_to_filename(fileName);
+        }
+        if (entry.p || entry.pS)
+        {
+            if (slot == &planCache[planCacheSize])
+            {
+                planCacheSize++;
+            }
+            else
+            {
+                destroyPlans(slot); /* evict the least recently used plan */
+            }
+            *slot = entry;
+            e = slot;
+        }
+    }
+    if (e)
+    {
+        e->lastUse = ++planCacheClock;
+        e->numUsers++;
+    }
+    pthread_mutex_unlock(&plannerLock);
+    return e;
 }
 
-/* calculates the fft of f in 1 dimension - double-precision*/
-void calculateFft1d(fftw_complex *in, fftw_complex *out, int q)
+static void fftPlanCacheRelease(fftPlanCacheEntry *e)
 {
-    fftw_plan p = fftw_plan_dft_1d(q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    if (e)
+    {
+        pthread_mutex_lock(&plannerLock);
+        e->numUsers--;
+        pthread_mutex_unlock(&plannerLock);
+    }
 }
 
-/* calculates the fft of f in 1 dimension - single-precision*/
-void calculateFft1dSingle(fftwf_complex *in, fftwf_complex *out, int q)
+/* destroy all cached fft plans (the wisdom stays on file) */
+void fftPlanCacheClear(void)
 {
-    fftwf_plan p = fftwf_plan_dft_1d(q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    pthread_mutex_lock(&plannerLock);
+    for (int i=0; i<planCacheSize; i++)
+    {
+        destroyPlans(&planCache[i]);
+    }
+    planCacheSize = 0;
+    pthread_mutex_unlock(&plannerLock);
 }
 
-/* calculates the fft of f in 2 dimensions - double-precision*/
-void calculateFft2d(fftw_complex *in, fftw_complex *out, int q)
+/* create the cached plan on in/out with FFT_PLANNER_FLAGS - the planner may overwrite the arrays, so call this before filling them */
+/* a planning failure shows up in calculateFft */
+static void prepareFft(fftw_complex *in, fftw_complex *out, int q, int rank, int numThreads)
 {
-    fftw_plan p = fftw_plan_dft_2d(q, q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    fftPlanCacheRelease(fftPlanCacheGet(q, rank, FFT_SOLVER_DOUBLE_PRECISION, numThreads, in, out, FFT_PLANNER_FLAGS));
 }
 
-/* calculates the fft of f in 2 dimensions - single-precision*/
-void calculateFft2dSingle(fftwf_complex *in, fftwf_complex *out, int q)
+static void prepareFftSingle(fftwf_complex *in, fftwf_complex *out, int q, int rank, int numThreads)
 {
-    fftwf_plan p = fftwf_plan_dft_2d(q, q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    fftPlanCacheRelease(fftPlanCacheGet(q, rank, FFT_SOLVER_SINGLE_PRECISION, numThreads, in, out, FFT_PLANNER_FLAGS));
 }
 
-/* calculates the fft of f in 3 dimensions - double-precision */
-void calculateFft3d(fftw_complex *in, fftw_complex *out, int q)
+/* calculates the fft of f in rank dimensions - double-precision, return non-zero if no plan could be created */
+/* a plan missing because prepareFft was not called is created with FFTW_ESTIMATE, which leaves the filled arrays intact */
+static int calculateFft(fftw_complex *in, fftw_complex *out, int q, int rank, int numThreads)
 {
-    fftw_plan p = fftw_plan_dft_3d(q, q, q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    fftPlanCacheEntry *e = fftPlanCacheGet(q, rank, FFT_SOLVER_DOUBLE_PRECISION, numThreads, in, out, FFTW_ESTIMATE);
+    if (!e)
+    {
+        return 1;
+    }
+    fftw_execute_dft(e->p, in, out);
+    fftPlanCacheRelease(e);
+    return 0;
 }
 
-/* calculates the fft of f in 3 dimensions - single-precision */
-void calculateFft3dSingle(fftwf_complex *in, fftwf_complex *out, int q)
+/* calculates the fft of f in rank dimensions - single-precision, return non-zero if no plan could be created */
+static int calculateFftSingle(fftwf_complex *in, fftwf_complex *out, int q, int rank, int numThreads)
 {
-    fftwf_plan p = fftwf_plan_dft_3d(q, q, q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    fftPlanCacheEntry *e = fftPlanCacheGet(q, rank, FFT_SOLVER_SINGLE_PRECISION, numThreads, in, out, FFTW_ESTIMATE);
+    if (!e)
+    {
+        return 1;
+    }
+    fftwf_execute_dft(e->pS, in, out);
+    fftPlanCacheRelease(e);
+    return 0;
 }
 
 /* find the solution by looking at the output of the fft - 1 position and double-precision case */
@@ -419,21 +529,22 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
     }
 
     /* create function to be fft input and output */
-    fftw_complex *in;
-    fftw_complex *out;
-    fftwf_complex *inS;
-    fftwf_complex *outS;
-    fftw_plan p;
-    fftwf_plan pS;
+    fftw_complex *in = NULL;
+    fftw_complex *out = NULL;
+    fftwf_complex *inS = NULL;
+    fftwf_complex *outS = NULL;
+    fftw_complex *roots = NULL; /* unit roots indexed by the sum with error, computed once instead of per sample */
+    fftwf_complex *rootsS = NULL;
 
     switch (precision)
     {
     case FFT_SOLVER_SINGLE_PRECISION:
         inS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * numFftSlots);
         outS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * numFftSlots);
+        rootsS = unitRootTableSingle(q);
         ASSERT(inS, "allocation failed");
         ASSERT(outS, "allocation failed");
-        if (!inS || !outS)
+        if (!inS || !outS || !rootsS)
         {
             char s[128];
             printf("*** solve_plain_bkw_sorted: allocation failure (tried to allocate %s bytes)\n", sprintf_u64_delim(s, sizeof(fftwf_complex) * numFftSlots));
@@ -441,15 +552,17 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
             lweDestroy(&lwe);
             return 4;
         }
+        prepareFftSingle(inS, outS, q, fftPositions, FFT_NUM_THREADS);
         MEMSET(inS, 0, sizeof(fftwf_complex) * numFftSlots);
         MEMSET(outS, 0, sizeof(fftwf_complex) * numFftSlots);
         break;
     case FFT_SOLVER_DOUBLE_PRECISION:
         in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * numFftSlots);
         out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * numFftSlots);
+        roots = unitRootTable(q);
         ASSERT(in, "allocation failed");
         ASSERT(out, "allocation failed");
-        if (!in || !out)
+        if (!in || !out || !roots)
         {
             char s[128];
             printf("*** solve_plain_bkw_sorted: allocation failure (tried to allocate %s bytes)\n", sprintf_u64_delim(s, sizeof(fftw_complex) * numFftSlots));
@@ -457,6 +570,7 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
             lweDestroy(&lwe);
             return 3;
         }
+        prepareFft(in, out, q, fftPositions, FFT_NUM_THREADS);
         MEMSET(in, 0, sizeof(fftw_complex) * numFftSlots);
         MEMSET(out, 0, sizeof(fftw_complex) * numFftSlots);
         break;
@@ -465,35 +579,6 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
         exit(1);
     }
 
-    switch (fftPositions)
-    {
-    case 1:
-        switch (precision)
-        {
-        case FFT_SOLVER_SINGLE_PRECISION:
-            pS = fftwf_plan_dft_1d(q, inS, outS, FFTW_FORWARD, FFTW_ESTIMATE);
-            MEMSET(inS, 0, sizeof(fftwf_complex) * numFftSlots);
-            MEMSET(outS, 0, sizeof(fftwf_complex) * numFftSlots);
-            break;
-        case FFT_SOLVER_DOUBLE_PRECISION:
-            p = fftw_plan_dft_1d(q, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-            MEMSET(in, 0, sizeof(fftw_complex) * numFftSlots);
-            MEMSET(out, 0, sizeof(fftw_complex) * numFftSlots);
-            break;
-        default:
-            ASSERT_ALWAYS("Unhandled precision");
-            exit(1);
-        }
-        break;
-    case 2:
-        break;
-    case 3:
-        break;
-    default:
-        ASSERT_ALWAYS("unsupported number of positions");
-        exit(1);
-    }
-
     /* collect statistics from samples */
     u64 categoryIndexCounter = 0;
     lweSample *buf1;
@@ -512,11 +597,11 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
             {
             case FFT_SOLVER_SINGLE_PRECISION:
                 categoryIndexCounter++;
-                processOneCategorySingle(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, inS, fftPositions);
+                processOneCategorySingle(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, inS, rootsS, fftPositions);
                 break;
             case FFT_SOLVER_DOUBLE_PRECISION:
                 categoryIndexCounter++;
-                processOneCategory(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, in, fftPositions);
+                fftAccumulateSamples(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, in, roots, fftPositions);
                 break;
             default:
                 ASSERT_ALWAYS("Unhandled precision");
@@ -531,11 +616,11 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
             {
             case FFT_SOLVER_SINGLE_PRECISION:
                 categoryIndexCounter++;
-                processOneCategorySingle(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, inS, fftPositions);
+                processOneCategorySingle(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, inS, rootsS, fftPositions);
                 break;
             case FFT_SOLVER_DOUBLE_PRECISION:
                 categoryIndexCounter++;
-                processOneCategory(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, in, fftPositions);
+                fftAccumulateSamples(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, in, roots, fftPositions);
                 break;
             default:
                 ASSERT_ALWAYS("Unhandled precision");
@@ -550,62 +635,48 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
         printf("*** solve_fft_search: %" PRIu64 " categories processed (%" PRIu64 " expected)\n", categoryIndexCounter, numCategories);
     }
 
-    switch (fftPositions)
+    /* Calculate fft and deduce position values from it */
+    switch (precision)
     {
-    case 1:
-        switch (precision)
-        {
-        case FFT_SOLVER_SINGLE_PRECISION:
-//      calculateFft1dSingle(inS, outS, q); /* Calculate fft */
-//      printf("in[1577] = %10.2f + %10.2fI (before execution)\n", creal(inS[1577]), cimag(inS[1577]));
-            fftwf_execute(pS);
-//      printf("in[1577] = %10.2f + %10.2fI (after execution)\n", creal(inS[1577]), cimag(inS[1577]));
-            updateSolution1dSingle(outS, solution, startIndex, q); /* deduce position values from fft */
-//      printf("in[1577] = %10.2f + %10.2fI (after update)\n", creal(inS[1577]), cimag(inS[1577]));
-            fftwf_destroy_plan(pS);
-            break;
-        case FFT_SOLVER_DOUBLE_PRECISION:
-//      calculateFft1d(in, out, q); /* Calculate fft */
-            fftw_execute(p);
-            updateSolution1d(out, solution, startIndex, q); /* deduce position values from fft */
-            fftw_destroy_plan(p);
-            break;
-        default:
-            ASSERT_ALWAYS("Unhandled precision");
-        }
+    case FFT_SOLVER_SINGLE_PRECISION:
+        ret = calculateFftSingle(inS, outS, q, fftPositions, FFT_NUM_THREADS);
         break;
-    case 2:
-        switch (precision)
-        {
-        case FFT_SOLVER_SINGLE_PRECISION:
-            calculateFft2dSingle(inS, outS, q); /* Calculate fft */
-            updateSolution2dSingle(outS, solution, startIndex, q); /* deduce position values from fft */
-            break;
-        case FFT_SOLVER_DOUBLE_PRECISION:
-            calculateFft2d(in, out, q); /* Calculate fft */
-            updateSolution2d(out, solution, startIndex, q); /* deduce position values from fft */
-            break;
-        default:
-            ASSERT_ALWAYS("Unhandled precision");
-        }
+    case FFT_SOLVER_DOUBLE_PRECISION:
+        ret = calculateFft(in, out, q, fftPositions, FFT_NUM_THREADS);
         break;
-    case 3:
-        switch (precision)
+    default:
+        ASSERT_ALWAYS("Unhandled precision");
+        exit(1);
+    }
+    if (ret)
+    {
+        printf("*** solve_fft_search: could not create fft plan\n");
+    }
+    else
+    {
+        switch (fftPositions)
         {
-        case FFT_SOLVER_SINGLE_PRECISION:
-            calculateFft3dSingle(inS, outS, q); /* Calculate fft */
-            updateSolution3dSingle(outS, solution, startIndex, q); /* deduce position values from fft */
+        case 1:
+            if (precision == FFT_SOLVER_SINGLE_PRECISION)
+                updateSolution1dSingle(outS, solution, startIndex, q);
+            else
+                updateSolution1d(out, solution, startIndex, q);
             break;
-        case FFT_SOLVER_DOUBLE_PRECISION:
-            calculateFft3d(in, out, q); /* Calculate fft */
-            updateSolution3d(out, solution, startIndex, q); /* deduce position values from fft */
+        case 2:
+            if (precision == FFT_SOLVER_SINGLE_PRECISION)
+                updateSolution2dSingle(outS, solution, startIndex, q);
+            else
+                updateSolution2d(out, solution, startIndex, q);
+            break;
+        case 3:
+            if (precision == FFT_SOLVER_SINGLE_PRECISION)
+                updateSolution3dSingle(outS, solution, startIndex, q);
+            else
+                updateSolution3d(out, solution, startIndex, q);
             break;
         default:
-            ASSERT_ALWAYS("Unhandled precision");
+            ASSERT_ALWAYS("unsupported number of positions");
         }
-        break;
-    default:
-        ASSERT_ALWAYS("unsupported number of positions");
     }
 
     /* cleanup */
@@ -615,304 +686,323 @@ int solve_fft_search(const char *srcFolder, short *solution, int numSolvedCoordi
     case FFT_SOLVER_SINGLE_PRECISION:
         fftw_free(inS);
         fftw_free(outS);
+        fftwf_free(rootsS);
         break;
     case FFT_SOLVER_DOUBLE_PRECISION:
         fftw_free(in);
         fftw_free(out);
+        fftw_free(roots);
         break;
     default:
         ASSERT_ALWAYS("Unhandled precision");
     }
 
     lweDestroy(&lwe);
-    return 0;
+    return ret ? 5 : 0;
 }
 
 /* HYBRID CONTENT STARTS HERE */
 
-/* Hybrid category processing - double-precision case */
-static void processOneCategoryHybrid(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftw_complex *in, int fftPositions, int *guess, int bruteForcePositions)
+/* compact per-sample data of the hybrid solver, shared (read-only) by the worker threads */
+typedef struct
+{
+    u64 numSamples;
+    u64 *fftIndex; /* index of the sample in the fft input function */
+    short *se; /* sum with error minus the contribution of the solved positions, modulo q */
+    short *bfCoefficients; /* values of the brute-force positions */
+    int bruteForcePositions;
+    int fftPositions;
+    int upperLimitGuess;
+    int q;
+    u64 numFftSlots;
+    int doublePrecision;
+    fftw_complex *roots; /* unit roots indexed by the sum with error */
+    fftwf_complex *rootsS;
+} fftHybridContext;
+
+/* fft input/output owned by one worker thread, the (cached) plan is shared */
+typedef struct
+{
+    fftw_complex *in, *out;
+    fftwf_complex *inS, *outS;
+} fftHybridWorker;
+
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hybrid category processing - store the compact form of the samples of one category */
+static void loadOneCategoryHybrid(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftHybridContext *ctx, u64 capacity)
 {
     int q = lwe->q;
     int n = lwe->n;
     ASSERT(0 <= numSolvedCoordinates && numSolvedCoordinates <= n, "Bad parameter numSolvedCoordinates!\n");
-    int startIndex = n - numSolvedCoordinates - fftPositions - bruteForcePositions; /* Subtract positions due to the BF guessing */
+    int startIndex = n - numSolvedCoordinates - ctx->fftPositions - ctx->bruteForcePositions; /* Subtract positions due to the BF guessing */
+    int bfStartIndex = n - numSolvedCoordinates - ctx->bruteForcePositions;
 
     /* process all samples */
-    for (u64 i=0; i<numSamples; i++)
+    for (u64 i=0; i<numSamples && ctx->numSamples < capacity; i++)
     {
         lweSample *sample = &buf[i];
+        u64 k = ctx->numSamples++;
 
-        /* compute partial sum for solved part */
-        u64 solvedSum = 0;
-
-        /* Calculates the contribution from the guessing part */
-        for (int j = 0; j < bruteForcePositions; j++)
-        {
-            solvedSum += columnValue(sample, n - numSolvedCoordinates - bruteForcePositions + j) * guess[j];
-        }
-
-        for (int j=n-numSolvedCoordinates; j<n; j++)
-        {
-            solvedSum += columnValue(sample, j) * solution[j];
-        }
-        solvedSum = solvedSum % q;
+        ctx->se[k] = fftSampleSe(sample, solution, numSolvedCoordinates, n, q);
 
-        u64 se = sumWithError(sample);
-        se = (se - solvedSum) % q;
-
-        /* update function value (index) to update */
-        int p1 = columnValue(sample, startIndex);
-        u64 currentIndex = p1;
-        ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-        if (fftPositions >= 2)
-        {
-            int p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            currentIndex = q * currentIndex + p2;
-        }
-        if (fftPositions >= 3)
+        /* Stores the values of the guessing part */
+        for (int j = 0; j < ctx->bruteForcePositions; j++)
         {
-            int p3 = columnValue(sample, startIndex + 2);
-            ASSERT(0 <= p3 && p3 < q, "unexpected p3");
-            currentIndex = q * currentIndex + p3;
+            ctx->bfCoefficients[k*ctx->bruteForcePositions + j] = columnValue(sample, bfStartIndex + j);
         }
 
-        /* update fft input function */
-        fftw_complex toAdd = cexp(TAU*I*se/q);
-        in[currentIndex] = in[currentIndex] + toAdd;
+        /* function value (index) to update */
+        ctx->fftIndex[k] = fftSampleIndex(sample, startIndex, ctx->fftPositions, q);
     }
 }
 
-/* Hybrid category processing - single-precision case */
-static void processOneCategoryHybridSingle(lweInstance *lwe, lweSample *buf, u64 numSamples, short *solution, int numSolvedCoordinates, fftwf_complex *in, int fftPositions, int *guess, int bruteForcePositions)
+/* bytes of the fft input and output owned by one worker */
+static u64 fftHybridWorkerBytes(const fftHybridContext *hy)
 {
-    int q = lwe->q;
-    int n = lwe->n;
-    ASSERT(0 <= numSolvedCoordinates && numSolvedCoordinates <= n, "Bad parameter numSolvedCoordinates!\n");
-    int startIndex = n - numSolvedCoordinates - fftPositions - bruteForcePositions; /* Subtract positions due to the BF guessing */
+    return 2 * (hy->doublePrecision ? sizeof(fftw_complex) : sizeof(fftwf_complex)) * hy->numFftSlots;
+}
 
-    /* process all samples */
-    for (u64 i=0; i<numSamples; i++)
+/* SOLVER_NUM_THREADS workers (all online processors if 0), but no more than fit in FFT_HYBRID_GRIDS_MEMORY_BUDGET_IN_BYTES */
+static int fftHybridNumWorkers(const fftHybridContext *hy)
+{
+    long numWorkers = SOLVER_NUM_THREADS;
+    if (numWorkers <= 0)
     {
-        lweSample *sample = &buf[i];
-
-        /* compute partial sum for solved part */
-        u64 solvedSum = 0;
+        numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = numWorkers > 0 ? numWorkers : 1;
+    }
+    u64 budget = FFT_HYBRID_GRIDS_MEMORY_BUDGET_IN_BYTES;
+    if (!budget)
+    {
+        long numPages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGESIZE);
+        budget = numPages > 0 && pageSize > 0 ? (u64)numPages * pageSize / 2 : 0;
+    }
+    u64 maxWorkers = budget ? budget / fftHybridWorkerBytes(hy) : (u64)numWorkers; /* no cap if the physical memory is unknown */
+    maxWorkers = maxWorkers < 1 ? 1 : maxWorkers;
+    return (u64)numWorkers > maxWorkers ? (int)maxWorkers : (int)numWorkers;
+}
 
-        /* Calculates the contribution from the guessing part */
-        for (int j = 0; j < bruteForcePositions; j++)
-        {
-            solvedSum += columnValue(sample, n - numSolvedCoordinates - bruteForcePositions + j) * guess[j];
-        }
+static void fftHybridWorkerFree(void *ctx, void *workerState);
 
-        for (int j=n-numSolvedCoordinates; j<n; j++)
+static void *fftHybridWorkerInit(void *ctx)
+{
+    fftHybridContext *hy = ctx;
+    fftHybridWorker *w = CALLOC(1, sizeof(fftHybridWorker));
+    int ok = 0;
+    if (w)
+    {
+        if (hy->doublePrecision)
         {
-            solvedSum += columnValue(sample, j) * solution[j];
+            w->in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * hy->numFftSlots);
+            w->out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * hy->numFftSlots);
+            ok = w->in && w->out;
+            if (ok)
+            {
+                prepareFft(w->in, w->out, hy->q, hy->fftPositions, 1);
+            }
         }
-        solvedSum = solvedSum % q;
-
-        u64 se = sumWithError(sample);
-        se = (se - solvedSum) % q;
-
-        /* update function value (index) to update */
-        int p1 = columnValue(sample, startIndex);
-        u64 currentIndex = p1;
-        ASSERT(0 <= p1 && p1 < q, "unexpected p1");
-        if (fftPositions >= 2)
+        else
         {
-            int p2 = columnValue(sample, startIndex + 1);
-            ASSERT(0 <= p2 && p2 < q, "unexpected p2");
-            currentIndex = q * currentIndex + p2;
+            w->inS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * hy->numFftSlots);
+            w->outS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * hy->numFftSlots);
+            ok = w->inS && w->outS;
+            if (ok)
+            {
+                prepareFftSingle(w->inS, w->outS, hy->q, hy->fftPositions, 1);
+            }
         }
-        if (fftPositions >= 3)
+    }
+    if (!ok)
+    {
+        char s[128];
+        pthread_mutex_lock(&printLock);
+        printf("*** solve_fft_search_hybrid: allocation failure (tried to allocate %s bytes), worker not started\n", sprintf_u64_delim(s, fftHybridWorkerBytes(hy)));
+        pthread_mutex_unlock(&printLock);
+        if (w)
         {
-            int p3 = columnValue(sample, startIndex + 2);
-            ASSERT(0 <= p3 && p3 < q, "unexpected p3");
-            currentIndex = q * currentIndex + p3;
+            fftHybridWorkerFree(ctx, w);
         }
-
-        /* update fft input function */
-        fftwf_complex toAdd = cexp(TAU*I*se/q);
-        in[currentIndex] = in[currentIndex] + toAdd;
+        return NULL;
     }
+    return w;
 }
 
-/* find the solution by looking at the output of the fft - 1 position and double-precision case */
-double updateSolution1dHybrid(fftw_complex *out, short *solution, int startIndex, int q, double current_max)
+static void fftHybridWorkerFree(void *ctx, void *workerState)
 {
-    double current_value;
-    double local_max = -42; /* Arbitrary low value */
+    (void)ctx;
+    fftHybridWorker *w = workerState;
+    fftw_free(w->in);
+    fftw_free(w->out);
+    fftwf_free(w->inS);
+    fftwf_free(w->outS);
+    FREE(w);
+}
 
-    for (int i = 0; i < q; i++)
+/* map a guess index to the brute-force values in [-upperLimitGuess, upperLimitGuess], the last position varying fastest */
+static void fftHybridGuessFromIndex(u64 guess, int upperLimitGuess, int bruteForcePositions, int *values)
+{
+    guessIndexToDigits(guess, 2*upperLimitGuess+1, bruteForcePositions, values);
+    for (int j = 0; j < bruteForcePositions; j++)
     {
-        current_value = creal(out[i]);
-
-        if (current_value > local_max)
-        {
-            local_max = current_value;
-        }
-
-        if (current_value > current_max)
-        {
-            current_max = current_value;
-            solution[startIndex] = i;
-        }
+        values[j] -= upperLimitGuess;
     }
-
-    return local_max;
 }
 
-/* find the solution by looking at the output of the fft - 1 position and single-precision case */
-float updateSolution1dHybridSingle(fftwf_complex *out, short *solution, int startIndex, int q, double current_max)
+/* reduce a guess index to the brute-force values modulo q */
+static void fftHybridGuessModQ(fftHybridContext *hy, u64 guess, int *guessModQ)
 {
-    float current_value;
-    float local_max = -42; /* Arbitrary low value */
-
-    for (int i = 0; i < q; i++)
+    int values[hy->bruteForcePositions];
+    fftHybridGuessFromIndex(guess, hy->upperLimitGuess, hy->bruteForcePositions, values);
+    for (int j = 0; j < hy->bruteForcePositions; j++)
     {
-        current_value = creal(out[i]);
+        guessModQ[j] = (hy->q + values[j]) % hy->q;
+    }
+}
 
-        if (current_value > local_max)
+/* Resets the values of the FFT input function */
+static void fftHybridResetInput(fftHybridContext *hy, fftHybridWorker *w)
+{
+    for (u64 j = 0; j < hy->numFftSlots; j++)
+    {
+        if (hy->doublePrecision)
         {
-            local_max = current_value;
+            w->in[j] = 0;
         }
-
-        if (current_value > current_max)
+        else
         {
-            current_max = current_value;
-            solution[startIndex] = i;
+            w->inS[j] = 0;
         }
     }
-
-    return local_max;
 }
 
-/* find the solution by looking at the output of the fft - 2 positions and double-precision case */
-double updateSolution2dHybrid(fftw_complex *out, short *solution, int startIndex, int q, double current_max)
+/* Add the samples currently held in the compact arrays to the fft input function of one guess */
+static void fftHybridAccumulate(fftHybridContext *hy, fftHybridWorker *w, const int *guessModQ)
 {
-    double current_value;
-    double local_max = -42; /* Arbitrary low value */
-
-    for (int i = 0; i < q; i++)
+    int q = hy->q;
+    int bruteForcePositions = hy->bruteForcePositions;
+    for (u64 i = 0; i < hy->numSamples; i++)
     {
-        for (int j = 0; j < q; j++)
+        /* Subtracts the contribution from the guessing part */
+        const short *coefficients = &hy->bfCoefficients[i*bruteForcePositions];
+        u64 guessSum = 0;
+        for (int j = 0; j < bruteForcePositions; j++)
         {
-            current_value = creal(out[j + q*i]);
-
-            if (current_value > local_max)
-            {
-                local_max = current_value;
-            }
+            guessSum += (u64)(coefficients[j] * guessModQ[j]);
+        }
+        int se = (hy->se[i] + q - (int)(guessSum % q)) % q;
 
-            if (current_value > current_max)
-            {
-                current_max = current_value;
-                solution[startIndex] = i;
-                solution[startIndex + 1] = j;
-            }
+        /* update fft input function */
+        if (hy->doublePrecision)
+        {
+            w->in[hy->fftIndex[i]] += hy->roots[se];
+        }
+        else
+        {
+            w->inS[hy->fftIndex[i]] += hy->rootsS[se];
         }
     }
-
-    return local_max;
 }
 
-/* find the solution by looking at the output of the fft - 2 positions and single-precision case */
-float updateSolution2dHybridSingle(fftwf_complex *out, short *solution, int startIndex, int q, double current_max)
+/* Compute the fft of an accumulated input function and return the maximum of the real part of the output */
+static double fftHybridTransform(fftHybridContext *hy, fftHybridWorker *w, const int *guessModQ, u64 *index)
 {
-    float current_value;
-    float local_max = -42; /* Arbitrary low value */
+    int bruteForcePositions = hy->bruteForcePositions;
 
-    for (int i = 0; i < q; i++)
+    /* Calculate fft and deduce position values, given current value of guess */
+    double local_max = -42; /* Arbitrary low value */
+    double current_value;
+    *index = 0;
+    /* the workers already run in parallel, so each transform is single-threaded */
+    if (hy->doublePrecision ? calculateFft(w->in, w->out, hy->q, hy->fftPositions, 1) : calculateFftSingle(w->inS, w->outS, hy->q, hy->fftPositions, 1))
     {
-        for (int j = 0; j < q; j++)
+        printf("*** solve_fft_search_hybrid: could not create fft plan\n");
+        exit(-1);
+    }
+    for (u64 j = 0; j < hy->numFftSlots; j++)
+    {
+        current_value = hy->doublePrecision ? creal(w->out[j]) : crealf(w->outS[j]);
+        if (current_value > local_max)
         {
-            current_value = creal(out[j + q*i]);
-
-            if (current_value > local_max)
-            {
-                local_max = current_value;
-            }
-
-            if (current_value > current_max)
-            {
-                current_max = current_value;
-                solution[startIndex] = i;
-                solution[startIndex + 1] = j;
-            }
+            local_max = current_value;
+            *index = j;
         }
     }
 
-    return local_max;
-}
-
-/* find the solution by looking at the output of the fft - 3 positions and double-precision case */
-double updateSolution3dHybrid(fftw_complex *out, short *solution, int startIndex, int q, double current_max)
-{
-    double current_value;
-    double local_max = -42; /* Arbitrary low value */
-
-    for (int i = 0; i < q; i++)
+    char line[1024];
+    int len = sprintf(line, "Current FFT value is: %lf, for guess = (", local_max);
+    for (int k = 0; k < bruteForcePositions; k++)
     {
-        for (int j = 0; j < q; j++)
-        {
-            for (int k = 0; k < q; k++)
-            {
-                current_value = creal(out[k + q*(j + q*i)]);
-
-                if (current_value > local_max)
-                {
-                    local_max = current_value;
-                }
-
-                if (current_value > current_max)
-                {
-                    current_max = current_value;
-                    solution[startIndex] = i;
-                    solution[startIndex + 1] = j;
-                    solution[startIndex + 2] = k;
-                }
-            }
-        }
+        len += sprintf(line + len, k < bruteForcePositions - 1 ? "%d, " : "%d", guessModQ[k]);
     }
+    sprintf(line + len, ")\n");
+    pthread_mutex_lock(&printLock);
+    printf("%s", line);
+    pthread_mutex_unlock(&printLock);
 
     return local_max;
 }
 
-/* find the solution by looking at the output of the fft - 3 positions and double-precision case */
-float updateSolution3dHybridSingle(fftwf_complex *out, short *solution, int startIndex, int q, double current_max)
+/* Accumulate the fft input function for one guess from the in-memory samples, compute the fft and return the maximum of the real part of the output */
+static double fftHybridEvaluate(void *ctx, void *workerState, u64 guess, u64 *index)
 {
-    float current_value;
-    float local_max = -42; /* Arbitrary low value */
+    fftHybridContext *hy = ctx;
+    fftHybridWorker *w = workerState;
+    int guessModQ[hy->bruteForcePositions];
+
+    fftHybridGuessModQ(hy, guess, guessModQ);
+    fftHybridResetInput(hy, w);
+    fftHybridAccumulate(hy, w, guessModQ);
+    return fftHybridTransform(hy, w, guessModQ, index);
+}
 
-    for (int i = 0; i < q; i++)
+/* Evaluate one guess by streaming the samples from file, capacity samples at a time through the compact arrays */
+static int fftHybridEvaluateStreamed(const char *srcFolder, lweInstance *lwe, short *solution, int numSolvedCoordinates, fftHybridContext *hy, u64 capacity, fftHybridWorker *w, u64 guess, u64 *index, double *score)
+{
+    int guessModQ[hy->bruteForcePositions];
+    fftHybridGuessModQ(hy, guess, guessModQ);
+    fftHybridResetInput(hy, w);
+
+    storageReader sr;
+    int ret = storageReaderInitialize(&sr, srcFolder);
+    if (ret)
     {
-        for (int j = 0; j < q; j++)
+        printf("*** solve_fft_search_hybrid: storage reader returned %d on initialize\n", ret);
+        return 2;
+    }
+    lweSample *bufs[2];
+    u64 numSamplesInBufs[2];
+    hy->numSamples = 0;
+    while (storageReaderGetNextAdjacentCategoryPair(&sr, &bufs[0], &numSamplesInBufs[0], &bufs[1], &numSamplesInBufs[1]))
+    {
+        for (int b = 0; b < 2; b++)
         {
-            for (int k = 0; k < q; k++)
+            for (u64 done = 0; bufs[b] && done < numSamplesInBufs[b]; )
             {
-                current_value = creal(out[k + q*(j + q*i)]);
-
-                if (current_value > local_max)
-                {
-                    local_max = current_value;
-                }
-
-                if (current_value > current_max)
+                u64 numToLoad = MIN(numSamplesInBufs[b] - done, capacity - hy->numSamples);
+                loadOneCategoryHybrid(lwe, bufs[b] + done, numToLoad, solution, numSolvedCoordinates, hy, capacity);
+                done += numToLoad;
+                if (hy->numSamples == capacity)
                 {
-                    current_max = current_value;
-                    solution[startIndex] = i;
-                    solution[startIndex + 1] = j;
-                    solution[startIndex + 2] = k;
+                    fftHybridAccumulate(hy, w, guessModQ);
+                    hy->numSamples = 0;
                 }
             }
         }
     }
+    storageReaderFree(&sr);
+    fftHybridAccumulate(hy, w, guessModQ);
+    hy->numSamples = 0;
 
-    return local_max;
+    *score = fftHybridTransform(hy, w, guessModQ, index);
+    return 0;
 }
 
-/* Hybrid solver that uses sparse brute-force for bruteForcePositions number of positions and FFT for fftPositions number of positions */
+/* Hybrid solver that uses sparse brute-force for bruteForcePositions number of positions and FFT for fftPositions number of positions.
+ * If the compact form of the samples fits in FFT_HYBRID_SAMPLES_MEMORY_BUDGET_IN_BYTES, the samples are read once and the guesses
+ * are evaluated in parallel by SOLVER_NUM_THREADS workers, each owning its fft input/output and plan.
+ * Otherwise the samples are read once per guess, a budget worth of them at a time. */
 int solve_fft_search_hybrid(const char *srcFolder, short *solution, int numSolvedCoordinates, int fftPositions, int bruteForcePositions, int doublePrecision)
 {
     ASSERT(1 <= fftPositions && fftPositions <= 3, "The number of positions for fft is not supported!\n");
@@ -923,8 +1013,8 @@ int solve_fft_search_hybrid(const char *srcFolder, short *solution, int numSolve
     int q = lwe.q;
     double sigma = lwe.alpha * q; /* The noise level */
 
-    u64 numCategories;
-    sampleInfoFromFile(srcFolder, NULL, &numCategories, NULL, NULL, NULL);
+    u64 numCategories, numTotalSamples;
+    sampleInfoFromFile(srcFolder, NULL, &numCategories, NULL, &numTotalSamples, NULL);
 
     if (numSolvedCoordinates == n)
     {
@@ -932,55 +1022,6 @@ int solve_fft_search_hybrid(const char *srcFolder, short *solution, int numSolve
         return 1; /* all positions solved */
     }
 
-    /* create function to be fft input and output */
-    fftw_complex *in, *out;
-    fftwf_complex *inS, *outS;
-    u64 numFftSlots;
-    switch (fftPositions)
-    {
-    case 1:
-        numFftSlots = q;
-        break;
-    case 2:
-        numFftSlots = q * q;
-        break;
-    case 3:
-        numFftSlots = q * q * q;
-        break;
-    default:
-        ASSERT_ALWAYS("unsupported number of positions");
-        exit(1);
-    }
-
-    if (doublePrecision)   /* double-precision */
-    {
-        in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * numFftSlots);
-        out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * numFftSlots);
-        ASSERT(in, "allocation failed");
-        ASSERT(out, "allocation failed");
-        if (!in || !out)
-        {
-            char s[128];
-            printf("*** solve_plain_bkw_sorted: allocation failure (tried to allocate %s bytes)\n", sprintf_u64_delim(s, sizeof(fftw_complex) * numFftSlots));
-            lweDestroy(&lwe);
-            return 3;
-        }
-    }
-    else     /* single-precision */
-    {
-        inS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * numFftSlots);
-        outS = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * numFftSlots);
-        ASSERT(inS, "allocation failed");
-        ASSERT(outS, "allocation failed");
-        if (!inS || !outS)
-        {
-            char s[128];
-            printf("*** solve_plain_bkw_sorted: allocation failure (tried to allocate %s bytes)\n", sprintf_u64_delim(s, sizeof(fftwf_complex) * numFftSlots));
-            lweDestroy(&lwe);
-            return 4;
-        }
-    }
-
     /* Checks that we don't try to solve more positions than there is */
     while (numSolvedCoordinates + fftPositions + bruteForcePositions > n)
     {
@@ -995,206 +1036,168 @@ int solve_fft_search_hybrid(const char *srcFolder, short *solution, int numSolve
         }
     }
 
-    /* Variable declaration related to the storage reader */
-    int ret;
-
-    /* Variable declaration related sample statistics */
-    u64 categoryIndexCounter;
-    lweSample *buf1;
-    lweSample *buf2;
-    u64 numSamplesInBuf1, numSamplesInBuf2;
-    int startIndex = n - fftPositions - numSolvedCoordinates - bruteForcePositions; /* The position where the FFT should start */
-
-    int upperLimitGuess = (int) 3*sigma;
-    printf("Upper limit of the guess is: %d\n", upperLimitGuess);
-    double current_max = -42; // arbitrary low value for the guesses
-    double current_value; // Current value for the guesses
-
-    /* Initial guess is that all positions are equal to the lower limit */
-    int guess[bruteForcePositions];
-    int j;/* j is a loop variable to be used below */
-    for(int i = 0 ; i < bruteForcePositions ; i++)
+    fftHybridContext ctx;
+    ctx.numSamples = 0;
+    ctx.bruteForcePositions = bruteForcePositions;
+    ctx.fftPositions = fftPositions;
+    ctx.upperLimitGuess = (int) 3*sigma;
+    ctx.q = q;
+    ctx.doublePrecision = doublePrecision;
+    ctx.numFftSlots = 1;
+    for (int i = 0; i < fftPositions; i++)
+    {
+        ctx.numFftSlots *= q;
+    }
+    ctx.roots = doublePrecision ? unitRootTable(q) : NULL;
+    ctx.rootsS = doublePrecision ? NULL : unitRootTableSingle(q);
+
+    /* the compact arrays hold all samples if they fit in the memory budget, otherwise a chunk of them */
+    u64 bytesPerSample = sizeof(u64) + (bruteForcePositions + 1) * sizeof(short);
+    int allSamplesInMemory = numTotalSamples * bytesPerSample <= FFT_HYBRID_SAMPLES_MEMORY_BUDGET_IN_BYTES;
+    u64 capacity = allSamplesInMemory ? numTotalSamples : FFT_HYBRID_SAMPLES_MEMORY_BUDGET_IN_BYTES / bytesPerSample;
+    capacity = capacity < 1 ? 1 : capacity;
+    ctx.fftIndex = MALLOC(capacity * sizeof(u64));
+    ctx.se = MALLOC(capacity * sizeof(short));
+    ctx.bfCoefficients = MALLOC((capacity * bruteForcePositions + 1) * sizeof(short));
+    if (!ctx.fftIndex || !ctx.se || !ctx.bfCoefficients || (doublePrecision ? !ctx.roots : !ctx.rootsS))
     {
-        guess[i] = -upperLimitGuess;
+        fftw_free(ctx.roots);
+        fftwf_free(ctx.rootsS);
+        char s[128];
+        printf("*** solve_fft_search_hybrid: allocation failure (tried to allocate %s bytes)\n", sprintf_u64_delim(s, capacity * bytesPerSample));
+        FREE(ctx.fftIndex);
+        FREE(ctx.se);
+        FREE(ctx.bfCoefficients);
+        lweDestroy(&lwe);
+        return 3;
     }
 
-    while (1)
+    printf("Upper limit of the guess is: %d\n", ctx.upperLimitGuess);
+    u64 numGuesses = 1;
+    for (int i = 0; i < bruteForcePositions; i++)
     {
+        numGuesses *= 2*ctx.upperLimitGuess+1;
+    }
+
+    /* the real part of the fft output of a wrong guess has variance numSamples/2 */
+    guessCandidate candidates[SOLVER_TOP_K_CANDIDATES];
+    int numCandidates = 0, earlyAborted = 0;
+    double threshold = guessSchedulerSignificanceThreshold(numTotalSamples / 2.0, (double)numGuesses * ctx.numFftSlots, SOLVER_EARLY_ABORT_SIGMAS);
+    int ret = 0;
 
-        /* Initialize the storage reader */
+    if (allSamplesInMemory)
+    {
+        /* read all samples once */
         storageReader sr;
         ret = storageReaderInitialize(&sr, srcFolder);
         if (ret)
         {
-            printf("*** solve_plain_bkw_sorted: storage reader returned %d on initialize\n", ret);
+            printf("*** solve_fft_search_hybrid: storage reader returned %d on initialize\n", ret);
+            fftw_free(ctx.roots);
+            fftwf_free(ctx.rootsS);
+            FREE(ctx.fftIndex);
+            FREE(ctx.se);
+            FREE(ctx.bfCoefficients);
+            lweDestroy(&lwe);
             return 2;
         }
-
-        /* collect statistics from samples */
-        categoryIndexCounter = 0;
-        ret = storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2);
-
-        /* Resets the values of the FFT input function */
-        if (doublePrecision)
-        {
-            for (j = 0; j < (int)numFftSlots; j++)
-            {
-                in[j] = 0;
-            }
-        }
-        else
+        lweSample *buf1;
+        lweSample *buf2;
+        u64 numSamplesInBuf1, numSamplesInBuf2;
+        u64 categoryIndexCounter = 0;
+        while (storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2))
         {
-            for (j = 0; j < (int)numFftSlots; j++)
-            {
-                inS[j] = 0;
-            }
-        }
-
-        while (ret)
-        {
-
-            /* process buf1 */
             if (buf1)
             {
-                if (doublePrecision)
-                {
-                    categoryIndexCounter++;
-                    processOneCategoryHybrid(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, in, fftPositions, guess, bruteForcePositions); /* Here one position is guessed */
-                }
-                else
-                {
-                    categoryIndexCounter++;
-                    processOneCategoryHybridSingle(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, inS, fftPositions, guess, bruteForcePositions);
-                }
+                categoryIndexCounter++;
+                loadOneCategoryHybrid(&lwe, buf1, numSamplesInBuf1, solution, numSolvedCoordinates, &ctx, capacity);
             }
-
-            /* process buf1 */
             if (buf2)
             {
-                if (doublePrecision)
-                {
-                    categoryIndexCounter++;
-                    processOneCategoryHybrid(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, in, fftPositions, guess, bruteForcePositions); /* Here one position is guessed */
-                }
-                else
-                {
-                    categoryIndexCounter++;
-                    processOneCategoryHybridSingle(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, inS, fftPositions, guess, bruteForcePositions);
-                }
+                categoryIndexCounter++;
+                loadOneCategoryHybrid(&lwe, buf2, numSamplesInBuf2, solution, numSolvedCoordinates, &ctx, capacity);
             }
-
-            ret = storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2);
         }
+        storageReaderFree(&sr);
         if (categoryIndexCounter != numCategories)
         {
-            printf("*** solve_plain_bkw_sorted: %" PRIu64 " categories processed (%" PRIu64 " expected)\n", categoryIndexCounter, numCategories);
+            printf("*** solve_fft_search_hybrid: %" PRIu64 " categories processed (%" PRIu64 " expected)\n", categoryIndexCounter, numCategories);
         }
 
-        switch (fftPositions)
+        /* the compact arrays are shared (read-only) by the workers, each worker has its own fft input/output */
+        int numWorkers = fftHybridNumWorkers(&ctx);
+        char s[128];
+        printf("%d fft workers with %s bytes of fft input/output each\n", numWorkers, sprintf_u64_delim(s, fftHybridWorkerBytes(&ctx)));
+        guessScheduler gs = { numWorkers, SOLVER_TOP_K_CANDIDATES, threshold, &ctx, fftHybridWorkerInit, fftHybridEvaluate, fftHybridWorkerFree };
+        ret = guessSchedulerRun(&gs, numGuesses, candidates, &numCandidates, &earlyAborted);
+    }
+    else
+    {
+        /* the samples do not fit in memory, so they are read once per guess */
+        char s[128];
+        printf("Samples do not fit in memory, reading them in chunks of %s samples per guess\n", sprintf_u64_delim(s, capacity));
+        fftHybridWorker *w = fftHybridWorkerInit(&ctx);
+        ret = !w;
+        for (u64 guess = 0; guess < numGuesses && !earlyAborted && !ret; guess++)
         {
-        case 1:
-            if (doublePrecision)   /* double-precision */
-            {
-                calculateFft1d(in, out, q); /* Calculate fft */
-                current_value = updateSolution1dHybrid(out, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
-            }
-            else     /* single-precision */
-            {
-                calculateFft1dSingle(inS, outS, q); /* Calculate fft */
-                current_value = updateSolution1dHybridSingle(outS, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
-            }
-            break;
-        case 2:
-            if (doublePrecision)   /* double-precision */
-            {
-                calculateFft2d(in, out, q); /* Calculate fft */
-                current_value = updateSolution2dHybrid(out, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
-            }
-            else     /* single-precision */
+            guessCandidate c;
+            c.guess = guess;
+            ret = fftHybridEvaluateStreamed(srcFolder, &lwe, solution, numSolvedCoordinates, &ctx, capacity, w, guess, &c.index, &c.score);
+            guessCandidateInsert(candidates, &numCandidates, SOLVER_TOP_K_CANDIDATES, &c);
+            if (threshold > 0 && c.score >= threshold)
             {
-                calculateFft2dSingle(inS, outS, q); /* Calculate fft */
-                current_value = updateSolution2dHybridSingle(outS, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
+                earlyAborted = 1;
             }
-            break;
-        case 3:
-            if (doublePrecision)   /* double-precision */
-            {
-                calculateFft3d(in, out, q); /* Calculate fft */
-                current_value = updateSolution3dHybrid(out, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
-
-            }
-            else     /* single-precision */
-            {
-                calculateFft3dSingle(inS, outS, q); /* Calculate fft */
-                current_value = updateSolution3dHybridSingle(outS, solution, startIndex, q, current_max); /* deduce position values from fft, given current value of guess */
-            }
-            break;
-        default:
-            ASSERT_ALWAYS("unsupported number of positions");
-            exit(1);
         }
-
-        /* Update the guessing values if we have found a better solution */
-        if (current_value > current_max)
+        if (w)
         {
-            current_max = current_value;
-            for (int k = 0; k < bruteForcePositions; k++)
-            {
-                solution[n - numSolvedCoordinates - bruteForcePositions + k] = (q + guess[k])%q; /* Save guess and make each value positive */
-            }
+            fftHybridWorkerFree(&ctx, w);
         }
+    }
 
-        printf("Current FFT value is: %lf, for guess = (", current_value);
+    /* report the best candidates and keep the best one */
+    int values[bruteForcePositions];
+    int positions[fftPositions];
+    printf("Best %d candidates%s\n", numCandidates, earlyAborted ? " (early termination)" : "");
+    for (int i = 0; i < numCandidates; i++)
+    {
+        fftHybridGuessFromIndex(candidates[i].guess, ctx.upperLimitGuess, bruteForcePositions, values);
+        guessIndexToDigits(candidates[i].index, q, fftPositions, positions);
+        printf("FFT value %lf - positions (", candidates[i].score);
+        for (int k = 0; k < fftPositions; k++)
+        {
+            printf(k < fftPositions - 1 ? "%d, " : "%d", positions[k]);
+        }
+        printf(") - guess (");
         for (int k = 0; k < bruteForcePositions; k++)
         {
-            if (k < bruteForcePositions - 1)
-            {
-                printf("%d, ", (q + guess[k])%q);
-            }
-            else
-            {
-                printf("%d", (q + guess[k])%q);
-            }
+            printf(k < bruteForcePositions - 1 ? "%d, " : "%d", (q + values[k])%q);
         }
         printf(")\n");
-
-        storageReaderFree(&sr); /* Free the current storage reader - preferable not to have to do this each lap */
-
-        /* Update the guess */
-        for(j = bruteForcePositions - 1 ; j >= 0 ; j--)
+    }
+    if (numCandidates > 0)
+    {
+        int startIndex = n - fftPositions - numSolvedCoordinates - bruteForcePositions; /* The position where the FFT should start */
+        fftHybridGuessFromIndex(candidates[0].guess, ctx.upperLimitGuess, bruteForcePositions, values);
+        guessIndexToDigits(candidates[0].index, q, fftPositions, positions);
+        for (int k = 0; k < fftPositions; k++)
         {
-            guess[j]++;
-            if(guess[j] <= upperLimitGuess)
-            {
-                break;
-            }
-            else
-            {
-                guess[j] = -upperLimitGuess;
-            }
+            solution[startIndex + k] = positions[k];
         }
-        if(j < 0)
+        for (int k = 0; k < bruteForcePositions; k++)
         {
-            break;
+            solution[n - numSolvedCoordinates - bruteForcePositions + k] = (q + values[k])%q; /* Save guess and make each value positive */
         }
-
     }
 
     /* cleanup */
-    // storageReaderFree(&sr);
-    if (doublePrecision)   /* double-precision */
-    {
-        fftw_free(in);
-        fftw_free(out);
-    }
-    else     /* single-precision */
-    {
-        fftw_free(inS);
-        fftw_free(outS);
-    }
-
+    fftw_free(ctx.roots);
+    fftwf_free(ctx.rootsS);
+    FREE(ctx.fftIndex);
+    FREE(ctx.se);
+    FREE(ctx.bfCoefficients);
     lweDestroy(&lwe);
-    return 0;
+    return ret ? 4 : 0;
 }
 
 /* HYBRID CONTENT ENDS HERE */
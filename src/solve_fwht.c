@@ -15,13 +15,17 @@
  */
 
 #include "solve_fwht.h"
+#include "guess_scheduler.h"
 #include "lwe_instance.h"
 #include "storage_reader.h"
 #include "storage_file_utilities.h"
+#include "solver_input.h"
 #include "memory_utils.h"
 #include "string_utils.h"
+#include "bkw_metrics.h"
 #include <math.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 /*
  * integer to binary sequence
@@ -143,7 +147,99 @@ void free_bias_table()
 }
 #endif
 
+/* add the contribution of a sample with the given fwht index and b value to list */
+static inline void accumulateFwhtSample(fwhtEntry *list, u64 intsample, short b, int q)
+{
+    short z = b > (q-1)/2 ? (b - q) : b;
+    short lsb_z = z%2 == 0 ? 0 : 1;
+#ifdef USE_SOFT_INFORMATION
+    if (lsb_z == 0)
+        list[intsample] += bias_table[z+(q-1)/2];
+    else
+        list[intsample] -= bias_table[z+(q-1)/2];
+#else
+    if (lsb_z == 0)
+        list[intsample] += 1;
+    else
+        list[intsample] -= 1;
+#endif
+}
+
+/* process all samples in source sample file */
+static int accumulateSamples(const char *srcFolder, fwhtEntry *list, int zeroPositions, int fwht_positions, int q)
+{
+    /* open source sample file */
+    FILE *f_src = fopenSamples(srcFolder, "rb");
+    if (!f_src)
+    {
+        return 4; /* could not open samples file */
+    }
+
+    /* allocate sample read buffer */
+    lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
+    if (!sampleReadBuf)
+    {
+        fclose(f_src);
+        return 6; /* could not allocate sample read buffer */
+    }
+
+    while (!feof(f_src))
+    {
+        /* read chunk of samples from source sample file into read buffer */
+        u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
+
+        for (u64 i=0; i<numRead; i++)
+        {
+            lweSample *sample = &sampleReadBuf[i];
+            accumulateFwhtSample(list, sample_to_int(sample->col.a+zeroPositions, fwht_positions, q), sample->sumWithError, q);
+        }
+    }
+    fclose(f_src);
+    FREE(sampleReadBuf);
+    return 0;
+}
+
+/* process all records in the solver-input file, which holds the precomputed fwht index of each sample */
+static int accumulateSolverInput(const char *srcFolder, fwhtEntry *list, int q)
+{
+    FILE *f_src = fopenSolverInput(srcFolder, "rb");
+    if (!f_src)
+    {
+        return 4; /* could not open solver input file */
+    }
+
+    /* the records are 8 bytes, so the buffer holds many more of them than the sample read buffer holds samples */
+    u64 capacity = READ_BUFFER_CAPACITY_IN_SAMPLES * (LWE_SAMPLE_SIZE_IN_BYTES / sizeof(solverInputRecord));
+    solverInputRecord *recordReadBuf = MALLOC(capacity * sizeof(solverInputRecord));
+    if (!recordReadBuf)
+    {
+        fclose(f_src);
+        return 6; /* could not allocate record read buffer */
+    }
+
+    while (!feof(f_src))
+    {
+        u64 numRead = freadSolverInput(f_src, recordReadBuf, capacity);
+        for (u64 i=0; i<numRead; i++)
+        {
+            accumulateFwhtSample(list, solverInputRecordIndex(recordReadBuf[i]), solverInputRecordB(recordReadBuf[i]), q);
+        }
+    }
+    fclose(f_src);
+    FREE(recordReadBuf);
+    return 0;
+}
+
 /* Retrieve binary secret using Fast Walsh Hadamard Transform */
+/* stop counting and write the metrics of a solver run to the solved folder */
+static void solverMetricsFinish(bkwMetrics *metrics, const char *srcFolder)
+{
+    bkwMetricsEnd(metrics);
+    char fileName[512];
+    solverMetricsFileName(fileName, srcFolder);
+    bkwMetricsToFile(metrics, fileName);
+}
+
 #ifdef USE_SOFT_INFORMATION
 int solve_fwht_search(const char *srcFolder, u8 *binary_solution, int zeroPositions, int fwht_positions, double sigma, time_t start)
 {
@@ -171,75 +267,44 @@ int solve_fwht_search(const char *srcFolder, u8 *binary_solution, int zeroPositi
 
     /* create initial list */
     u64 N = (u64)1<<fwht_positions; // N = 2^fwht_positions
-#ifdef USE_SOFT_INFORMATION
-    double* list = CALLOC(N,sizeof(double));
-#else
-    long* list = CALLOC(N,sizeof(long));
-#endif
+    fwhtEntry *list = CALLOC(N,sizeof(fwhtEntry));
     if (!list)
     {
         printf("*** solve_fwht_search: failed to allocate memory for initial list\n");
         exit(-1);
     }
 
-    /* open source sample file */
-    FILE *f_src = fopenSamples(srcFolder, "rb");
-    if (!f_src)
-    {
-        lweDestroy(&lwe);
-        return 4; /* could not open samples file */
-    }
-
-    /* allocate sample read buffer */
-    lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
-    if (!sampleReadBuf)
-    {
-        fclose(f_src);
-        lweDestroy(&lwe);
-        return 6; /* could not allocate sample read buffer */
-    }
-
 #ifdef USE_SOFT_INFORMATION
     /* initialize bias_table */
     initialize_bias_table(q, sigma);
 #endif
 
-    /* process all samples in source file */
-    lweSample *sample;
-    short z, lsb_z;
-    u64 intsample;
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, srcFolder);
+    double accumulateBegin = bkwMetricsNow();
 
-    while (!feof(f_src))
-    {
-        /* read chunk of samples from source sample file into read buffer */
-        u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
-
-        for (u64 i=0; i<numRead; i++)
-        {
-            sample = &sampleReadBuf[i];
-            intsample = sample_to_int(sample->col.a+zeroPositions, fwht_positions, q);
-            z = sample->sumWithError > (q-1)/2 ? (sample->sumWithError -q) : (sample->sumWithError);
-            lsb_z = z%2 == 0 ? 0 : 1;
-#ifdef USE_SOFT_INFORMATION
-            if (lsb_z == 0)
-                list[intsample] += bias_table[z+(q-1)/2];
-            else
-                list[intsample] -= bias_table[z+(q-1)/2];
-#else
-            if (lsb_z == 0)
-                list[intsample] += 1;
-            else
-                list[intsample] -= 1;
-#endif
-        }
-    }
-    fclose(f_src);
-    FREE(sampleReadBuf);
+    /* use the compact solver-input file written by the final reduction step when it matches the requested positions */
+    solverInputParameters solverInputPar;
+    int useSolverInput = !solverInputParametersFromFile(srcFolder, &solverInputPar, NULL) &&
+                         solverInputPar.type == solverInputFwht &&
+                         solverInputPar.startIndex == zeroPositions &&
+                         solverInputPar.numPositions == fwht_positions;
+    int ret = useSolverInput ? accumulateSolverInput(srcFolder, list, q) : accumulateSamples(srcFolder, list, zeroPositions, fwht_positions, q);
 
 #ifdef USE_SOFT_INFORMATION
     /* free bias_table */
     free_bias_table();
 #endif
+    if (ret)
+    {
+        bkwMetricsEnd(&metrics);
+        FREE(list);
+        lweDestroy(&lwe);
+        return ret;
+    }
+    timeStamp(start);
+    printf("Read samples from %s\n", useSolverInput ? "solver input file" : "sample file");
+    double transformBegin = bkwMetricsNow();
 
 
     /* Apply Fast Walsh Hadamard Tranform */
@@ -267,6 +332,8 @@ int solve_fwht_search(const char *srcFolder, u8 *binary_solution, int zeroPositi
             max_pos = i;
         }
     }
+    bkwMetricsAddSolverSeconds(&metrics, transformBegin - accumulateBegin, bkwMetricsNow() - transformBegin);
+    solverMetricsFinish(&metrics, srcFolder);
     timeStamp(start);
     printf("Index found %lld - max %f - probability %f \n", max_pos, max, (max)/tot);
 
@@ -295,7 +362,171 @@ int nextBruteForceGuess(int ratio, int *BFguess, int lenght)
     return 0;
 }
 
+/* Read the next chunk of samples and store, for each sample, its FWHT index, its value b and its
+ * coefficients on the brute-force positions in compact side arrays. Return the number of samples read.
+ */
+static u64 readBruteForceSideArrays(FILE *f_src, lweSample *sampleReadBuf, u64 *fwhtIndex, short *bValue, short *bfCoefficients, int zeroPositions, int bruteForcePositions, int fwhtPositions, int q)
+{
+    u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
+    for (u64 i=0; i<numRead; i++)
+    {
+        lweSample *sample = &sampleReadBuf[i];
+        fwhtIndex[i] = sample_to_int(sample->col.a+zeroPositions, fwhtPositions, q);
+        bValue[i] = sample->sumWithError;
+        for (int j=0; j<bruteForcePositions; j++)
+        {
+            bfCoefficients[i*bruteForcePositions+j] = columnValue(sample, zeroPositions+fwhtPositions+j);
+        }
+    }
+    return numRead;
+}
+
+/* Add the contribution of the samples in the side arrays to the table of one brute-force guess */
+static void accumulateBruteForceGuess(fwhtEntry *list, u64 numSamples, const u64 *fwhtIndex, const short *bValue, const short *bfCoefficients, const int *guessModQ, int bruteForcePositions, int q)
+{
+    short z;
+    for (u64 i=0; i<numSamples; i++)
+    {
+        const short *coefficients = &bfCoefficients[i*bruteForcePositions];
+        z = bValue[i];
+        // update z with the bruteforce-guessed positions
+        for(int j = 0; j<bruteForcePositions; j++)
+        {
+            z = (z - (coefficients[j]*guessModQ[j])%q );
+            if (z < 0)
+                z += q;
+        }
+        z = z > (q-1)/2 ? z -q : z;
+#ifdef USE_SOFT_INFORMATION
+        if (z%2 == 0)
+            list[fwhtIndex[i]] += bias_table[z+(q-1)/2];
+        else
+            list[fwhtIndex[i]] -= bias_table[z+(q-1)/2];
+#else
+        if (z%2 == 0)
+            list[fwhtIndex[i]] += 1;
+        else
+            list[fwhtIndex[i]] -= 1;
+#endif
+    }
+}
+
+/* Apply the Fast Walsh Hadamard Tranform to the table of one guess and return the largest absolute value (position in max_pos) */
+static double transformAndFindMax(fwhtEntry *list, u64 N, u64 *max_pos)
+{
+    FWHT(list, N);
+
+    double max = 0;
+    *max_pos = 0;
+    for (u64 i = 0; i<N; i++)
+    {
+#ifdef USE_SOFT_INFORMATION
+        if (max < fabs(list[i]))
+        {
+            max = fabs(list[i]);
+#else
+        if (max < labs(list[i]))
+        {
+            max = labs(list[i]);
+#endif
+            *max_pos = i;
+        }
+    }
+    return max;
+}
+
+/* map a guess index to the brute-force values in [-ratio, ratio], in the order of nextBruteForceGuess */
+static void bruteForceGuessFromIndex(u64 guess, int ratio, int q, int bruteForcePositions, int *BFguess, int *guessModQ)
+{
+    guessIndexToDigits(guess, 2*ratio+1, bruteForcePositions, BFguess);
+    for (int j=0; j<bruteForcePositions; j++)
+    {
+        BFguess[j] -= ratio;
+        guessModQ[j] = BFguess[j] < 0 ? BFguess[j]+q : BFguess[j];
+    }
+}
+
+/* serializes the per-guess output of the worker threads */
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef PRINT_INTERMEDIATE_SOLUTIONS_BRUTEFORCE
+/* print one line per guess, in one piece since guesses may be evaluated by several threads */
+static void printBruteForceGuess(time_t start, u64 max_pos, double max, const int *BFguess, int bruteForcePositions, int fwhtPositions)
+{
+    char line[2048];
+    u8 bin_guess[fwhtPositions];
+    int_to_bin(max_pos, bin_guess, fwhtPositions);
+    int len = sprintf(line, "Index found %" PRIu64 " - max %f \n(", max_pos, max);
+    for(int j = 0; j<bruteForcePositions; j++)
+        len += sprintf(line+len, "%d ", BFguess[j]);
+    len += sprintf(line+len, ") - (");
+    for(int j = 0; j<fwhtPositions; j++)
+        len += sprintf(line+len, "%hu ", bin_guess[j]);
+    sprintf(line+len, ")\n");
+    pthread_mutex_lock(&printLock);
+    timeStamp(start);
+    printf("%s", line);
+    pthread_mutex_unlock(&printLock);
+}
+#endif
+
+typedef struct
+{
+    u64 numSamples;
+    const u64 *fwhtIndex;
+    const short *bValue;
+    const short *bfCoefficients;
+    int bruteForcePositions;
+    int fwhtPositions;
+    int ratio;
+    int q;
+    u64 N;
+    time_t start;
+    bkwMetrics *metrics;
+} bruteForceContext;
+
+static void *bruteForceWorkerInit(void *ctx)
+{
+    bruteForceContext *bf = ctx;
+    fwhtEntry *list = MALLOC(bf->N * sizeof(fwhtEntry));
+    if (!list)
+    {
+        printf("*** solve_fwht_search_bruteforce: failed to allocate memory for worker list\n");
+        exit(-1);
+    }
+    return list;
+}
+
+static double bruteForceEvaluate(void *ctx, void *workerState, u64 guess, u64 *index)
+{
+    bruteForceContext *bf = ctx;
+    fwhtEntry *list = workerState;
+    int BFguess[bf->bruteForcePositions];
+    int guessModQ[bf->bruteForcePositions];
+
+    bruteForceGuessFromIndex(guess, bf->ratio, bf->q, bf->bruteForcePositions, BFguess, guessModQ);
+    double accumulateBegin = bkwMetricsNow();
+    MEMSET(list, 0, bf->N * sizeof(fwhtEntry));
+    accumulateBruteForceGuess(list, bf->numSamples, bf->fwhtIndex, bf->bValue, bf->bfCoefficients, guessModQ, bf->bruteForcePositions, bf->q);
+    double transformBegin = bkwMetricsNow();
+    double max = transformAndFindMax(list, bf->N, index);
+    bkwMetricsAddSolverSeconds(bf->metrics, transformBegin - accumulateBegin, bkwMetricsNow() - transformBegin);
+#ifdef PRINT_INTERMEDIATE_SOLUTIONS_BRUTEFORCE
+    printBruteForceGuess(bf->start, *index, max, BFguess, bf->bruteForcePositions, bf->fwhtPositions);
+#endif
+    return max;
+}
+
+static void bruteForceWorkerFree(void *ctx, void *workerState)
+{
+    (void)ctx;
+    FREE(workerState);
+}
+
 /* Hybrid solver that uses brute-force for bruteForcePositions number of positions and Fast Walsh Hadamard Transform for fftPositions number of positions
+ * If all samples fit in the read buffer, the guesses are evaluated in parallel by SOLVER_NUM_THREADS workers, each owning its table.
+ * Otherwise, up to BRUTEFORCE_GUESS_TABLES_MEMORY_BUDGET_IN_BYTES worth of guess tables are accumulated in the same pass over the samples,
+ * so the sample file is read once per batch of guesses.
  */
 #ifdef USE_SOFT_INFORMATION
 int solve_fwht_search_bruteforce(const char *srcFolder, u8 *binary_solution, short *bf_solution, int zeroPositions, int bruteForcePositions, int fwhtPositions, double sigma, time_t start)
@@ -310,293 +541,378 @@ int solve_fwht_search_bruteforce(const char *srcFolder, u8 *binary_solution, sho
 
     u64 numCategories;
     sampleInfoFromFile(srcFolder, NULL, &numCategories, NULL, NULL, NULL);
+    u64 numTotalSamples = numSamplesInSampleFile(srcFolder); /* the final (unsorted) folder has no sample info file */
 
     ASSERT(1 <= fwhtPositions && fwhtPositions <= MAX_FWHT, "The number of positions for fwht is not supported in this implementation!\n");
     ASSERT(1 <= bruteForcePositions && bruteForcePositions <= MAX_BRUTE_FORCE, "The number of positions for bruteforce guessing is not supported in this implementation!\n");
-    ASSERT(fwhtPositions + bruteForcePositions + zeroPositions == n, "The number of positions for bruteforce and fwht is => n!\n");
+    ASSERT(fwhtPositions + bruteForcePositions + zeroPositions == lwe.n, "The number of positions for bruteforce and fwht is => n!\n");
 
-    /* create initial list */
+    int ratio = round(lwe.alpha*lwe.q*3); // 2*3*standard_deviation is the interval length where to search
     u64 N = (u64)1<<fwhtPositions; // N = 2^fwht_positions
-#ifdef USE_SOFT_INFORMATION
-    double* list = CALLOC(N,sizeof(double));
-#else
-    long* list = CALLOC(N,sizeof(long));
-#endif
-    if (!list)
+    u64 numGuesses = 1;
+    for (int i=0; i<bruteForcePositions; i++)
+        numGuesses *= 2*ratio+1;
+
+    /* allocate sample read buffer and compact side arrays */
+    lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
+    u64 *fwhtIndex = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * sizeof(u64));
+    short *bValue = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * sizeof(short));
+    short *bfCoefficients = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * bruteForcePositions * sizeof(short));
+    if (!sampleReadBuf || !fwhtIndex || !bValue || !bfCoefficients)
     {
-        printf("*** solve_fwht_search: failed to allocate memory for initial list\n");
-        exit(-1);
+        FREE(sampleReadBuf);
+        FREE(fwhtIndex);
+        FREE(bValue);
+        FREE(bfCoefficients);
+        lweDestroy(&lwe);
+        return 6; /* could not allocate sample read buffer */
+    }
+
+    FILE *f_src = fopenSamples(srcFolder, "rb");
+    if (!f_src)
+    {
+        FREE(sampleReadBuf);
+        FREE(fwhtIndex);
+        FREE(bValue);
+        FREE(bfCoefficients);
+        lweDestroy(&lwe);
+        return 4; /* could not open samples file */
     }
+    /* reading the samples into the side arrays counts as accumulation */
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, srcFolder);
+    double readBegin = bkwMetricsNow();
+    u64 numRead = readBruteForceSideArrays(f_src, sampleReadBuf, fwhtIndex, bValue, bfCoefficients, zeroPositions, bruteForcePositions, fwhtPositions, q);
+    int allSamplesInSideArrays = feof(f_src);
+    bkwMetricsAddSolverSeconds(&metrics, bkwMetricsNow() - readBegin, 0);
 
 #ifdef USE_SOFT_INFORMATION
     /* initialize bias_table */
     initialize_bias_table(q, sigma);
 #endif
 
-    FILE *f_src;
-
-    /* allocate sample read buffer */
-    lweSample *sampleReadBuf;
-
-    lweSample *sample;
-    long max_pos = -1;
-    double max = 0, global_max = 0;
-    u64 intsample;
-    short z, lsb_z;
-
-    u8 bin_guess[fwhtPositions];
+    guessCandidate candidates[SOLVER_TOP_K_CANDIDATES];
+    int numCandidates = 0, earlyAborted = 0;
+    double threshold = guessSchedulerSignificanceThreshold(numTotalSamples, (double)numGuesses * N, SOLVER_EARLY_ABORT_SIGMAS);
 
     timeStamp(start);
     printf("Start FWHT: brute force %d positions, guess %d positions\n", bruteForcePositions, fwhtPositions);
 
-    int ratio = round(lwe.alpha*lwe.q*3); // 2*3*standard_deviation is the interval length where to search
-    int BFguess[bruteForcePositions];
-    int tmp_si;
-
-    // initialize brute force guess
-    for(int i = 0; i<bruteForcePositions; i++)
-        BFguess[i] = -ratio;
-
-    do
+    if (allSamplesInSideArrays)
     {
-#ifdef USE_SOFT_INFORMATION
-        memset(list, 0, N*sizeof(double));
-#else
-        memset(list, 0, N*sizeof(long));
-#endif
-        sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
-        if (!sampleReadBuf)
-        {
-            lweDestroy(&lwe);
-            return 6; /* could not allocate sample read buffer */
-        }
-
-        /* process all samples in source file */
-        /* open source sample file */
-        f_src = fopenSamples(srcFolder, "rb");
-        if (!f_src)
+        /* the side arrays are shared (read-only) by the workers */
+        fclose(f_src);
+        bruteForceContext ctx = { numRead, fwhtIndex, bValue, bfCoefficients, bruteForcePositions, fwhtPositions, ratio, q, N, start, &metrics };
+        guessScheduler gs = { SOLVER_NUM_THREADS, SOLVER_TOP_K_CANDIDATES, threshold, &ctx, bruteForceWorkerInit, bruteForceEvaluate, bruteForceWorkerFree };
+        guessSchedulerRun(&gs, numGuesses, candidates, &numCandidates, &earlyAborted);
+    }
+    else
+    {
+        /* determine how many guess tables fit in the memory budget */
+        u64 numTables = BRUTEFORCE_GUESS_TABLES_MEMORY_BUDGET_IN_BYTES / (N*sizeof(fwhtEntry));
+        numTables = numTables < 1 ? 1 : numTables;
+        numTables = numTables > numGuesses ? numGuesses : numTables;
+
+        fwhtEntry *list = CALLOC(numTables*N, sizeof(fwhtEntry));
+        int *guessBatch = MALLOC(numTables * bruteForcePositions * sizeof(int));
+        int *guessBatchModQ = MALLOC(numTables * bruteForcePositions * sizeof(int));
+        if (!list || !guessBatch || !guessBatchModQ)
         {
-            lweDestroy(&lwe);
-            return 4; /* could not open samples file */
+            printf("*** solve_fwht_search: failed to allocate memory for initial list\n");
+            exit(-1);
         }
+        timeStamp(start);
+        printf("Samples do not fit in memory, %" PRIu64 " guess tables per pass\n", numTables);
 
-        while (!feof(f_src))
+        for (u64 batchStart = 0; batchStart < numGuesses && !earlyAborted; batchStart += numTables)
         {
-            /* read chunk of samples from source sample file into read buffer */
-            u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
-            for (u64 i=0; i<numRead; i++)
+            u64 batchSize = numGuesses - batchStart < numTables ? numGuesses - batchStart : numTables;
+            for (u64 k=0; k<batchSize; k++)
+                bruteForceGuessFromIndex(batchStart+k, ratio, q, bruteForcePositions, &guessBatch[k*bruteForcePositions], &guessBatchModQ[k*bruteForcePositions]);
+            double accumulateBegin = bkwMetricsNow();
+            MEMSET(list, 0, batchSize*N*sizeof(fwhtEntry));
+
+            /* the first chunk of the first batch is already in the side arrays */
+            if (batchStart > 0)
             {
-                sample = &sampleReadBuf[i];
-                intsample = sample_to_int(sample->col.a+zeroPositions, fwhtPositions, q);
-                z = sample->sumWithError;
-                // update z with the bruteforce-guessed positions
-                for(int j = 0; j<bruteForcePositions; j++)
-                {
-                    if(BFguess[j] < 0)
-                        tmp_si = BFguess[j]+q;
-                    else
-                        tmp_si = BFguess[j];
-                    z = (z - (columnValue(sample, zeroPositions+fwhtPositions+j)*tmp_si)%q );
-                    if (z < 0)
-                        z += q;
-                }
-                z = z > (q-1)/2 ? z -q : z;
-                intsample = sample_to_int(sample->col.a+zeroPositions, fwhtPositions, q);
-                lsb_z = z%2 == 0 ? 0 : 1;
-#ifdef USE_SOFT_INFORMATION
-                if (lsb_z == 0)
-                    list[intsample] += bias_table[z+(q-1)/2];
-                else
-                    list[intsample] -= bias_table[z+(q-1)/2];
-#else
-                if (lsb_z == 0)
-                    list[intsample] += 1;
-                else
-                    list[intsample] -= 1;
-#endif
+                rewind(f_src);
+                numRead = readBruteForceSideArrays(f_src, sampleReadBuf, fwhtIndex, bValue, bfCoefficients, zeroPositions, bruteForcePositions, fwhtPositions, q);
             }
-        }
-        fclose(f_src);
-        FREE(sampleReadBuf);
-
-        /* Apply Fast Walsh Hadamard Tranform */
-        FWHT(list, N);
-
-        // find maximum
-        max_pos = -1;
-        max = 0;
-        for (u64 i = 0; i<N; i++)
-        {
-#ifdef USE_SOFT_INFORMATION
-            if (max < fabs(list[i]))
+            for (;;)
             {
-                max = fabs(list[i]);
-#else
-            if (max < labs(list[i]))
+                for (u64 k=0; k<batchSize; k++)
+                    accumulateBruteForceGuess(list+k*N, numRead, fwhtIndex, bValue, bfCoefficients, &guessBatchModQ[k*bruteForcePositions], bruteForcePositions, q);
+                if (feof(f_src))
+                    break;
+                numRead = readBruteForceSideArrays(f_src, sampleReadBuf, fwhtIndex, bValue, bfCoefficients, zeroPositions, bruteForcePositions, fwhtPositions, q);
+            }
+
+            double transformBegin = bkwMetricsNow();
+            for (u64 k=0; k<batchSize; k++)
             {
-                max = labs(list[i]);
+                guessCandidate c;
+                c.guess = batchStart+k;
+                c.score = transformAndFindMax(list+k*N, N, &c.index);
+#ifdef PRINT_INTERMEDIATE_SOLUTIONS_BRUTEFORCE
+                printBruteForceGuess(start, c.index, c.score, &guessBatch[k*bruteForcePositions], bruteForcePositions, fwhtPositions);
 #endif
-                max_pos = i;
+                guessCandidateInsert(candidates, &numCandidates, SOLVER_TOP_K_CANDIDATES, &c);
+                if (threshold > 0 && c.score >= threshold)
+                    earlyAborted = 1;
             }
+            bkwMetricsAddSolverSeconds(&metrics, transformBegin - accumulateBegin, bkwMetricsNow() - transformBegin);
         }
+        fclose(f_src);
+        FREE(list);
+        FREE(guessBatch);
+        FREE(guessBatchModQ);
+    }
 
-        // Convert solution into binary
-        int_to_bin(max_pos, bin_guess, fwhtPositions);
+    solverMetricsFinish(&metrics, srcFolder);
 
-#ifdef PRINT_INTERMEDIATE_SOLUTIONS_BRUTEFORCE
-        timeStamp(start);
-        printf("Index found %ld - max %f \n(",max_pos, max);
+    /* report the best candidates and keep the best one */
+    int BFguess[bruteForcePositions];
+    int guessModQ[bruteForcePositions];
+    timeStamp(start);
+    printf("Best %d candidates%s\n", numCandidates, earlyAborted ? " (early termination)" : "");
+    for (int i=0; i<numCandidates; i++)
+    {
+        bruteForceGuessFromIndex(candidates[i].guess, ratio, q, bruteForcePositions, BFguess, guessModQ);
+        printf("max %f - index %" PRIu64 " - guess (", candidates[i].score, candidates[i].index);
         for(int j = 0; j<bruteForcePositions; j++)
             printf("%d ", BFguess[j]);
-        printf(") - (");
-        for(int j = 0; j<fwhtPositions; j++)
-            printf("%hu ", bin_guess[j]);
         printf(")\n");
-#endif
-
-        if(max > global_max)
-        {
-            global_max = max;
-            for(int j = 0; j<fwhtPositions; j++)
-                binary_solution[j] = bin_guess[j];
-            for(int j = 0; j<bruteForcePositions; j++)
-                bf_solution[j] = BFguess[j] >= 0 ? BFguess[j] : BFguess[j] +q;
-        }
-
     }
-    while(nextBruteForceGuess(ratio, BFguess, bruteForcePositions));
+    if (numCandidates > 0)
+    {
+        int_to_bin(candidates[0].index, binary_solution, fwhtPositions);
+        bruteForceGuessFromIndex(candidates[0].guess, ratio, q, bruteForcePositions, BFguess, guessModQ);
+        for(int j = 0; j<bruteForcePositions; j++)
+            bf_solution[j] = guessModQ[j];
+    }
 
 #ifdef USE_SOFT_INFORMATION
     /* free bias_table */
     free_bias_table();
 #endif
-    FREE(list);
+    FREE(sampleReadBuf);
+    FREE(fwhtIndex);
+    FREE(bValue);
+    FREE(bfCoefficients);
     lweDestroy(&lwe);
     return 0;
 }
 
 #ifndef USE_SOFT_INFORMATION
+/* Read the next chunk of samples and store, for each sample, its FWHT index, the parity of b and
+ * the parities of the brute-force positions (one bit per position) in compact side arrays.
+ */
+static u64 readHybridSideArrays(FILE *f_src, lweSample *sampleReadBuf, u64 *fwhtIndex, u8 *bParity, u64 *bfParityMask, int zeroPositions, int bruteForcePositions, int fwhtPositions, int q)
+{
+    u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
+    for (u64 i=0; i<numRead; i++)
+    {
+        lweSample *sample = &sampleReadBuf[i];
+        fwhtIndex[i] = sample_to_int(sample->col.a+zeroPositions, fwhtPositions, q);
+        bParity[i] = abs(sample->sumWithError <= q/2 ? sample->sumWithError : sample->sumWithError - q) % 2;
+        bfParityMask[i] = sample_to_int(sample->col.a+zeroPositions+fwhtPositions, bruteForcePositions, q);
+    }
+    return numRead;
+}
+
+/* Add the contribution of the samples in the side arrays to the table of one binary guess */
+static void accumulateHybridGuess(long *list, u64 numSamples, const u64 *fwhtIndex, const u8 *bParity, const u64 *bfParityMask, u64 guess)
+{
+    for (u64 i=0; i<numSamples; i++)
+    {
+        int z = bParity[i] ^ (__builtin_popcountll(bfParityMask[i] & guess) & 1);
+        if (z == 0)
+            list[fwhtIndex[i]] += 1;
+        else
+            list[fwhtIndex[i]] -= 1;
+    }
+}
+
+typedef struct
+{
+    u64 numSamples;
+    const u64 *fwhtIndex;
+    const u8 *bParity;
+    const u64 *bfParityMask;
+    int bruteForcePositions;
+    int fwhtPositions;
+    u64 N;
+    time_t start;
+    bkwMetrics *metrics;
+} hybridContext;
+
+static void *hybridWorkerInit(void *ctx)
+{
+    hybridContext *hy = ctx;
+    long *list = MALLOC(hy->N * sizeof(long));
+    if (!list)
+    {
+        printf("*** solve_fwht_search_hybrid: failed to allocate memory for worker list\n");
+        exit(-1);
+    }
+    return list;
+}
+
+static void hybridPrintGuess(hybridContext *hy, u64 guess, u64 max_pos, double max)
+{
+#if 1 // print intermediate solutions
+    char line[1024];
+    int numBits = hy->fwhtPositions + hy->bruteForcePositions;
+    u8 bin_guess[numBits];
+    int_to_bin(max_pos, bin_guess, hy->fwhtPositions);
+    int_to_bin(guess, bin_guess+hy->fwhtPositions, hy->bruteForcePositions);
+    int len = sprintf(line, "Index found %" PRIu64 " - max %ld \n(", max_pos, (long)max);
+    for(int j = 0; j<numBits; j++)
+        len += sprintf(line+len, "%hu ", bin_guess[j]);
+    sprintf(line+len, ")\n");
+    pthread_mutex_lock(&printLock);
+    timeStamp(hy->start);
+    printf("%s", line);
+    pthread_mutex_unlock(&printLock);
+#endif
+}
+
+static double hybridEvaluate(void *ctx, void *workerState, u64 guess, u64 *index)
+{
+    hybridContext *hy = ctx;
+    long *list = workerState;
+    double accumulateBegin = bkwMetricsNow();
+    MEMSET(list, 0, hy->N * sizeof(long));
+    accumulateHybridGuess(list, hy->numSamples, hy->fwhtIndex, hy->bParity, hy->bfParityMask, guess);
+    double transformBegin = bkwMetricsNow();
+    double max = transformAndFindMax(list, hy->N, index);
+    bkwMetricsAddSolverSeconds(hy->metrics, transformBegin - accumulateBegin, bkwMetricsNow() - transformBegin);
+    hybridPrintGuess(hy, guess, *index, max);
+    return max;
+}
+
 /* Hybrid solver that uses sparse brute-force for bruteForcePositions number of positions and Fast Walsh Hadamard Transform for fftPositions number of positions */
 /* NOTE: if the brute-force positions are not reduced, the success probability goes down quite a lot, this is more intended to be used for guessing a larger number
  * of positions than the FWHT can handle. It does not support soft-information.
+ * If all samples fit in the read buffer, the guesses are evaluated in parallel by SOLVER_NUM_THREADS workers.
  */
 int solve_fwht_search_hybrid(const char *srcFolder, u8 *binary_solution, int zeroPositions, int bruteForcePositions, int fwhtPositions, time_t start)
 {
 
     lweInstance lwe;
     lweParametersFromFile(&lwe, srcFolder);
-    int n = lwe.n;
     int q = lwe.q;
 
     u64 numCategories;
     sampleInfoFromFile(srcFolder, NULL, &numCategories, NULL, NULL, NULL);
+    u64 numTotalSamples = numSamplesInSampleFile(srcFolder); /* the final (unsorted) folder has no sample info file */
 
     ASSERT(1 <= fwhtPositions && fwhtPositions <= MAX_FWHT, "The number of positions for fwht is not supported in this implementation!\n");
     ASSERT(1 <= bruteForcePositions && bruteForcePositions <= MAX_BRUTE_FORCE, "The number of positions for bruteforce guessing is not supported in this implementation!\n");
-    ASSERT(fwhtPositions + bruteForcePositions + zeroPositions == n, "The number of positions for bruteforce and fwht is => n!\n");
+    ASSERT(fwhtPositions + bruteForcePositions + zeroPositions == lwe.n, "The number of positions for bruteforce and fwht is => n!\n");
 
-    /* create initial list */
     u64 N = (u64)1<<fwhtPositions; // N = 2^fwht_positions
-    long *list = CALLOC(N,sizeof(long));  // calloc every time so that we start with all zeros
-    if (!list)
+    u64 numGuesses = ((u64)1)<<bruteForcePositions;
+
+    /* allocate sample read buffer and compact side arrays */
+    lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
+    u64 *fwhtIndex = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * sizeof(u64));
+    u8 *bParity = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * sizeof(u8));
+    u64 *bfParityMask = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * sizeof(u64));
+    if (!sampleReadBuf || !fwhtIndex || !bParity || !bfParityMask)
     {
-        printf("*** solve_fwht_search: failed to allocate memory for initial list\n");
-        exit(-1);
+        FREE(sampleReadBuf);
+        FREE(fwhtIndex);
+        FREE(bParity);
+        FREE(bfParityMask);
+        lweDestroy(&lwe);
+        return 6; /* could not allocate sample read buffer */
     }
 
-    FILE *f_src;
-
-    /* allocate sample read buffer */
-    lweSample *sampleReadBuf;
-
-    lweSample *sample;
-    short z;
-    long max_pos = -1, global_max = 0, max = 0;
-    u64 intsample;
+    FILE *f_src = fopenSamples(srcFolder, "rb");
+    if (!f_src)
+    {
+        FREE(sampleReadBuf);
+        FREE(fwhtIndex);
+        FREE(bParity);
+        FREE(bfParityMask);
+        lweDestroy(&lwe);
+        return 4; /* could not open samples file */
+    }
+    /* reading the samples into the side arrays counts as accumulation */
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, srcFolder);
+    double readBegin = bkwMetricsNow();
+    u64 numRead = readHybridSideArrays(f_src, sampleReadBuf, fwhtIndex, bParity, bfParityMask, zeroPositions, bruteForcePositions, fwhtPositions, q);
+    bkwMetricsAddSolverSeconds(&metrics, bkwMetricsNow() - readBegin, 0);
 
     timeStamp(start);
     printf("Start FWHT: brute force %d positions, guess %d positions\n", bruteForcePositions, fwhtPositions);
 
-    u64 MAX = ((int)1)<<bruteForcePositions;
-    u8 bin_guess[n-zeroPositions];
+    guessCandidate candidates[SOLVER_TOP_K_CANDIDATES];
+    int numCandidates = 0, earlyAborted = 0;
+    double threshold = guessSchedulerSignificanceThreshold(numTotalSamples, (double)numGuesses * N, SOLVER_EARLY_ABORT_SIGMAS);
+    hybridContext ctx = { numRead, fwhtIndex, bParity, bfParityMask, bruteForcePositions, fwhtPositions, N, start, &metrics };
 
-    /* bruteforce the last bruteForcePositions positions */
-    for(u64 guess = 0; guess<MAX; guess++)
+    if (feof(f_src))
     {
-        int_to_bin(guess, bin_guess+fwhtPositions, bruteForcePositions);
-
-        memset(list, 0, N*sizeof(long));
-        sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
-        if (!sampleReadBuf)
-        {
-            lweDestroy(&lwe);
-            return 6; /* could not allocate sample read buffer */
-        }
-
-        /* process all samples in source file */
-        /* open source sample file */
-        f_src = fopenSamples(srcFolder, "rb");
-        if (!f_src)
-        {
-            lweDestroy(&lwe);
-            return 4; /* could not open samples file */
-        }
-        while (!feof(f_src))
+        /* all samples are in the side arrays, which are shared (read-only) by the workers */
+        fclose(f_src);
+        guessScheduler gs = { SOLVER_NUM_THREADS, SOLVER_TOP_K_CANDIDATES, threshold, &ctx, hybridWorkerInit, hybridEvaluate, bruteForceWorkerFree };
+        guessSchedulerRun(&gs, numGuesses, candidates, &numCandidates, &earlyAborted);
+    }
+    else
+    {
+        /* bruteforce the last bruteForcePositions positions, reading the samples once per guess */
+        long *list = hybridWorkerInit(&ctx);
+        for(u64 guess = 0; guess<numGuesses && !earlyAborted; guess++)
         {
-            /* read chunk of samples from source sample file into read buffer */
-            u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
-            for (u64 i=0; i<numRead; i++)
+            double accumulateBegin = bkwMetricsNow();
+            MEMSET(list, 0, N*sizeof(long));
+            if (guess > 0)
             {
-                sample = &sampleReadBuf[i];
-                intsample = sample_to_int(sample->col.a+zeroPositions, fwhtPositions, q);
-                z = sample->sumWithError <= q/2 ? (sample->sumWithError%2) : (sample->sumWithError -q)%2;
-                // update z with the bruteforce-guessed positions
-                for(int j = fwhtPositions; j<fwhtPositions+bruteForcePositions; j++)
-                    z = (z + abs(columnValueSigned(sample, zeroPositions+j, q)%2)*(bin_guess[j]))%2 ;
-                if (z == 0)
-                    list[intsample] += 1;
-                else
-                    list[intsample] -= 1;
+                rewind(f_src);
+                numRead = readHybridSideArrays(f_src, sampleReadBuf, fwhtIndex, bParity, bfParityMask, zeroPositions, bruteForcePositions, fwhtPositions, q);
             }
-        }
-        fclose(f_src);
-        FREE(sampleReadBuf);
-
-        /* Apply Fast Walsh Hadamard Tranform */
-        FWHT(list, N);
-
-        // find maximum
-        max_pos = -1;
-        max = 0;
-        for (u64 i = 0; i<N; i++)
-        {
-            if (max < labs(list[i]))
+            for (;;)
             {
-                max = labs(list[i]);
-                max_pos = i;
+                accumulateHybridGuess(list, numRead, fwhtIndex, bParity, bfParityMask, guess);
+                if (feof(f_src))
+                    break;
+                numRead = readHybridSideArrays(f_src, sampleReadBuf, fwhtIndex, bParity, bfParityMask, zeroPositions, bruteForcePositions, fwhtPositions, q);
             }
-        }
-
-        // Convert solution into binary
-        int_to_bin(max_pos, bin_guess, fwhtPositions);
-
-#if 1 // print intermediate solutions
-        timeStamp(start);
-        printf("Index found %ld - max %ld \n(",max_pos, max);
-        for(int j = 0; j<n-zeroPositions; j++)
-            printf("%hu ", bin_guess[j]);
-        printf(")\n");
-#endif
 
-        if(max > global_max)
-        {
-            global_max = max;
-            for(int j = 0; j<n; j++)
-                binary_solution[j] = bin_guess[j];
+            guessCandidate c;
+            c.guess = guess;
+            double transformBegin = bkwMetricsNow();
+            c.score = transformAndFindMax(list, N, &c.index);
+            bkwMetricsAddSolverSeconds(&metrics, transformBegin - accumulateBegin, bkwMetricsNow() - transformBegin);
+            hybridPrintGuess(&ctx, guess, c.index, c.score);
+            guessCandidateInsert(candidates, &numCandidates, SOLVER_TOP_K_CANDIDATES, &c);
+            if (threshold > 0 && c.score >= threshold)
+                earlyAborted = 1;
         }
+        fclose(f_src);
+        FREE(list);
     }
+    solverMetricsFinish(&metrics, srcFolder);
 
-    FREE(list);
+    timeStamp(start);
+    printf("Best %d candidates%s\n", numCandidates, earlyAborted ? " (early termination)" : "");
+    for (int i=0; i<numCandidates; i++)
+    {
+        printf("max %ld - index %" PRIu64 " - guess %" PRIu64 "\n", (long)candidates[i].score, candidates[i].index, candidates[i].guess);
+    }
+    if (numCandidates > 0)
+    {
+        int_to_bin(candidates[0].index, binary_solution, fwhtPositions);
+        int_to_bin(candidates[0].guess, binary_solution+fwhtPositions, bruteForcePositions);
+    }
+
+    FREE(sampleReadBuf);
+    FREE(fwhtIndex);
+    FREE(bParity);
+    FREE(bfParityMask);
     lweDestroy(&lwe);
     return 0;
 }
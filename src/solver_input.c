@@ -0,0 +1,170 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "solver_input.h"
+#include "solve_fwht.h"
+#include "assert_utils.h"
+#include <string.h>
+#include <inttypes.h>
+
+/* name of solver-input file */
+static const char *solver_input_file_name = "solver_input.dat";
+
+/* name of solver-input info file */
+static const char *solver_input_info_file_name = "solver_input_info.txt";
+
+static const char *solver_input_type_label[numSolverInputTypes] =
+{
+    "fwht",
+    "fft"
+};
+
+const char *solverInputTypeAsString(solverInputType type)
+{
+    return type < numSolverInputTypes ? solver_input_type_label[type] : NULL;
+}
+
+static int solverInputTypeFromString(const char *str, solverInputType *type)
+{
+    for (int i=0; i<numSolverInputTypes; i++)
+    {
+        if (!strcmp(solver_input_type_label[i], str))
+        {
+            *type = i;
+            return 0;
+        }
+    }
+    return 1; /* unknown type */
+}
+
+/* packed solver index of a sample */
+u64 solverInputIndex(lweSample *sample, solverInputParameters *par, int q)
+{
+    u64 index = 0;
+    switch (par->type)
+    {
+    case solverInputFwht:
+        ASSERT(par->numPositions <= SOLVER_INPUT_INDEX_BITS, "too many positions for the solver input index");
+        return sample_to_int(sample->col.a + par->startIndex, par->numPositions, q);
+    case solverInputFft:
+        for (int i=0; i<par->numPositions; i++)
+        {
+            index = q * index + columnValue(sample, par->startIndex + i);
+        }
+        ASSERT(index <= SOLVER_INPUT_INDEX_MASK, "too many positions for the solver input index");
+        return index;
+    default:
+        ASSERT_ALWAYS("unhandled solver input type");
+        return 0;
+    }
+}
+
+static void solverInputFileName(char *fileName, const char *folderName)
+{
+    sprintf(fileName, "%s/%s", folderName, solver_input_file_name);
+}
+
+static void solverInputInfoFileName(char *fileName, const char *folderName)
+{
+    sprintf(fileName, "%s/%s", folderName, solver_input_info_file_name);
+}
+
+static int solverInputParametersToFile(const char *folderName, solverInputParameters *par, u64 numRecords)
+{
+    char fileName[512];
+    solverInputInfoFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "w");
+    if (!f)
+    {
+        return 1; /* could not open solver input info file */
+    }
+    fprintf(f, "type = %s\n", solverInputTypeAsString(par->type));
+    fprintf(f, "start index = %d\n", par->startIndex);
+    fprintf(f, "num positions = %d\n", par->numPositions);
+    fprintf(f, "total num records = %" PRIu64 "\n", numRecords);
+    fclose(f);
+    return 0;
+}
+
+/* read solver-input parameters from file, return non-zero if the folder has no (valid) solver-input file */
+/* note: last parameter is optional by passing NULL */
+int solverInputParametersFromFile(const char *folderName, solverInputParameters *par, u64 *numRecords)
+{
+    char fileName[512];
+    solverInputInfoFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+    {
+        return 1; /* no solver input in folder */
+    }
+    char typeString[64];
+    u64 dummy;
+    int ret = 0;
+    if (fscanf(f, "type = %63s\n", typeString) != 1 || solverInputTypeFromString(typeString, &par->type))
+    {
+        ret = 2; /* could not determine solver input type */
+    }
+    else if (fscanf(f, "start index = %d\n", &par->startIndex) != 1 ||
+             fscanf(f, "num positions = %d\n", &par->numPositions) != 1 ||
+             fscanf(f, "total num records = %" SCNu64 "\n", numRecords ? numRecords : &dummy) != 1)
+    {
+        ret = 3; /* error in solver input info file */
+    }
+    fclose(f);
+    return ret;
+}
+
+FILE *fopenSolverInput(const char *folderName, const char *mode)
+{
+    char fileName[512];
+    solverInputFileName(fileName, folderName);
+    return fopen(fileName, mode);
+}
+
+/* read records from current position into buffer (does not close file) */
+u64 freadSolverInput(FILE *f, solverInputRecord *buf, u64 numRecords)
+{
+    return fread(buf, sizeof(solverInputRecord), numRecords, f);
+}
+
+int solverInputWriterInitialize(solverInputWriter *siw, const char *folderName, solverInputParameters *par, int q)
+{
+    siw->f = fopenSolverInput(folderName, "wb");
+    if (!siw->f)
+    {
+        return 1; /* could not create solver input file */
+    }
+    siw->par = *par;
+    siw->q = q;
+    siw->numRecords = 0;
+    return 0;
+}
+
+void solverInputWriterAddSample(solverInputWriter *siw, lweSample *sample)
+{
+    solverInputRecord r = solverInputRecordPack(solverInputIndex(sample, &siw->par, siw->q), sumWithError(sample));
+    int numWritten = fwrite(&r, sizeof(solverInputRecord), 1, siw->f);
+    ASSERT(numWritten == 1, "Error in writing solver input record\n");
+    siw->numRecords += numWritten;
+}
+
+/* close the solver-input file and write its info file, the records are only used by the solvers when the info file exists */
+int solverInputWriterClose(solverInputWriter *siw, const char *folderName)
+{
+    fclose(siw->f);
+    siw->f = NULL;
+    return solverInputParametersToFile(folderName, &siw->par, siw->numRecords);
+}
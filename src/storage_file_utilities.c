@@ -14,6 +14,8 @@
  *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "storage_file_utilities.h"
 
 #include "config_compiler.h"
@@ -33,6 +35,7 @@
 #include "memory_utils.h"
 #include "string_utils.h"
 #include "bkw_step_parameters.h"
+#include "position_values_2_category_index.h"
 #include "linear_algebra_modular.h"
 
 #define _FILE_OFFSET_BITS 64
@@ -57,6 +60,13 @@ static const char *sam_file_name = "samples.dat";
 /* name of samples info file */
 static const char *sam_info_file_name = "samples_info.txt";
 
+/* names of metrics files (see bkw_metrics.h) */
+static const char *metrics_file_name = "metrics.json";
+static const char *solver_metrics_file_name = "solver_metrics.json";
+
+/* name of the marker file of a completely written folder */
+static const char *complete_file_name = "complete.txt";
+
 void parameterFileName(char *paramFileName, const char *folderName)
 {
     sprintf(paramFileName, "%s/%s", folderName, par_file_name);
@@ -72,6 +82,42 @@ void samplesInfoFileName(char *samplesInfoFileName, const char *folderName)
     sprintf(samplesInfoFileName, "%s/%s", folderName, sam_info_file_name);
 }
 
+void metricsFileName(char *metricsFileName, const char *folderName)
+{
+    sprintf(metricsFileName, "%s/%s", folderName, metrics_file_name);
+}
+
+void solverMetricsFileName(char *solverMetricsFileName, const char *folderName)
+{
+    sprintf(solverMetricsFileName, "%s/%s", folderName, solver_metrics_file_name);
+}
+
+void completeMarkerFileName(char *completeMarkerFileName, const char *folderName)
+{
+    sprintf(completeMarkerFileName, "%s/%s", folderName, complete_file_name);
+}
+
+/* marks the folder as completely written, call when its samples and sample info are final */
+int completeMarkerToFile(const char *folderName)
+{
+    char fileName[512];
+    completeMarkerFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "w");
+    if (!f)
+    {
+        return 1; /* could not create marker file */
+    }
+    fprintf(f, "complete\n");
+    return fclose(f) ? 2 : 0; /* 2 if the marker could not be written */
+}
+
+int folderIsComplete(const char *folderName)
+{
+    char fileName[512];
+    completeMarkerFileName(fileName, folderName);
+    return fileExists(fileName);
+}
+
 /* writes (lwe) problem parameters to file */
 int parametersToFile(lweInstance *lwe, const char *folderName)
 {
@@ -219,8 +265,106 @@ int lweParametersFromFile(lweInstance *lwe, const char *folderName)
     return 0;
 }
 
+/* the reduction lines are appended after the lwe parameters, which lweParametersFromFile ignores */
+int secretReductionToFile(const char *folderName, secretReduction *r)
+{
+    char fileName[512];
+    parameterFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "a");
+    if (!f)
+    {
+        return 1;
+    }
+    fprintf(f, "base = %s\n", r->baseFolderName);
+    fprintf(f, "reduction = (%d; %hi", r->numReductions, r->t[0]);
+    for (int i=1; i<MAX_N; i++)
+    {
+        fprintf(f, ",%hi", r->t[i]);
+    }
+    fprintf(f, ")\n");
+    fclose(f);
+    return 0;
+}
+
+int secretReductionFromFile(const char *folderName, secretReduction *r)
+{
+    r->numReductions = 0;
+    r->baseFolderName[0] = 0;
+    char fileName[512];
+    parameterFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+    {
+        return 1;
+    }
+    char line[64 + 8 * MAX_N]; /* long enough for the reduction line */
+    int ret = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (!strncmp(line, "base = ", 7))
+        {
+            strncpy(r->baseFolderName, line + 7, sizeof(r->baseFolderName) - 1);
+            r->baseFolderName[sizeof(r->baseFolderName) - 1] = 0;
+            r->baseFolderName[strcspn(r->baseFolderName, "\r\n")] = 0;
+        }
+        else if (!strncmp(line, "reduction = (", 13))
+        {
+            char *p = line + 13, *end;
+            r->numReductions = (int)strtol(p, &end, 10);
+            for (int i=0; i<MAX_N && end != p && (*end == ';' || *end == ','); i++)
+            {
+                p = end + 1;
+                r->t[i] = (short)strtol(p, &end, 10);
+                ret = i == MAX_N-1 && end != p && *end == ')' ? 0 : 2;
+            }
+            break;
+        }
+    }
+    fclose(f);
+    if (ret || (r->numReductions && !r->baseFolderName[0]))
+    {
+        r->numReductions = 0;
+        return 2; /* malformed reduction */
+    }
+    return 0;
+}
+
+const char *secretReductionSampleFolder(const char *folderName, secretReduction *r)
+{
+    return r->numReductions ? r->baseFolderName : folderName;
+}
+
+void secretReductionApply(lweInstance *lwe, const secretReduction *r, lweSample *samples, u64 numSamples)
+{
+    if (!r->numReductions)
+    {
+        return;
+    }
+    int n = lwe->n;
+    int q = lwe->q;
+    int scale = 1;
+    for (int k=0; k<r->numReductions; k++)
+    {
+        scale = (2 * scale) % q;
+    }
+    for (u64 j=0; j<numSamples; j++)
+    {
+        lweSample *sample = &samples[j];
+        long subt = 0;
+        for (int i=0; i<n; i++)
+        {
+            subt = (subt + (long)sample->col.a[i] * r->t[i]) % q;
+            sample->col.a[i] = (short)((scale * sample->col.a[i]) % q);
+        }
+        sample->sumWithError = (short)((sample->sumWithError - subt + q) % q);
+        sample->col.hash = bkwColumnComputeHash(sample, n, q, 0);
+    }
+}
+
 /* write sample information to file */
-int sampleInfoToFile(const char *folderName, bkwStepParameters *bkwStepPar, u64 numCategories, u64 categoryCapacity, u64 numTotalSamples, u64 *numSamplesPerCategory)
+/* the singleton categories are stored so that readers do not have to recompute the category layout */
+/* categoryOffsets (numCategories + 1 prefix sums, NULL if all categories have categoryCapacity samples) gives the extent of each category on file */
+int sampleInfoToFile(const char *folderName, bkwStepParameters *bkwStepPar, u64 numCategories, u64 categoryCapacity, u64 numTotalSamples, u64 *singletons, int numSingletons, u64 *numSamplesPerCategory, u64 *categoryOffsets)
 {
     char fileName[512];
     samplesInfoFileName(fileName, folderName);
@@ -234,12 +378,27 @@ int sampleInfoToFile(const char *folderName, bkwStepParameters *bkwStepPar, u64
     fprintf(f, "num categories = %" PRIu64 "\n", numCategories);
     fprintf(f, "category capacity (num samples) = %" PRIu64 "\n", categoryCapacity);
     fprintf(f, "total num samples stored = %" PRIu64 "\n", numTotalSamples);
+    fprintf(f, "singleton categories = (");
+    for (int i=0; i<numSingletons; i++)
+    {
+        fprintf(f, i ? ",%" PRIu64 : "%" PRIu64, singletons[i]);
+    }
+    fprintf(f, ")\n");
     fprintf(f, "num samples per category = (%" PRIu64, numSamplesPerCategory[0]);
-    for (int i=1; i<numCategories; i++)
+    for (u64 i=1; i<numCategories; i++)
     {
         fprintf(f, ",%" PRIu64, numSamplesPerCategory[i]);
     }
     fprintf(f, ")\n");
+    if (categoryOffsets) /* the category capacity above is then that of the largest category */
+    {
+        fprintf(f, "category offsets (num samples) = (%" PRIu64, categoryOffsets[0]);
+        for (u64 i=1; i<=numCategories; i++)
+        {
+            fprintf(f, ",%" PRIu64, categoryOffsets[i]);
+        }
+        fprintf(f, ")\n");
+    }
     fclose(f);
     return 0;
 }
@@ -313,6 +472,15 @@ int sampleInfoFromFile(const char *folderName, bkwStepParameters *bkwStepPar, u6
         return 3;
     }
 
+    /* singleton categories (not present in folders written by older versions) */
+    int ch = fgetc(f);
+    ungetc(ch, f);
+    if (ch == 's' && fscanf(f, "%*[^\n]\n"))
+    {
+        lweDestroy(&lwe);
+        return 3;
+    }
+
     /* number of samples per category */
     if (numSamplesPerCategory)
     {
@@ -321,7 +489,7 @@ int sampleInfoFromFile(const char *folderName, bkwStepParameters *bkwStepPar, u6
             lweDestroy(&lwe);
             return 3;
         }
-        for (int i=1; i<numCat; i++)
+        for (u64 i=1; i<numCat; i++)
         {
             if(!fscanf(f, ",%" PRIu64 "", &numSamplesPerCategory[i]))
             {
@@ -336,6 +504,84 @@ int sampleInfoFromFile(const char *folderName, bkwStepParameters *bkwStepPar, u6
     return 0;
 }
 
+/* read the category offsets (room for numCategories + 1 entries) from the sample info file */
+/* category i holds the samples [categoryOffsets[i], categoryOffsets[i+1]) of the sample file */
+int sampleInfoCategoryOffsetsFromFile(const char *folderName, u64 numCategories, u64 *categoryOffsets)
+{
+    char fileName[512];
+    samplesInfoFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+    {
+        return 1; /* could not open sample info file */
+    }
+    /* the offset line follows the (long) per category lines, skip lines until it is found */
+    int found = 0;
+    while (!found)
+    {
+        found = fscanf(f, "category offsets (num samples) = (%" PRIu64, &categoryOffsets[0]) == 1;
+        int ch = 0;
+        while (!found && (ch = fgetc(f)) != EOF && ch != '\n');
+        if (ch == EOF)
+        {
+            fclose(f);
+            return 3; /* no offsets, all categories have the same capacity */
+        }
+    }
+    for (u64 i=1; i<=numCategories; i++)
+    {
+        if (fscanf(f, ",%" PRIu64, &categoryOffsets[i]) != 1 || categoryOffsets[i] < categoryOffsets[i-1])
+        {
+            fclose(f);
+            return 2; /* malformed offset table */
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* read the singleton categories (room for MAX_NUM_SINGLETON_CATEGORIES entries) from the sample info file */
+int sampleInfoSingletonsFromFile(const char *folderName, u64 *singletons, int *numSingletons)
+{
+    char fileName[512];
+    samplesInfoFileName(fileName, folderName);
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+    {
+        return 1; /* could not open sample info file */
+    }
+    /* the singleton line is the fifth line, after the sorting, size and sample count lines */
+    char line[32 * MAX_NUM_SINGLETON_CATEGORIES];
+    for (int i=0; i<5; i++)
+    {
+        if (!fgets(line, sizeof(line), f))
+        {
+            fclose(f);
+            return 2; /* unexpected end of file */
+        }
+    }
+    fclose(f);
+    const char *prefix = "singleton categories = (";
+    if (strncmp(line, prefix, strlen(prefix)))
+    {
+        return 3; /* no singleton information in file */
+    }
+    char *p = line + strlen(prefix);
+    *numSingletons = 0;
+    while (*p != ')')
+    {
+        char *end;
+        u64 index = strtoull(p, &end, 10);
+        if (end == p || *numSingletons >= MAX_NUM_SINGLETON_CATEGORIES)
+        {
+            return 4; /* malformed singleton list */
+        }
+        singletons[(*numSingletons)++] = index;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
 int newStorageFolder(lweInstance *lwe, const char *folderName, int n, int q, double alpha)
 {
     lweInit(lwe, n, q, alpha); /* create lwe instance with given parameters */
@@ -373,6 +619,9 @@ int deleteStorageFolder(const char *folderName, int deleteParFile, int deleteSam
 {
     int ret = 0;
     char fileName[512];
+    /* a partially deleted folder is not complete */
+    completeMarkerFileName(fileName, folderName);
+    remove(fileName);
     if(deleteParFile)
     {
         parameterFileName(fileName, folderName);
@@ -389,6 +638,11 @@ int deleteStorageFolder(const char *folderName, int deleteParFile, int deleteSam
             /* folder with unsorted samples has no samples info file, so do not report failure to delete as error */
             //    ret |= 2;
         }
+        /* metrics files are optional as well */
+        metricsFileName(fileName, folderName);
+        remove(fileName);
+        solverMetricsFileName(fileName, folderName);
+        remove(fileName);
     }
     if(deleteSamples)
     {
@@ -419,8 +673,7 @@ FILE *fopenSamples(const char *folderName, const char *mode)
 /* read sample range from current position into buffer (does not close file) */
 u64 freadSamples(FILE *f, lweSample *sampleBuf, u64 numSamples)
 {
-    u64 ret = fread(sampleBuf, LWE_SAMPLE_SIZE_IN_BYTES, numSamples, f);
-    return ret >= 0 ? ret : 0;
+    return fread(sampleBuf, LWE_SAMPLE_SIZE_IN_BYTES, numSamples, f);
 }
 
 /* read category range from current position into buffer (does not close file) */
@@ -432,10 +685,6 @@ u64 freadCategories(FILE *f, lweSample *sampleBuf, u64 numCategories, u64 catego
 /* read sample range into buffer (does not close file) */
 u64 fsetAndReadSamples(FILE *f, lweSample *sampleBuf, u64 startingSample, u64 nbrOfSamples)
 {
-    if (startingSample < 0)
-    {
-        return 0;
-    }
     fseeko(f, startingSample * LWE_SAMPLE_SIZE_IN_BYTES, SEEK_SET);
     return freadSamples(f, sampleBuf, nbrOfSamples);
 }
@@ -481,7 +730,7 @@ u64 numSamplesInSampleFile(const char *folderName)
 u64 addSamplesToSampleFile(const char *folderName, u64 nbrOfSamples, time_t start)
 {
     u64 n = nbrOfSamples;
-    int blockSize = 1000000;
+    u64 blockSize = 1000000;
     lweInstance lwe;
     if (lweParametersFromFile(&lwe, folderName))
     {
@@ -526,10 +775,6 @@ u64 addSamplesToSampleFile(const char *folderName, u64 nbrOfSamples, time_t star
 /* read sample range into buffer (closes file) */
 u64 readSamplesFromSampleFile(lweSample *sampleBuf, const char *folderName, u64 startingSample, u64 nbrOfSamples)
 {
-    if (startingSample < 0)
-    {
-        return 0;
-    }
     FILE *f = fopenSamples(folderName, "rb");
     if (!f)
     {
@@ -573,7 +818,7 @@ static void transformSampleInPlace(lweInstance *lwe, lweSample *sample)
     ASSERT(0 <= sample->sumWithError, "unexpected value");
     ASSERT(sample->sumWithError < q, "unexpected value");
     sample->error = -1; /* unknown error */
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0); /* compute column hash */
+    sample->col.hash = bkwColumnComputeHash(sample, n, q, 0); /* compute column hash */
 }
 
 /*
@@ -584,7 +829,7 @@ static void combineTwoSamplesAdd(lweInstance *lwe, lweSample *dst, lweSample *sa
     {
         dst->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
     if (sample1->error == -1 || sample2->error == -1)   // if either error term is undefined
     {
         dst->error = -1; // resulting sum of error terms is also undefined
@@ -597,6 +842,7 @@ static void combineTwoSamplesAdd(lweInstance *lwe, lweSample *dst, lweSample *sa
 }
 */
 
+/*
 static void combineTwoSamplesSub(lweInstance *lwe, lweSample *dst, lweSample *sample1, lweSample *sample2)
 {
     int q = lwe->q;
@@ -604,10 +850,10 @@ static void combineTwoSamplesSub(lweInstance *lwe, lweSample *dst, lweSample *sa
     {
         dst->col.a[i] = (q + columnValue(sample1, i) - columnValue(sample2, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
-    if (sample1->error == -1 || sample2->error == -1)   /* if either error term is undefined */
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
+    if (sample1->error == -1 || sample2->error == -1)   // if either error term is undefined
     {
-        dst->error = -1; /* resulting sum of error terms is also undefined */
+        dst->error = -1; // resulting sum of error terms is also undefined
     }
     else
     {
@@ -615,6 +861,7 @@ static void combineTwoSamplesSub(lweInstance *lwe, lweSample *dst, lweSample *sa
     }
     dst->sumWithError = (q + sample1->sumWithError - sample2->sumWithError) % q;
 }
+*/
 
 static void combineThreeSamplesAddAdd(lweInstance *lwe, lweSample *dst, lweSample *sample1, lweSample *sample2, lweSample *sample3)
 {
@@ -623,7 +870,7 @@ static void combineThreeSamplesAddAdd(lweInstance *lwe, lweSample *dst, lweSampl
     {
         dst->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i) + columnValue(sample3, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
     if (sample1->error == -1 || sample2->error == -1 || sample3->error == -1)   /* if either error term is undefined */
     {
         dst->error = -1; /* resulting sum of error terms is also undefined */
@@ -642,7 +889,7 @@ static void combineThreeSamplesAddSub(lweInstance *lwe, lweSample *dst, lweSampl
     {
         dst->col.a[i] = (q + columnValue(sample1, i) + columnValue(sample2, i) - columnValue(sample3, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
     if (sample1->error == -1 || sample2->error == -1 || sample3->error == -1)   /* if either error term is undefined */
     {
         dst->error = -1; /* resulting sum of error terms is also undefined */
@@ -661,7 +908,7 @@ static void combineThreeSamplesSubAdd(lweInstance *lwe, lweSample *dst, lweSampl
     {
         dst->col.a[i] = (q + columnValue(sample1, i) - columnValue(sample2, i) + columnValue(sample3, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
     if (sample1->error == -1 || sample2->error == -1 || sample3->error == -1)   /* if either error term is undefined */
     {
         dst->error = -1; /* resulting sum of error terms is also undefined */
@@ -680,7 +927,7 @@ static void combineThreeSamplesSubSub(lweInstance *lwe, lweSample *dst, lweSampl
     {
         dst->col.a[i] = (q + q + columnValue(sample1, i) - columnValue(sample2, i) - columnValue(sample3, i)) % q;
     }
-    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, 0);
+    dst->col.hash = bkwColumnComputeHash(dst, lwe->n, lwe->q, 0);
     if (sample1->error == -1 || sample2->error == -1 || sample3->error == -1)   /* if either error term is undefined */
     {
         dst->error = -1; /* resulting sum of error terms is also undefined */
@@ -756,7 +1003,7 @@ int convertTUDarmstadtProblemInstanceToNativeFormat(lweInstance *lwe, const char
         }
         if(fscanf(f, "]\n"))
             return 1;
-        sampleBuf[i].col.hash = bkwColumnComputeHash(&sampleBuf[i], lwe->n, 0);
+        sampleBuf[i].col.hash = bkwColumnComputeHash(&sampleBuf[i], lwe->n, lwe->q, 0);
     }
     if(fscanf(f, "]\n"))
         return 1;
@@ -910,6 +1157,13 @@ void fileExtend(FILE *fp, u64 size)
     // rewind(fp);
 }
 
+// Truncates a file to a specified file size
+int fileTruncate(FILE *fp, u64 size)
+{
+    fflush(fp);
+    return ftruncate(fileno(fp), size);
+}
+
 int folderExists(const char *folderPath)
 {
     struct stat info;
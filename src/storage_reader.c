@@ -18,13 +18,15 @@
 #include "memory_utils.h"
 #include "storage_file_utilities.h"
 #include "position_values_2_category_index.h"
+#include "bkw_metrics.h"
 #include <inttypes.h>
 
 int storageReaderInitialize(storageReader *sr, const char *srcFolderName)
 {
     ASSERT(sr, "unexpected parameter");
     ASSERT(srcFolderName, "unexpected parameter");
-    strncpy(sr->srcFolderName, srcFolderName, 512);
+    strncpy(sr->srcFolderName, srcFolderName, sizeof(sr->srcFolderName) - 1);
+    sr->srcFolderName[sizeof(sr->srcFolderName) - 1] = 0;
     u64 numTotalSamples;
     int ret = sampleInfoFromFile(sr->srcFolderName, &sr->srcBkwStepPar, &sr->numCategories, &sr->categoryCapacity, &numTotalSamples, NULL);
     if (ret)
@@ -32,50 +34,90 @@ int storageReaderInitialize(storageReader *sr, const char *srcFolderName)
         return 1; /* could not read sample info file */
     }
     u64 categorySizeInBytes = sr->categoryCapacity * LWE_SAMPLE_SIZE_IN_BYTES;
-    sr->bufferCapacityNumCategories = APPROXIMATE_SIZE_IN_BYTES_OF_FILE_READER_BUFFER / categorySizeInBytes;
-    if (sr->bufferCapacityNumCategories < 3)
+    sr->bufferCapacityNumSamples = APPROXIMATE_SIZE_IN_BYTES_OF_FILE_READER_BUFFER / LWE_SAMPLE_SIZE_IN_BYTES;
+    if (sr->bufferCapacityNumSamples < 3 * sr->categoryCapacity)
     {
-        sr->bufferCapacityNumCategories = 3;
+        sr->bufferCapacityNumSamples = 3 * sr->categoryCapacity;
     }
-    if (sr->srcBkwStepPar.sorting == LMS)
+
+    /* category extents, all categories have the same capacity unless the sample info file has an offset table */
+    sr->categoryOffset = MALLOC((sr->numCategories + 1) * sizeof(u64));
+    if (!sr->categoryOffset)
+    {
+        return 8; /* could not allocate category offsets */
+    }
+    ret = sampleInfoCategoryOffsetsFromFile(srcFolderName, sr->numCategories, sr->categoryOffset);
+    if (ret == 3)
+    {
+        for (u64 i=0; i<=sr->numCategories; i++)
+        {
+            sr->categoryOffset[i] = i * sr->categoryCapacity;
+        }
+    }
+    else if (ret)
+    {
+        FREE(sr->categoryOffset);
+        return 9; /* could not read category offsets */
+    }
+    if (sr->bufferCapacityNumSamples > sr->categoryOffset[sr->numCategories])
+    {
+        sr->bufferCapacityNumSamples = sr->categoryOffset[sr->numCategories] ? sr->categoryOffset[sr->numCategories] : 1; /* entire file */
+    }
+
+    /* singleton categories, recomputed for folders written without them */
+    u64 singletons[MAX_NUM_SINGLETON_CATEGORIES];
+    int numSingletons;
+    if (sampleInfoSingletonsFromFile(srcFolderName, singletons, &numSingletons))
     {
         lweInstance lwe;
         lweParametersFromFile(&lwe, srcFolderName);
-        bkwStepParameters bkwStepPar;
-        if (sampleInfoFromFile(srcFolderName, &bkwStepPar, NULL, NULL, NULL, NULL))
+        numSingletons = singleton_categories(&lwe, &sr->srcBkwStepPar, singletons);
+        lweDestroy(&lwe);
+        if (numSingletons < 0)
         {
-            lweDestroy(&lwe);
-            return 2; /* could not get sample info */
+            FREE(sr->categoryOffset);
+            return 2; /* could not determine singleton categories */
         }
-        /* when reading lms-sorted samples we care about c = q/p + 1. */
-        /* whether c is even or odd determines the number and location of singleton categories. */
-        sr->c = lwe.q / bkwStepPar.sortingPar.LMS.p + 1;
+    }
+    sr->singletonBitmap = singletonBitmapCreate(sr->numCategories, singletons, numSingletons);
+    if (!sr->singletonBitmap)
+    {
+        FREE(sr->categoryOffset);
+        return 2; /* could not allocate singleton bitmap */
     }
 
     /* allocate container for sample counter (per category) */
     sr->numSamplesPerCategory = CALLOC(sr->numCategories, sizeof(u64)); /* calloc used to zero-initialize */
     if (!sr->numSamplesPerCategory)
     {
+        FREE(sr->singletonBitmap);
+        FREE(sr->categoryOffset);
         return 3; /* could not allocate num */
     }
     ret = sampleInfoFromFile(sr->srcFolderName, NULL, NULL, NULL, NULL, sr->numSamplesPerCategory);
     if (ret)
     {
+        FREE(sr->singletonBitmap);
+        FREE(sr->categoryOffset);
         return 4; /* could not read sample counts per category */
     }
 
     /* allocate read buffer */
-    u64 bufferSizeInBytes = sr->bufferCapacityNumCategories * categorySizeInBytes;
+    u64 bufferSizeInBytes = sr->bufferCapacityNumSamples * LWE_SAMPLE_SIZE_IN_BYTES;
     sr->buf = MALLOC(bufferSizeInBytes);
     if (!sr->buf)
     {
         FREE(sr->numSamplesPerCategory);
+        FREE(sr->singletonBitmap);
+        FREE(sr->categoryOffset);
         return 5; /* could not allocate buf */
     }
     sr->indexOfFirstCategoryInBuffer = 0;
     sr->numCategoriesInBuffer = 0;
     sr->currentCategoryIndex = 0;
     sr->totalNumCategoriesReadFromFile = 0;
+    sr->totalNumBytesReadFromFile = 0;
+    sr->readSeconds = 0;
 
     /* allocate mini buffer */
     sr->minibuf = MALLOC(categorySizeInBytes);
@@ -83,6 +125,8 @@ int storageReaderInitialize(storageReader *sr, const char *srcFolderName)
     {
         FREE(sr->numSamplesPerCategory);
         FREE(sr->buf);
+        FREE(sr->singletonBitmap);
+        FREE(sr->categoryOffset);
         return 6; /* could not allocate minibuf */
     }
 
@@ -93,6 +137,8 @@ int storageReaderInitialize(storageReader *sr, const char *srcFolderName)
         FREE(sr->numSamplesPerCategory);
         FREE(sr->buf);
         FREE(sr->minibuf);
+        FREE(sr->singletonBitmap);
+        FREE(sr->categoryOffset);
         return 7; /* could not open source file */
     }
 
@@ -101,29 +147,50 @@ int storageReaderInitialize(storageReader *sr, const char *srcFolderName)
 
 void storageReaderFree(storageReader *sr)
 {
+    bkwMetricsAddStorageReader(sr);
+    FREE(sr->singletonBitmap);
+    FREE(sr->categoryOffset);
     FREE(sr->numSamplesPerCategory);
     FREE(sr->buf);
     FREE(sr->minibuf);
     fclose(sr->f);
 }
 
-static size_t fillBuf(storageReader *sr, int numCategoriesToRead)
+/* read the categories following those in the buffer, as many whole categories as fit */
+static size_t fillBuf(storageReader *sr)
 {
-    if (feof(sr->f))
+    u64 first = sr->indexOfFirstCategoryInBuffer + sr->numCategoriesInBuffer;
+    if (first >= sr->numCategories)
     {
-        return 0; /* end of file reached */
+        return 0; /* all categories read */
     }
-    size_t numReadDestinationCategories = fread(sr->buf, LWE_SAMPLE_SIZE_IN_BYTES * sr->categoryCapacity, numCategoriesToRead, sr->f);
-    if ((numReadDestinationCategories != numCategoriesToRead) || ferror(sr->f))
+    u64 end = first + 1;
+    while (end < sr->numCategories && sr->categoryOffset[end + 1] - sr->categoryOffset[first] <= sr->bufferCapacityNumSamples)
     {
-        clearerr(sr->f);
+        end++;
     }
-    if (sr->numCategoriesInBuffer > 0)
+    double readBegin = bkwMetricsNow();
+    fseeko64(sr->f, sr->categoryOffset[first] * LWE_SAMPLE_SIZE_IN_BYTES, SEEK_SET);
+    size_t numRead = fread(sr->buf, LWE_SAMPLE_SIZE_IN_BYTES, sr->categoryOffset[end] - sr->categoryOffset[first], sr->f);
+    sr->readSeconds += bkwMetricsNow() - readBegin;
+    sr->totalNumBytesReadFromFile += numRead * LWE_SAMPLE_SIZE_IN_BYTES;
+    if ((numRead != sr->categoryOffset[end] - sr->categoryOffset[first]) || ferror(sr->f))
     {
-        sr->indexOfFirstCategoryInBuffer += sr->numCategoriesInBuffer;
+        clearerr(sr->f);
+        while (end > first && sr->categoryOffset[end] - sr->categoryOffset[first] > numRead)
+        {
+            end--; /* only whole categories */
+        }
     }
-    sr->numCategoriesInBuffer = numReadDestinationCategories;
-    return numReadDestinationCategories;
+    sr->indexOfFirstCategoryInBuffer = first;
+    sr->numCategoriesInBuffer = end - first;
+    return end - first;
+}
+
+/* start of a category in the buffer */
+static lweSample *categoryInBuf(storageReader *sr, u64 categoryIndex)
+{
+    return sr->buf + (sr->categoryOffset[categoryIndex] - sr->categoryOffset[sr->indexOfFirstCategoryInBuffer]);
 }
 
 int storageReaderGetNextAdjacentCategoryPair(storageReader *sr, lweSample **buf1, u64 *numSamplesInBuf1, lweSample **buf2, u64 *numSamplesInBuf2)
@@ -136,7 +203,7 @@ int storageReaderGetNextAdjacentCategoryPair(storageReader *sr, lweSample **buf1
     /* read from file if there are no categories available in the buffer */
     if (firstTimeReadingFromFile || exhaustedCategoriesInReadBuffer)
     {
-        u64 numCategoriesReadFromFile = fillBuf(sr, sr->bufferCapacityNumCategories);
+        u64 numCategoriesReadFromFile = fillBuf(sr);
         if (numCategoriesReadFromFile == 0)
         {
             *buf1 = *buf2 = NULL;
@@ -147,10 +214,9 @@ int storageReaderGetNextAdjacentCategoryPair(storageReader *sr, lweSample **buf1
 
     /* there is now at least one category available in the buffer (could be just one) */
 
-    if (is_singleton(&sr->srcBkwStepPar, sr->currentCategoryIndex, sr->numCategories))   /* singleton category */
+    if (singletonBitmapTest(sr->singletonBitmap, sr->currentCategoryIndex))   /* singleton category */
     {
-        u64 offsetInCategories = sr->currentCategoryIndex - sr->indexOfFirstCategoryInBuffer;
-        *buf1 = sr->buf + (offsetInCategories * sr->categoryCapacity); /* category 1 */
+        *buf1 = categoryInBuf(sr, sr->currentCategoryIndex); /* category 1 */
         *buf2 = NULL;                                               /* no category 2 */
         *numSamplesInBuf1 = sr->numSamplesPerCategory[sr->currentCategoryIndex];
         *numSamplesInBuf2 = 0;
@@ -161,31 +227,28 @@ int storageReaderGetNextAdjacentCategoryPair(storageReader *sr, lweSample **buf1
     u64 numCategoriesAvailableInBuf = sr->indexOfFirstCategoryInBuffer + sr->numCategoriesInBuffer - sr->currentCategoryIndex;
 
     /* return adjacent categories */
-    u64 offsetInCategories = sr->currentCategoryIndex - sr->indexOfFirstCategoryInBuffer;
     if (numCategoriesAvailableInBuf >= 2)   /* both adjacent categories available in buf */
     {
         /* two categories available in buf */
-        cat1 = sr->buf + (offsetInCategories * sr->categoryCapacity);
-        cat2 = cat1 + sr->categoryCapacity;
+        cat1 = categoryInBuf(sr, sr->currentCategoryIndex);
+        cat2 = categoryInBuf(sr, sr->currentCategoryIndex + 1);
     }
     else     /* only one category available in buf */
     {
         ASSERT(numCategoriesAvailableInBuf == 1, "unexpected number of available categories");
-        /* copy last remaining category to minibuf */
-        u64 categorySizeInBytes = sr->categoryCapacity * LWE_SAMPLE_SIZE_IN_BYTES;
-        cat1 = sr->buf + (offsetInCategories * sr->categoryCapacity);
-        MEMCPY(sr->minibuf, cat1, categorySizeInBytes);
+        /* copy the samples of the last remaining category to minibuf */
+        cat1 = categoryInBuf(sr, sr->currentCategoryIndex);
+        MEMCPY(sr->minibuf, cat1, sr->numSamplesPerCategory[sr->currentCategoryIndex] * LWE_SAMPLE_SIZE_IN_BYTES);
         /* reload buffer */
-        u64 numCategoriesReadFromFile = fillBuf(sr, sr->bufferCapacityNumCategories);
+        u64 numCategoriesReadFromFile = fillBuf(sr);
         if (numCategoriesReadFromFile == 0)
         {
             printf("*** storageReaderGetNextAdjacentCategoryPair_lms: error reading categories");
         }
         ASSERT(numCategoriesReadFromFile > 0, "could not categories from file read as expected");
         /* return buf1 from minibuf, buf2 from buf */
-        u64 offsetInCategories = sr->currentCategoryIndex + 1 - sr->indexOfFirstCategoryInBuffer;
         cat1 = sr->minibuf;
-        cat2 = sr->buf + (offsetInCategories * sr->categoryCapacity);
+        cat2 = categoryInBuf(sr, sr->currentCategoryIndex + 1);
     }
     *buf1 = cat1;
     *buf2 = cat2;
@@ -17,29 +17,82 @@
 #include "storage_writer.h"
 #include "memory_utils.h"
 #include "storage_file_utilities.h"
+#include "verify_samples.h"
+#include "bkw_metrics.h"
 #if !defined(STORAGE_WRITER_CACHE_SIZE_IN_BYTES)
 #include "physicalmemorysize.h"
 #endif
 #include <inttypes.h>
 
+/* sampled verification of new writers (see storageWriterSetDefaultVerification) */
+static u64 defaultVerificationRate = STORAGE_WRITER_VERIFICATION_RATE;
+static int defaultBackgroundVerification = STORAGE_WRITER_BACKGROUND_VERIFICATION;
+
+/* the offset table (numCategories + 1 prefix sums) of the sample info file, NULL for fixed-size categories */
+static u64 *categoryOffsetsForSampleInfo(storageWriter *sw)
+{
+    return sw->categoryOffsetFile[sw->numCategories] == sw->numCategories * sw->categoryCapacityFile ? NULL : sw->categoryOffsetFile;
+}
+
 int storageWriterInitialize(storageWriter *sw, const char *dstFolderName, lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 categoryCapacityFile)
 {
-    strncpy(sw->dstFolderName, dstFolderName, 512);
+    return storageWriterInitializeWithCapacities(sw, dstFolderName, lwe, bkwStepPar, categoryCapacityFile, NULL);
+}
+
+/* as storageWriterInitialize, but category i gets room for categoryCapacities[i] samples on file (if not NULL) */
+/* the category extents are recorded as an offset table in the sample info file, categoryCapacityFile is then ignored */
+int storageWriterInitializeWithCapacities(storageWriter *sw, const char *dstFolderName, lweInstance *lwe, bkwStepParameters *bkwStepPar, u64 categoryCapacityFile, const u64 *categoryCapacities)
+{
+    strncpy(sw->dstFolderName, dstFolderName, sizeof(sw->dstFolderName) - 1);
+    sw->dstFolderName[sizeof(sw->dstFolderName) - 1] = 0;
     sw->f = NULL; // handle to samples file
     sw->bkwStepPar = bkwStepPar;
     sw->numCategories = num_categories(lwe, sw->bkwStepPar); /* number of destination categories */
-    sw->categoryCapacityBuf = 2 * categoryCapacityFile;
-    sw->categoryCapacityFile = categoryCapacityFile;
+    sw->numSingletons = singleton_categories(lwe, sw->bkwStepPar, sw->singletons);
+    if (sw->numSingletons < 0)
+    {
+        return 7; /* could not determine the singleton categories */
+    }
     sw->totalNumSamplesProcessedByStorageWriter = 0;
     sw->totalNumSamplesCurrentlyInStorageWriter = 0;
     sw->totalNumSamplesAddedToStorageWriter = 0;
     sw->totalNumSamplesWrittenToFile = 0;
+    sw->totalNumDuplicatesDiscarded = 0;
+    sw->fingerprints = NULL;
+    sw->fingerprintSlotsPerCategory = 0;
+    sw->verifier = NULL;
+    sw->totalNumSamplesVerified = 0;
+    sw->totalNumVerificationErrors = 0;
+    sw->totalNumSamplesDiscardedCacheFull = 0;
+    sw->totalNumSamplesDiscardedCategoryFull = 0;
+    sw->totalNumSamplesReturned = 0;
+    sw->numFlushes = 0;
+    sw->totalNumBytesFlushed = 0;
+    sw->flushSeconds = 0;
+
+    /* category extents on file */
+    sw->categoryOffsetFile = MALLOC((sw->numCategories + 1) * sizeof(u64));
+    if (!sw->categoryOffsetFile)
+    {
+        return 11; /* failed to allocate category offsets */
+    }
+    u64 uniformCapacity = categoryCapacityFile;
+    categoryCapacityFile = categoryCapacities ? 0 : uniformCapacity; /* largest category */
+    sw->categoryOffsetFile[0] = 0;
+    for (u64 i=0; i<sw->numCategories; i++)
+    {
+        u64 capacity = categoryCapacities ? categoryCapacities[i] : uniformCapacity;
+        sw->categoryOffsetFile[i + 1] = sw->categoryOffsetFile[i] + capacity;
+        categoryCapacityFile = capacity > categoryCapacityFile ? capacity : categoryCapacityFile;
+    }
+    sw->categoryCapacityFile = categoryCapacityFile;
 
     /* allocate container for sample counter (per category) for buffer */
     sw->numStoredBuf = CALLOC(sw->numCategories, sizeof(u64)); /* CALLOC sets counters to zero */
     ASSERT(sw->numStoredBuf, "Allocation failed");
     if (!sw->numStoredBuf)   /* failed to allocate sample counter vector for storage buffer */
     {
+        FREE(sw->categoryOffsetFile);
         return 1;
     }
 
@@ -49,23 +102,29 @@ int storageWriterInitialize(storageWriter *sw, const char *dstFolderName, lweIns
     if (!sw->numStoredFile)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         return 2; /* failed to allocate sample counter vector for file storage */
     }
 
     /* allocate space for file writing buffer */
-    u64 categorySizeInBytes = categoryCapacityFile * LWE_SAMPLE_SIZE_IN_BYTES;
-    sw->numCategoriesInFileWritingBuffer = APPROXIMATE_SIZE_IN_BYTES_OF_FILE_WRITER_BUFFER / categorySizeInBytes;
-    if (sw->numCategoriesInFileWritingBuffer < 1)
+    sw->fileWritingBufferCapacity = APPROXIMATE_SIZE_IN_BYTES_OF_FILE_WRITER_BUFFER / LWE_SAMPLE_SIZE_IN_BYTES;
+    if (sw->fileWritingBufferCapacity > sw->categoryOffsetFile[sw->numCategories])
+    {
+        sw->fileWritingBufferCapacity = sw->categoryOffsetFile[sw->numCategories]; /* entire file */
+    }
+    if (sw->fileWritingBufferCapacity < categoryCapacityFile || !sw->fileWritingBufferCapacity)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         FREE(sw->numStoredFile);
         printf("ERROR: not enough space in FileWritingBuffer\n");
         return 3; /* probably a configuration error, file writing buffer holds very few categories */
     }
-    sw->fileWritingBuffer = MALLOC(sw->numCategoriesInFileWritingBuffer * categoryCapacityFile * LWE_SAMPLE_SIZE_IN_BYTES);
+    sw->fileWritingBuffer = MALLOC(sw->fileWritingBufferCapacity * LWE_SAMPLE_SIZE_IN_BYTES);
     if (!sw->fileWritingBuffer)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         FREE(sw->numStoredFile);
         return 4; /* failed to allocate file writing buffer */
     }
@@ -83,6 +142,48 @@ int storageWriterInitialize(storageWriter *sw, const char *dstFolderName, lweIns
     }
     sw->buf = MALLOC(sw->numCategories * sw->categoryCapacityBuf * LWE_SAMPLE_SIZE_IN_BYTES);
     ASSERT(sw->buf, "Allocation failed");
+
+    /* order samples within categories by sub-bucket, see subBucketIndexer */
+    sw->subBucketSortBuffer = NULL;
+    sw->subBucketCounts = NULL;
+    if (subBucketIndexerInitialize(&sw->subBuckets, lwe, sw->bkwStepPar))
+    {
+        FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
+        FREE(sw->numStoredFile);
+        FREE(sw->fileWritingBuffer);
+        FREE(sw->buf);
+        return 8; /* unsupported sub-bucket layout */
+    }
+    if (sw->subBuckets.numSubBuckets)
+    {
+        sw->subBucketSortBuffer = MALLOC(categoryCapacityFile * LWE_SAMPLE_SIZE_IN_BYTES);
+        sw->subBucketCounts = MALLOC((sw->subBuckets.numSubBuckets + 1) * sizeof(u64));
+        if (!sw->subBucketSortBuffer || !sw->subBucketCounts)
+        {
+            FREE(sw->numStoredBuf);
+            FREE(sw->categoryOffsetFile);
+            FREE(sw->numStoredFile);
+            FREE(sw->fileWritingBuffer);
+            FREE(sw->buf);
+            FREE(sw->subBucketSortBuffer);
+            FREE(sw->subBucketCounts);
+            return 9; /* failed to allocate sub-bucket sort buffer */
+        }
+    }
+#if STORAGE_WRITER_DEDUPLICATION
+    if (storageWriterEnableDeduplication(sw))
+    {
+        FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
+        FREE(sw->numStoredFile);
+        FREE(sw->fileWritingBuffer);
+        FREE(sw->buf);
+        FREE(sw->subBucketSortBuffer);
+        FREE(sw->subBucketCounts);
+        return 10; /* failed to allocate fingerprint sets */
+    }
+#endif
 //  double memUsed = sw->numCategories * sw->categoryCapacityBuf * LWE_SAMPLE_SIZE_IN_BYTES / 1024 / 1024 / (double)1024;
 //  printf("%.2f GB used for storage writer cache\n", memUsed);
 
@@ -91,9 +192,13 @@ int storageWriterInitialize(storageWriter *sw, const char *dstFolderName, lweIns
     if (ret)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         FREE(sw->numStoredFile);
         FREE(sw->fileWritingBuffer);
         FREE(sw->buf);
+        FREE(sw->subBucketSortBuffer);
+        FREE(sw->subBucketCounts);
+        FREE(sw->fingerprints);
         return 100 + ret; /* could not create destination folder */
     }
 
@@ -102,168 +207,472 @@ int storageWriterInitialize(storageWriter *sw, const char *dstFolderName, lweIns
     if (!sw->f)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         FREE(sw->numStoredFile);
         FREE(sw->fileWritingBuffer);
         FREE(sw->buf);
+        FREE(sw->subBucketSortBuffer);
+        FREE(sw->subBucketCounts);
+        FREE(sw->fingerprints);
         /* destination folder intentionally not deleted */
         /* lwe params intentionally not deleted */
         return 5; /* could not create destination sample file */
     }
-    fileExtend(sw->f, categoryCapacityFile * sw->numCategories * LWE_SAMPLE_SIZE_IN_BYTES);
+    fileExtend(sw->f, sw->categoryOffsetFile[sw->numCategories] * LWE_SAMPLE_SIZE_IN_BYTES);
 
     /* create sample info file */
-    ret = sampleInfoToFile(sw->dstFolderName, sw->bkwStepPar, sw->numCategories, sw->categoryCapacityFile, sw->totalNumSamplesWrittenToFile, sw->numStoredFile);
+    ret = sampleInfoToFile(sw->dstFolderName, sw->bkwStepPar, sw->numCategories, sw->categoryCapacityFile, sw->totalNumSamplesWrittenToFile, sw->singletons, sw->numSingletons, sw->numStoredFile, categoryOffsetsForSampleInfo(sw));
     if (ret)
     {
         FREE(sw->numStoredBuf);
+        FREE(sw->categoryOffsetFile);
         FREE(sw->numStoredFile);
         FREE(sw->fileWritingBuffer);
         FREE(sw->buf);
+        FREE(sw->subBucketSortBuffer);
+        FREE(sw->subBucketCounts);
+        FREE(sw->fingerprints);
         /* destination folder intentionally not deleted */
         /* lwe params intentionally not deleted */
         /* samples file intentionally not deleted */
         return 6; /* could not create sample info file */
     }
 
+    if (defaultVerificationRate && storageWriterEnableVerification(sw, lwe, defaultVerificationRate, defaultBackgroundVerification))
+    {
+        printf("*** storage writer: sampled verification not available\n"); /* optional, the samples are written anyway */
+    }
+
     return 0;
 }
 
-inline int storageWriterFlush(storageWriter *sw)
+/* allocates one fingerprint set per category, must be called before any sample is added */
+int storageWriterEnableDeduplication(storageWriter *sw)
 {
-//  printf("storageWriterFlush called at %6.02g%% load\n", storageWriterCurrentLoadPercentageCache(sw));
-    if (sw->totalNumSamplesCurrentlyInStorageWriter == 0)
+    if (sw->fingerprints)
     {
-        return 0; /* nothing to do, skip flushing */
+        return 0; /* already enabled */
+    }
+    if (sw->totalNumSamplesAddedToStorageWriter)
+    {
+        return 1; /* samples already added would be missing from the fingerprint sets */
+    }
+    u64 slots = 1;
+    while (slots < 2 * sw->categoryCapacityFile) /* load factor at most 1/2 */
+    {
+        slots <<= 1;
+    }
+    sw->fingerprints = CALLOC(sw->numCategories * slots, sizeof(u32)); /* zero marks an empty slot */
+    if (!sw->fingerprints)
+    {
+        return 2; /* failed to allocate fingerprint sets */
     }
+    sw->fingerprintSlotsPerCategory = slots;
+    return 0;
+}
 
-//  printf("tot %d %d\n", sw->totalNumSamplesCurrentlyInStorageWriter, sw->numCategoriesInFileWritingBuffer);
-    ASSERT(sw->numCategoriesInFileWritingBuffer > 0, "numCategoriesInFileWritingBuffer must be > 0");
+/* verifies every rate-th sample written by the writers initialized from now on (rate 0 disables the verification) */
+void storageWriterSetDefaultVerification(u64 rate, int background)
+{
+    defaultVerificationRate = rate;
+    defaultBackgroundVerification = background;
+}
 
-    u64 szInBytes = fileSize(sw->f);
-    u64 szInSamples = szInBytes / LWE_SAMPLE_SIZE_IN_BYTES;
-    u64 szInCategories = szInSamples / sw->categoryCapacityFile;
+void storageWriterGetDefaultVerification(u64 *rate, int *background)
+{
+    *rate = defaultVerificationRate;
+    *background = defaultBackgroundVerification;
+}
+
+static void verifierFree(storageWriterVerifier *v)
+{
+    categoryIndexerFree(&v->indexer);
+    FREE(v->batch[0]);
+    FREE(v->batch[1]);
+    FREE(v->batchCategory[0]);
+    FREE(v->batchCategory[1]);
+    FREE(v);
+}
+
+static void verifierFinish(storageWriter *sw);
 
-    /* flush to storage writer cache to file */
+/* verifies every rate-th sample written to file from now on, in batches on a background thread if requested
+   (replaces the current setting, rate 0 disables the verification) */
+int storageWriterEnableVerification(storageWriter *sw, lweInstance *lwe, u64 rate, int background)
+{
+    if (sw->verifier)
+    {
+        verifierFinish(sw);
+    }
+    if (!rate)
+    {
+        return 0;
+    }
+    storageWriterVerifier *v = CALLOC(1, sizeof(storageWriterVerifier));
+    if (!v)
+    {
+        return 2; /* failed to allocate verifier */
+    }
+    if (categoryIndexerInitialize(&v->indexer, lwe, sw->bkwStepPar))
+    {
+        FREE(v);
+        return 3; /* could not build category indexer */
+    }
+    v->lwe = lwe;
+    v->rate = rate;
+    v->next = rate - 1;
+    v->background = background;
+    if (background)
+    {
+        for (int b=0; b<2; b++)
+        {
+            v->batch[b] = MALLOC(STORAGE_WRITER_VERIFICATION_BATCH_SIZE * LWE_SAMPLE_SIZE_IN_BYTES);
+            v->batchCategory[b] = MALLOC(STORAGE_WRITER_VERIFICATION_BATCH_SIZE * sizeof(u64));
+        }
+        if (!v->batch[0] || !v->batch[1] || !v->batchCategory[0] || !v->batchCategory[1])
+        {
+            verifierFree(v);
+            return 2; /* failed to allocate verification batches */
+        }
+    }
+    sw->verifier = v;
+    return 0;
+}
 
-    /* set file position to beginning of file */
-    fseeko64(sw->f, 0L, SEEK_SET);
+static void *verifierMain(void *arg)
+{
+    storageWriterVerifier *v = arg;
+    int b = v->verifying;
+    for (u64 i=0; i<v->batchSize[b]; i++)
+    {
+        verifyOneSampleSortedWithIndexer(v->lwe, &v->batch[b][i], &v->indexer, &v->numIncorrectSums, &v->numIncorrectHashes, v->batchCategory[b][i], &v->numIncorrectCategoryClassifications, 0);
+    }
+    v->numSamplesVerified += v->batchSize[b];
+    v->batchSize[b] = 0;
+    return NULL;
+}
 
-    int oddBytes = szInBytes - (szInCategories * sw->categoryCapacityFile * LWE_SAMPLE_SIZE_IN_BYTES);
-    if (oddBytes)
+static void verifierJoin(storageWriterVerifier *v)
+{
+    if (v->threadRunning)
     {
-        printf("*** destinaton file seems to hold %" PRIu64 " categories (and %d additional bytes)\n", szInCategories, oddBytes);
+        pthread_join(v->thread, NULL);
+        v->threadRunning = 0;
     }
+}
 
-    u64 currentDestinationCategory = 0;
-    size_t numReadDestinationCategories;
-    u64 totalNumDestinationCategoriesRead = 0;
-    u64 numIterationsInReadLoop = 0;
-    lweSample *s = sw->buf;
-    _off64_t nextLastReadPosition = 0;
-    _off64_t lastReadPosition = 0;
-    do
+/* the thread verifies the filled batch while the other one is filled */
+static void verifierHandOff(storageWriterVerifier *v)
+{
+    verifierJoin(v);
+    v->verifying = v->current;
+    v->current = 1 - v->current;
+    v->threadRunning = !pthread_create(&v->thread, NULL, verifierMain, v);
+    if (!v->threadRunning)
     {
-        /* read categories from destination file */
-        nextLastReadPosition = lastReadPosition;
-        lastReadPosition = ftello64(sw->f);
-        if ((lastReadPosition - nextLastReadPosition) % (LWE_SAMPLE_SIZE_IN_BYTES * sw->categoryCapacityFile) != 0)
+        verifierMain(v); /* verify in this thread instead */
+    }
+}
+
+/* samples that have just been copied to a category on file */
+static void verifierAdd(storageWriterVerifier *v, lweSample *samples, u64 numSamples, u64 categoryIndex)
+{
+    u64 i;
+    for (i = v->next; i < numSamples; i += v->rate)
+    {
+        if (!v->background)
         {
-            printf("*** non-integral number of categories (div=%d, mod=%d)\n", (lastReadPosition - nextLastReadPosition) / (LWE_SAMPLE_SIZE_IN_BYTES * sw->categoryCapacityFile), (lastReadPosition - nextLastReadPosition) % (LWE_SAMPLE_SIZE_IN_BYTES * sw->categoryCapacityFile));
+            verifyOneSampleSortedWithIndexer(v->lwe, &samples[i], &v->indexer, &v->numIncorrectSums, &v->numIncorrectHashes, categoryIndex, &v->numIncorrectCategoryClassifications, 0);
+            v->numSamplesVerified++;
+            continue;
         }
-        if (lastReadPosition + LWE_SAMPLE_SIZE_IN_BYTES * sw->categoryCapacityFile * sw->numCategoriesInFileWritingBuffer > szInBytes)
+        int b = v->current;
+        MEMCPY(&v->batch[b][v->batchSize[b]], &samples[i], LWE_SAMPLE_SIZE_IN_BYTES);
+        v->batchCategory[b][v->batchSize[b]++] = categoryIndex;
+        if (v->batchSize[b] == STORAGE_WRITER_VERIFICATION_BATCH_SIZE)
         {
-//      printf("*** about to read too far ***\n");
+            verifierHandOff(v);
         }
+    }
+    v->next = i - numSamples;
+}
 
-        numReadDestinationCategories = fread(sw->fileWritingBuffer, LWE_SAMPLE_SIZE_IN_BYTES * sw->categoryCapacityFile, sw->numCategoriesInFileWritingBuffer, sw->f);
-        if (ferror(sw->f))
+/* waits for the verification of all selected samples and reports the outcome */
+static void verifierFinish(storageWriter *sw)
+{
+    storageWriterVerifier *v = sw->verifier;
+    verifierJoin(v);
+    if (v->batchSize[v->current])
+    {
+        v->verifying = v->current;
+        verifierMain(v);
+    }
+    sw->totalNumSamplesVerified += v->numSamplesVerified;
+    sw->totalNumVerificationErrors += v->numIncorrectSums + v->numIncorrectHashes + v->numIncorrectCategoryClassifications;
+    if (v->numIncorrectSums + v->numIncorrectHashes + v->numIncorrectCategoryClassifications)
+    {
+        printf("****** storage writer %s: %" PRIu64 " incorrect sums, %" PRIu64 " incorrect hashes and %" PRIu64 " incorrect category classifications in %" PRIu64 " verified samples\n",
+               sw->dstFolderName, v->numIncorrectSums, v->numIncorrectHashes, v->numIncorrectCategoryClassifications, v->numSamplesVerified);
+    }
+    verifierFree(v);
+    sw->verifier = NULL;
+}
+
+/* 64-bit fingerprint of (column, b), the column hash already covers the entire column */
+static inline u64 sampleFingerprint(lweSample *sample)
+{
+    u64 x = columnHash(sample) ^ ((u64)(unsigned short)sumWithError(sample) * 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+    x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+/* inserts the fingerprint of a sample into the set of its category, returns 1 if it was already there */
+static int fingerprintSetInsert(storageWriter *sw, u64 categoryIndex, lweSample *sample)
+{
+    u64 x = sampleFingerprint(sample);
+    u32 fp = (u32)x ? (u32)x : 1;
+    u64 mask = sw->fingerprintSlotsPerCategory - 1;
+    u32 *set = sw->fingerprints + categoryIndex * sw->fingerprintSlotsPerCategory;
+    for (u64 slot = (x >> 32) & mask; ; slot = (slot + 1) & mask)
+    {
+        if (set[slot] == fp)
         {
-            perror("error on read");
-            clearerr(sw->f);
+            return 1;
+        }
+        if (set[slot] == 0)
+        {
+            set[slot] = fp;
+            return 0;
+        }
+    }
+}
+
+/* removes samples from the cache of a category that duplicate a sample already in the category
+   (on file or earlier in the cache), returns the number of samples kept */
+static u64 removeDuplicates(storageWriter *sw, u64 categoryIndex, lweSample *samples, u64 numSamples)
+{
+    u64 numKept = 0;
+    for (u64 i=0; i<numSamples; i++)
+    {
+        if (fingerprintSetInsert(sw, categoryIndex, &samples[i]))
+        {
+            continue;
         }
+        if (numKept != i)
+        {
+            MEMCPY(&samples[numKept], &samples[i], LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+        numKept++;
+    }
+    sw->totalNumDuplicatesDiscarded += numSamples - numKept;
+    sw->totalNumSamplesCurrentlyInStorageWriter -= numSamples - numKept;
+    sw->totalNumSamplesAddedToStorageWriter -= numSamples - numKept;
+    return numKept;
+}
 
-        totalNumDestinationCategoriesRead += numReadDestinationCategories;
-        numIterationsInReadLoop++;
-//    printf("%" PRIu64 " read (total %" PRIu64 " read, tried to get %" PRIu64 ", iteration %" PRIu64 ")\n", numReadDestinationCategories, totalNumDestinationCategoriesRead, sw->numCategoriesInFileWritingBuffer, numIterationsInReadLoop);
+/* keeps a category (on file) ordered by sub-bucket: the first numSorted samples are already ordered and
+   the numNew samples appended after them are counting sorted on their sub-bucket and merged into them.
+   both steps are stable, so the samples within a sub-bucket stay in the order they were added */
+static void sortCategoryOnSubBuckets(storageWriter *sw, lweSample *category, u64 numSorted, u64 numNew)
+{
+    u64 *count = sw->subBucketCounts;
+    lweSample *run = sw->subBucketSortBuffer;
+    lweSample *newSamples = category + numSorted;
+    MEMSET(count, 0, (sw->subBuckets.numSubBuckets + 1) * sizeof(u64));
+    for (u64 i=0; i<numNew; i++)
+    {
+        count[subBucketIndexerKey(&sw->subBuckets, &newSamples[i]) + 1]++;
+    }
+    for (int k=0; k<sw->subBuckets.numSubBuckets; k++)
+    {
+        count[k + 1] += count[k];
+    }
+    for (u64 i=0; i<numNew; i++)
+    {
+        MEMCPY(&run[count[subBucketIndexerKey(&sw->subBuckets, &newSamples[i])]++], &newSamples[i], LWE_SAMPLE_SIZE_IN_BYTES);
+    }
 
-        u64 pos = ftello64(sw->f);
-        if (pos > szInBytes)
+    /* merge from the back, an already stored sample goes before a new one of the same sub-bucket */
+    u64 i = numSorted, j = numNew, k = numSorted + numNew;
+    while (j > 0)
+    {
+        if (i > 0 && subBucketIndexerKey(&sw->subBuckets, &category[i - 1]) > subBucketIndexerKey(&sw->subBuckets, &run[j - 1]))
+        {
+            MEMCPY(&category[--k], &category[--i], LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+        else
         {
-            printf("*** read too far (%" PRIu64 " bytes past end)\n", pos - szInBytes);
+            MEMCPY(&category[--k], &run[--j], LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+    }
+}
+
+/* if compact is set, the categories are written back to back (from the start of the file) instead of in place,
+   and the file is truncated to the samples written. the writer can not take more samples after that */
+static int flush(storageWriter *sw, int compact)
+{
+//  printf("storageWriterFlush called at %6.02g%% load\n", storageWriterCurrentLoadPercentageCache(sw));
+    if (sw->totalNumSamplesCurrentlyInStorageWriter == 0 && !compact)
+    {
+        return 0; /* nothing to do, skip flushing */
+    }
+    double flushBegin = bkwMetricsNow();
+
+    ASSERT(sw->fileWritingBufferCapacity >= sw->categoryCapacityFile, "file writing buffer must hold the largest category");
+
+    u64 szInBytes = fileSize(sw->f);
+    if (szInBytes != sw->categoryOffsetFile[sw->numCategories] * LWE_SAMPLE_SIZE_IN_BYTES)
+    {
+        printf("*** destinaton file holds %" PRIu64 " bytes (expected %" PRIu64 ")\n", szInBytes, sw->categoryOffsetFile[sw->numCategories] * LWE_SAMPLE_SIZE_IN_BYTES);
+    }
+
+    /* flush to storage writer cache to file, one range of whole categories at a time */
+    u64 currentDestinationCategory = 0;
+    u64 numSamplesCompacted = 0; /* file position (in samples) of the next compacted range */
+    lweSample *s = sw->buf;
+    while (currentDestinationCategory < sw->numCategories)
+    {
+        /* categories [currentDestinationCategory, endCategory) fit in the file writing buffer */
+        u64 *offset = sw->categoryOffsetFile;
+        u64 firstSample = offset[currentDestinationCategory];
+        u64 endCategory = currentDestinationCategory + 1;
+        while (endCategory < sw->numCategories && offset[endCategory + 1] - firstSample <= sw->fileWritingBufferCapacity)
+        {
+            endCategory++;
+        }
+        u64 numSamplesInRange = offset[endCategory] - firstSample;
+        u64 numCategoriesInRange = endCategory - currentDestinationCategory;
+
+        /* read categories from destination file */
+        fseeko64(sw->f, firstSample * LWE_SAMPLE_SIZE_IN_BYTES, SEEK_SET);
+        size_t numRead = fread(sw->fileWritingBuffer, LWE_SAMPLE_SIZE_IN_BYTES, numSamplesInRange, sw->f);
+        if (ferror(sw->f) || numRead != numSamplesInRange)
+        {
+            perror("error on read");
+            clearerr(sw->f);
         }
 
         /* copy samples from cache buffer to flush buffer */
-        lweSample *d = sw->fileWritingBuffer;
-        for (u64 i=0; i<numReadDestinationCategories; i++, currentDestinationCategory++)
+        for (; currentDestinationCategory<endCategory; currentDestinationCategory++)
         {
+            lweSample *d = sw->fileWritingBuffer + (offset[currentDestinationCategory] - firstSample);
+            u64 categoryCapacity = offset[currentDestinationCategory + 1] - offset[currentDestinationCategory];
+
+            /* discard duplicates before they take up room on file */
+            if (sw->fingerprints && sw->numStoredBuf[currentDestinationCategory])
+            {
+                sw->numStoredBuf[currentDestinationCategory] = removeDuplicates(sw, currentDestinationCategory, s, sw->numStoredBuf[currentDestinationCategory]);
+            }
 
             /* copy samples from  */
             u64 numSamplesToCopy = sw->numStoredBuf[currentDestinationCategory];
             u64 numInCurrentCategoryFile = sw->numStoredFile[currentDestinationCategory];
-            if (numSamplesToCopy + numInCurrentCategoryFile > sw->categoryCapacityFile)   /* all samples do not fit on file */
+            if (numSamplesToCopy + numInCurrentCategoryFile > categoryCapacity)   /* all samples do not fit on file */
             {
-                numSamplesToCopy = sw->categoryCapacityFile - numInCurrentCategoryFile; /* copy only the ones that fit */
+                numSamplesToCopy = categoryCapacity - numInCurrentCategoryFile; /* copy only the ones that fit */
                 printf("reduced from %" PRIu64 " to %" PRIu64 "\n", sw->numStoredBuf[currentDestinationCategory], numSamplesToCopy);
             }
             if (numSamplesToCopy > 0)
             {
                 MEMCPY(d + sw->numStoredFile[currentDestinationCategory], s, numSamplesToCopy * LWE_SAMPLE_SIZE_IN_BYTES); /* copy samples from current category*/
+                if (sw->verifier)
+                {
+                    verifierAdd(sw->verifier, d + sw->numStoredFile[currentDestinationCategory], numSamplesToCopy, currentDestinationCategory);
+                }
             }
             sw->totalNumSamplesCurrentlyInStorageWriter -= sw->numStoredBuf[currentDestinationCategory];
             sw->numStoredBuf[currentDestinationCategory] = 0;
             sw->numStoredFile[currentDestinationCategory] += numSamplesToCopy;
             sw->totalNumSamplesWrittenToFile += numSamplesToCopy;
+            if (numSamplesToCopy > 0 && sw->subBuckets.numSubBuckets)
+            {
+                sortCategoryOnSubBuckets(sw, d, sw->numStoredFile[currentDestinationCategory] - numSamplesToCopy, numSamplesToCopy);
+            }
 
             s = s + sw->categoryCapacityBuf;
-            d = d + sw->categoryCapacityFile;
         }
 
-        /* back up to previous read position */
-        fseeko64(sw->f, lastReadPosition, SEEK_SET);
-
         /* write adjusted buffer back to file (same position it was read from, but now with additional samples added) */
-        size_t written = fwrite(sw->fileWritingBuffer, sw->categoryCapacityFile * LWE_SAMPLE_SIZE_IN_BYTES, numReadDestinationCategories, sw->f);
+        u64 writePosition = firstSample;
+        u64 numToWrite = numRead;
+        if (compact)
+        {
+            /* move the samples of each category next to those of the previous one, only towards lower positions */
+            numToWrite = 0;
+            for (u64 i=endCategory-numCategoriesInRange; i<endCategory; i++)
+            {
+                memmove(sw->fileWritingBuffer + numToWrite, sw->fileWritingBuffer + (offset[i] - firstSample), sw->numStoredFile[i] * LWE_SAMPLE_SIZE_IN_BYTES);
+                numToWrite += sw->numStoredFile[i];
+            }
+            writePosition = numSamplesCompacted; /* never beyond the range just read */
+            numSamplesCompacted += numToWrite;
+        }
+        fseeko64(sw->f, writePosition * LWE_SAMPLE_SIZE_IN_BYTES, SEEK_SET);
+        size_t written = fwrite(sw->fileWritingBuffer, LWE_SAMPLE_SIZE_IN_BYTES, numToWrite, sw->f);
+        sw->totalNumBytesFlushed += written * LWE_SAMPLE_SIZE_IN_BYTES;
         if (ferror(sw->f))
         {
 //      perror("error on write");
             clearerr(sw->f);
         }
         fseeko64(sw->f, 0L, SEEK_CUR); /* necessary */
-        if (written != numReadDestinationCategories)
+    }
+
+    /* the categories are now stored densely, the offset table follows the number of samples stored */
+    if (compact)
+    {
+        for (u64 i=0; i<sw->numCategories; i++)
         {
-//      printf("%d categories written to file (expected %d)\n", written, numReadDestinationCategories);
+            sw->categoryOffsetFile[i + 1] = sw->categoryOffsetFile[i] + sw->numStoredFile[i];
         }
-        pos = ftello64(sw->f);
-        if (pos > szInBytes)
+        if (fileTruncate(sw->f, numSamplesCompacted * LWE_SAMPLE_SIZE_IN_BYTES))
         {
-            printf("*** wrote too far (%" PRIu64 " bytes past end)\n", pos - szInBytes);
+            return 2; /* could not truncate sample file */
         }
-//    printf("%d < %d - %d - %d \n", currentDestinationCategory, sw->numCategories, sw->totalNumSamplesCurrentlyInStorageWriter, sw->numCategoriesInFileWritingBuffer);
     }
-    while (currentDestinationCategory < sw->numCategories);
 
     /* (over)write sample info file */
-    int ret = sampleInfoToFile(sw->dstFolderName, sw->bkwStepPar, sw->numCategories, sw->categoryCapacityFile, sw->totalNumSamplesWrittenToFile, sw->numStoredFile);
+    int ret = sampleInfoToFile(sw->dstFolderName, sw->bkwStepPar, sw->numCategories, sw->categoryCapacityFile, sw->totalNumSamplesWrittenToFile, sw->singletons, sw->numSingletons, sw->numStoredFile, categoryOffsetsForSampleInfo(sw));
     if (ret)
     {
         return 1; /* could not overwrite sample info file */
     }
 
+    double flushDuration = bkwMetricsNow() - flushBegin;
+    sw->numFlushes++;
+    sw->flushSeconds += flushDuration;
+    bkwMetricsStreamFlush(sw, flushDuration);
+
 //  printf(" (after flush, file storage at %6.02g%% load)\n", storageWriterCurrentLoadPercentageFile(sw));
     return 0;
 }
 
+inline int storageWriterFlush(storageWriter *sw)
+{
+    return flush(sw, 0);
+}
+
 int storageWriterFree(storageWriter *sw)
 {
-    int ret = storageWriterFlush(sw);
+    int ret = flush(sw, STORAGE_WRITER_DENSE_CATEGORIES); /* last flush */
     if (ret)
     {
         return ret;
     }
+    if (sw->verifier)
+    {
+        verifierFinish(sw);
+    }
+    bkwMetricsAddStorageWriter(sw);
     FREE(sw->buf);
     FREE(sw->numStoredBuf);
     FREE(sw->numStoredFile);
+    FREE(sw->categoryOffsetFile);
     FREE(sw->fileWritingBuffer);
+    FREE(sw->subBucketSortBuffer);
+    FREE(sw->subBucketCounts);
+    FREE(sw->fingerprints);
     fclose(sw->f);
     return 0;
 }
@@ -271,7 +680,8 @@ int storageWriterFree(storageWriter *sw)
 inline int storageWriterHasRoom(storageWriter *sw, u64 categoryIndex)
 {
     /* check if there is room for this sample on file and in cache */
-    if (sw->numStoredBuf[categoryIndex] + sw->numStoredFile[categoryIndex] < sw->categoryCapacityFile)   /* if there is room on disk (after flush) */
+    u64 categoryCapacityFile = sw->categoryOffsetFile[categoryIndex + 1] - sw->categoryOffsetFile[categoryIndex];
+    if (sw->numStoredBuf[categoryIndex] + sw->numStoredFile[categoryIndex] < categoryCapacityFile)   /* if there is room on disk (after flush) */
     {
 
         if (sw->numStoredBuf[categoryIndex] < sw->categoryCapacityBuf - 1)   /* if there is room in storage writer cache */
@@ -313,12 +723,18 @@ inline lweSample *storageWriterAddSample(storageWriter *sw, u64 categoryIndex, i
         lweSample *s = sw->buf + (categoryIndex * sw->categoryCapacityBuf) + sw->numStoredBuf[categoryIndex];
         sw->numStoredBuf[categoryIndex] = sw->numStoredBuf[categoryIndex] + 1;
         return s; /* return reserved memory area for sample */
+    case 2:
+        sw->totalNumSamplesDiscardedCacheFull++;
+        break;
+    default:
+        sw->totalNumSamplesDiscardedCategoryFull++;
     }
     return NULL; /* no room for sample */
 }
 
 inline void storageWriterUndoAddSample(storageWriter *sw, u64 categoryIndex)
 {
+    sw->totalNumSamplesReturned++;
     sw->totalNumSamplesCurrentlyInStorageWriter--;
     sw->totalNumSamplesAddedToStorageWriter--;
     sw->numStoredBuf[categoryIndex] = sw->numStoredBuf[categoryIndex] - 1;
@@ -331,12 +747,12 @@ double storageWriterCurrentLoadPercentageCache(storageWriter *sw)
 
 double storageWriterCurrentLoadPercentageFile(storageWriter *sw)
 {
-    return 100 * sw->totalNumSamplesWrittenToFile / (double)(sw->categoryCapacityFile * sw->numCategories);
+    return 100 * sw->totalNumSamplesWrittenToFile / (double)sw->categoryOffsetFile[sw->numCategories];
 }
 
 double storageWriterCurrentLoadPercentage(storageWriter *sw)
 {
-    return 100 * (sw->totalNumSamplesAddedToStorageWriter) / (double)(sw->categoryCapacityFile * sw->numCategories);
+    return 100 * (sw->totalNumSamplesAddedToStorageWriter) / (double)sw->categoryOffsetFile[sw->numCategories];
 }
 
 // void storageWriterPrint(storageWriter *sw)
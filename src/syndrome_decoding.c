@@ -19,68 +19,64 @@
 #include "workplace_localization.h"
 #include "storage_file_utilities.h"
 
-static struct
-{
-    int q;
-    codingType ct;
-    union
-    {
-        intpair *_2;
-        inttriplet *_3;
-        intquad *_4;
-    } table;
-} syndrome_repo = { .q = -1, .ct = blockCode_21, .table._2 = NULL };
+static syndromeDecodingTable syndrome_repo = { .q = -1, .ct = blockCode_21, .table._2 = NULL };
 
-/* check if corresponding syndrome table has been already been loaded (read from file into memory buffer) */
-int is_syndrome_decoding_table_loaded(int q, codingType ct)
+/* check if the syndrome table sdt can be used for decoding with parameters q and ct */
+static int syndrome_decoding_table_matches(const syndromeDecodingTable *sdt, int q, codingType ct)
 {
-    if (syndrome_repo.q != q) return 0;
+    if (sdt->q != q) return 0;
     if (ct == concatenatedCode_21_21)
     {
-        if (syndrome_repo.ct != blockCode_21) return 0; /* concatenatedCode_21_21 uses tables for [2,1] block code */
+        if (sdt->ct != blockCode_21) return 0; /* concatenatedCode_21_21 uses tables for [2,1] block code */
     }
     else
     {
-        if (syndrome_repo.ct != ct) return 0;
+        if (sdt->ct != ct) return 0;
     }
     switch (ct)
     {
     case blockCode_21:
-        return syndrome_repo.table._2 != NULL;
+        return sdt->table._2 != NULL;
     case blockCode_31:
-        return syndrome_repo.table._3 != NULL;
+        return sdt->table._3 != NULL;
     case blockCode_41:
-        return syndrome_repo.table._4 != NULL;
+        return sdt->table._4 != NULL;
     case concatenatedCode_21_21:
-        return syndrome_repo.table._2 != NULL;
+        return sdt->table._2 != NULL;
     default: ; /* intentionally left blank */
     }
-    ASSERT_ALWAYS("unhandled case in is_syndrome_decoding_table_loaded (all coding types listed?)");
+    ASSERT_ALWAYS("unhandled case in syndrome_decoding_table_matches (all coding types listed?)");
     return 0;
 }
 
-static void free_current_syndrome_table(void)
+/* check if corresponding syndrome table has been already been loaded (read from file into memory buffer) */
+int is_syndrome_decoding_table_loaded(int q, codingType ct)
+{
+    return syndrome_decoding_table_matches(&syndrome_repo, q, ct);
+}
+
+void syndrome_decoding_table_free(syndromeDecodingTable *sdt)
 {
-    if (syndrome_repo.q == -1) return; /* no syndrome table loaded */
-    switch (syndrome_repo.ct)
+    if (sdt->q == -1) return; /* no syndrome table loaded */
+    switch (sdt->ct)
     {
     case concatenatedCode_21_21: /* intentional fall-through */
     case blockCode_21:
-        FREE(syndrome_repo.table._2);
-        syndrome_repo.table._2 = NULL;
+        FREE(sdt->table._2);
+        sdt->table._2 = NULL;
         break;
     case blockCode_31:
-        FREE(syndrome_repo.table._3);
-        syndrome_repo.table._3 = NULL;
+        FREE(sdt->table._3);
+        sdt->table._3 = NULL;
         break;
     case blockCode_41:
-        FREE(syndrome_repo.table._4);
-        syndrome_repo.table._4 = NULL;
+        FREE(sdt->table._4);
+        sdt->table._4 = NULL;
         break;
     default:
-        ASSERT_ALWAYS("unhandled case in is_syndrome_decoding_table_loaded (all coding types listed?)");
+        ASSERT_ALWAYS("unhandled case in syndrome_decoding_table_free (all coding types listed?)");
     }
-    syndrome_repo.q = -1;
+    sdt->q = -1;
 }
 
 static void intpairs_from_file_2_buf(FILE *f, intpair *buf, int numTableEntriesToRead)
@@ -119,7 +115,8 @@ static void intquads_from_file_2_buf(FILE *f, intquad *buf, int numTableEntriesT
     ASSERT(rd == numTableEntriesToRead, "Read from file not complete!\n");
 }
 
-int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNotExist)
+/* read the syndrome decoding table for q and ct from file into sdt (owned by the caller, free with syndrome_decoding_table_free) */
+int syndrome_decoding_table_read(syndromeDecodingTable *sdt, int q, codingType ct, int generateIfFileDoesNotExist)
 {
     char fileName[256];
     FILE *f;
@@ -127,14 +124,8 @@ int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNot
     int bl; /* block length */
     int ml; /* message length */
 
-    /* check if (correct) syndrome table is already loaded into memory */
-    if (is_syndrome_decoding_table_loaded(q, ct))
-    {
-        return 0; /* this syndrome table is already loaded and ready to use */
-    }
-
-    /* free currently loaded syndrome table (in case another one was loaded previously) */
-    free_current_syndrome_table();
+    sdt->q = -1;
+    sdt->table._2 = NULL;
 
     /* make sure that there is a suitable syndrome decoding table on file */
     if (!is_syndrome_decoding_table_generated(q, ct))
@@ -175,6 +166,7 @@ int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNot
         break;
     default:
         ASSERT_ALWAYS("unhandled case in load_syndrome_table (all coding types listed?)");
+        return 3; /* unsupported coding type */
     }
     sprintf(fileName, LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A LOCAL_PATH_DELIMITER "syndrome_decoding_table_%d%d_%d.dat", bl, ml, q);
     f = fopen(fileName, "rb");
@@ -189,31 +181,45 @@ int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNot
     {
     case concatenatedCode_21_21: /* intentional fall-though */
     case blockCode_21:
-        syndrome_repo.ct = blockCode_21;
-        syndrome_repo.table._2 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
-        ASSERT(syndrome_repo.table._2, "Allocation failed!\n");
-        intpairs_from_file_2_buf(f, syndrome_repo.table._2, tableSize); /* read syndrome table from file into buffer */
+        sdt->ct = blockCode_21;
+        sdt->table._2 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
+        ASSERT(sdt->table._2, "Allocation failed!\n");
+        intpairs_from_file_2_buf(f, sdt->table._2, tableSize); /* read syndrome table from file into buffer */
         break;
     case blockCode_31:
-        syndrome_repo.ct = blockCode_31;
-        syndrome_repo.table._3 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
-        ASSERT(syndrome_repo.table._3, "Allocation failed!\n");
-        inttriplets_from_file_2_buf(f, syndrome_repo.table._3, tableSize); /* read syndrome table from file into buffer */
+        sdt->ct = blockCode_31;
+        sdt->table._3 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
+        ASSERT(sdt->table._3, "Allocation failed!\n");
+        inttriplets_from_file_2_buf(f, sdt->table._3, tableSize); /* read syndrome table from file into buffer */
         break;
     case blockCode_41:
-        syndrome_repo.ct = blockCode_41;
-        syndrome_repo.table._4 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
-        ASSERT(syndrome_repo.table._4, "Allocation failed!\n");
-        intquads_from_file_2_buf(f, syndrome_repo.table._4, tableSize); /* read syndrome table from file into buffer */
+        sdt->ct = blockCode_41;
+        sdt->table._4 = MALLOC(tableSize * entrySize); /* allocate memory for syndrome table buffer p */
+        ASSERT(sdt->table._4, "Allocation failed!\n");
+        intquads_from_file_2_buf(f, sdt->table._4, tableSize); /* read syndrome table from file into buffer */
         break;
     default:
         ASSERT_ALWAYS("unhandled case in load_syndrome_table (all coding types listed?)");
     }
-    syndrome_repo.q = q;
+    sdt->q = q;
     fclose(f);
     return 0; /* syndrome decoding table successfully loaded into memory */
 }
 
+int load_syndrome_decoding_table(int q, codingType ct, int generateIfFileDoesNotExist)
+{
+    /* check if (correct) syndrome table is already loaded into memory */
+    if (is_syndrome_decoding_table_loaded(q, ct))
+    {
+        return 0; /* this syndrome table is already loaded and ready to use */
+    }
+
+    /* free currently loaded syndrome table (in case another one was loaded previously) */
+    syndrome_decoding_table_free(&syndrome_repo);
+
+    return syndrome_decoding_table_read(&syndrome_repo, q, ct, generateIfFileDoesNotExist);
+}
+
 void freeSyndromeTables2(intpair *syndrome_table)
 {
     if (syndrome_table)
@@ -498,41 +504,51 @@ int is_code_word_4_1(int q, int a1, int a2, int a3, int a4)
     return syndrome_4_1(NULL, NULL, NULL, q, g2fromq_4(q), g3fromq_4(q), g4fromq_4(q), a1, a2, a3, a4) == 0;
 }
 
-void closest_code_word_2_1(int *c1, int *c2, int q, int a1, int a2)
+void closest_code_word_2_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int q, int a1, int a2)
 {
     int syndrome = syndrome_2_1(q, g2fromq_2(q), a1, a2);
     int e1, e2; /* error vector */
-    ASSERT(is_syndrome_decoding_table_loaded(q, blockCode_21), "syndrome table not loaded ([21]-code)");
-    e1 = syndrome_repo.table._2[syndrome].t1;
-    e2 = syndrome_repo.table._2[syndrome].t2;
+    ASSERT(syndrome_decoding_table_matches(sdt, q, blockCode_21), "syndrome table not loaded ([21]-code)");
+    e1 = sdt->table._2[syndrome].t1;
+    e2 = sdt->table._2[syndrome].t2;
     *c1 = (a1 - e1 + q) % q;
     *c2 = (a2 - e2 + q) % q;
     ASSERT(is_code_word_2_1(q, *c1, *c2), "Not a code word!\n");
 }
 
-void closest_code_word_3_1(int *c1, int *c2, int *c3, int q, int a1, int a2, int a3)
+void closest_code_word_2_1(int *c1, int *c2, int q, int a1, int a2)
+{
+    closest_code_word_2_1_from_table(&syndrome_repo, c1, c2, q, a1, a2);
+}
+
+void closest_code_word_3_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int *c3, int q, int a1, int a2, int a3)
 {
     int syndrome = syndrome_3_1(NULL, NULL, q, g2fromq_3(q), g3fromq_3(q), a1, a2, a3);
     int e1, e2, e3; /* error vector */
-    ASSERT(is_syndrome_decoding_table_loaded(q, blockCode_31), "syndrome table for 31-code not loaded");
-    e1 = syndrome_repo.table._3[syndrome].t1;
-    e2 = syndrome_repo.table._3[syndrome].t2;
-    e3 = syndrome_repo.table._3[syndrome].t3;
+    ASSERT(syndrome_decoding_table_matches(sdt, q, blockCode_31), "syndrome table for 31-code not loaded");
+    e1 = sdt->table._3[syndrome].t1;
+    e2 = sdt->table._3[syndrome].t2;
+    e3 = sdt->table._3[syndrome].t3;
     *c1 = (a1 - e1 + q) % q;
     *c2 = (a2 - e2 + q) % q;
     *c3 = (a3 - e3 + q) % q;
     ASSERT(is_code_word_3_1(q, *c1, *c2, *c3), "Not a code word!\n");
 }
 
-void closest_code_word_4_1(int *c1, int *c2, int *c3, int *c4, int q, int a1, int a2, int a3, int a4)
+void closest_code_word_3_1(int *c1, int *c2, int *c3, int q, int a1, int a2, int a3)
+{
+    closest_code_word_3_1_from_table(&syndrome_repo, c1, c2, c3, q, a1, a2, a3);
+}
+
+void closest_code_word_4_1_from_table(const syndromeDecodingTable *sdt, int *c1, int *c2, int *c3, int *c4, int q, int a1, int a2, int a3, int a4)
 {
     int syndrome = syndrome_4_1(NULL, NULL, NULL, q, g2fromq_4(q), g3fromq_4(q), g4fromq_4(q), a1, a2, a3, a4);
     int e1, e2, e3, e4; /* error vector */
-    ASSERT(is_syndrome_decoding_table_loaded(q, blockCode_41), "syndrome table for 41-code not loaded");
-    e1 = syndrome_repo.table._4[syndrome].t1;
-    e2 = syndrome_repo.table._4[syndrome].t2;
-    e3 = syndrome_repo.table._4[syndrome].t3;
-    e4 = syndrome_repo.table._4[syndrome].t4;
+    ASSERT(syndrome_decoding_table_matches(sdt, q, blockCode_41), "syndrome table for 41-code not loaded");
+    e1 = sdt->table._4[syndrome].t1;
+    e2 = sdt->table._4[syndrome].t2;
+    e3 = sdt->table._4[syndrome].t3;
+    e4 = sdt->table._4[syndrome].t4;
     *c1 = (a1 - e1 + q) % q;
     *c2 = (a2 - e2 + q) % q;
     *c3 = (a3 - e3 + q) % q;
@@ -541,6 +557,11 @@ void closest_code_word_4_1(int *c1, int *c2, int *c3, int *c4, int q, int a1, in
     ASSERT(is_code_word_4_1(q, *c1, *c2, *c3, *c4), "Not a code word!\n");
 }
 
+void closest_code_word_4_1(int *c1, int *c2, int *c3, int *c4, int q, int a1, int a2, int a3, int a4)
+{
+    closest_code_word_4_1_from_table(&syndrome_repo, c1, c2, c3, c4, q, a1, a2, a3, a4);
+}
+
 int generate_syndrome_decoding_table_2_1_code(int q)
 {
     char fileName[256];
@@ -553,6 +574,13 @@ int generate_syndrome_decoding_table_2_1_code(int q)
     sprintf(fileName, "%s/syndrome_decoding_table_21_%d.dat", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A, q);
     f = fopen(fileName, "wb");
     ASSERT(f, "Could not open output file!\n");
+    if (!f)
+    {
+        FREE(t);
+        FREE(minvar);
+        FREE(num);
+        return 2; /* could not open table file */
+    }
     ASSERT(num, "Could not allocate num!\n");
     ASSERT(minvar, "Could not allocate minvar!\n");
     ASSERT(t, "Could not allocate t!\n");
@@ -599,7 +627,7 @@ int generate_syndrome_decoding_table_2_1_code(int q)
     FREE(t);
     FREE(minvar);
     FREE(num);
-    return 0;
+    return wr == q ? 0 : 3; /* 3 if the table was not completely written */
 }
 
 int generate_syndrome_decoding_table_3_1_code(int q)
@@ -615,6 +643,13 @@ int generate_syndrome_decoding_table_3_1_code(int q)
     sprintf(fileName, "%s/syndrome_decoding_table_31_%d.dat", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A, q);
     f = fopen(fileName, "wb");
     ASSERT(f, "Could not open output file!\n");
+    if (!f)
+    {
+        FREE(t);
+        FREE(minvar);
+        FREE(num);
+        return 2; /* could not open table file */
+    }
 
     ASSERT(num, "Could not allocate num!\n");
     ASSERT(minvar, "Could not allocate minvar!\n");
@@ -669,7 +704,7 @@ int generate_syndrome_decoding_table_3_1_code(int q)
     FREE(t);
     FREE(minvar);
     FREE(num);
-    return 0;
+    return wr == numSyndromes ? 0 : 3; /* 3 if the table was not completely written */
 }
 
 int generate_syndrome_decoding_table_4_1_code(int q, int maxComponentError)
@@ -692,6 +727,12 @@ int generate_syndrome_decoding_table_4_1_code(int q, int maxComponentError)
     sprintf(fileName, "%s/syndrome_decoding_table_41_%d.dat", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A, q);
     f = fopen(fileName, "wb");
     ASSERT(f, "Could not open output file!\n");
+    if (!f)
+    {
+        FREE(t);
+        FREE(minvar);
+        return 2; /* could not open table file */
+    }
 
     ASSERT(minvar, "Could not allocate minvar!\n");
     ASSERT(t, "Could not allocate t!\n");
@@ -767,7 +808,7 @@ int generate_syndrome_decoding_table_4_1_code(int q, int maxComponentError)
 
     FREE(t);
     FREE(minvar);
-    return 0;
+    return wr == numSyndromes ? 0 : 3; /* 3 if the table was not completely written */
 }
 
 // Check if the syndrome table has been already generated
@@ -789,6 +830,7 @@ int is_syndrome_decoding_table_generated(int q, codingType ct)
         break;
     default:
         ASSERT_ALWAYS("coding type not handled (all types listed?)");
+        return 0; /* no table for this coding type */
     }
     sprintf(fileName, "%s/syndrome_decoding_table_%d%d_%d.dat", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A, bl, 1, q);
     return fileExists(fileName);
@@ -24,6 +24,7 @@
 #include "log_utils.h"
 #include "string_utils.h"
 #include "storage_file_utilities.h"
+#include "bkw_metrics.h"
 
 int transition_bkw_step(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, u64 *numSamplesStored, time_t start)
 {
@@ -37,6 +38,9 @@ int transition_bkw_step(const char *srcFolderName, const char *dstFolderName, bk
         return 100; /* reduction step already performed (destination folder already exists) */
     }
 
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, dstFolderName);
+
     switch (srcBkwStepPar->sorting)
     {
 
@@ -50,8 +54,8 @@ int transition_bkw_step(const char *srcFolderName, const char *dstFolderName, bk
         case 3:
             ret = transition_bkw_step_plain_bkw_3_positions(srcFolderName, dstFolderName, srcBkwStepPar, dstBkwStepPar, numSamplesStored, start);
             break;
-        default:
-            ASSERT_ALWAYS("unsupported number of bkw positions detected in transition_bkw_step");
+        default: /* generic mixed-radix layout, the same as for LMS */
+            ret = transition_bkw_step_lms(srcFolderName, dstFolderName, srcBkwStepPar, dstBkwStepPar, numSamplesStored, start);
         }
         break;
 
@@ -74,6 +78,8 @@ int transition_bkw_step(const char *srcFolderName, const char *dstFolderName, bk
         ASSERT_ALWAYS("unsupported sorting detected in transition_bkw_step");
     }
 
+    bkwMetricsEnd(&metrics);
+
     if (ret)   /* catch errors thrown in bkw reduction step */
     {
         timeStamp(start);
@@ -86,6 +92,13 @@ int transition_bkw_step(const char *srcFolderName, const char *dstFolderName, bk
         printf("%s reduction completed\n", sortingAsString(dstBkwStepPar->sorting));
         timeStamp(start);
         printf("%s samples stored\n", sprintf_u64_delim(s, *numSamplesStored));
+        char fileName[512];
+        metricsFileName(fileName, dstFolderName);
+        if (bkwMetricsToFile(&metrics, fileName))
+        {
+            timeStamp(start);
+            printf("*** could not write %s\n", fileName);
+        }
     }
 
     return ret;
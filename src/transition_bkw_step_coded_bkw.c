@@ -26,7 +26,7 @@
 #include "config_bkw.h"
 #include <math.h>
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -38,7 +38,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     {
         p01[i] = (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i) + q) % q;
     }
-    u64 categoryIndex = position_values_2_category_index_coded_bkw(lwe, dstBkwStepPar, p01);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -60,7 +60,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     {
         newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i) + q) % q;
     }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
+    newSample->col.hash = columnHashAdd(columnHash(sample1), columnHash(sample2), q);
     int err1 = error(sample1);
     int err2 = error(sample2);
     newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2 + q) % q; /* undefined if either parent error term is undefined */
@@ -76,7 +76,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -88,7 +88,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     {
         p01[i] = (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i)) % q;
     }
-    u64 categoryIndex = position_values_2_category_index_coded_bkw(lwe, dstBkwStepPar, p01);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -107,15 +107,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (add), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) + sumWithError(sample2)) % q;
+    lweSampleAdd(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -153,7 +145,7 @@ static void flushStorageWriterIfCloseToFull(storageWriter *sw, time_t start)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -169,13 +161,13 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int n
     for (int i=1; i<numSamplesInCategory; i++)
     {
         sample = &category[i];
-        numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+        numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
     }
     flushStorageWriterIfCloseToFull(sw, start);
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -189,13 +181,13 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
         for (int i=1; i<numSamplesInCategory1; i++)
         {
             sample = &category1[i];
-            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
             sample = &category2[i];
-            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -207,7 +199,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
             for (int i=1; i<numSamplesInCategory2; i++)
             {
                 sample = &category2[i];
-                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
             }
         }
     }
@@ -215,7 +207,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
     return numProcessed;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, int flush, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, int flush, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -228,7 +220,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
             sample2 = &category[j];
-            numProcessed += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 if (flush)
@@ -246,7 +238,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -255,7 +247,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -263,7 +255,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory - numProcessed, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory - numProcessed, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -277,7 +269,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
         for (int j=0; j<numSamplesInCategory2; j++)
         {
             sample2 = &category2[j];
-            numProcessed += addSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += addSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -290,7 +282,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
 }
 
 /* TODO: improve compatibility checking (should include q, could include checking for an existing decoding table, or computing one if this is easy enough in practice in terms of time and space) */
-static int coded_bkw_supports_given_parameters(lweInstance *lwe, bkwStepParameters *srcBkwStepPar)
+static int coded_bkw_supports_given_parameters(bkwStepParameters *srcBkwStepPar)
 {
     if (srcBkwStepPar->sorting != codedBKW)
     {
@@ -341,15 +333,25 @@ int transition_bkw_step_coded_bkw(const char *srcFolderName, const char *dstFold
     char nc[256], cc[256], ns[256];
     timeStamp(start);
     printf("transition_bkw_step_coded_bkw: num src categories is %s, category capacity is %s, total num src samples is %s (%5.2f%% full)\n", sprintf_u64_delim(nc, srcNumCategories), sprintf_u64_delim(cc, srcCategoryCapacity), sprintf_u64_delim(ns, srcNumTotalSamples), 100*srcNumTotalSamples/(double)(srcNumCategories * srcCategoryCapacity));
-    if (!coded_bkw_supports_given_parameters(&lwe, srcBkwStepPar))
+    if (!coded_bkw_supports_given_parameters(srcBkwStepPar))
     {
         return 2; /* unexpected sample sorting at src folder */
     }
 
+    /* build the category index tables of the destination step once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("could not initialize category indexer");
+        return 5; /* could not initialize category indexer */
+    }
+
     /* initialize storage reader */
     storageReader sr;
     if (storageReaderInitialize(&sr, srcFolderName))
     {
+        categoryIndexerFree(&ci);
         ASSERT_ALWAYS("could not initialize storage reader");
         return 3; /* could not initialize storage reader */
     }
@@ -364,6 +366,7 @@ int transition_bkw_step_coded_bkw(const char *srcFolderName, const char *dstFold
     storageWriter sw;
     if (storageWriterInitialize(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity /* categoryCapacityFile same as in src file */))
     {
+        categoryIndexerFree(&ci);
         ASSERT_ALWAYS("could not initialize storage writer");
         return 4; /* could not initialize storage writer */
     }
@@ -388,12 +391,12 @@ int transition_bkw_step_coded_bkw(const char *srcFolderName, const char *dstFold
             {
             case 1: /* single category (no corresponding category is additive inverse) */
                 ASSERT(buf1, "unexpected parameter");
-                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, &ci, start);
                 break;
             case 2: /* two categories (additive inverses) */
                 ASSERT(buf1, "unexpected parameter");
                 ASSERT(buf2, "unexpected parameter");
-                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, &ci, start);
                 break;
             default:
                 timeStamp(start);
@@ -405,12 +408,12 @@ int transition_bkw_step_coded_bkw(const char *srcFolderName, const char *dstFold
             {
             case 1: /* single category (no corresponding category is additive inverse) */
                 ASSERT(buf1, "unexpected parameter");
-                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory, 1, start);
+                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory, 1, start);
                 break;
             case 2:  /* two meta categories (first two coordinates are additive inverses) */
                 ASSERT(buf1, "unexpected parameter");
                 ASSERT(buf2, "unexpected parameter");
-                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, 2*maxNumSamplesPerCategory, start);
+                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, &ci, 2*maxNumSamplesPerCategory, start);
                 break;
             default:
                 timeStamp(start);
@@ -440,6 +443,7 @@ int transition_bkw_step_coded_bkw(const char *srcFolderName, const char *dstFold
     storageReaderFree(&sr);
     *numSamplesStored = sw.totalNumSamplesAddedToStorageWriter;
     storageWriterFree(&sw); /* flushes automatically */
+    categoryIndexerFree(&ci);
 
     return 0;
 }
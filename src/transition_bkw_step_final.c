@@ -24,18 +24,25 @@
 #include "storage_writer.h"
 #include "position_values_2_category_index.h"
 #include "config_bkw.h"
+#include "solver_input.h"
+#include "bkw_metrics.h"
 #include <inttypes.h>
 
 #define MIN(X, Y)  ((X) < (Y) ? (X) : (Y))
 
 static u64 numZeroColumns;
 static u64 numZeroColumnsAdd;
+static u64 numUnnaturalSelectionRejects;
+static u64 numPairsConsidered;
+static u64 numSamplesWritten; /* to the samples file */
+static u64 numBytesWritten; /* samples and solver-input records */
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
 
     int n = lwe->n;
     int q = lwe->q;
+    numPairsConsidered++;
 
     /* perform Unnatural Selection */
     if (srcBkwStepPar->sorting == smoothLMS)
@@ -54,39 +61,22 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
             double limit = numSelectionPositions * srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts*srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts; /* The threshold below which we accept samples */
             if (a_norm_squared >= limit)
             {
+                numUnnaturalSelectionRejects++;
                 return 1; /* Sample discarded */
             }
         }
     }
 
-    lweSample *newSample = MALLOC(LWE_SAMPLE_SIZE_IN_BYTES);
-
-    /* compute new sample (subtract), write to reserved sample memory area */
-    if (newSample)
-    {
-        for (int i=0; i<n; i++)
-        {
-            newSample->col.a[i] = (columnValue(sample1, i) - columnValue(sample2, i) + q) % q;
-        }
-        newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-        int err1 = error(sample1);
-        int err2 = error(sample2);
-        newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 - err2 + q) % q; /* undefined if either parent error term is undefined */
-        newSample->sumWithError = (sumWithError(sample1) - sumWithError(sample2) + q) % q;
-    }
-    else
-    {
-        printf("********* ERROR transition_bkw_step_final.c: allocation for new sample failed\n");
-        exit(-1);
-    }
-
+    /* compute new sample (subtract) on the stack, it is written out (or discarded) right away */
+    lweSample combined;
+    lweSample *newSample = &combined;
+    lweSampleSubtract(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
     {
         numZeroColumns++;
         numZeroColumnsAdd++;
-        free(newSample);
         return 1; /* sample processed but not added */
     }
 
@@ -96,16 +86,22 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     {
         printf("numWritten = %d\n", numWritten);
     }
+    numSamplesWritten += numWritten;
+    numBytesWritten += numWritten * LWE_SAMPLE_SIZE_IN_BYTES;
+    if (siw)
+    {
+        solverInputWriterAddSample(siw, newSample);
+    }
 
-    free(newSample);
     return 1; /* one sample processed (and actually added) */
 }
 
-static int addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf)
+static int addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
 
     int n = lwe->n;
     int q = lwe->q;
+    numPairsConsidered++;
 
     /* perform Unnatural Selection */
     if(srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts)
@@ -122,37 +118,21 @@ static int addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
         double limit = numSelectionPositions * srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts*srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts; /* The threshold below which we accept samples */
         if (a_norm_squared >= limit)
         {
+            numUnnaturalSelectionRejects++;
             return 1; /* Sample processed but discarded */
         }
     }
 
-    lweSample *newSample = MALLOC(LWE_SAMPLE_SIZE_IN_BYTES);
-
-    /* compute new sample (add), write to reserved sample memory area */
-    if (newSample)
-    {
-        for (int i=0; i<n; i++)
-        {
-            newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-        }
-        newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-        int err1 = error(sample1);
-        int err2 = error(sample2);
-        newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2) % q; /* undefined if either parent error term is undefined */
-        newSample->sumWithError = (sumWithError(sample1) + sumWithError(sample2)) % q;
-    }
-    else
-    {
-        printf("********* ERROR transition_bkw_step_final.c: allocation for new sample failed\n");
-        exit(-1);
-    }
+    /* compute new sample (add) on the stack, it is written out (or discarded) right away */
+    lweSample combined;
+    lweSample *newSample = &combined;
+    lweSampleAdd(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
     {
         numZeroColumns++;
         numZeroColumnsAdd++;
-        free(newSample);
         return 0; /* sample processed but not added */
     }
 
@@ -162,12 +142,17 @@ static int addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     {
         printf("numWritten = %d\n", numWritten);
     }
+    numSamplesWritten += numWritten;
+    numBytesWritten += numWritten * LWE_SAMPLE_SIZE_IN_BYTES;
+    if (siw)
+    {
+        solverInputWriterAddSample(siw, newSample);
+    }
 
-    free(newSample);
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     if (numSamplesInCategory < 2)
     {
@@ -178,12 +163,12 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int n
     for (int j=1; j<numSamplesInCategory; j++)
     {
         lweSample *thisSample = &category[j];
-        numAdded += subtractSamples(lwe, firstSample, thisSample, srcBkwStepPar, wf);
+        numAdded += subtractSamples(lwe, firstSample, thisSample, srcBkwStepPar, wf, siw);
     }
     return numAdded;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, u64 maxNewSamples, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw, u64 maxNewSamples)
 {
     u64 numAdded = 0;
     for (int i=0; i<numSamplesInCategory; i++)
@@ -192,7 +177,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
             lweSample *sample2 = &category[j];
-            numAdded += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, wf);
+            numAdded += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, wf, siw);
             if (numAdded >= maxNewSamples)
             {
                 return numAdded;
@@ -202,7 +187,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
     return numAdded;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     u64 numAdded = 0;
     lweSample *firstSample;
@@ -216,13 +201,13 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
         for (int i=1; i<numSamplesInCategory1; i++)
         {
             sample = &category1[i];
-            numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+            numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
             sample = &category2[i];
-            numAdded += addSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+            numAdded += addSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -234,28 +219,28 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
             for (int i=1; i<numSamplesInCategory2; i++)
             {
                 sample = &category2[i];
-                numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+                numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
             }
         }
     }
     return numAdded;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, u64 maxNewSamples, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw, u64 maxNewSamples)
 {
     u64 numAdded = 0;
 
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numAdded += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, wf, maxNewSamples, start);
+    numAdded += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, wf, siw, maxNewSamples);
     if (numAdded >= maxNewSamples)
     {
         return numAdded;
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numAdded += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, wf, maxNewSamples - numAdded, start);
+    numAdded += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, wf, siw, maxNewSamples - numAdded);
     if (numAdded >= maxNewSamples)
     {
         return numAdded;
@@ -266,7 +251,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     {
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            numAdded += addSamples(lwe, &category1[i], &category2[j], srcBkwStepPar, wf);
+            numAdded += addSamples(lwe, &category1[i], &category2[j], srcBkwStepPar, wf, siw);
             if (numAdded >= maxNewSamples)
             {
                 return numAdded;
@@ -279,11 +264,11 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
 /* perform a bkw step when reducing last b coefficients */
 int transition_bkw_step_final(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, u64 *numSamplesStored, time_t start)
 {
+    return transition_bkw_step_final_with_solver_input(srcFolderName, dstFolderName, srcBkwStepPar, NULL, numSamplesStored, start);
+}
 
-    if (folderExists(dstFolderName))   /* if destination folder already exists, assume that we have performed this reduction step already */
-    {
-        return 100; /* reduction step already performed (destination folder already exists) */
-    }
+static int bkwStepFinal(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, solverInputParameters *solverInputPar, u64 *numSamplesStored, time_t start)
+{
 
 #if 0 /* for testing only */
     numZeroColumns = 0;
@@ -326,6 +311,18 @@ int transition_bkw_step_final(const char *srcFolderName, const char *dstFolderNa
         lweDestroy(&lwe);
         return -1;
     }
+    solverInputWriter solverInput;
+    solverInputWriter *siw = NULL;
+    if (solverInputPar)
+    {
+        if (solverInputWriterInitialize(&solverInput, dstFolderName, solverInputPar, lwe.q))
+        {
+            fclose(wf);
+            lweDestroy(&lwe);
+            return -1;
+        }
+        siw = &solverInput;
+    }
 
     /* process samples */
     u64 cat = 0; /* current category index */
@@ -343,24 +340,25 @@ int transition_bkw_step_final(const char *srcFolderName, const char *dstFolderNa
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                numSamplesAdded += processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, wf, start);
+                numSamplesAdded += processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, wf, siw);
                 break;
             case 2: /* two meta categories (first two coordinates are additive inverses) */
-                numSamplesAdded += processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, wf, start);
+                numSamplesAdded += processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, wf, siw);
                 break;
             default:
                 timeStamp(start);
                 printf("*** transition_bkw_step_final: Unexpected number of categories\n");
             }
             break;
+        case LSH_LF2: /* LSH buckets are only used in the intermediate smooth LMS steps, all pairs are checked here */
         case LF2:
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                numSamplesAdded += processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, wf, maxNewSamplesPerCategory, start);
+                numSamplesAdded += processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, wf, siw, maxNewSamplesPerCategory);
                 break;
             case 2:  /* two meta categories (first two coordinates are additive inverses) */
-                numSamplesAdded += processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, wf, 2*maxNewSamplesPerCategory, start);
+                numSamplesAdded += processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, wf, siw, 2*maxNewSamplesPerCategory);
                 break;
             default:
                 timeStamp(start);
@@ -390,7 +388,46 @@ int transition_bkw_step_final(const char *srcFolderName, const char *dstFolderNa
     /* close storage handlers */
     storageReaderFree(&sr);
     fclose(wf);
+    if (siw)
+    {
+        numBytesWritten += siw->numRecords * sizeof(solverInputRecord);
+        solverInputWriterClose(siw, dstFolderName);
+    }
     lweDestroy(&lwe);
 
     return 0;
 }
+
+/* same as above, but also write the compact solver-input file described by solverInputPar (unless NULL) to the destination folder */
+int transition_bkw_step_final_with_solver_input(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, solverInputParameters *solverInputPar, u64 *numSamplesStored, time_t start)
+{
+    if (folderExists(dstFolderName))   /* if destination folder already exists, assume that we have performed this reduction step already */
+    {
+        return 100; /* reduction step already performed (destination folder already exists) */
+    }
+
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, dstFolderName);
+    u64 zeroColumnsBefore = numZeroColumns;
+    u64 unnaturalSelectionRejectsBefore = numUnnaturalSelectionRejects;
+    u64 pairsConsideredBefore = numPairsConsidered;
+    u64 samplesWrittenBefore = numSamplesWritten;
+    u64 bytesWrittenBefore = numBytesWritten;
+
+    int ret = bkwStepFinal(srcFolderName, dstFolderName, srcBkwStepPar, solverInputPar, numSamplesStored, start);
+
+    /* the samples are written directly, without storage writer (so without flushes), their bytes count as flush bytes */
+    metrics.numPairsConsidered = numPairsConsidered - pairsConsideredBefore;
+    metrics.numSamplesWritten = numSamplesWritten - samplesWrittenBefore;
+    metrics.numZeroColumnRejects = numZeroColumns - zeroColumnsBefore;
+    metrics.numUnnaturalSelectionRejects = numUnnaturalSelectionRejects - unnaturalSelectionRejectsBefore;
+    metrics.numFlushBytes = numBytesWritten - bytesWrittenBefore;
+    bkwMetricsEnd(&metrics);
+    if (!ret)
+    {
+        char fileName[512];
+        metricsFileName(fileName, dstFolderName);
+        bkwMetricsToFile(&metrics, fileName);
+    }
+    return ret;
+}
@@ -24,6 +24,8 @@
 #include "storage_writer.h"
 #include "position_values_2_category_index.h"
 #include "config_bkw.h"
+#include "solver_input.h"
+#include "scratch_arena.h"
 #include <inttypes.h>
 #include <math.h>
 
@@ -46,7 +48,7 @@ static short subtractModuloQ(short a, short b, int q) {
     return c;
 }
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -66,32 +68,24 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     }
 
     //  int storageWriterStatus = 0;
-    lweSample *newSample = MALLOC(LWE_SAMPLE_SIZE_IN_BYTES);
-
-    if (newSample)
-    {
-        for (int i=0; i<n; i++)
-        {
-            newSample->col.a[i] = subtractModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
-        }
-        newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-        int err1 = error(sample1);
-        int err2 = error(sample2);
-        newSample->error = (err1 == -1 || err2 == -1) ? -1 : subtractModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
-        newSample->sumWithError = subtractModuloQ(sumWithError(sample1), sumWithError(sample2), q);
-    }
-    else
+    /* the new sample lives on the stack, it is written out (or discarded) right away */
+    lweSample combined;
+    lweSample *newSample = &combined;
+    for (int i=0; i<n; i++)
     {
-        printf("********* ERROR transition_bkw_step_final_smooth_lms_meta.c: allocation for new sample failed\n");
-        exit(-1);
+        newSample->col.a[i] = subtractModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
     }
+    newSample->col.hash = columnHashSubtract(columnHash(sample1), columnHash(sample2), q);
+    int err1 = error(sample1);
+    int err2 = error(sample2);
+    newSample->error = (err1 == -1 || err2 == -1) ? -1 : subtractModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
+    newSample->sumWithError = subtractModuloQ(sumWithError(sample1), sumWithError(sample2), q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
     {
         numZeroColumns++;
         numZeroColumnsAdd++;
-        free(newSample);
         return 0; /* sample processed but not added */
     }
 
@@ -101,13 +95,15 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     {
         printf("numWritten = %d\n", numWritten);
     }
-
-    free(newSample);
+    if (siw)
+    {
+        solverInputWriterAddSample(siw, newSample);
+    }
 
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -125,32 +121,24 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
         }
     }
     //  int storageWriterStatus = 0;
-    lweSample *newSample = MALLOC(LWE_SAMPLE_SIZE_IN_BYTES);
-
-    if (newSample)
-    {
-        for (int i=0; i<n; i++)
-        {
-            newSample->col.a[i] = addModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
-        }
-        newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-        int err1 = error(sample1);
-        int err2 = error(sample2);
-        newSample->error = (err1 == -1 || err2 == -1) ? -1 : addModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
-        newSample->sumWithError = addModuloQ(sumWithError(sample1), sumWithError(sample2), q);
-    }
-    else
+    /* the new sample lives on the stack, it is written out (or discarded) right away */
+    lweSample combined;
+    lweSample *newSample = &combined;
+    for (int i=0; i<n; i++)
     {
-        printf("********* ERROR transition_bkw_step_final_smooth_lms_meta.c: allocation for new sample failed\n");
-        exit(-1);
+        newSample->col.a[i] = addModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
     }
+    newSample->col.hash = columnHashAdd(columnHash(sample1), columnHash(sample2), q);
+    int err1 = error(sample1);
+    int err2 = error(sample2);
+    newSample->error = (err1 == -1 || err2 == -1) ? -1 : addModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
+    newSample->sumWithError = addModuloQ(sumWithError(sample1), sumWithError(sample2), q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
     {
         numZeroColumns++;
         numZeroColumnsAdd++;
-        free(newSample);
         return 0; /* sample processed but not added */
     }
 
@@ -160,8 +148,11 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     {
         printf("numWritten = %d\n", numWritten);
     }
+    if (siw)
+    {
+        solverInputWriterAddSample(siw, newSample);
+    }
 
-    free(newSample);
     return 1; /* one sample processed (and actually added) */
 }
 
@@ -177,7 +168,7 @@ static inline int additiveInverse(int c, int val)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     u64 numAdded = 0;
     lweSample *firstSample;
@@ -189,16 +180,16 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySample
     }
 
     /* subtract all samples from the first one (linear) */
-    firstSample = categorySamplePointers[0];
+    firstSample = &categorySamples[0];
     for (int i=1; i<numSamplesInCategory; i++)
     {
-        sample = categorySamplePointers[i];
-        numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+        sample = &categorySamples[i];
+        numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
     }
     return numAdded;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     u64 numAdded = 0;
     lweSample *firstSample;
@@ -208,17 +199,17 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
     {
         /* LF1-process category 1 */
         /* subtract all samples from the first one (linear) */
-        firstSample = categorySamplePointers1[0];
+        firstSample = &categorySamples1[0];
         for (int i=1; i<numSamplesInCategory1; i++)
         {
-            sample = categorySamplePointers1[i];
-            numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+            sample = &categorySamples1[i];
+            numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
-            sample = categorySamplePointers2[i];
-            numAdded += addSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+            sample = &categorySamples2[i];
+            numAdded += addSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -226,18 +217,18 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
         if (numSamplesInCategory2 >= 2)
         {
             /* LF1-process samples in category 2 only */
-            firstSample = categorySamplePointers2[0];
+            firstSample = &categorySamples2[0];
             for (int i=1; i<numSamplesInCategory2; i++)
             {
-                sample = categorySamplePointers2[i];
-                numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf);
+                sample = &categorySamples2[i];
+                numAdded += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, wf, siw);
             }
         }
     }
     return numAdded;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     u64 numAdded = 0;
     lweSample *sample1;
@@ -246,17 +237,17 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySample
     /* subtract all pairs of samples (quadratic) */
     for (int i=0; i<numSamplesInCategory; i++)
     {
-        sample1 = categorySamplePointers[i];
+        sample1 = &categorySamples[i];
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
-            sample2 = categorySamplePointers[j];
-            numAdded += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, wf);
+            sample2 = &categorySamples[j];
+            numAdded += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, wf, siw);
         }
     }
     return numAdded;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, FILE *wf, solverInputWriter *siw)
 {
     u64 numAdded = 0;
     lweSample *sample1;
@@ -265,19 +256,19 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numAdded += processSingleCategoryLF2(lwe, categorySamplePointers1, numSamplesInCategory1, srcBkwStepPar, wf, start);
+    numAdded += processSingleCategoryLF2(lwe, categorySamples1, numSamplesInCategory1, srcBkwStepPar, wf, siw);
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numAdded += processSingleCategoryLF2(lwe, categorySamplePointers2, numSamplesInCategory2, srcBkwStepPar, wf, start);
+    numAdded += processSingleCategoryLF2(lwe, categorySamples2, numSamplesInCategory2, srcBkwStepPar, wf, siw);
 
     /* process all pairs in categories 1 and 2 (add sample pairs) */
     for (int i=0; i<numSamplesInCategory1; i++)
     {
-        sample1 = categorySamplePointers1[i];
+        sample1 = &categorySamples1[i];
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            sample2 = categorySamplePointers2[j];
-            numAdded += addSamples(lwe, sample1, sample2, srcBkwStepPar, wf);
+            sample2 = &categorySamples2[j];
+            numAdded += addSamples(lwe, sample1, sample2, srcBkwStepPar, wf, siw);
         }
     }
 
@@ -302,137 +293,13 @@ static void getLastCategorySizes(int q, int n, bkwStepParameters *srcBkwStepPar,
     }
 }
 
-static lweSample ***sortMetacategoryTwoPositions(lweSample *category, int numSamplesInCategory, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, int *valueCounter, int n, int cMidPosition, int cLastPosition)
+int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, u64 *numSamplesStored, time_t start)
 {
-    int maxNumRepetitionsOfCategory = 0;
-    int q = lwe->q;
-
-    int pLast;
-    int pSecondToLast = srcBkwStepPar->sortingPar.smoothLMS.p;
-
-    int metaCategorySize = cMidPosition*cLastPosition;
-
-    int q_ = q%2 == 1 ? (q+1)/2 : q/2;
-
-    int lastPos = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; /* Index for the last position */
-    if (lastPos == n)   /* Last step of smooth LMS */
-    {
-        lastPos--;
-        pLast = srcBkwStepPar->sortingPar.smoothLMS.p;
-    }
-    else
-    {
-        pLast = srcBkwStepPar->sortingPar.smoothLMS.p1;
-    }
-
-    /* compute distribution of last position value */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    /* TODO: Implement this function... */
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        int pnLast = columnValue(&category[i], lastPos); /* Last position value */
-        int pnSecondToLast = columnValue(&category[i], lastPos - 1); /* Second to last position value */
-        int currentLastPositionCategory = positionSmoothLMSMap(pnLast, q, q_, pLast, cLastPosition); /* Last position category */
-        int currentSecondToLastPositionCategory = positionSmoothLMSMap(pnSecondToLast, q, q_, pSecondToLast, cMidPosition); /* Second to last position category */
-        int currentCategory = currentLastPositionCategory*cMidPosition + currentSecondToLastPositionCategory;
-        // printf("The current category for sample %d is %d\n", i, currentCategory);
-        valueCounter[currentCategory]++; /* Increase counter for corresponding category */
-    }
-    /* find maximum */
-    for (int i=0; i<metaCategorySize; i++)   /* Loop over all categories */
-    {
-        if (valueCounter[i] > maxNumRepetitionsOfCategory)
-        {
-            maxNumRepetitionsOfCategory = valueCounter[i];
-        }
-    }
-
-    /* allocate storage structure for (properly) sorted samples (no copying, pointers only) */
-    lweSample ***metaCategory = (lweSample***)MALLOC(metaCategorySize * sizeof(lweSample**));
-
-    for (int i=0; i<metaCategorySize; i++)
-    {
-        metaCategory[i] = (lweSample**)MALLOC(maxNumRepetitionsOfCategory * sizeof(lweSample*));
-    }
-
-
-
-    /* TODO: Finish this function! */
-    /* sort */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        lweSample *thisSample = &category[i];
-        int pnLast = columnValue(thisSample, lastPos);
-        int pnSecondToLast = columnValue(thisSample, lastPos - 1);
-        int currentLastPositionCategory = positionSmoothLMSMap(pnLast, q, q_, pLast, cLastPosition); /* Last position category */
-        int currentSecondToLastPositionCategory = positionSmoothLMSMap(pnSecondToLast, q, q_, pSecondToLast, cMidPosition); /* Second to last position category */
-        int currentCategory = currentLastPositionCategory*cMidPosition + currentSecondToLastPositionCategory;
-        metaCategory[currentCategory][valueCounter[currentCategory]++] = thisSample;
-    }
-
-    return metaCategory;
+    return transition_bkw_step_final_smooth_lms_meta_with_solver_input(srcFolderName, dstFolderName, srcBkwStepPar, NULL, numSamplesStored, start);
 }
 
-static lweSample ***sortMetacategoryOnePosition(lweSample *category, int numSamplesInCategory, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, int *valueCounter, int n, int metaCategorySize)
-{
-    int maxNumRepetitionsOfLastPos = 0;
-    int q = lwe->q;
-    int p;
-    int q_ = q%2 == 1 ? (q+1)/2 : q/2;
-    int lastPos = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; /* Index for the last position */
-    if (lastPos == n)   /* Last step of smooth LMS */
-    {
-        lastPos--;
-        p = srcBkwStepPar->sortingPar.smoothLMS.p;
-    }
-    else
-    {
-        p = srcBkwStepPar->sortingPar.smoothLMS.p1;
-    }
-
-//  printf("Meta category size is %d\n", metaCategorySize);
-//  printf("The whole category has %d samples\n", numSamplesInCategory);
-
-    /* compute distribution of last position value */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        int pn = columnValue(&category[i], lastPos); /* Last position value */
-        int currentCategory = positionSmoothLMSMap(pn, q, q_, p, metaCategorySize); /* Corresponding category */
-        valueCounter[currentCategory]++; /* Increase counter for corresponding category */
-    }
-    /* find maximum */
-    for (int i=0; i<metaCategorySize; i++)
-    {
-//    printf("Category at index %d has %d samples\n", i, valueCounter[i]);
-        if (valueCounter[i] > maxNumRepetitionsOfLastPos)
-        {
-            maxNumRepetitionsOfLastPos = valueCounter[i];
-        }
-    }
-
-    /* allocate storage structure for (properly) sorted samples (no copying, pointers only) */
-    lweSample ***metaCategory = (lweSample***)MALLOC(metaCategorySize * sizeof(lweSample**));
-    for (int i=0; i<metaCategorySize; i++)
-    {
-        metaCategory[i] = (lweSample**)MALLOC(maxNumRepetitionsOfLastPos * sizeof(lweSample*));
-    }
-
-    /* sort */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        lweSample *thisSample = &category[i];
-        int pn = columnValue(&category[i], lastPos); /* Last position value */
-        int currentCategory = positionSmoothLMSMap(pn, q, q_, p, metaCategorySize); /* Corresponding category */
-        metaCategory[currentCategory][valueCounter[currentCategory]++] = thisSample;
-    }
-
-    return metaCategory;
-}
-
-int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, u64 *numSamplesStored, time_t start)
+/* same as above, but also write the compact solver-input file described by solverInputPar (unless NULL) to the destination folder */
+int transition_bkw_step_final_smooth_lms_meta_with_solver_input(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, solverInputParameters *solverInputPar, u64 *numSamplesStored, time_t start)
 {
 
     if (folderExists(dstFolderName))   /* if destination folder already exists, assume that we have performed this reduction step already */
@@ -481,6 +348,18 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
         lweDestroy(&lwe);
         return -1;
     }
+    solverInputWriter solverInput;
+    solverInputWriter *siw = NULL;
+    if (solverInputPar)
+    {
+        if (solverInputWriterInitialize(&solverInput, dstFolderName, solverInputPar, lwe.q))
+        {
+            fclose(wf);
+            lweDestroy(&lwe);
+            return -1;
+        }
+        siw = &solverInput;
+    }
 
     /* process samples */
     u64 cat = 0; /* current category index */
@@ -513,51 +392,49 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
 
     u64 abortSampleLimit = 4*MAX_NUM_SAMPLES/3;
 
+    /* the samples of a meta category are ordered by sub-bucket (the positions skipped for the meta
+       categories) by the writer of the previous step, the sub-buckets are located in place */
+    subBucketIndexer sbi;
+    subBucketIndexerInitialize(&sbi, &lwe, srcBkwStepPar);
+    ASSERT(sbi.numSubBuckets == metaCategorySize, "unexpected sub-bucket layout");
+
+    scratchArena scratch; /* sub-bucket arrays of the current meta category pair */
+    if (scratchArenaInitialize(&scratch, 2 * metaCategorySize * (sizeof(lweSample*) + sizeof(int)) + 4 * sizeof(max_align_t)))
+    {
+        storageReaderFree(&sr);
+        fclose(wf);
+        if (siw)
+        {
+            solverInputWriterClose(siw, dstFolderName);
+        }
+        lweDestroy(&lwe);
+        return 6; /* could not allocate scratch arena */
+    }
+
     /* The main while loop */
     while (numReadCategories)
     {
 
-        /* The meta category pair and the corresponding counter for number samples within each category within the meta category */
+        lweSample **metaCategory1 = NULL;
+        lweSample **metaCategory2 = NULL;
         int *valueCounter1 = NULL;
         int *valueCounter2 = NULL;
-        lweSample ***metaCategory1 = NULL;
-        lweSample ***metaCategory2 = NULL;
 
-        /* pre-process metacategory 1 (if available) */
+        /* locate the sub-buckets of meta category 1 (if available) */
         if (buf1)
         {
-            valueCounter1 = MALLOC(metaCategorySize * sizeof(int)); /* We should find out what this number is */
-            if (meta_skipped == 1)
-            {
-                metaCategory1 = sortMetacategoryOnePosition(buf1, numSamplesInBuf1, &lwe, srcBkwStepPar, valueCounter1, lwe.n, metaCategorySize);
-            }
-            else if (meta_skipped == 2)
-            {
-                metaCategory1 = sortMetacategoryTwoPositions(buf1, numSamplesInBuf1, &lwe, srcBkwStepPar, valueCounter1, lwe.n, cMidPosition, cLastPosition);
-            }
-            else
-            {
-                ASSERT_ALWAYS("Unsupported number of skipped positions!");
-            }
+            metaCategory1 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(lweSample*));
+            valueCounter1 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf1, numSamplesInBuf1, metaCategory1, valueCounter1);
         }
 
-        /* pre-process metacategory 2 (if available) */
+        /* locate the sub-buckets of meta category 2 (if available) */
         if (buf2)
         {
             ASSERT(buf1, "buf2 should only be available if buf1 is");
-            valueCounter2 = MALLOC(metaCategorySize * sizeof(int));
-            if (meta_skipped == 1)
-            {
-                metaCategory2 = sortMetacategoryOnePosition(buf2, numSamplesInBuf2, &lwe, srcBkwStepPar, valueCounter2, lwe.n, metaCategorySize);
-            }
-            else if (meta_skipped == 2)
-            {
-                metaCategory2 = sortMetacategoryTwoPositions(buf2, numSamplesInBuf2, &lwe, srcBkwStepPar, valueCounter2, lwe.n, cMidPosition, cLastPosition);
-            }
-            else
-            {
-                ASSERT_ALWAYS("Unsupported number of skipped positions!");
-            }
+            metaCategory2 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(lweSample*));
+            valueCounter2 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf2, numSamplesInBuf2, metaCategory2, valueCounter2);
         }
 
         /* Process meta categories based on selection method, single/pair and number of positions skipped */
@@ -567,19 +444,18 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                ASSERT(metaCategory1, "unexpected parameter");
                 for (int i=0; i<cLastPosition; i++)
                 {
                     if (meta_skipped == 1)   /* One position skipped for meta categories */
                     {
-                        numSamplesAdded += processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, wf, start);
+                        numSamplesAdded += processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, wf, siw);
                     }
                     else     /* Two positions skipped for meta categories */
                     {
                         for (int k = 0; k < cMidPosition; k++)
                         {
                             int index = i*cLastPosition + k; /* Index in the meta category to access when skipping to positions */
-                            numSamplesAdded += processSingleCategoryLF1(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, wf, start);
+                            numSamplesAdded += processSingleCategoryLF1(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, wf, siw);
                         }
                     }
                 }
@@ -590,7 +466,7 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
                     int j = additiveInverse(cLastPosition, i);
                     if (meta_skipped == 1)
                     {
-                        numSamplesAdded +=  processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, wf, start); /* note: does not matter if i == j or not */
+                        numSamplesAdded +=  processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, wf, siw); /* note: does not matter if i == j or not */
                     }
                     else
                     {
@@ -599,7 +475,7 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
                             int l = additiveInverse(cMidPosition, k);
                             int index = i*cLastPosition + k;
                             int additiveInverseIndex = j*cLastPosition + l;
-                            numSamplesAdded +=  processAdjacentCategoriesLF1(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, wf, start); /* note: does not matter if i == j or not */
+                            numSamplesAdded +=  processAdjacentCategoriesLF1(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, wf, siw); /* note: does not matter if i == j or not */
                         }
                     }
                 }
@@ -617,14 +493,14 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
                 {
                     if (meta_skipped == 1)   /* One position skipped for meta categories */
                     {
-                        numSamplesAdded +=  processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, wf, start);
+                        numSamplesAdded +=  processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, wf, siw);
                     }
                     else     /* Two positions skipped for meta categories */
                     {
                         for (int k = 0; k < cMidPosition; k++)
                         {
                             int index = i*cLastPosition + k; /* Index in the meta category to access when skipping to positions */
-                            numSamplesAdded += processSingleCategoryLF2(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, wf, start);
+                            numSamplesAdded += processSingleCategoryLF2(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, wf, siw);
                         }
                     }
                 }
@@ -635,7 +511,7 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
                     int j = additiveInverse(cLastPosition, i);
                     if (meta_skipped == 1)
                     {
-                        numSamplesAdded += processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, wf, start); /* note: does not matter if i == j or not */
+                        numSamplesAdded += processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, wf, siw); /* note: does not matter if i == j or not */
                     }
                     else
                     {
@@ -644,7 +520,7 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
                             int l = additiveInverse(cMidPosition, k);
                             int index = i*cMidPosition + k;
                             int additiveInverseIndex = j*cMidPosition + l;
-                            numSamplesAdded += processAdjacentCategoriesLF2(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, wf, start); /* note: does not matter if i == j or not */
+                            numSamplesAdded += processAdjacentCategoriesLF2(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, wf, siw); /* note: does not matter if i == j or not */
                         }
                     }
                 }
@@ -659,32 +535,7 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
         }
 
         cat += numReadCategories;
-
-        /* free intermediate meta category information */
-        if (metaCategory1)
-        {
-            for (int i=0; i<metaCategorySize; i++)
-            {
-                FREE(metaCategory1[i]);
-            }
-            FREE(metaCategory1);
-        }
-        if (metaCategory2)
-        {
-            for (int i=0; i<metaCategorySize; i++)
-            {
-                FREE(metaCategory2[i]);
-            }
-            FREE(metaCategory2);
-        }
-        if (valueCounter1)
-        {
-            FREE(valueCounter1);
-        }
-        if (valueCounter2)
-        {
-            FREE(valueCounter2);
-        }
+        scratchArenaReset(&scratch);
 
         while (cat > nextPrintLimit)
         {
@@ -708,9 +559,16 @@ int transition_bkw_step_final_smooth_lms_meta(const char *srcFolderName, const c
 
     *numSamplesStored = numSamplesAdded;
 
+    scratchArenaReport(&scratch, "transition_bkw_step_final_smooth_lms_meta", start);
+    scratchArenaFree(&scratch);
+
     /* close storage handlers */
     storageReaderFree(&sr);
     fclose(wf);
+    if (siw)
+    {
+        solverInputWriterClose(siw, dstFolderName);
+    }
     lweDestroy(&lwe);
 
     return 0;
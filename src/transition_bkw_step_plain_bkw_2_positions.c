@@ -33,7 +33,7 @@ static u64 numZeroColumnsAdd;
 static u64 numZeroColumnsSub;
 #endif
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -46,7 +46,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     /* compute category index of new sample (without computing entire new sample) */
     for (int i=0; i<Ni_; i++)
         p01[i] = (columnValue(sample1, startIndex + i) - columnValue(sample2, startIndex + i) + q) % q;
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, p01, dstBkwStepPar);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -58,15 +58,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (subtract), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) - columnValue(sample2, i) + q) % q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 - err2 + q) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) - sumWithError(sample2) + q) % q;
+    lweSampleSubtract(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -80,7 +72,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -93,7 +85,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     /* compute category index of new sample (without computing entire new sample) */
     for (int i=0; i<Ni_; i++)
         p01[i] = (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i)) % q;
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, p01, dstBkwStepPar);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -105,15 +97,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (add), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) + sumWithError(sample2)) % q;
+    lweSampleAdd(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -148,7 +132,7 @@ static void flushStorageWriterIfCloseToFull(storageWriter *sw, time_t start)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF1, "unexpected selection type");
     if (numSamplesInCategory < 2)
@@ -160,13 +144,13 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int n
     for (int j=1; j<numSamplesInCategory; j++)
     {
         lweSample *thisSample = &category[j];
-        numProcessed += subtractSamples(lwe, firstSample, thisSample, srcBkwStepPar, dstBkwStepPar, sw);
+        numProcessed += subtractSamples(lwe, firstSample, thisSample, dstBkwStepPar, sw, ci);
     }
     flushStorageWriterIfCloseToFull(sw, start);
     return numProcessed;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF2, "unexpected selection type");
     u64 numProcessed = 0;
@@ -174,7 +158,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
     {
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
-            numProcessed += subtractSamples(lwe, &category[i], &category[j], srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, &category[i], &category[j], dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -186,7 +170,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF1, "unexpected selection type");
     u64 numProcessed = 0;
@@ -201,13 +185,13 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
         for (int i=1; i<numSamplesInCategory1; i++)
         {
             sample = &category1[i];
-            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
             sample = &category2[i];
-            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += addSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -219,7 +203,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
             for (int i=1; i<numSamplesInCategory2; i++)
             {
                 sample = &category2[i];
-                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+                numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
             }
         }
     }
@@ -228,7 +212,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF2, "unexpected selection type");
     u64 numProcessed = 0;
@@ -236,7 +220,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory, start);
+    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -244,7 +228,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory - numProcessed, start);
+    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory - numProcessed, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -256,7 +240,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     {
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            numProcessed += addSamples(lwe, &category1[i], &category2[j], srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += addSamples(lwe, &category1[i], &category2[j], dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -298,10 +282,20 @@ int transition_bkw_step_plain_bkw_2_positions(const char *srcFolderName, const c
         return 2; /* unexpected sample sorting at src folder */
     }
 
+    /* build the category index tables of the destination step once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("could not initialize category indexer");
+        return 5; /* could not initialize category indexer */
+    }
+
     /* initialize storage reader */
     storageReader sr;
     if (storageReaderInitialize(&sr, srcFolderName))
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage reader");
         return 3; /* could not initialize storage reader */
@@ -318,6 +312,7 @@ int transition_bkw_step_plain_bkw_2_positions(const char *srcFolderName, const c
     storageWriter sw;
     if (storageWriterInitialize(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity))
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage writer");
         return 4; /* could not initialize storage writer */
@@ -348,10 +343,10 @@ int transition_bkw_step_plain_bkw_2_positions(const char *srcFolderName, const c
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, dstBkwStepPar, &sw, &ci, start);
                 break;
             case 2: /* two meta categories (first two coordinates are additive inverses) */
-                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, dstBkwStepPar, &sw, &ci, start);
                 break;
             default:
                 timeStamp(start);
@@ -362,10 +357,10 @@ int transition_bkw_step_plain_bkw_2_positions(const char *srcFolderName, const c
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory, start);
+                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory, start);
                 break;
             case 2:  /* two meta categories (first two coordinates are additive inverses) */
-                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, 2*maxNumSamplesPerCategory, start);
+                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, dstBkwStepPar, &sw, &ci, 2*maxNumSamplesPerCategory, start);
                 break;
             default:
                 timeStamp(start);
@@ -397,6 +392,7 @@ int transition_bkw_step_plain_bkw_2_positions(const char *srcFolderName, const c
 //  u64 dstCategoryCapacityFile = sw.categoryCapacityFile;
     *numSamplesStored = sw.totalNumSamplesAddedToStorageWriter;
     storageWriterFree(&sw); /* flushes automatically */
+    categoryIndexerFree(&ci);
 
 #if 0 /* for testing purposes only, counting number of zero columns */
     u64 sum = 0;
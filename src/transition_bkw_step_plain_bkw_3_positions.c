@@ -23,11 +23,12 @@
 #include "storage_reader.h"
 #include "storage_writer.h"
 #include "position_values_2_category_index.h"
+#include "scratch_arena.h"
 #include "config_bkw.h"
 #include <inttypes.h>
 #include <math.h>
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
 
     int n = lwe->n;
@@ -41,7 +42,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     /* compute category index of new sample (without computing entire new sample) */
     for (int i=0; i<Ni_; i++)
         p01[i] = (columnValue(sample1, startIndex + i) - columnValue(sample2, startIndex + i) + q) %q;
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, p01, dstBkwStepPar);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -59,15 +60,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (subtract), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) - columnValue(sample2, i) + q) %q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 - err2 + q) %q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) - sumWithError(sample2) + q) %q;
+    lweSampleSubtract(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -79,7 +72,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
 
     int n = lwe->n;
@@ -96,7 +89,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
         // printf("INDEX %d\n", startIndex + i);
         p01[i] = (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i)) % q;
     }
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, p01, dstBkwStepPar);
+    u64 categoryIndex = categoryIndexerIndex(ci, p01);
 
     /* retrieve memory area for new sample in destination storage */
     int storageWriterStatus = 0;
@@ -115,15 +108,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (add), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) + sumWithError(sample2)) % q;
+    lweSampleAdd(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -161,7 +146,7 @@ static void flushStorageWriterIfCloseToFull(storageWriter *sw, time_t start)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -173,17 +158,17 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySample
     }
 
     /* subtract all samples from the first one (linear) */
-    firstSample = categorySamplePointers[0];
+    firstSample = &categorySamples[0];
     for (int i=1; i<numSamplesInCategory; i++)
     {
-        sample = categorySamplePointers[i];
-        numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw);
+        sample = &categorySamples[i];
+        numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
     }
     flushStorageWriterIfCloseToFull(sw, start);
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -193,17 +178,17 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
     {
         /* LF1-process category 1 */
         /* subtract all samples from the first one (linear) */
-        firstSample = categorySamplePointers1[0];
+        firstSample = &categorySamples1[0];
         for (int i=1; i<numSamplesInCategory1; i++)
         {
-            sample = categorySamplePointers1[i];
-            numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw);
+            sample = &categorySamples1[i];
+            numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
-            sample = categorySamplePointers2[i];
-            numProcessed += addSamples(lwe, firstSample, sample, dstBkwStepPar, sw);
+            sample = &categorySamples2[i];
+            numProcessed += addSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -211,11 +196,11 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
         if (numSamplesInCategory2 >= 2)
         {
             /* LF1-process samples in category 2 only */
-            firstSample = categorySamplePointers2[0];
+            firstSample = &categorySamples2[0];
             for (int i=1; i<numSamplesInCategory2; i++)
             {
-                sample = categorySamplePointers2[i];
-                numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw);
+                sample = &categorySamples2[i];
+                numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
             }
         }
     }
@@ -223,7 +208,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
     return numProcessed;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, int flush, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, int flush, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -232,11 +217,11 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySample
     /* subtract all pairs of samples (quadratic) */
     for (int i=0; i<numSamplesInCategory; i++)
     {
-        sample1 = categorySamplePointers[i];
+        sample1 = &categorySamples[i];
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
-            sample2 = categorySamplePointers[j];
-            numProcessed += subtractSamples(lwe, sample1, sample2, dstBkwStepPar, sw);
+            sample2 = &categorySamples[j];
+            numProcessed += subtractSamples(lwe, sample1, sample2, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 if (flush)
@@ -254,7 +239,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySample
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -263,7 +248,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, categorySamplePointers1, numSamplesInCategory1, dstBkwStepPar, sw, maxNumSamplesPerCategory, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, categorySamples1, numSamplesInCategory1, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -271,7 +256,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, categorySamplePointers2, numSamplesInCategory2, dstBkwStepPar, sw, maxNumSamplesPerCategory - numProcessed, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, categorySamples2, numSamplesInCategory2, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory - numProcessed, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -281,11 +266,11 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     /* process all pairs in categories 1 and 2 (add sample pairs) */
     for (int i=0; i<numSamplesInCategory1; i++)
     {
-        sample1 = categorySamplePointers1[i];
+        sample1 = &categorySamples1[i];
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            sample2 = categorySamplePointers2[j];
-            numProcessed += addSamples(lwe, sample1, sample2, dstBkwStepPar, sw);
+            sample2 = &categorySamples2[j];
+            numProcessed += addSamples(lwe, sample1, sample2, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -297,46 +282,6 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     return numProcessed;
 }
 
-static lweSample ***sortMetacategorySamplesOnThirdCoordinate(lweSample *category, int numSamplesInCategory, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, int *valueCounter)
-{
-    int q = lwe->q;
-    int pos3 = srcBkwStepPar->startIndex + 2;
-    int maxNumRepetitionsOfPos3 = 0;
-
-    /* compute distribution of third coordinate value */
-    MEMSET(valueCounter, 0, q * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        valueCounter[columnValue(&category[i], pos3)]++;
-    }
-    /* find maximum */
-    for (int i=0; i<q; i++)
-    {
-        if (valueCounter[i] > maxNumRepetitionsOfPos3)
-        {
-            maxNumRepetitionsOfPos3 = valueCounter[i];
-        }
-    }
-
-    /* allocate storage structure for (properly) sorted samples (no copying, pointers only) */
-    lweSample ***metaCategory = (lweSample***)MALLOC(q * sizeof(lweSample**));
-    for (int i=0; i<q; i++)
-    {
-        metaCategory[i] = (lweSample**)MALLOC(maxNumRepetitionsOfPos3 * sizeof(lweSample*));
-    }
-
-    /* sort */
-    MEMSET(valueCounter, 0, q * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        lweSample *thisSample = &category[i];
-        int val = columnValue(thisSample, pos3); /* get value of third coordinate from sample */
-        metaCategory[val][valueCounter[val]++] = thisSample;
-    }
-
-    return metaCategory;
-}
-
 int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, u64 *numSamplesStored, time_t start)
 {
 
@@ -359,10 +304,20 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
         return 2; /* unexpected sample sorting at src folder */
     }
 
+    /* build the category index tables of the destination step once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("could not initialize category indexer");
+        return 5; /* could not initialize category indexer */
+    }
+
     /* initialize storage reader */
     storageReader sr;
     if (storageReaderInitialize(&sr, srcFolderName))
     {
+        categoryIndexerFree(&ci);
         ASSERT_ALWAYS("could not initialize storage reader");
         return 3; /* could not initialize storage reader */
     }
@@ -379,10 +334,26 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
     storageWriter sw;
     if (storageWriterInitialize(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity /* categoryCapacityFile same as in src file */))
     {
+        categoryIndexerFree(&ci);
         ASSERT_ALWAYS("could not initialize storage writer");
         return 4; /* could not initialize storage writer */
     }
 
+    /* meta categories are ordered on the third coordinate by the writer of the previous step,
+       the sub-buckets are located in place (pointers to the first sample and sample counts) */
+    subBucketIndexer sbi;
+    subBucketIndexerInitialize(&sbi, &lwe, srcBkwStepPar);
+    ASSERT(sbi.numSubBuckets == lwe.q, "unexpected sub-bucket layout");
+    scratchArena scratch; /* sub-bucket arrays of the current meta category pair */
+    if (scratchArenaInitialize(&scratch, 2 * lwe.q * (sizeof(lweSample*) + sizeof(int)) + 4 * sizeof(max_align_t)))
+    {
+        storageReaderFree(&sr);
+        storageWriterFree(&sw);
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        return 6; /* could not allocate scratch arena */
+    }
+
     /* process samples */
     u64 maxNumSamplesPerCategory = dstCategoryCapacity * EARLY_ABORT_LOAD_LIMIT_PERCENTAGE / SAMPLE_DEPENDENCY_SMEARING + 1;
     u64 cat = 0; /* current category index */
@@ -394,24 +365,26 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
     while (numReadCategories && (storageWriterCurrentLoadPercentage(&sw) < EARLY_ABORT_LOAD_LIMIT_PERCENTAGE))
     {
 
+        lweSample **metaCategory1 = NULL;
+        lweSample **metaCategory2 = NULL;
         int *valueCounter1 = NULL;
         int *valueCounter2 = NULL;
-        lweSample ***metaCategory1 = NULL;
-        lweSample ***metaCategory2 = NULL;
 
-        /* pre-process metacategory 1 (if available) */
+        /* locate sub-buckets of meta category 1 (if available) */
         if (buf1)
         {
-            valueCounter1 = MALLOC(lwe.q * sizeof(int));
-            metaCategory1 = sortMetacategorySamplesOnThirdCoordinate(buf1, numSamplesInBuf1, &lwe, srcBkwStepPar, valueCounter1);
+            metaCategory1 = scratchArenaAlloc(&scratch, lwe.q * sizeof(lweSample*));
+            valueCounter1 = scratchArenaAlloc(&scratch, lwe.q * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf1, numSamplesInBuf1, metaCategory1, valueCounter1);
         }
 
-        /* pre-process metacategory 2 (if available) */
+        /* locate sub-buckets of meta category 2 (if available) */
         if (buf2)
         {
             ASSERT(buf1, "buf2 should only be available if buf1 is");
-            valueCounter2 = MALLOC(lwe.q * sizeof(int));
-            metaCategory2 = sortMetacategorySamplesOnThirdCoordinate(buf2, numSamplesInBuf2, &lwe, srcBkwStepPar, valueCounter2);
+            metaCategory2 = scratchArenaAlloc(&scratch, lwe.q * sizeof(lweSample*));
+            valueCounter2 = scratchArenaAlloc(&scratch, lwe.q * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf2, numSamplesInBuf2, metaCategory2, valueCounter2);
         }
 
         switch (dstBkwStepPar->selection)
@@ -420,17 +393,16 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                ASSERT(metaCategory1, "unexpected parameter");
                 for (int i=0; i<lwe.q; i++)
                 {
-                    processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], dstBkwStepPar, &sw, start);
+                    processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], dstBkwStepPar, &sw, &ci, start);
                 }
                 break;
             case 2: /* two meta categories (first two coordinates are additive inverses) */
                 for (int i=0; i<lwe.q; i++)
                 {
                     int j = additiveInverse(lwe.q, i);
-                    processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], dstBkwStepPar, &sw, start); /* note: does not matter if i == j or not */
+                    processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], dstBkwStepPar, &sw, &ci, start); /* note: does not matter if i == j or not */
                 }
                 break;
             default:
@@ -444,14 +416,14 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
                 for (int i=0; i<lwe.q; i++)
                 {
-                    processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], dstBkwStepPar, &sw, maxNumSamplesPerCategory / lwe.q + 1, 1, start);
+                    processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory / lwe.q + 1, 1, start);
                 }
                 break;
             case 2:  /* two meta categories (first two coordinates are additive inverses) */
                 for (int i=0; i<lwe.q; i++)
                 {
                     int j = additiveInverse(lwe.q, i);
-                    processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, dstBkwStepPar, &sw, 2*maxNumSamplesPerCategory / lwe.q + 1, start);
+                    processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], dstBkwStepPar, &sw, &ci, 2*maxNumSamplesPerCategory / lwe.q + 1, start);
                 }
                 break;
             default:
@@ -464,32 +436,7 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
         }
 
         cat += numReadCategories;
-
-        /* free intermediate meta category information */
-        if (metaCategory1)
-        {
-            for (int i=0; i<lwe.q; i++)
-            {
-                FREE(metaCategory1[i]);
-            }
-            FREE(metaCategory1);
-        }
-        if (metaCategory2)
-        {
-            for (int i=0; i<lwe.q; i++)
-            {
-                FREE(metaCategory2[i]);
-            }
-            FREE(metaCategory2);
-        }
-        if (valueCounter1)
-        {
-            FREE(valueCounter1);
-        }
-        if (valueCounter2)
-        {
-            FREE(valueCounter2);
-        }
+        scratchArenaReset(&scratch);
 
         while (cat > nextPrintLimit)
         {
@@ -504,9 +451,13 @@ int transition_bkw_step_plain_bkw_3_positions(const char *srcFolderName, const c
     timeStamp(start);
     printf("transition_bkw_step_plain_bkw_3_positions: num src categories read so far / all %10s /%10s, dst storage load %5.2f%% (%s samples)\n", sprintf_u64_delim(s1, cat), sprintf_u64_delim(s2, srcNumCategories), storageWriterCurrentLoadPercentage(&sw), sprintf_u64_delim(s3, sw.totalNumSamplesAddedToStorageWriter));
 
+    scratchArenaReport(&scratch, "transition_bkw_step_plain_bkw_3_positions", start);
+    scratchArenaFree(&scratch);
+
     /* close storage handlers */
     storageReaderFree(&sr);
     *numSamplesStored = sw.totalNumSamplesAddedToStorageWriter;
     storageWriterFree(&sw); /* flushes automatically */
+    categoryIndexerFree(&ci);
     return 0;
 }
@@ -14,6 +14,7 @@
  *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
  */
 
+#include "transition_bkw_step_smooth_lms.h"
 #include "storage_file_utilities.h"
 #include "memory_utils.h"
 #include "log_utils.h"
@@ -23,45 +24,35 @@
 #include "storage_writer.h"
 #include "position_values_2_category_index.h"
 #include "config_bkw.h"
+#include "unnatural_selection.h"
+#include "random_utils.h"
 #include <inttypes.h>
 #include <math.h>
 
-#define MIN(X, Y)  ((X) < (Y) ? (X) : (Y))
-
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+/* category index of the sum (add) or difference of two samples, without computing the new sample */
+static u64 combinedCategoryIndex(lweInstance *lwe, lweSample *sample1, lweSample *sample2, int add, bkwStepParameters *dstBkwStepPar, const categoryIndexer *ci)
 {
-    int n = lwe->n;
     int q = lwe->q;
 
-    /* perform Unnatural Selection */
-    if(srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts)
-    {
-        double a_norm_squared = 0;
-        short tmp_a;
-        for (int i=srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_start_index; i<srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; i++)
-        {
-            tmp_a = (columnValue(sample1, i) - columnValue(sample2, i) + q) % q;
-            tmp_a = MIN(tmp_a, q - tmp_a);
-            a_norm_squared += tmp_a*tmp_a;
-        }
-        int numSelectionPositions = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions - srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_start_index; /* Number of positions to apply unnatural selection on */
-        double limit = numSelectionPositions * srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts*srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts; /* The threshold below which we accept samples */
-        if (a_norm_squared >= limit)
-            return 1; /* Sample processed but discarded */
-    }
-
     int startIndex = dstBkwStepPar->startIndex;
     int numPositions = dstBkwStepPar->numPositions;
     short pn[MAX_SMOOTH_LMS_POSITIONS];
 
-    /* compute category index of new sample (without computing entire new sample) */
     int Ni_ = (startIndex + numPositions) == lwe->n ? numPositions : numPositions+1; // differentiate last step
     for (int i=0; i<Ni_; i++)
     {
-        pn[i] = (columnValue(sample1, startIndex + i) - columnValue(sample2, startIndex + i) + q) % q;
+        pn[i] = add ? (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i)) % q : (columnValue(sample1, startIndex + i) - columnValue(sample2, startIndex + i) + q) % q;
     }
+    return categoryIndexerIndex(ci, pn);
+}
+
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
+{
+    int n = lwe->n;
+    int q = lwe->q;
 
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, pn, dstBkwStepPar);
+    /* compute category index of new sample (without computing entire new sample) */
+    u64 categoryIndex = combinedCategoryIndex(lwe, sample1, sample2, 0, dstBkwStepPar, ci);
     ASSERT(categoryIndex >= 0, "ERROR: invalid category");
 
     /* retrieve memory area for new sample in destination storage */
@@ -80,16 +71,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (subtract), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) - columnValue(sample2, i) + q) % q;
-    }
-
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 - err2 + q) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) - sumWithError(sample2) + q) % q;
+    lweSampleSubtract(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -103,40 +85,13 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
 
-    /* perform Unnatural Selection */
-    if(srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts)
-    {
-        double a_norm_squared = 0;
-        short tmp_a;
-        for (int i=srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_start_index; i<srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; i++)
-        {
-            tmp_a = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-            tmp_a = MIN(tmp_a, q - tmp_a);
-            a_norm_squared += tmp_a*tmp_a;
-        }
-        int numSelectionPositions = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions - srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_start_index; /* Number of positions to apply unnatural selection on */
-        double limit = numSelectionPositions * srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts*srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts; /* The threshold below which we accept samples */
-        if (a_norm_squared >= limit)
-            return 1; /* Sample processed but discarded */
-    }
-
-    int startIndex = dstBkwStepPar->startIndex;
-    int numPositions = dstBkwStepPar->numPositions;
-    short pn[MAX_LMS_POSITIONS];
-
     /* compute category index of new sample (without computing entire new sample) */
-    int Ni_ = (startIndex + numPositions) == lwe->n ? numPositions : numPositions+1; // differentiate last step
-    for (int i=0; i<Ni_; i++)
-    {
-        pn[i] = (columnValue(sample1, startIndex + i) + columnValue(sample2, startIndex + i)) % q;
-    }
-
-    u64 categoryIndex = position_values_2_category_index_from_partial_sample(lwe, pn, dstBkwStepPar);
+    u64 categoryIndex = combinedCategoryIndex(lwe, sample1, sample2, 1, dstBkwStepPar, ci);
     ASSERT(categoryIndex >= 0, "ERROR: invalid category");
 
     /* retrieve memory area for new sample in destination storage */
@@ -155,15 +110,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
     ASSERT(newSample, "No sample area returned from storage writer");
 
     /* compute new sample (add), write to reserved sample memory area */
-    for (int i=0; i<n; i++)
-    {
-        newSample->col.a[i] = (columnValue(sample1, i) + columnValue(sample2, i)) % q;
-    }
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
-    int err1 = error(sample1);
-    int err2 = error(sample2);
-    newSample->error = (err1 == -1 || err2 == -1) ? -1 : (err1 + err2) % q; /* undefined if either parent error term is undefined */
-    newSample->sumWithError = (sumWithError(sample1) + sumWithError(sample2)) % q;
+    lweSampleAdd(newSample, sample1, sample2, n, q);
 
     /* discard zero columns (assuming that these are produced by coincidental cancellation due to sample amplification) */
     if (columnIsZero(newSample, n))
@@ -197,7 +144,10 @@ static void flushStorageWriterIfCloseToFull(storageWriter *sw, time_t start)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+/* the filter (NULL without unnatural selection) holds category 1 of the pair from index 0 and
+   category 2 from index numSamplesInCategory1, offset is the filter index of the first sample of the
+   given category. pairs rejected by the filter count as processed */
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, unnaturalSelectionFilter *us, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF1, "unexpected selection type");
     if (numSamplesInCategory < 2)
@@ -206,26 +156,40 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *category, int n
     }
     u64 numProcessed = 0;
     lweSample *firstSample = &category[0];
+    const u8 *accept = us ? unnaturalSelectionFilterPairs(us, 0, 1, numSamplesInCategory, 0) : NULL;
     for (int j=1; j<numSamplesInCategory; j++)
     {
+        if (accept && !accept[j - 1])
+        {
+            numProcessed++;
+            continue;
+        }
         lweSample *thisSample = &category[j];
-        numProcessed += subtractSamples(lwe, firstSample, thisSample, srcBkwStepPar, dstBkwStepPar, sw);
+        numProcessed += subtractSamples(lwe, firstSample, thisSample, dstBkwStepPar, sw, ci);
     }
     flushStorageWriterIfCloseToFull(sw, start);
     return numProcessed;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int numSamplesInCategory, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, unnaturalSelectionFilter *us, int offset, u64 maxNumSamplesPerCategory, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF2, "unexpected selection type");
     u64 numProcessed = 0;
     for (int i=0; i<numSamplesInCategory; i++)
     {
         lweSample *sample1 = &category[i];
+        const u8 *accept = us && i+1 < numSamplesInCategory ? unnaturalSelectionFilterPairs(us, offset + i, offset + i+1, offset + numSamplesInCategory, 0) : NULL;
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
-            lweSample *sample2 = &category[j];
-            numProcessed += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw);
+            if (accept && !accept[j - (i+1)])
+            {
+                numProcessed++;
+            }
+            else
+            {
+                lweSample *sample2 = &category[j];
+                numProcessed += subtractSamples(lwe, sample1, sample2, dstBkwStepPar, sw, ci);
+            }
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -237,28 +201,41 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *category, int n
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, unnaturalSelectionFilter *us, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF1, "unexpected selection type");
     u64 numProcessed = 0;
     lweSample *firstSample;
     lweSample *sample;
+    const u8 *accept;
 
     if (numSamplesInCategory1 > 0)
     {
         /* LF1-process category 1 */
         /* subtract all samples from the first one (linear) */
         firstSample = &category1[0];
+        accept = us && numSamplesInCategory1 > 1 ? unnaturalSelectionFilterPairs(us, 0, 1, numSamplesInCategory1, 0) : NULL;
         for (int i=1; i<numSamplesInCategory1; i++)
         {
+            if (accept && !accept[i - 1])
+            {
+                numProcessed++;
+                continue;
+            }
             sample = &category1[i];
-            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
+        accept = us && numSamplesInCategory2 > 0 ? unnaturalSelectionFilterPairs(us, 0, numSamplesInCategory1, numSamplesInCategory1 + numSamplesInCategory2, 1) : NULL;
         for (int i=0; i<numSamplesInCategory2; i++)
         {
+            if (accept && !accept[i])
+            {
+                numProcessed++;
+                continue;
+            }
             sample = &category2[i];
-            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += addSamples(lwe, firstSample, sample, dstBkwStepPar, sw, ci);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -266,12 +243,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
         if (numSamplesInCategory2 >= 2)
         {
             /* LF1-process samples in category 2 only */
-            firstSample = &category2[0];
-            for (int i=1; i<numSamplesInCategory2; i++)
-            {
-                sample = &category2[i];
-                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
-            }
+            numProcessed += processSingleCategoryLF1(lwe, category2, numSamplesInCategory2, dstBkwStepPar, sw, ci, us, start);
         }
     }
 
@@ -279,7 +251,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *category1,
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1, int numSamplesInCategory1, lweSample *category2, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, unnaturalSelectionFilter *us, u64 maxNumSamplesPerCategory, time_t start)
 {
     ASSERT(dstBkwStepPar->selection == LF2, "unexpected selection type");
     u64 numProcessed = 0;
@@ -287,7 +259,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory, start);
+    numProcessed += processSingleCategoryLF2(lwe, category1, numSamplesInCategory1, dstBkwStepPar, sw, ci, us, 0, maxNumSamplesPerCategory, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -295,7 +267,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory - numProcessed, start);
+    numProcessed += processSingleCategoryLF2(lwe, category2, numSamplesInCategory2, dstBkwStepPar, sw, ci, us, numSamplesInCategory1, maxNumSamplesPerCategory - numProcessed, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -305,9 +277,17 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     /* process all pairs in categories 1 and 2 (add sample pairs) */
     for (int i=0; i<numSamplesInCategory1; i++)
     {
+        const u8 *accept = us && numSamplesInCategory2 > 0 ? unnaturalSelectionFilterPairs(us, i, numSamplesInCategory1, numSamplesInCategory1 + numSamplesInCategory2, 1) : NULL;
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            numProcessed += addSamples(lwe, &category1[i], &category2[j], srcBkwStepPar, dstBkwStepPar, sw);
+            if (accept && !accept[j])
+            {
+                numProcessed++;
+            }
+            else
+            {
+                numProcessed += addSamples(lwe, &category1[i], &category2[j], dstBkwStepPar, sw, ci);
+            }
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -320,6 +300,255 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *category1,
     return numProcessed;
 }
 
+/* LSH_LF2: subtract the pairs of a bucketed load [loadBegin, loadEnd) that are in the same or neighbouring buckets */
+static u64 processSingleCategoryLSH(lweInstance *lwe, unnaturalSelectionFilter *us, int loadBegin, int loadEnd, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
+{
+    u64 numProcessed = 0;
+    u64 keys[LSH_LF2_MAX_NEIGHBOUR_BUCKETS];
+    for (int i=loadBegin; i<loadEnd; i++)
+    {
+        int numKeys = unnaturalSelectionNeighbourBuckets(us, i, 0, keys);
+        for (int k=0; k<numKeys; k++)
+        {
+            int begin, end;
+            unnaturalSelectionBucketRange(us, loadBegin, loadEnd, keys[k], &begin, &end);
+            begin = begin > i ? begin : i+1; /* each pair once */
+            if (begin >= end)
+            {
+                continue;
+            }
+            const u8 *accept = unnaturalSelectionFilterPairs(us, i, begin, end, 0);
+            for (int j=begin; j<end; j++)
+            {
+                numProcessed += accept[j - begin] ? subtractSamples(lwe, us->sample[i], us->sample[j], dstBkwStepPar, sw, ci) : 1;
+            }
+            if (numProcessed >= maxNumSamplesPerCategory)
+            {
+                flushStorageWriterIfCloseToFull(sw, start);
+                return numProcessed;
+            }
+        }
+    }
+    flushStorageWriterIfCloseToFull(sw, start);
+    return numProcessed;
+}
+
+/* LSH_LF2: as processSingleCategoryLSH for each category, then add the pairs across the categories
+   where the sample of category 2 is in a bucket neighbouring the additive inverse of the sample of category 1 */
+static u64 processAdjacentCategoriesLSH(lweInstance *lwe, unnaturalSelectionFilter *us, int numSamplesInCategory1, int numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
+{
+    int end2 = numSamplesInCategory1 + numSamplesInCategory2;
+    u64 numProcessed = processSingleCategoryLSH(lwe, us, 0, numSamplesInCategory1, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory, start);
+    if (numProcessed >= maxNumSamplesPerCategory)
+    {
+        return numProcessed;
+    }
+    numProcessed += processSingleCategoryLSH(lwe, us, numSamplesInCategory1, end2, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory - numProcessed, start);
+    if (numProcessed >= maxNumSamplesPerCategory)
+    {
+        return numProcessed;
+    }
+    u64 keys[LSH_LF2_MAX_NEIGHBOUR_BUCKETS];
+    for (int i=0; i<numSamplesInCategory1; i++)
+    {
+        int numKeys = unnaturalSelectionNeighbourBuckets(us, i, 1, keys);
+        for (int k=0; k<numKeys; k++)
+        {
+            int begin, end;
+            unnaturalSelectionBucketRange(us, numSamplesInCategory1, end2, keys[k], &begin, &end);
+            if (begin >= end)
+            {
+                continue;
+            }
+            const u8 *accept = unnaturalSelectionFilterPairs(us, i, begin, end, 1);
+            for (int j=begin; j<end; j++)
+            {
+                numProcessed += accept[j - begin] ? addSamples(lwe, us->sample[i], us->sample[j], dstBkwStepPar, sw, ci) : 1;
+            }
+            if (numProcessed >= maxNumSamplesPerCategory)
+            {
+                flushStorageWriterIfCloseToFull(sw, start);
+                return numProcessed;
+            }
+        }
+    }
+    flushStorageWriterIfCloseToFull(sw, start);
+    return numProcessed;
+}
+
+/* pilot pass: count the destination categories of the combinations of one source category (pair),
+   in the order and up to the limit of the LF1/LF2 processing above (the unnatural selection filter is
+   not applied). category1 is empty for a singleton category */
+static void pilotCountCategoryPair(lweInstance *lwe, lweSample *category1, u64 numSamplesInCategory1, lweSample *category2, u64 numSamplesInCategory2, bkwStepParameters *dstBkwStepPar, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, u64 *histogram)
+{
+    u64 numProcessed = 0;
+    if (dstBkwStepPar->selection == LF1)
+    {
+        if (!numSamplesInCategory1)
+        {
+            category1 = category2;
+            numSamplesInCategory1 = numSamplesInCategory2;
+            numSamplesInCategory2 = 0;
+        }
+        for (u64 i=1; i<numSamplesInCategory1; i++)
+        {
+            histogram[combinedCategoryIndex(lwe, &category1[0], &category1[i], 0, dstBkwStepPar, ci)]++;
+        }
+        for (u64 i=0; i<numSamplesInCategory1 && i<numSamplesInCategory2; i++)
+        {
+            histogram[combinedCategoryIndex(lwe, &category1[0], &category2[i], 1, dstBkwStepPar, ci)]++;
+        }
+        return;
+    }
+    lweSample *category[2] = {category1, category2};
+    u64 numSamplesInCategory[2] = {numSamplesInCategory1, numSamplesInCategory2};
+    for (int c=0; c<2; c++)
+    {
+        for (u64 i=0; i<numSamplesInCategory[c]; i++)
+        {
+            for (u64 j=i+1; j<numSamplesInCategory[c]; j++)
+            {
+                histogram[combinedCategoryIndex(lwe, &category[c][i], &category[c][j], 0, dstBkwStepPar, ci)]++;
+                if (++numProcessed >= maxNumSamplesPerCategory)
+                {
+                    return;
+                }
+            }
+        }
+    }
+    for (u64 i=0; i<numSamplesInCategory1; i++)
+    {
+        for (u64 j=0; j<numSamplesInCategory2; j++)
+        {
+            histogram[combinedCategoryIndex(lwe, &category1[i], &category2[j], 1, dstBkwStepPar, ci)]++;
+            if (++numProcessed >= maxNumSamplesPerCategory)
+            {
+                return;
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    double remainder;
+    u64 index;
+} pilotRemainder;
+
+/* larger remainders first, ties by category index */
+static int comparePilotRemainders(const void *a, const void *b)
+{
+    const pilotRemainder *x = a, *y = b;
+    if (x->remainder != y->remainder)
+    {
+        return x->remainder > y->remainder ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* estimates the destination occupancy by combining the samples of about percentage percent of the source
+   category pairs (chosen at random), and divides totalCapacity over the destination categories accordingly.
+   every category gets one sample, the rest is divided proportionally to the histogram plus a uniform prior of
+   SMOOTH_LMS_PILOT_PRIOR_PERCENTAGE percent of its mean count (so that categories missed by the pilot still get
+   some room), with largest remainder rounding so that the capacities add up to totalCapacity exactly.
+   LSH_LF2 is modelled as LF2, the pilot does not run the unnatural selection filter that LSH_LF2 depends on.
+   costs one extra read of the source folder */
+int smoothLmsPilotCapacities(const char *srcFolderName, bkwStepParameters *dstBkwStepPar, int percentage, u64 totalCapacity, u64 *capacities)
+{
+    lweInstance lwe;
+    lweParametersFromFile(&lwe, srcFolderName);
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        return 1; /* could not initialize category indexer */
+    }
+    u64 dstNumCategories = ci.numCategories;
+    if (totalCapacity < dstNumCategories)
+    {
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        return 4; /* not one sample per category */
+    }
+    u64 *histogram = CALLOC(dstNumCategories, sizeof(u64));
+    pilotRemainder *remainders = MALLOC(dstNumCategories * sizeof(pilotRemainder));
+    if (!histogram || !remainders)
+    {
+        FREE(remainders);
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        return 2; /* could not allocate histogram */
+    }
+    storageReader sr;
+    if (storageReaderInitialize(&sr, srcFolderName))
+    {
+        FREE(remainders);
+        FREE(histogram);
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        return 3; /* could not initialize storage reader */
+    }
+
+    /* same per category (pair) limit as the transition with the same total capacity */
+    u64 maxNumSamplesPerCategory = (totalCapacity + dstNumCategories - 1) / dstNumCategories * EARLY_ABORT_LOAD_LIMIT_PERCENTAGE / SAMPLE_DEPENDENCY_SMEARING + 1;
+    rand_ctx rnd;
+    randomUtilInit(&rnd);
+    lweSample *buf1, *buf2;
+    u64 numSamplesInBuf1, numSamplesInBuf2;
+    int numReadCategories;
+    while ((numReadCategories = storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2)))
+    {
+        if (randomUtilDouble(&rnd) * 100 >= percentage)
+        {
+            continue;
+        }
+        if (numReadCategories == 1)
+        {
+            pilotCountCategoryPair(&lwe, NULL, 0, buf1, numSamplesInBuf1, dstBkwStepPar, &ci, maxNumSamplesPerCategory, histogram);
+        }
+        else
+        {
+            pilotCountCategoryPair(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, dstBkwStepPar, &ci, 2*maxNumSamplesPerCategory, histogram);
+        }
+    }
+    storageReaderFree(&sr);
+
+    /* one sample per category plus a share of the rest proportional to the histogram plus prior, rounded down */
+    u64 numCounted = 0;
+    for (u64 i=0; i<dstNumCategories; i++)
+    {
+        numCounted += histogram[i];
+    }
+    u64 numShared = totalCapacity - dstNumCategories;
+    double prior = numCounted ? numCounted * (SMOOTH_LMS_PILOT_PRIOR_PERCENTAGE / 100.0) / dstNumCategories : 1;
+    double scale = numShared / (numCounted + prior * dstNumCategories);
+    u64 numAssigned = 0;
+    for (u64 i=0; i<dstNumCategories; i++)
+    {
+        double share = (histogram[i] + prior) * scale;
+        u64 rounded = (u64)floor(share);
+        rounded = numAssigned + rounded > numShared ? numShared - numAssigned : rounded; /* guard against floating point excess */
+        capacities[i] = 1 + rounded;
+        numAssigned += rounded;
+        remainders[i].remainder = share - rounded;
+        remainders[i].index = i;
+    }
+
+    /* hand out the samples lost to rounding down, largest remainders first */
+    qsort(remainders, dstNumCategories, sizeof(pilotRemainder), comparePilotRemainders);
+    for (u64 i=0; numAssigned < numShared; i = (i + 1) % dstNumCategories)
+    {
+        capacities[remainders[i].index]++;
+        numAssigned++;
+    }
+
+    FREE(remainders);
+    FREE(histogram);
+    categoryIndexerFree(&ci);
+    lweDestroy(&lwe);
+    return 0;
+}
+
 int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, u64 *numSamplesStored, time_t start)
 {
     /* get lwe parameters from file */
@@ -344,10 +573,20 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
         return 2; /* unexpected sample sorting at src folder */
     }
 
+    /* build the category index tables of the destination step once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("could not initialize category indexer");
+        return 5; /* could not initialize category indexer */
+    }
+
     /* initialize storage reader */
     storageReader sr;
     if (storageReaderInitialize(&sr, srcFolderName))
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage reader");
         return 3; /* could not initialize storage reader */
@@ -360,16 +599,70 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
     timeStamp(start);
     printf("transition_bkw_step_smooth_lms: num dst categories is %s, category capacity is %s, minDestinationSamplesCapacity %s\n", sprintf_u64_delim(nc, dstNumCategories), sprintf_u64_delim(cc, dstCategoryCapacity), sprintf_u64_delim(mc, minDestinationStorageCapacityInSamples));
 
+    /* optionally size the destination categories from a pilot pass */
+    u64 *dstCategoryCapacities = NULL;
+    u64 maxCategoryCapacity = dstCategoryCapacity; /* largest dst category capacity, bounds the samples combined per src category (pair) */
+    if (SMOOTH_LMS_PILOT_PERCENTAGE)
+    {
+        dstCategoryCapacities = MALLOC(dstNumCategories * sizeof(u64));
+        if (!dstCategoryCapacities || smoothLmsPilotCapacities(srcFolderName, dstBkwStepPar, SMOOTH_LMS_PILOT_PERCENTAGE, dstNumCategories * dstCategoryCapacity, dstCategoryCapacities))
+        {
+            FREE(dstCategoryCapacities);
+            dstCategoryCapacities = NULL;
+            timeStamp(start);
+            printf("transition_bkw_step_smooth_lms: pilot pass failed, all dst categories get the same capacity\n");
+        }
+        else
+        {
+            maxCategoryCapacity = 0;
+            for (u64 i=0; i<dstNumCategories; i++)
+            {
+                maxCategoryCapacity = dstCategoryCapacities[i] > maxCategoryCapacity ? dstCategoryCapacities[i] : maxCategoryCapacity;
+            }
+            timeStamp(start);
+            printf("transition_bkw_step_smooth_lms: pilot pass on %d%% of the src category pairs, largest dst category capacity is %s\n", SMOOTH_LMS_PILOT_PERCENTAGE, sprintf_u64_delim(cc, maxCategoryCapacity));
+        }
+    }
+
     storageWriter sw;
-    if (storageWriterInitialize(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity))
+    int ret = storageWriterInitializeWithCapacities(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity, dstCategoryCapacities);
+    FREE(dstCategoryCapacities);
+    if (ret)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage writer");
         return 4; /* could not initialize storage writer */
     }
 
+    /* unnatural selection pre-filter, holds the samples of a category pair */
+    unnaturalSelectionFilter usFilter;
+    unnaturalSelectionFilter *us = NULL;
+    if (dstBkwStepPar->selection == LSH_LF2 && !srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts)
+    {
+        storageReaderFree(&sr);
+        storageWriterFree(&sw);
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("LSH_LF2 selection requires unnatural selection");
+        return 7; /* LSH_LF2 selection without unnatural selection threshold */
+    }
+    if (srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts)
+    {
+        if (unnaturalSelectionInitialize(&usFilter, &lwe, srcBkwStepPar, 2 * srcCategoryCapacity))
+        {
+            storageReaderFree(&sr);
+            storageWriterFree(&sw);
+            categoryIndexerFree(&ci);
+            lweDestroy(&lwe);
+            ASSERT_ALWAYS("could not initialize unnatural selection filter");
+            return 6; /* could not initialize unnatural selection filter */
+        }
+        us = &usFilter;
+    }
+
     /* process samples */
-    u64 maxNumSamplesPerCategory = dstCategoryCapacity * EARLY_ABORT_LOAD_LIMIT_PERCENTAGE / SAMPLE_DEPENDENCY_SMEARING + 1;
+    u64 maxNumSamplesPerCategory = maxCategoryCapacity * EARLY_ABORT_LOAD_LIMIT_PERCENTAGE / SAMPLE_DEPENDENCY_SMEARING + 1;
     u64 cat = 0; /* current category index */
     u64 nextPrintLimit = 2;
     lweSample *buf1;
@@ -378,6 +671,16 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
     int numReadCategories = storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2);
     while (numReadCategories && (storageWriterCurrentLoadPercentage(&sw) < EARLY_ABORT_LOAD_LIMIT_PERCENTAGE))
     {
+        if (us)
+        {
+            void (*load)(unnaturalSelectionFilter*, lweSample*, int) = dstBkwStepPar->selection == LSH_LF2 ? unnaturalSelectionLoadBucketed : unnaturalSelectionLoad;
+            unnaturalSelectionReset(us);
+            load(us, buf1, numSamplesInBuf1);
+            if (numReadCategories == 2)
+            {
+                load(us, buf2, numSamplesInBuf2);
+            }
+        }
 
         switch (dstBkwStepPar->selection)
         {
@@ -385,10 +688,10 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processSingleCategoryLF1(&lwe, buf1, numSamplesInBuf1, dstBkwStepPar, &sw, &ci, us, start);
                 break;
             case 2: /* two meta categories (first two coordinates are additive inverses) */
-                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, start);
+                processAdjacentCategoriesLF1(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, dstBkwStepPar, &sw, &ci, us, start);
                 break;
             default:
                 timeStamp(start);
@@ -399,10 +702,24 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory, start);
+                processSingleCategoryLF2(&lwe, buf1, numSamplesInBuf1, dstBkwStepPar, &sw, &ci, us, 0, maxNumSamplesPerCategory, start);
                 break;
             case 2:  /* two meta categories (first two coordinates are additive inverses) */
-                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, srcBkwStepPar, dstBkwStepPar, &sw, 2*maxNumSamplesPerCategory, start);
+                processAdjacentCategoriesLF2(&lwe, buf1, numSamplesInBuf1, buf2, numSamplesInBuf2, dstBkwStepPar, &sw, &ci, us, 2*maxNumSamplesPerCategory, start);
+                break;
+            default:
+                timeStamp(start);
+                printf("*** transition_bkw_step_smooth_lms: Unexpected number of categories\n");
+            }
+            break;
+        case LSH_LF2:
+            switch (numReadCategories)
+            {
+            case 1:
+                processSingleCategoryLSH(&lwe, us, 0, numSamplesInBuf1, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory, start);
+                break;
+            case 2:
+                processAdjacentCategoriesLSH(&lwe, us, numSamplesInBuf1, numSamplesInBuf2, dstBkwStepPar, &sw, &ci, 2*maxNumSamplesPerCategory, start);
                 break;
             default:
                 timeStamp(start);
@@ -434,6 +751,11 @@ int transition_bkw_step_smooth_lms(const char *srcFolderName, const char *dstFol
 //  u64 dstCategoryCapacityFile = sw.categoryCapacityFile;
     *numSamplesStored = sw.totalNumSamplesAddedToStorageWriter;
     storageWriterFree(&sw); /* flushes automatically */
+    if (us)
+    {
+        unnaturalSelectionFree(us);
+    }
+    categoryIndexerFree(&ci);
     lweDestroy(&lwe);
 
     return 0;
@@ -23,6 +23,7 @@
 #include "storage_reader.h"
 #include "storage_writer.h"
 #include "position_values_2_category_index.h"
+#include "scratch_arena.h"
 #include "config_bkw.h"
 #include <inttypes.h>
 #include <math.h>
@@ -45,7 +46,7 @@ static short subtractModuloQ(short a, short b, int q) {
     return c;
 }
 
-static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -92,7 +93,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
         pn[i] = subtractModuloQ(columnValue(sample1, startIndex + i), columnValue(sample2, startIndex + i), q);
     }
 
-    u64 categoryIndex = position_values_2_category_index_smooth_lms_meta(lwe, dstBkwStepPar, pn);
+    u64 categoryIndex = categoryIndexerIndex(ci, pn);
     ASSERT(categoryIndex >= 0, "ERROR: invalid category");
 
     /* retrieve memory area for new sample in destination storage */
@@ -132,7 +133,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
         newSample->col.a[i] = subtractModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
     }
 
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
+    newSample->col.hash = columnHashSubtract(columnHash(sample1), columnHash(sample2), q);
     int err1 = error(sample1);
     int err2 = error(sample2);
     newSample->error = (err1 == -1 || err2 == -1) ? -1 : subtractModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
@@ -151,7 +152,7 @@ static u64 subtractSamples(lweInstance *lwe, lweSample *sample1, lweSample *samp
     return 1; /* one sample processed (and actually added) */
 }
 
-static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw)
+static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci)
 {
     int n = lwe->n;
     int q = lwe->q;
@@ -199,7 +200,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
 
     }
 
-    u64 categoryIndex = position_values_2_category_index_smooth_lms_meta(lwe, dstBkwStepPar, pn);
+    u64 categoryIndex = categoryIndexerIndex(ci, pn);
     ASSERT(categoryIndex >= 0, "ERROR: invalid category");
 
     /* retrieve memory area for new sample in destination storage */
@@ -237,7 +238,7 @@ static u64 addSamples(lweInstance *lwe, lweSample *sample1, lweSample *sample2,
         newSample->col.a[i] = addModuloQ(columnValue(sample1, i), columnValue(sample2, i), q);
     }
 
-    newSample->col.hash = bkwColumnComputeHash(newSample, n, 0 /* startRow */);
+    newSample->col.hash = columnHashAdd(columnHash(sample1), columnHash(sample2), q);
     int err1 = error(sample1);
     int err2 = error(sample2);
     newSample->error = (err1 == -1 || err2 == -1) ? -1 : addModuloQ(err1, err2, q); /* undefined if either parent error term is undefined */
@@ -289,7 +290,7 @@ static void flushStorageWriterIfCloseToFull(storageWriter *sw, time_t start)
     }
 }
 
-static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -301,17 +302,17 @@ static u64 processSingleCategoryLF1(lweInstance *lwe, lweSample **categorySample
     }
 
     /* subtract all samples from the first one (linear) */
-    firstSample = categorySamplePointers[0];
+    firstSample = &categorySamples[0];
     for (int i=1; i<numSamplesInCategory; i++)
     {
-        sample = categorySamplePointers[i];
-        numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+        sample = &categorySamples[i];
+        numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
     }
     flushStorageWriterIfCloseToFull(sw, start);
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, time_t start)
+static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *firstSample;
@@ -321,17 +322,17 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
     {
         /* LF1-process category 1 */
         /* subtract all samples from the first one (linear) */
-        firstSample = categorySamplePointers1[0];
+        firstSample = &categorySamples1[0];
         for (int i=1; i<numSamplesInCategory1; i++)
         {
-            sample = categorySamplePointers1[i];
-            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            sample = &categorySamples1[i];
+            numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
         }
         /* add all samples in adjacent category to first (same as above) sample (linear) */
         for (int i=0; i<numSamplesInCategory2; i++)
         {
-            sample = categorySamplePointers2[i];
-            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+            sample = &categorySamples2[i];
+            numProcessed += addSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
         }
     }
     else     /* numSamplesInCategory1 == 0 */
@@ -339,11 +340,11 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
         if (numSamplesInCategory2 >= 2)
         {
             /* LF1-process samples in category 2 only */
-            firstSample = categorySamplePointers2[0];
+            firstSample = &categorySamples2[0];
             for (int i=1; i<numSamplesInCategory2; i++)
             {
-                sample = categorySamplePointers2[i];
-                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw);
+                sample = &categorySamples2[i];
+                numProcessed += subtractSamples(lwe, firstSample, sample, srcBkwStepPar, dstBkwStepPar, sw, ci);
             }
         }
     }
@@ -351,7 +352,7 @@ static u64 processAdjacentCategoriesLF1(lweInstance *lwe, lweSample **categorySa
     return numProcessed;
 }
 
-static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySamplePointers, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, int flush, time_t start)
+static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample *categorySamples, int numSamplesInCategory, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, int flush, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -363,13 +364,13 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySample
     for (int i=0; i<numSamplesInCategory; i++)
     {
         // printf("Hello there i = %d!\n", i);
-        sample1 = categorySamplePointers[i];
+        sample1 = &categorySamples[i];
         for (int j=i+1; j<numSamplesInCategory; j++)
         {
             // printf("Hello there j = %d!\n", j);
-            sample2 = categorySamplePointers[j];
+            sample2 = &categorySamples[j];
             // printf("Hello there j = %d!\n", j);
-            numProcessed += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw);
+            numProcessed += subtractSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 if (flush)
@@ -387,7 +388,7 @@ static u64 processSingleCategoryLF2(lweInstance *lwe, lweSample **categorySample
     return numProcessed;
 }
 
-static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySamplePointers1, int numSamplesInCategory1, lweSample **categorySamplePointers2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, u64 maxNumSamplesPerCategory, time_t start)
+static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample *categorySamples1, int numSamplesInCategory1, lweSample *categorySamples2, int numSamplesInCategory2, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, storageWriter *sw, const categoryIndexer *ci, u64 maxNumSamplesPerCategory, time_t start)
 {
     u64 numProcessed = 0;
     lweSample *sample1;
@@ -396,7 +397,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     /* Paul's note: sample dependency may be reduced beyond that given by SAMPLE_DEPENDENCY_SMEARING combining samples in a smarter order (all LF1 samples first, then...) */
 
     /* process all pairs in category 1 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, categorySamplePointers1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, categorySamples1, numSamplesInCategory1, srcBkwStepPar, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -404,7 +405,7 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     }
 
     /* process all pairs in category 2 (subtract sample pairs) */
-    numProcessed += processSingleCategoryLF2(lwe, categorySamplePointers2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, maxNumSamplesPerCategory - numProcessed, 0, start);
+    numProcessed += processSingleCategoryLF2(lwe, categorySamples2, numSamplesInCategory2, srcBkwStepPar, dstBkwStepPar, sw, ci, maxNumSamplesPerCategory - numProcessed, 0, start);
     if (numProcessed >= maxNumSamplesPerCategory)
     {
         flushStorageWriterIfCloseToFull(sw, start);
@@ -414,11 +415,11 @@ static u64 processAdjacentCategoriesLF2(lweInstance *lwe, lweSample **categorySa
     /* process all pairs in categories 1 and 2 (add sample pairs) */
     for (int i=0; i<numSamplesInCategory1; i++)
     {
-        sample1 = categorySamplePointers1[i];
+        sample1 = &categorySamples1[i];
         for (int j=0; j<numSamplesInCategory2; j++)
         {
-            sample2 = categorySamplePointers2[j];
-            numProcessed += addSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw);
+            sample2 = &categorySamples2[j];
+            numProcessed += addSamples(lwe, sample1, sample2, srcBkwStepPar, dstBkwStepPar, sw, ci);
             if (numProcessed >= maxNumSamplesPerCategory)
             {
                 flushStorageWriterIfCloseToFull(sw, start);
@@ -450,136 +451,6 @@ static void getLastCategorySizes(int q, int n, bkwStepParameters *srcBkwStepPar,
     }
 }
 
-static lweSample ***sortMetacategoryTwoPositions(lweSample *category, int numSamplesInCategory, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, int *valueCounter, int n, int cMidPosition, int cLastPosition)
-{
-    int maxNumRepetitionsOfCategory = 0;
-    int q = lwe->q;
-
-    int pLast;
-    int pSecondToLast = srcBkwStepPar->sortingPar.smoothLMS.p;
-
-    int metaCategorySize = cMidPosition*cLastPosition;
-
-    int q_ = q%2 == 1 ? (q+1)/2 : q/2;
-
-    int lastPos = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; /* Index for the last position */
-    if (lastPos == n)   /* Last step of smooth LMS */
-    {
-        lastPos--;
-        pLast = srcBkwStepPar->sortingPar.smoothLMS.p;
-    }
-    else
-    {
-        pLast = srcBkwStepPar->sortingPar.smoothLMS.p1;
-    }
-
-    /* compute distribution of last position value */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    /* TODO: Implement this function... */
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        int pnLast = columnValue(&category[i], lastPos); /* Last position value */
-        int pnSecondToLast = columnValue(&category[i], lastPos - 1); /* Second to last position value */
-        int currentLastPositionCategory = positionSmoothLMSMap(pnLast, q, q_, pLast, cLastPosition); /* Last position category */
-        int currentSecondToLastPositionCategory = positionSmoothLMSMap(pnSecondToLast, q, q_, pSecondToLast, cMidPosition); /* Second to last position category */
-        int currentCategory = currentLastPositionCategory*cMidPosition + currentSecondToLastPositionCategory;
-        // printf("The current category for sample %d is %d\n", i, currentCategory);
-        valueCounter[currentCategory]++; /* Increase counter for corresponding category */
-    }
-    /* find maximum */
-    for (int i=0; i<metaCategorySize; i++)   /* Loop over all categories */
-    {
-        if (valueCounter[i] > maxNumRepetitionsOfCategory)
-        {
-            maxNumRepetitionsOfCategory = valueCounter[i];
-        }
-    }
-
-    /* allocate storage structure for (properly) sorted samples (no copying, pointers only) */
-    lweSample ***metaCategory = (lweSample***)MALLOC(metaCategorySize * sizeof(lweSample**));
-
-    for (int i=0; i<metaCategorySize; i++)
-    {
-        metaCategory[i] = (lweSample**)MALLOC(maxNumRepetitionsOfCategory * sizeof(lweSample*));
-    }
-
-
-
-    /* TODO: Finish this function! */
-    /* sort */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        lweSample *thisSample = &category[i];
-        int pnLast = columnValue(thisSample, lastPos);
-        int pnSecondToLast = columnValue(thisSample, lastPos - 1);
-        int currentLastPositionCategory = positionSmoothLMSMap(pnLast, q, q_, pLast, cLastPosition); /* Last position category */
-        int currentSecondToLastPositionCategory = positionSmoothLMSMap(pnSecondToLast, q, q_, pSecondToLast, cMidPosition); /* Second to last position category */
-        int currentCategory = currentLastPositionCategory*cMidPosition + currentSecondToLastPositionCategory;
-        metaCategory[currentCategory][valueCounter[currentCategory]++] = thisSample;
-    }
-
-    return metaCategory;
-}
-
-static lweSample ***sortMetacategoryOnePosition(lweSample *category, int numSamplesInCategory, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, int *valueCounter, int n, int metaCategorySize)
-{
-    int maxNumRepetitionsOfLastPos = 0;
-    int q = lwe->q;
-    int p;
-    int q_ = q%2 == 1 ? (q+1)/2 : q/2;
-    int lastPos = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions; /* Index for the last position */
-    if (lastPos == n)   /* Last step of smooth LMS */
-    {
-        lastPos--;
-        p = srcBkwStepPar->sortingPar.smoothLMS.p;
-    }
-    else
-    {
-        p = srcBkwStepPar->sortingPar.smoothLMS.p1;
-    }
-
-//  printf("Meta category size is %d\n", metaCategorySize);
-//  printf("The whole category has %d samples\n", numSamplesInCategory);
-
-    /* compute distribution of last position value */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        int pn = columnValue(&category[i], lastPos); /* Last position value */
-        int currentCategory = positionSmoothLMSMap(pn, q, q_, p, metaCategorySize); /* Corresponding category */
-        valueCounter[currentCategory]++; /* Increase counter for corresponding category */
-    }
-    /* find maximum */
-    for (int i=0; i<metaCategorySize; i++)
-    {
-//    printf("Category at index %d has %d samples\n", i, valueCounter[i]);
-        if (valueCounter[i] > maxNumRepetitionsOfLastPos)
-        {
-            maxNumRepetitionsOfLastPos = valueCounter[i];
-        }
-    }
-
-    /* allocate storage structure for (properly) sorted samples (no copying, pointers only) */
-    lweSample ***metaCategory = (lweSample***)MALLOC(metaCategorySize * sizeof(lweSample**));
-    for (int i=0; i<metaCategorySize; i++)
-    {
-        metaCategory[i] = (lweSample**)MALLOC(maxNumRepetitionsOfLastPos * sizeof(lweSample*));
-    }
-
-    /* sort */
-    MEMSET(valueCounter, 0, metaCategorySize * sizeof(int));
-    for (int i=0; i<numSamplesInCategory; i++)
-    {
-        lweSample *thisSample = &category[i];
-        int pn = columnValue(&category[i], lastPos); /* Last position value */
-        int currentCategory = positionSmoothLMSMap(pn, q, q_, p, metaCategorySize); /* Corresponding category */
-        metaCategory[currentCategory][valueCounter[currentCategory]++] = thisSample;
-    }
-
-    return metaCategory;
-}
-
 int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *dstFolderName, bkwStepParameters *srcBkwStepPar, bkwStepParameters *dstBkwStepPar, u64 *numSamplesStored, time_t start)
 {
     /* get lwe parameters from file */
@@ -611,10 +482,20 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
         return 2; /* unexpected sample sorting at src folder */
     }
 
+    /* build the category index tables of the destination step once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, dstBkwStepPar))
+    {
+        lweDestroy(&lwe);
+        ASSERT_ALWAYS("could not initialize category indexer");
+        return 5; /* could not initialize category indexer */
+    }
+
     /* initialize storage reader */
     storageReader sr;
     if (storageReaderInitialize(&sr, srcFolderName))
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage reader");
         return 3; /* could not initialize storage reader */
@@ -630,6 +511,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
     storageWriter sw;
     if (storageWriterInitialize(&sw, dstFolderName, &lwe, dstBkwStepPar, dstCategoryCapacity))
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("could not initialize storage writer");
         return 4; /* could not initialize storage writer */
@@ -661,55 +543,51 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
     }
     else
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         ASSERT_ALWAYS("Unsupported number of skipped positions");
         return 7;
     }
 
+    /* the samples of a meta category are ordered by sub-bucket (the positions skipped for the meta
+       categories) by the writer of the previous step, the sub-buckets are located in place */
+    subBucketIndexer sbi;
+    subBucketIndexerInitialize(&sbi, &lwe, srcBkwStepPar);
+    ASSERT(sbi.numSubBuckets == metaCategorySize, "unexpected sub-bucket layout");
+    scratchArena scratch; /* sub-bucket arrays of the current meta category pair */
+    if (scratchArenaInitialize(&scratch, 2 * metaCategorySize * (sizeof(lweSample*) + sizeof(int)) + 4 * sizeof(max_align_t)))
+    {
+        storageReaderFree(&sr);
+        storageWriterFree(&sw);
+        categoryIndexerFree(&ci);
+        lweDestroy(&lwe);
+        return 6; /* could not allocate scratch arena */
+    }
+
     /* The main while loop */
     while (numReadCategories && (storageWriterCurrentLoadPercentage(&sw) < EARLY_ABORT_LOAD_LIMIT_PERCENTAGE))
     {
 
-        /* The meta category pair and the corresponding counter for number samples within each category within the meta category */
+        lweSample **metaCategory1 = NULL;
+        lweSample **metaCategory2 = NULL;
         int *valueCounter1 = NULL;
         int *valueCounter2 = NULL;
-        lweSample ***metaCategory1 = NULL;
-        lweSample ***metaCategory2 = NULL;
 
-        /* pre-process metacategory 1 (if available) */
+        /* locate the sub-buckets of meta category 1 (if available) */
         if (buf1)
         {
-            valueCounter1 = MALLOC(metaCategorySize * sizeof(int)); /* We should find out what this number is */
-            if (meta_skipped == 1)
-            {
-                metaCategory1 = sortMetacategoryOnePosition(buf1, numSamplesInBuf1, &lwe, srcBkwStepPar, valueCounter1, lwe.n, metaCategorySize);
-            }
-            else if (meta_skipped == 2)
-            {
-                metaCategory1 = sortMetacategoryTwoPositions(buf1, numSamplesInBuf1, &lwe, srcBkwStepPar, valueCounter1, lwe.n, cMidPosition, cLastPosition);
-            }
-            else
-            {
-                ASSERT_ALWAYS("Unsupported number of skipped positions!");
-            }
+            metaCategory1 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(lweSample*));
+            valueCounter1 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf1, numSamplesInBuf1, metaCategory1, valueCounter1);
         }
 
+        /* locate the sub-buckets of meta category 2 (if available) */
         if (buf2)
         {
             ASSERT(buf1, "buf2 should only be available if buf1 is");
-            valueCounter2 = MALLOC(metaCategorySize * sizeof(int));
-            if (meta_skipped == 1)
-            {
-                metaCategory2 = sortMetacategoryOnePosition(buf2, numSamplesInBuf2, &lwe, srcBkwStepPar, valueCounter2, lwe.n, metaCategorySize);
-            }
-            else if (meta_skipped == 2)
-            {
-                metaCategory2 = sortMetacategoryTwoPositions(buf2, numSamplesInBuf2, &lwe, srcBkwStepPar, valueCounter2, lwe.n, cMidPosition, cLastPosition);
-            }
-            else
-            {
-                ASSERT_ALWAYS("Unsupported number of skipped positions!");
-            }
+            metaCategory2 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(lweSample*));
+            valueCounter2 = scratchArenaAlloc(&scratch, metaCategorySize * sizeof(int));
+            subBucketIndexerLocate(&sbi, buf2, numSamplesInBuf2, metaCategory2, valueCounter2);
         }
 
         /* Process meta categories based on selection method, single/pair and number of positions skipped */
@@ -719,19 +597,18 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
             switch (numReadCategories)
             {
             case 1: /* single meta category (no corresponding meta category with first two coordinates having (differing) additive inverses) */
-                ASSERT(metaCategory1, "unexpected parameter");
                 for (int i=0; i<cLastPosition; i++)
                 {
                     if (meta_skipped == 1)   /* One position skipped for meta categories */
                     {
-                        processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, dstBkwStepPar, &sw, start);
+                        processSingleCategoryLF1(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, dstBkwStepPar, &sw, &ci, start);
                     }
                     else     /* Two positions skipped for meta categories */
                     {
                         for (int k = 0; k < cMidPosition; k++)
                         {
                             int index = i*cLastPosition + k; /* Index in the meta category to access when skipping to positions */
-                            processSingleCategoryLF1(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, dstBkwStepPar, &sw, start);
+                            processSingleCategoryLF1(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, dstBkwStepPar, &sw, &ci, start);
                         }
                     }
                 }
@@ -742,7 +619,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
                     int j = additiveInverse(cLastPosition, i);
                     if (meta_skipped == 1)
                     {
-                        processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, dstBkwStepPar, &sw, start); /* note: does not matter if i == j or not */
+                        processAdjacentCategoriesLF1(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, dstBkwStepPar, &sw, &ci, start); /* note: does not matter if i == j or not */
                     }
                     else
                     {
@@ -751,7 +628,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
                             int l = additiveInverse(cMidPosition, k);
                             int index = i*cLastPosition + k;
                             int additiveInverseIndex = j*cLastPosition + l;
-                            processAdjacentCategoriesLF1(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, dstBkwStepPar, &sw, start); /* note: does not matter if i == j or not */
+                            processAdjacentCategoriesLF1(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, dstBkwStepPar, &sw, &ci, start); /* note: does not matter if i == j or not */
                         }
                     }
                 }
@@ -772,14 +649,14 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
                     if (meta_skipped == 1)   /* One position skipped for meta categories */
                     {
                         // printf("i = %d\n", i);
-                        processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory / metaCategorySize + 1, 1, start);
+                        processSingleCategoryLF2(&lwe, metaCategory1[i], valueCounter1[i], srcBkwStepPar, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory / metaCategorySize + 1, 1, start);
                     }
                     else     /* Two positions skipped for meta categories */
                     {
                         for (int k = 0; k < cMidPosition; k++)
                         {
                             int index = i*cLastPosition + k; /* Index in the meta category to access when skipping to positions */
-                            processSingleCategoryLF2(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory / metaCategorySize + 1, 1, start);
+                            processSingleCategoryLF2(&lwe, metaCategory1[index], valueCounter1[index], srcBkwStepPar, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory / metaCategorySize + 1, 1, start);
                         }
                     }
                 }
@@ -790,7 +667,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
                     int j = additiveInverse(cLastPosition, i);
                     if (meta_skipped == 1)
                     {
-                        processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory / metaCategorySize + 1, start); /* note: does not matter if i == j or not */
+                        processAdjacentCategoriesLF2(&lwe, metaCategory1[i], valueCounter1[i], metaCategory2[j], valueCounter2[j], srcBkwStepPar, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory / metaCategorySize + 1, start); /* note: does not matter if i == j or not */
                     }
                     else
                     {
@@ -799,7 +676,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
                             int l = additiveInverse(cMidPosition, k);
                             int index = i*cMidPosition + k;
                             int additiveInverseIndex = j*cMidPosition + l;
-                            processAdjacentCategoriesLF2(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, dstBkwStepPar, &sw, maxNumSamplesPerCategory / metaCategorySize + 1, start); /* note: does not matter if i == j or not */
+                            processAdjacentCategoriesLF2(&lwe, metaCategory1[index], valueCounter1[index], metaCategory2[additiveInverseIndex], valueCounter2[additiveInverseIndex], srcBkwStepPar, dstBkwStepPar, &sw, &ci, maxNumSamplesPerCategory / metaCategorySize + 1, start); /* note: does not matter if i == j or not */
                         }
                     }
                 }
@@ -814,32 +691,7 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
         }
 
         cat += numReadCategories;
-
-        /* free intermediate meta category information */
-        if (metaCategory1)
-        {
-            for (int i=0; i<metaCategorySize; i++)
-            {
-                FREE(metaCategory1[i]);
-            }
-            FREE(metaCategory1);
-        }
-        if (metaCategory2)
-        {
-            for (int i=0; i<metaCategorySize; i++)
-            {
-                FREE(metaCategory2[i]);
-            }
-            FREE(metaCategory2);
-        }
-        if (valueCounter1)
-        {
-            FREE(valueCounter1);
-        }
-        if (valueCounter2)
-        {
-            FREE(valueCounter2);
-        }
+        scratchArenaReset(&scratch);
 
         while (cat > nextPrintLimit)
         {
@@ -855,10 +707,14 @@ int transition_bkw_step_smooth_lms_meta(const char *srcFolderName, const char *d
     timeStamp(start);
     printf("transition_bkw_step_smooth_lms_meta: num src categories read so far / all %10s /%10s, dst storage load %5.2f%% (%s samples)\n", sprintf_u64_delim(s1, cat), sprintf_u64_delim(s2, srcNumCategories), storageWriterCurrentLoadPercentage(&sw), sprintf_u64_delim(s3, sw.totalNumSamplesAddedToStorageWriter));
 
+    scratchArenaReport(&scratch, "transition_bkw_step_smooth_lms_meta", start);
+    scratchArenaFree(&scratch);
+
     /* close storage handlers */
     storageReaderFree(&sr);
     *numSamplesStored = sw.totalNumSamplesAddedToStorageWriter;
     storageWriterFree(&sw); /* flushes automatically */
+    categoryIndexerFree(&ci);
 
     lweDestroy(&lwe);
 
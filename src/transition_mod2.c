@@ -33,7 +33,7 @@ int sample_mod2(lweInstance *lwe, lweSample *sample)
     for (int i=0; i<n; i++)
         sample->col.a[i] = sample->col.a[i] < q/2 ? sample->col.a[i] % 2 : abs((sample->col.a[i]-q) %2);
     sample->sumWithError = sample->sumWithError < q/2 ? sample->sumWithError % 2 : abs((sample->sumWithError-q) % 2);
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0);
+    sample->col.hash = bkwColumnComputeHash(sample, n, q, 0);
     sample->error = error(sample) < q/2 ? error(sample) % 2 : abs((error(sample)-q) % 2);
     return 0;
 }
@@ -109,7 +109,7 @@ int transition_mod2(const char *srcFolderName, const char *dstFolderName, time_t
 
         /* add samples to storage writer */
         u64 n = numRead;
-        int blockSize = 1000000;
+        u64 blockSize = 1000000;
 
         newStorageFolderWithGivenLweInstance(&lwe, dstFolderName);
         FILE *f = fopenSamples(dstFolderName, "ab");
@@ -26,32 +26,6 @@
 #include "test_functions.h"
 #include <inttypes.h>
 
-/* a-> 2a
- * b -> b-a*lsb_secret
- */
-int transform_sample(lweInstance *lwe, lweSample *sample, u8 * lsb_secret)
-{
-    int n = lwe->n;
-    int q = lwe->q;
-    // compute a*lsb_secret
-    int subt = 0;
-    int sgn = 0;
-
-    for (int i=0; i<n; i++)
-    {
-        if (!lsb_secret[i])
-            sgn = 0;
-        else
-            sgn = lsb_secret[i] <= q/2 ? 1 : q-1;
-        subt = (subt+sample->col.a[i]*sgn) % q;
-    }
-    for (int i=0; i<n; i++)
-        sample->col.a[i] = (2*sample->col.a[i]) % q;
-    sample->sumWithError = (sample->sumWithError -subt) >= 0 ? (sample->sumWithError -subt) : (sample->sumWithError -subt) +q;
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0);
-    return 0;
-}
-
 /* given lsb of the secret, get a reduced secret
  */
 int reduce_secret(lweInstance *lwe, u8 * lsb_secret)
@@ -68,7 +42,15 @@ int reduce_secret(lweInstance *lwe, u8 * lsb_secret)
 
 
 /*
- * Given the LSBs of the secret, create new samples with a reduced version of the secret
+ * Given the LSBs of the secret, create a folder of samples with a reduced version of the secret,
+ * a -> 2a and b -> b - a*lsb_secret. The samples are not rewritten: the destination folder only
+ * records the reduction (composed with that of the source folder) in its parameter file, and the
+ * readers of unsorted samples apply it on the fly. The base folder must therefore be kept.
+ *
+ * The reduction steps of the next iteration must be recomputed from these samples. Since the steps
+ * are linear, replaying the combinations of an earlier iteration is the same as reducing the secret
+ * of its final samples, but that gives b - a*t = 2^k*a*s' + e, whose parity carries no information
+ * on the least significant bits of the reduced secret s'.
  */
 int transition_reduce_secret(const char *srcFolderName, const char *dstFolderName, u8 * lsb_secret, time_t start)
 {
@@ -82,80 +64,55 @@ int transition_reduce_secret(const char *srcFolderName, const char *dstFolderNam
     timeStamp(start);
     printf("dst folder: %s\n", dstFolderName);
 
-    lweInstance lwe;
-    lweParametersFromFile(&lwe, srcFolderName); /* read lwe parameters from source folder */
+    secretReduction r;
+    if (secretReductionFromFile(srcFolderName, &r))
+    {
+        return 3; /* could not read parameter file */
+    }
+    if (!r.numReductions)
+    {
+        strncpy(r.baseFolderName, srcFolderName, sizeof(r.baseFolderName) - 1);
+        r.baseFolderName[sizeof(r.baseFolderName) - 1] = 0;
+        MEMSET(r.t, 0, sizeof(r.t));
+    }
 
-    /* get number of samples in source file */
-    u64 totNumdSamples = numSamplesInSampleFile(srcFolderName);
+    /* get number of samples in base sample file */
+    u64 totNumdSamples = numSamplesInSampleFile(r.baseFolderName);
     if (!totNumdSamples)
     {
         return 2; /* no samples in source file */
     }
     char str[256];
     timeStamp(start);
-    printf("src folder: %s (contains %s samples)\n", srcFolderName, sprintf_u64_delim(str, totNumdSamples));
+    printf("base folder: %s (contains %s samples)\n", r.baseFolderName, sprintf_u64_delim(str, totNumdSamples));
 
-    /* Reduce secret */
-    reduce_secret(&lwe, lsb_secret);
+    lweInstance lwe;
+    lweParametersFromFile(&lwe, srcFolderName); /* read lwe parameters from source folder */
 
-    /* open source sample file */
-    FILE *f_src = fopenSamples(srcFolderName, "rb");
-    if (!f_src)
+    /* the current samples have a scaled by 2^numReductions, so b -> b - a*lsb_secret adds 2^numReductions * lsb_secret to t */
+    int q = lwe.q;
+    int scale = 1;
+    for (int k=0; k<r.numReductions; k++)
     {
-        return 4; /* could not open samples file */
+        scale = (2 * scale) % q;
     }
-
-    /* allocate sample read buffer */
-    lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
-    if (!sampleReadBuf)
+    for (int i=0; i<lwe.n; i++)
     {
-        fclose(f_src);
-        return 6; /* could not allocate sample read buffer */
+        int sgn = !lsb_secret[i] ? 0 : lsb_secret[i] <= q/2 ? 1 : q-1;
+        r.t[i] = (r.t[i] + scale * sgn) % q;
     }
+    r.numReductions++;
 
-    /* process all samples in source file */
-    lweSample *s;
+    /* Reduce secret */
+    reduce_secret(&lwe, lsb_secret);
 
-    while (!feof(f_src))
+    /* destination folder with reduced secret and an empty sample file */
+    if (newStorageFolderWithGivenLweInstance(&lwe, dstFolderName) || secretReductionToFile(dstFolderName, &r))
     {
-        /* read chunk of samples from source sample file into read buffer */
-        u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
-
-        /* transform sample by subtracting a*s in both sides of the equation */
-        for (u64 i=0; i<numRead; i++)
-        {
-            s = &sampleReadBuf[i];
-            transform_sample(&lwe, s, lsb_secret);
-        }
-
-        /* add samples to storage writer */
-        u64 n = numRead;
-        int blockSize = 1000000;
-
-        newStorageFolderWithGivenLweInstance(&lwe, dstFolderName);
-        newStorageFolder(&lwe, dstFolderName, lwe.n, lwe.q, lwe.alpha);
-        FILE *f = fopenSamples(dstFolderName, "ab");
-        if (!f)
-        {
-            return -1;
-        }
-
-        while (n)
-        {
-            int numSamplesThisRound = MIN(n, blockSize);
-            int numWritten = fwrite(sampleReadBuf, LWE_SAMPLE_SIZE_IN_BYTES, numSamplesThisRound, f);
-            n -= numWritten;
-            // printf("n = %" PRIu64 "\n", n);
-        }
-        fclose(f);
+        lweDestroy(&lwe);
+        return 4; /* could not create destination folder */
     }
 
-    /* cleanup */
-    FREE(sampleReadBuf);
-    fclose(f_src);
-
+    lweDestroy(&lwe);
     return 0;
 }
-
-
-
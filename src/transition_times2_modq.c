@@ -22,8 +22,8 @@
 #include "string_utils.h"
 #include "storage_writer.h"
 #include "bkw_step_parameters.h"
-#include "verify_samples.h"
 #include "test_functions.h"
+#include "bkw_metrics.h"
 #include <inttypes.h>
 
 short multiply_time2_modq(short a, int q) {
@@ -41,24 +41,24 @@ int sample_times2_modq(lweInstance *lwe, lweSample *sample)
         // sample->col.a[i] = (2*sample->col.a[i]) % q;
         sample->col.a[i] = multiply_time2_modq(sample->col.a[i], q);
     sample->sumWithError = multiply_time2_modq(sample->sumWithError, q);
-    sample->col.hash = bkwColumnComputeHash(sample, n, 0);
+    sample->col.hash = bkwColumnComputeHash(sample, n, q, 0);
     sample->error = sample->error < 0 ? -1 : multiply_time2_modq(error(sample), q);
     return 0;
 }
 
 
-int transition_times2_modq(const char *srcFolderName, const char *dstFolderName, u64 minDestinationStorageCapacityInSamples, bkwStepParameters *bkwStepPar, time_t start)
+static int times2ModqAndSort(const char *srcFolderName, const char *dstFolderName, u64 minDestinationStorageCapacityInSamples, bkwStepParameters *bkwStepPar, time_t start)
 {
-    if (folderExists(dstFolderName))
-    {
-        return 1; /* output folder already exists */
-    }
-
     lweInstance lwe;
     lweParametersFromFile(&lwe, srcFolderName); /* read lwe parameters from source folder */
 
+    /* samples of a lazily reduced folder are read from its base folder and transformed on the fly */
+    secretReduction reduction;
+    secretReductionFromFile(srcFolderName, &reduction);
+    const char *srcSampleFolderName = secretReductionSampleFolder(srcFolderName, &reduction);
+
     /* get number of samples in source file */
-    u64 totNumUnsortedSamples = numSamplesInSampleFile(srcFolderName);
+    u64 totNumUnsortedSamples = numSamplesInSampleFile(srcSampleFolderName);
     if (!totNumUnsortedSamples)
     {
         lweDestroy(&lwe);
@@ -68,6 +68,14 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     timeStamp(start);
     printf("src folder: %s (contains %s samples)\n", srcFolderName, sprintf_u64_delim(str, totNumUnsortedSamples));
 
+    /* build the category index tables once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, bkwStepPar))
+    {
+        lweDestroy(&lwe);
+        return 7; /* could not initialize category indexer */
+    }
+
     /* initiate storage writer (creates destination folder) */
     u64 numCategories = num_categories(&lwe, bkwStepPar);
     u64 categoryCapacityFile = (minDestinationStorageCapacityInSamples + numCategories - 1) / numCategories;
@@ -75,6 +83,7 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     int ret = storageWriterInitialize(&sw, dstFolderName, &lwe, bkwStepPar, categoryCapacityFile);
     if (ret)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         return 100 + ret; /* could not initialize storage writer */
     }
@@ -82,9 +91,10 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     printf("dst folder: %s (has room for %s samples)\n", dstFolderName, sprintf_u64_delim(str, numCategories * categoryCapacityFile));
 
     /* open source sample file */
-    FILE *f_src = fopenSamples(srcFolderName, "rb");
+    FILE *f_src = fopenSamples(srcSampleFolderName, "rb");
     if (!f_src)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         if (storageWriterFree(&sw))
         {
@@ -98,6 +108,7 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     lweSample *sampleReadBuf = MALLOC(READ_BUFFER_CAPACITY_IN_SAMPLES * LWE_SAMPLE_SIZE_IN_BYTES);
     if (!sampleReadBuf)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         fclose(f_src);
         if (storageWriterFree(&sw))
@@ -114,21 +125,19 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     {
         /* read chunk of samples from source sample file into read buffer */
         u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
+        secretReductionApply(&lwe, &reduction, sampleReadBuf, numRead);
+        if (bkwMetricsCurrent())
+        {
+            bkwMetricsCurrent()->numReaderBytes += numRead * LWE_SAMPLE_SIZE_IN_BYTES; /* unsorted samples, read without storage reader */
+        }
 
         /* add samples to storage writer */
         for (u64 i=0; i<numRead; i++)
         {
             lweSample *s = &sampleReadBuf[i];
             sample_times2_modq(&lwe, s);
-            u64 categoryIndex = position_values_2_category_index(&lwe, s, bkwStepPar);
+            u64 categoryIndex = categoryIndexerSampleIndex(&ci, s);
             ASSERT(categoryIndex<numCategories, "ERROR *** invalid category index");
-
-            u64 numIncorrectCategoryClassifications = 0;
-            verifyOneSampleSorted(&lwe, s, bkwStepPar, NULL, NULL, categoryIndex, &numIncorrectCategoryClassifications, 0);
-            if (numIncorrectCategoryClassifications)
-            {
-                printf("****** classification error detected\n");
-            }
             int storageWriterStatus = 0;
             lweSample *d = storageWriterAddSample(&sw, categoryIndex, &storageWriterStatus); /* reserve memory area in storage writer */
             if (d)
@@ -144,11 +153,6 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
             switch (storageWriterStatus)
             {
             case 0: /* insertion succeeded */
-                verifyOneSampleSorted(&lwe, d, bkwStepPar, NULL, NULL, categoryIndex, &numIncorrectCategoryClassifications, 0);
-                if (numIncorrectCategoryClassifications)
-                {
-                    printf("****** classification error detected (2)");
-                }
                 break;
             case 1: /* insertion succeeded but this was the last available slot in the cache */
                 /* so it makes sense to flush the cache to file here, but only if the cache is actually smaller than the storage on file. */
@@ -180,6 +184,7 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
     /* cleanup */
     FREE(sampleReadBuf);
     fclose(f_src);
+    categoryIndexerFree(&ci);
     lweDestroy(&lwe);
     ret = storageWriterFree(&sw); /* flushes automatically */
     if (ret)
@@ -190,3 +195,22 @@ int transition_times2_modq(const char *srcFolderName, const char *dstFolderName,
 
 }
 
+int transition_times2_modq(const char *srcFolderName, const char *dstFolderName, u64 minDestinationStorageCapacityInSamples, bkwStepParameters *bkwStepPar, time_t start)
+{
+    if (folderExists(dstFolderName))
+    {
+        return 1; /* output folder already exists */
+    }
+
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, dstFolderName);
+    int ret = times2ModqAndSort(srcFolderName, dstFolderName, minDestinationStorageCapacityInSamples, bkwStepPar, start);
+    bkwMetricsEnd(&metrics);
+    if (!ret)
+    {
+        char fileName[512];
+        metricsFileName(fileName, dstFolderName);
+        bkwMetricsToFile(&metrics, fileName);
+    }
+    return ret;
+}
@@ -22,7 +22,6 @@
 #include "string_utils.h"
 #include "storage_writer.h"
 #include "bkw_step_parameters.h"
-#include "verify_samples.h"
 #include <inttypes.h>
 
 int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolderName, u64 minDestinationStorageCapacityInSamples, bkwStepParameters *bkwStepPar, time_t start)
@@ -35,8 +34,13 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     lweInstance lwe;
     lweParametersFromFile(&lwe, srcFolderName); /* read lwe parameters from source folder */
 
+    /* samples of a lazily reduced folder are read from its base folder and transformed on the fly */
+    secretReduction reduction;
+    secretReductionFromFile(srcFolderName, &reduction);
+    const char *srcSampleFolderName = secretReductionSampleFolder(srcFolderName, &reduction);
+
     /* get number of samples in source file */
-    u64 totNumUnsortedSamples = numSamplesInSampleFile(srcFolderName);
+    u64 totNumUnsortedSamples = numSamplesInSampleFile(srcSampleFolderName);
     if (!totNumUnsortedSamples)
     {
         lweDestroy(&lwe);
@@ -46,6 +50,14 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     timeStamp(start);
     printf("src folder: %s (contains %s samples)\n", srcFolderName, sprintf_u64_delim(str, totNumUnsortedSamples));
 
+    /* build the category index tables once */
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, bkwStepPar))
+    {
+        lweDestroy(&lwe);
+        return 7; /* could not initialize category indexer */
+    }
+
     /* initiate storage writer (creates destination folder) */
     u64 numCategories = num_categories(&lwe, bkwStepPar);
     u64 categoryCapacityFile = (minDestinationStorageCapacityInSamples + numCategories - 1) / numCategories;
@@ -53,6 +65,7 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     int ret = storageWriterInitialize(&sw, dstFolderName, &lwe, bkwStepPar, categoryCapacityFile);
     if (ret)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         return 100 + ret; /* could not initialize storage writer */
     }
@@ -60,9 +73,10 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     printf("dst folder: %s (has room for %s samples)\n", dstFolderName, sprintf_u64_delim(str, numCategories * categoryCapacityFile));
 
     /* open source sample file */
-    FILE *f_src = fopenSamples(srcFolderName, "rb");
+    FILE *f_src = fopenSamples(srcSampleFolderName, "rb");
     if (!f_src)
     {
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         if (storageWriterFree(&sw))
         {
@@ -77,6 +91,7 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     if (!sampleReadBuf)
     {
         fclose(f_src);
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         if (storageWriterFree(&sw))
         {
@@ -92,20 +107,14 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     {
         /* read chunk of samples from source sample file into read buffer */
         u64 numRead = freadSamples(f_src, sampleReadBuf, READ_BUFFER_CAPACITY_IN_SAMPLES);
+        secretReductionApply(&lwe, &reduction, sampleReadBuf, numRead);
 
         /* add samples to storage writer */
         for (u64 i=0; i<numRead; i++)
         {
             lweSample *s = &sampleReadBuf[i];
-            u64 categoryIndex = position_values_2_category_index(&lwe, s, bkwStepPar);
+            u64 categoryIndex = categoryIndexerSampleIndex(&ci, s);
             ASSERT(categoryIndex<numCategories, "ERROR *** invalid category index");
-
-            u64 numIncorrectCategoryClassifications = 0;
-            verifyOneSampleSorted(&lwe, s, bkwStepPar, NULL, NULL, categoryIndex, &numIncorrectCategoryClassifications, 0);
-            if (numIncorrectCategoryClassifications)
-            {
-                printf("****** classification error detected\n");
-            }
             int storageWriterStatus = 0;
             lweSample *d = storageWriterAddSample(&sw, categoryIndex, &storageWriterStatus); /* reserve memory area in storage writer */
             if (d)
@@ -121,11 +130,6 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
             switch (storageWriterStatus)
             {
             case 0: /* insertion succeeded */
-                verifyOneSampleSorted(&lwe, d, bkwStepPar, NULL, NULL, categoryIndex, &numIncorrectCategoryClassifications, 0);
-                if (numIncorrectCategoryClassifications)
-                {
-                    printf("****** classification error detected (2)");
-                }
                 break;
             case 1: /* insertion succeeded but this was the last available slot in the cache */
                 /* so it makes sense to flush the cache to file here, but only if the cache is actually smaller than the storage on file. */
@@ -157,6 +161,7 @@ int transition_unsorted_2_sorted(const char *srcFolderName, const char *dstFolde
     /* cleanup */
     FREE(sampleReadBuf);
     fclose(f_src);
+    categoryIndexerFree(&ci);
     ret = storageWriterFree(&sw); /* flushes automatically */
     lweDestroy(&lwe);
     if (ret)
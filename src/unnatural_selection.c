@@ -0,0 +1,286 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "unnatural_selection.h"
+#include "memory_utils.h"
+#include "assert_utils.h"
+#include "bkw_metrics.h"
+#include <stdlib.h>
+
+#define MIN(X, Y)  ((X) < (Y) ? (X) : (Y))
+
+int unnaturalSelectionInitialize(unnaturalSelectionFilter *us, lweInstance *lwe, bkwStepParameters *srcBkwStepPar, u64 capacity)
+{
+    int ts = srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_ts;
+    us->q = lwe->q;
+    us->startIndex = srcBkwStepPar->sortingPar.smoothLMS.unnatural_selection_start_index;
+    us->numPositions = srcBkwStepPar->startIndex + srcBkwStepPar->numPositions - us->startIndex;
+    if (us->numPositions < 0)
+    {
+        us->numPositions = 0;
+    }
+    us->limit = (u64)us->numPositions * ts * ts;
+    us->useU32 = (u64)us->numPositions * (us->q / 2) * (us->q / 2) < ((u64)1 << 32);
+    us->capacity = capacity;
+    us->numSamples = 0;
+    us->numPairsRejected = 0;
+    us->centred = MALLOC(((size_t)us->numPositions * capacity + 1) * sizeof(short));
+    us->norm = MALLOC(UNNATURAL_SELECTION_BLOCK_SIZE * sizeof(u32));
+    us->accept = MALLOC(capacity + 1);
+    us->sample = MALLOC((capacity + 1) * sizeof(lweSample*));
+    us->key = MALLOC((capacity + 1) * sizeof(u64));
+    if (!us->centred || !us->norm || !us->accept || !us->sample || !us->key)
+    {
+        unnaturalSelectionFree(us);
+        return 1; /* allocation failed */
+    }
+
+    /* LSH_LF2 grid, the keys of all cells must fit in 32 bits */
+    us->cellWidth = ts > 0 ? ts : 1;
+    us->numCells = (us->q + us->cellWidth - 1) / us->cellWidth;
+    us->numHashPositions = MIN(LSH_LF2_HASH_POSITIONS, us->numPositions);
+    u64 numKeys = 1;
+    for (int p=0; p<us->numHashPositions; p++)
+    {
+        numKeys *= us->numCells;
+        if (numKeys >= ((u64)1 << 32))
+        {
+            us->numHashPositions = p;
+            break;
+        }
+    }
+    return 0;
+}
+
+void unnaturalSelectionFree(unnaturalSelectionFilter *us)
+{
+    bkwMetricsAddUnnaturalSelection(us);
+    FREE(us->centred);
+    FREE(us->norm);
+    FREE(us->accept);
+    FREE(us->sample);
+    FREE(us->key);
+}
+
+void unnaturalSelectionLoad(unnaturalSelectionFilter *us, lweSample *samples, int numSamples)
+{
+    ASSERT(us->numSamples + numSamples <= us->capacity, "unnatural selection filter is full");
+    for (int p=0; p<us->numPositions; p++)
+    {
+        short *c = us->centred + (size_t)p * us->capacity + us->numSamples;
+        for (int i=0; i<numSamples; i++)
+        {
+            c[i] = columnValueSigned(&samples[i], us->startIndex + p, us->q);
+        }
+    }
+    for (int i=0; i<numSamples; i++)
+    {
+        us->sample[us->numSamples + i] = &samples[i];
+    }
+    us->numSamples += numSamples;
+}
+
+/* cell of position value a (or of -a) on a hashed position */
+static inline int lshCell(const unnaturalSelectionFilter *us, int a, int negate)
+{
+    if (negate)
+    {
+        a = (us->q - a) % us->q;
+    }
+    return a / us->cellWidth;
+}
+
+static u64 lshKey(const unnaturalSelectionFilter *us, lweSample *sample)
+{
+    u64 key = 0;
+    int firstHashed = us->startIndex + us->numPositions - us->numHashPositions;
+    for (int p=0; p<us->numHashPositions; p++)
+    {
+        key = key * us->numCells + lshCell(us, columnValue(sample, firstHashed + p), 0);
+    }
+    return key;
+}
+
+static int compareSortKeys(const void *a, const void *b)
+{
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+void unnaturalSelectionLoadBucketed(unnaturalSelectionFilter *us, lweSample *samples, int numSamples)
+{
+    ASSERT(us->numSamples + numSamples <= us->capacity, "unnatural selection filter is full");
+    /* sort (key, index) pairs, the key area past the loaded samples is free */
+    u64 *order = us->key + us->numSamples;
+    for (int i=0; i<numSamples; i++)
+    {
+        order[i] = (lshKey(us, &samples[i]) << 32) | i;
+    }
+    qsort(order, numSamples, sizeof(u64), compareSortKeys);
+    int first = us->numSamples;
+    for (int i=0; i<numSamples; i++)
+    {
+        lweSample *sample = &samples[order[i] & 0xffffffff];
+        us->key[first + i] = order[i] >> 32;
+        us->sample[first + i] = sample;
+        for (int p=0; p<us->numPositions; p++)
+        {
+            us->centred[(size_t)p * us->capacity + first + i] = columnValueSigned(sample, us->startIndex + p, us->q);
+        }
+    }
+    us->numSamples += numSamples;
+}
+
+int unnaturalSelectionNeighbourBuckets(const unnaturalSelectionFilter *us, int i, int negate, u64 *keys)
+{
+    int numKeys = 1;
+    keys[0] = 0;
+    int firstHashed = us->numPositions - us->numHashPositions;
+    for (int p=0; p<us->numHashPositions; p++)
+    {
+        short c = us->centred[(size_t)(firstHashed + p) * us->capacity + i];
+        int cell = lshCell(us, c < 0 ? c + us->q : c, negate);
+        /* distinct neighbouring cells, the grid wraps around modulo q */
+        int cells[3] = {cell, (cell + 1) % us->numCells, (cell + us->numCells - 1) % us->numCells};
+        int numNeighbours = MIN(us->numCells, 3);
+        int n = numKeys;
+        for (int k=0; k<numKeys; k++)
+        {
+            keys[k] *= us->numCells;
+        }
+        for (int c1=1; c1<numNeighbours; c1++)
+        {
+            for (int k=0; k<numKeys; k++)
+            {
+                keys[n++] = keys[k] + cells[c1];
+            }
+        }
+        for (int k=0; k<numKeys; k++)
+        {
+            keys[k] += cells[0];
+        }
+        numKeys = n;
+    }
+    return numKeys;
+}
+
+void unnaturalSelectionBucketRange(const unnaturalSelectionFilter *us, int loadBegin, int loadEnd, u64 key, int *begin, int *end)
+{
+    int lo = loadBegin, hi = loadEnd;
+    while (lo < hi) /* first index with key >= given key */
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (us->key[mid] < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *begin = lo;
+    hi = loadEnd;
+    while (lo < hi) /* first index with key > given key */
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (us->key[mid] <= key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *end = lo;
+}
+
+/* squared norms for one block, |ci +- cj| < q so min(|d|, q - |d|) is the absolute value of the centred result */
+static void blockNormsU32(const unnaturalSelectionFilter *us, int i, int jBegin, int numPartners, int add, u32 *restrict norm)
+{
+    int q = us->q;
+    for (int j=0; j<numPartners; j++)
+    {
+        norm[j] = 0;
+    }
+    for (int p=0; p<us->numPositions; p++)
+    {
+        const short *restrict c = us->centred + (size_t)p * us->capacity;
+        const short *restrict cj = c + jBegin;
+        int ci = c[i];
+        if (add)
+        {
+            for (int j=0; j<numPartners; j++)
+            {
+                int d = ci + cj[j];
+                d = d < 0 ? -d : d;
+                int t = MIN(d, q - d);
+                norm[j] += (u32)(t * t);
+            }
+        }
+        else
+        {
+            for (int j=0; j<numPartners; j++)
+            {
+                int d = ci - cj[j];
+                d = d < 0 ? -d : d;
+                int t = MIN(d, q - d);
+                norm[j] += (u32)(t * t);
+            }
+        }
+    }
+}
+
+const u8 *unnaturalSelectionFilterPairs(unnaturalSelectionFilter *us, int i, int jBegin, int jEnd, int add)
+{
+    u8 *accept = us->accept;
+    ASSERT(jEnd <= us->numSamples, "partner not loaded");
+    int q = us->q;
+    if (!us->useU32)
+    {
+        /* large q, 64-bit scalar fallback */
+        for (int j=jBegin; j<jEnd; j++)
+        {
+            u64 norm = 0;
+            for (int p=0; p<us->numPositions; p++)
+            {
+                const short *c = us->centred + (size_t)p * us->capacity;
+                int d = add ? c[i] + c[j] : c[i] - c[j];
+                d = d < 0 ? -d : d;
+                u64 t = MIN(d, q - d);
+                norm += t * t;
+            }
+            accept[j - jBegin] = norm < us->limit;
+            us->numPairsRejected += norm >= us->limit;
+        }
+        return accept;
+    }
+    for (int b=jBegin; b<jEnd; b+=UNNATURAL_SELECTION_BLOCK_SIZE)
+    {
+        int numPartners = MIN(UNNATURAL_SELECTION_BLOCK_SIZE, jEnd - b);
+        blockNormsU32(us, i, b, numPartners, add, us->norm);
+        u8 *a = accept + (b - jBegin);
+        int numAccepted = 0;
+        for (int j=0; j<numPartners; j++)
+        {
+            a[j] = us->norm[j] < us->limit;
+            numAccepted += a[j];
+        }
+        us->numPairsRejected += numPartners - numAccepted;
+    }
+    return accept;
+}
@@ -51,12 +51,33 @@ static void verifySum(lweInstance *lwe, lweSample *sample, u64 *numIncorrectSums
     }
 }
 
+/* the linear column hash holds one value in [0, q) per lane, and zeros in the bits below the lanes */
+static int columnHashIsReduced(u64 hash, int q)
+{
+    int w = columnHashLaneBits(q);
+    int numLanes = 64 / w;
+    if (numLanes * w < 64 && (hash & (((u64)1 << (64 - numLanes * w)) - 1)))
+    {
+        return 0;
+    }
+    for (int j=0; j<numLanes; j++)
+    {
+        if (((hash >> (64 - w * (j + 1))) & (((u64)1 << w) - 1)) >= (u64)q)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* verification of column hash when computed as a hash of the remaining part of the sample column vector */
+/* the hash of a combined sample is combined from the hashes of its parents, so this checks that the
+   linear hash was maintained correctly through all reduction steps */
 static void verifyPartialHash(lweInstance *lwe, lweSample *sample, int startIndex, u64 *numIncorrectHashes, int printOnError)
 {
     u64 hash = columnHash(sample);
-    u64 computedHash = bkwColumnComputeHash(sample, lwe->n, startIndex);
-    if (hash != computedHash)
+    u64 computedHash = bkwColumnComputeHash(sample, lwe->n, lwe->q, startIndex);
+    if (hash != computedHash || !columnHashIsReduced(hash, lwe->q))
     {
         *numIncorrectHashes = *numIncorrectHashes + 1;
         if (printOnError)
@@ -96,6 +117,22 @@ void verifyOneSampleSorted(lweInstance *lwe, lweSample *sample, bkwStepParameter
     }
 }
 
+/* as verifyOneSampleSorted, but with a category indexer owned by the caller instead of the shared one */
+void verifyOneSampleSortedWithIndexer(lweInstance *lwe, lweSample *sample, const categoryIndexer *ci, u64 *numIncorrectSums, u64 *numIncorrectHashes, u64 expectedCategoryIndex, u64 *numIncorrectCategoryClassifications, int printOnError)
+{
+    verifySum(lwe, sample, numIncorrectSums, printOnError);
+    verifyEntireHash(lwe, sample, numIncorrectHashes, printOnError);
+    u64 index = categoryIndexerSampleIndex(ci, sample);
+    if (index != expectedCategoryIndex)
+    {
+        *numIncorrectCategoryClassifications = *numIncorrectCategoryClassifications + 1;
+        if (printOnError)
+        {
+            printf("  category classification error: expectedCategoryIndex = %" PRIu64 ", computed index = %" PRIu64 "\n", expectedCategoryIndex, index);
+        }
+    }
+}
+
 int verifyUnsortedSamples(const char *folderName, u64 *numSamplesProcessed, u64 *numIncorrectSums, u64 *numIncorrectHashes, int printOnError)
 {
     /* read lwe parameters */
@@ -111,8 +148,10 @@ int verifyUnsortedSamples(const char *folderName, u64 *numSamplesProcessed, u64
     *numIncorrectHashes = 0;
     *numSamplesProcessed = 0;
 
-    /* verify samples */
-    FILE *f = fopenSamples(folderName, "rb");
+    /* verify samples (of the base folder, transformed, if the folder is lazily reduced) */
+    secretReduction reduction;
+    secretReductionFromFile(folderName, &reduction);
+    FILE *f = fopenSamples(secretReductionSampleFolder(folderName, &reduction), "rb");
     if (!f)
     {
         lweDestroy(&lwe);
@@ -121,6 +160,7 @@ int verifyUnsortedSamples(const char *folderName, u64 *numSamplesProcessed, u64
     while (!feof(f))
     {
         u64 numRead = freadSamples(f, sampleBuf, numSamples);
+        secretReductionApply(&lwe, &reduction, sampleBuf, numRead);
         for (u64 i=0; i<numRead; i++)
         {
             lweSample *sample = &sampleBuf[i];
@@ -144,9 +184,19 @@ int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u
     lweSample *buf2;
     u64 numSamplesInBuf1, numSamplesInBuf2;
 
-    /* get parameters */
+    /* get parameters, the indexer is local so that folders can be verified in any thread */
     lweParametersFromFile(&lwe, folderName);
-    u64 numCategories = num_categories(&lwe, bkwStepPar);
+    categoryIndexer ci;
+    if (categoryIndexerInitialize(&ci, &lwe, bkwStepPar))
+    {
+        if (printOnError)
+        {
+            printf("could not initialize category indexer\n");
+        }
+        lweDestroy(&lwe);
+        return 2;
+    }
+    u64 numCategories = ci.numCategories;
 
     /* initialize parameters */
     *totalNumSamplesProcessed = 0;
@@ -163,6 +213,7 @@ int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u
         {
             printf("storage reader returned %d on initialize\n", ret);
         }
+        categoryIndexerFree(&ci);
         lweDestroy(&lwe);
         return 1;
     }
@@ -175,7 +226,7 @@ int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u
             for (u64 i=0; i<numSamplesInBuf1; i++)
             {
                 lweSample *sample = &buf1[i];
-                verifyOneSampleSorted(&lwe, sample, bkwStepPar, numIncorrectSums, numIncorrectHashes, categoryIndexCounter, numIncorrectCategoryClassifications, printOnError);
+                verifyOneSampleSortedWithIndexer(&lwe, sample, &ci, numIncorrectSums, numIncorrectHashes, categoryIndexCounter, numIncorrectCategoryClassifications, printOnError);
             }
             *totalNumSamplesProcessed = *totalNumSamplesProcessed + numSamplesInBuf1;
             categoryIndexCounter++;
@@ -186,7 +237,7 @@ int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u
             for (u64 i=0; i<numSamplesInBuf2; i++)
             {
                 lweSample *sample = &buf2[i];
-                verifyOneSampleSorted(&lwe, sample, bkwStepPar, numIncorrectSums, numIncorrectHashes, categoryIndexCounter, numIncorrectCategoryClassifications, printOnError);
+                verifyOneSampleSortedWithIndexer(&lwe, sample, &ci, numIncorrectSums, numIncorrectHashes, categoryIndexCounter, numIncorrectCategoryClassifications, printOnError);
             }
             *totalNumSamplesProcessed = *totalNumSamplesProcessed + numSamplesInBuf2;
             categoryIndexCounter++;
@@ -202,6 +253,7 @@ int verifySortedSamples(const char *folderName, bkwStepParameters *bkwStepPar, u
         }
     }
     storageReaderFree(&sr);
+    categoryIndexerFree(&ci);
     lweDestroy(&lwe);
     return 0;
 }
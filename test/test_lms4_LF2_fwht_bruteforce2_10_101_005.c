@@ -41,6 +41,7 @@
 #include "transition_times2_modq.h"
 #include "transition_mod2.h"
 #include "solve_fwht.h"
+#include "storage_writer.h"
 
 #define NUM_REDUCTION_STEPS 2
 #define BRUTE_FORCE_POSITIONS 2
@@ -55,6 +56,7 @@ int main()
     time_t start = time(NULL);
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     lweInstance lwe;
     int ret;
@@ -41,6 +41,7 @@
 #include "transition_times2_modq.h"
 #include "transition_mod2.h"
 #include "solve_fwht.h"
+#include "storage_writer.h"
 
 #define NUM_REDUCTION_STEPS 4
 
@@ -54,6 +55,7 @@ int main()
     time_t start = time(NULL);
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     lweInstance lwe, lpn;
     int ret;
@@ -0,0 +1,177 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "storage_file_utilities.h"
+#include "workplace_localization.h"
+#include "random_utils.h"
+#include "pipeline.h"
+#include "storage_writer.h"
+
+#define NUM_REDUCTION_STEPS 4
+#define BRUTE_FORCE_POSITIONS 2
+
+int main()
+{
+    time_t start = time(NULL);
+    srand(time(NULL));
+    randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
+
+    char outputfolder[256];
+    char planFileName[512];
+    sprintf(outputfolder, "%s/test_pipeline_smooth_lms_fwht_bruteforce_10_101_01", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A);
+    mkdir(outputfolder, 0777);
+    sprintf(planFileName, "%s/plan.txt", outputfolder);
+
+    /* write the plan of test_smooth_lms_fwht_bruteforce_10_101_01 */
+    FILE *f = fopen(planFileName, "w");
+    if (!f)
+    {
+        printf("could not create plan file %s\n", planFileName);
+        return 1;
+    }
+    fprintf(f, "# smooth LMS reduction of 8 positions, fwht on 8 positions and bruteforce on 2 positions\n");
+    fprintf(f, "folder = %s/run\n", outputfolder);
+    fprintf(f, "n = 10\nq = 101\nalpha = 0.01\nsamples = 10000\n");
+    for (int i=0; i<NUM_REDUCTION_STEPS; i++)
+    {
+        fprintf(f, "step = Smooth LMS [2 positions, start index=%d, p=21, p1=38, p2=21, prev_p1=%d, meta_skipped=0, unnatural_selection=0, unnatural_selection_start_index=0]\n", 2*i, i == 0 ? -1 : 38);
+        fprintf(f, "selection = LF2\n");
+    }
+    fprintf(f, "solver = fwht_bruteforce\nbruteforce_positions = %d\ndelete_intermediates = 1\nverify = 1\nverify_folders = 1\n", BRUTE_FORCE_POSITIONS);
+    fprintf(f, "metrics_stream = %s/metrics_stream.json\n", outputfolder);
+    fclose(f);
+
+    pipelinePlan plan;
+    int ret = pipelinePlanFromFile(planFileName, &plan);
+    if (ret)
+    {
+        printf("error %d when reading plan file\n", ret);
+        return 1;
+    }
+
+    int fwhtPositions = plan.n - BRUTE_FORCE_POSITIONS;
+    u8 binary_solution[fwhtPositions];
+    short bf_solution[BRUTE_FORCE_POSITIONS];
+    pipelineStageStatistics stats[NUM_REDUCTION_STEPS + 1];
+
+    /* new initial samples, also when the folders of an earlier test run are left */
+    char folderName[512];
+    char fileName[1024];
+    sprintf(folderName, "%s/run/original", outputfolder);
+    completeMarkerFileName(fileName, folderName);
+    remove(fileName);
+
+    /* the first run keeps its intermediate folders, then the last stage is marked as interrupted. the second
+       run only performs the last stage again and solves, the third run finds the final folder and only solves */
+    for (int run=0; run<3; run++)
+    {
+        plan.deleteIntermediates = run > 0;
+        ret = pipelineRun(&plan, binary_solution, bf_solution, stats, start);
+        if (ret)
+        {
+            printf("error %d in pipeline run %d\n", ret, run);
+            return 1;
+        }
+        for (int s=0; s<NUM_REDUCTION_STEPS+1 && run; s++)
+        {
+            if (stats[s].skipped != (run == 2 || s < NUM_REDUCTION_STEPS))
+            {
+                printf("stage %d %s in run %d\n", s, stats[s].skipped ? "skipped" : "performed again", run);
+                return 1;
+            }
+        }
+        for (int s=0; s<NUM_REDUCTION_STEPS+1 && !run; s++)
+        {
+            if (!stats[s].numBytesRead || !stats[s].numBytesWritten || !stats[s].peakRssBytes)
+            {
+                printf("no i/o statistics for stage %d\n", s);
+                return 1;
+            }
+        }
+        if (!run)
+        {
+            sprintf(folderName, "%s/run/step_final", outputfolder);
+            completeMarkerFileName(fileName, folderName);
+            remove(fileName);
+        }
+    }
+
+    /* the runs leave the verification of the writers as the test set it */
+    u64 verificationRate;
+    int backgroundVerification;
+    storageWriterGetDefaultVerification(&verificationRate, &backgroundVerification);
+    if (verificationRate != STORAGE_WRITER_SAMPLED_VERIFICATION_RATE || backgroundVerification != STORAGE_WRITER_BACKGROUND_VERIFICATION)
+    {
+        printf("default writer verification changed by the pipeline\n");
+        return 1;
+    }
+
+    /* intermediate folders are deleted */
+    sprintf(folderName, "%s/run/step_%02d", outputfolder, 0);
+    if (folderExists(folderName))
+    {
+        printf("intermediate folder %s not deleted\n", folderName);
+        return 1;
+    }
+
+    /* the last step and the solver leave their metrics in the final folder */
+    sprintf(folderName, "%s/run/step_final", outputfolder);
+    metricsFileName(fileName, folderName);
+    if (!fileExists(fileName))
+    {
+        printf("metrics file %s not written\n", fileName);
+        return 1;
+    }
+    solverMetricsFileName(fileName, folderName);
+    if (!fileExists(fileName) || !fileExists(plan.metricsStreamFileName))
+    {
+        printf("solver metrics or metrics stream not written\n");
+        return 1;
+    }
+
+    lweInstance lwe;
+    sprintf(folderName, "%s/run/original", outputfolder);
+    lweParametersFromFile(&lwe, folderName);
+    for (int i=0; i<fwhtPositions; i++)
+    {
+        u8 real = lwe.s[i] < lwe.q/2 ? lwe.s[i] % 2 : (lwe.s[i]+1) % 2;
+        if (binary_solution[i] != real)
+        {
+            printf("WRONG retrieved solution!\n");
+            return 1;
+        }
+    }
+    for (int i=0; i<BRUTE_FORCE_POSITIONS; i++)
+    {
+        if (bf_solution[i] != lwe.s[i+fwhtPositions])
+        {
+            printf("WRONG retrieved solution!\n");
+            return 1;
+        }
+    }
+    lweDestroy(&lwe);
+
+    timeStamp(start);
+    printf("Test passed\n");
+    return 0;
+}
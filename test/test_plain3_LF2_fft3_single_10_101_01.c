@@ -29,6 +29,7 @@
 // #include "Python.h" // needs to be included before any standard headers, also make sure to add Python37.dll (or whichever version you need to use) to project
 #include "bkw_step_parameters.h"
 #include "transform_secret.h"
+#include "storage_writer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -86,6 +87,7 @@ int main()
     time_t start = time(NULL);
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     lweInstance lwe;
     int n, ret;
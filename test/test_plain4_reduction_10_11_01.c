@@ -0,0 +1,183 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "memory_utils.h"
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "string_utils.h"
+#include "transition_unsorted_2_sorted.h"
+#include "storage_file_utilities.h"
+#include "storage_reader.h"
+#include "test_functions.h"
+#include "transition_bkw_step.h"
+#include "workplace_localization.h"
+#include "verify_samples.h"
+#include "bkw_step_parameters.h"
+#include "storage_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+/* Plain BKW on 4 positions has no dedicated transition and goes through the generic (LMS-style)
+   mixed-radix layout. Two such steps must leave the first 8 positions zero in every sample. */
+#define NUM_REDUCTION_STEPS 2
+
+/* count the samples in a sorted folder with a non-zero value in positions 0 to numZeroPositions-1 */
+static int countNonReducedSamples(const char *folderName, int numZeroPositions, u64 *numSamples, u64 *numNonReduced)
+{
+    lweSample *buf1;
+    lweSample *buf2;
+    u64 numSamplesInBuf1, numSamplesInBuf2;
+    *numSamples = 0;
+    *numNonReduced = 0;
+    storageReader sr;
+    if (storageReaderInitialize(&sr, folderName))
+    {
+        return 1;
+    }
+    while (storageReaderGetNextAdjacentCategoryPair(&sr, &buf1, &numSamplesInBuf1, &buf2, &numSamplesInBuf2))
+    {
+        lweSample *bufs[2] = { buf1, buf2 };
+        u64 numSamplesInBufs[2] = { numSamplesInBuf1, numSamplesInBuf2 };
+        for (int b=0; b<2; b++)
+        {
+            for (u64 i=0; bufs[b] && i<numSamplesInBufs[b]; i++)
+            {
+                for (int j=0; j<numZeroPositions; j++)
+                {
+                    if (columnValue(&bufs[b][i], j))
+                    {
+                        *numNonReduced = *numNonReduced + 1;
+                        break;
+                    }
+                }
+            }
+            *numSamples = *numSamples + (bufs[b] ? numSamplesInBufs[b] : 0);
+        }
+    }
+    storageReaderFree(&sr);
+    return 0;
+}
+
+/**************************************************************************
+ * Main
+ **************************************************************************/
+int main()
+{
+    u64 totalNumInitialSamples = 100000;
+
+    time_t start = time(NULL);
+    srand(time(NULL));
+    randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
+
+    lweInstance lwe;
+    int n = 10;
+    int q = 11; /* 11^4 categories per plain BKW step */
+    double alpha = 0.01;
+
+    lweInit(&lwe, n, q, alpha);
+
+    char outputfolder[128];
+    char unsortedFolderName[256];
+    char sortedFolderName[256];
+    char srcFolderName[256];
+    char dstFolderName[256];
+
+    sprintf(outputfolder, "%s/test_plain4_reduction_10_11_01", LOCAL_SIMULATION_DIRECTORY_PATH_PREFIX_A);
+    mkdir(outputfolder, 0777);
+
+    sprintf(unsortedFolderName, "%s/original", outputfolder);
+    sprintf(sortedFolderName, "%s/step_0", outputfolder);
+    testCreateNewInstanceFolder(unsortedFolderName, n, q, alpha);
+    newStorageFolder(&lwe, unsortedFolderName, n, q, alpha);
+    addSamplesToSampleFile(unsortedFolderName, totalNumInitialSamples, start);
+
+    /* two plain BKW steps on 4 positions, the last folder is sorted on 2 positions */
+    bkwStepParameters bkwStepPar[NUM_REDUCTION_STEPS + 1];
+    for (int i=0; i<NUM_REDUCTION_STEPS+1; i++)
+    {
+        bkwStepPar[i].sorting = plainBKW;
+        bkwStepPar[i].startIndex = 4 * i;
+        bkwStepPar[i].numPositions = i < NUM_REDUCTION_STEPS ? 4 : 2;
+        bkwStepPar[i].selection = LF2;
+    }
+
+    /* sort (unsorted) samples */
+    timeStamp(start);
+    printf("sorting initial samples\n");
+    u64 minDestinationStorageCapacityInSamples = totalNumInitialSamples * 4 / 3; /* add about 25% storage room for sorted samples */
+    int ret = transition_unsorted_2_sorted(unsortedFolderName, sortedFolderName, minDestinationStorageCapacityInSamples, &bkwStepPar[0], start);
+    if (ret && ret != 1)
+    {
+        timeStamp(start);
+        printf("error %d when sorting initial samples\n", ret);
+        exit(1);
+    }
+
+    for (int i=0; i<NUM_REDUCTION_STEPS; i++)
+    {
+        timeStamp(start);
+        printf("Reduction step %02d -> %02d, %s reduction at positions %d to %d (destination sorting using positions %d to %d)\n", i, i+1, sortingAsString(bkwStepPar[i+1].sorting), bkwStepPar[i].startIndex, bkwStepPar[i].startIndex + bkwStepPar[i].numPositions - 1, bkwStepPar[i+1].startIndex, bkwStepPar[i+1].startIndex + bkwStepPar[i+1].numPositions - 1);
+
+        sprintf(srcFolderName, "%s/step_%d", outputfolder, i);
+        sprintf(dstFolderName, "%s/step_%d", outputfolder, i+1);
+
+        u64 numSamplesStored;
+        ret = transition_bkw_step(srcFolderName, dstFolderName, &bkwStepPar[i], &bkwStepPar[i+1], &numSamplesStored, start);
+        if (ret && ret != 100)
+        {
+            timeStamp(start);
+            printf("error %d in reduction step %d\n", ret, i);
+            exit(1);
+        }
+
+        /* the samples must be consistent and correctly sorted */
+        u64 numSamples, numIncorrectSums, numIncorrectHashes, numIncorrectCategoryClassifications;
+        if (verifySortedSamples(dstFolderName, &bkwStepPar[i+1], &numSamples, &numIncorrectSums, &numIncorrectHashes, &numIncorrectCategoryClassifications, 0))
+        {
+            timeStamp(start);
+            printf("Error: could not verify %s\n", dstFolderName);
+            exit(1);
+        }
+        timeStamp(start);
+        printf("%" PRIu64 " samples, %" PRIu64 " incorrect sums, %" PRIu64 " incorrect hashes, %" PRIu64 " incorrect categories\n", numSamples, numIncorrectSums, numIncorrectHashes, numIncorrectCategoryClassifications);
+        if (!numSamples || numIncorrectSums || numIncorrectHashes || numIncorrectCategoryClassifications)
+        {
+            timeStamp(start);
+            printf("Error: incorrect samples in %s\n", dstFolderName);
+            exit(1);
+        }
+
+        /* all positions up to and including the reduced ones must be zero */
+        u64 numNonReduced;
+        int numZeroPositions = bkwStepPar[i].startIndex + bkwStepPar[i].numPositions;
+        if (countNonReducedSamples(dstFolderName, numZeroPositions, &numSamples, &numNonReduced) || numNonReduced)
+        {
+            timeStamp(start);
+            printf("Error: %" PRIu64 " of %" PRIu64 " samples in %s not zero on positions 0 to %d\n", numNonReduced, numSamples, dstFolderName, numZeroPositions - 1);
+            exit(1);
+        }
+    }
+
+    lweDestroy(&lwe);
+    timeStamp(start);
+    printf("Test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*  This file is part of FBBL (File-Based BKW for LWE).
+ *
+ *  FBBL is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  FBBL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Nome-Programma.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "memory_utils.h"
+#include "lwe_instance.h"
+#include "log_utils.h"
+#include "bkw_step_parameters.h"
+#include "position_values_2_category_index.h"
+
+#define NUM_LOOKUPS (1 << 22)
+#define NUM_ROUNDS 8
+
+/* time NUM_ROUNDS passes over the position values, return nanoseconds per lookup */
+static double timeLookups(const categoryIndexer *ci, short *pairs, u64 *checksum)
+{
+    clock_t begin = clock();
+    u64 sum = 0;
+    for (int r=0; r<NUM_ROUNDS; r++)
+    {
+        for (int i=0; i<NUM_LOOKUPS; i++)
+        {
+            sum += categoryIndexerIndex(ci, &pairs[2*i]);
+        }
+    }
+    *checksum = sum;
+    return (clock() - begin) * 1e9 / CLOCKS_PER_SEC / ((double)NUM_ROUNDS * NUM_LOOKUPS);
+}
+
+int main()
+{
+    time_t start = time(NULL);
+
+    /* largest q in the tests for which the cost model selects the table */
+    int n = 10, q = 1009;
+    lweInstance lwe;
+    lweInit(&lwe, n, q, 0.01);
+
+    bkwStepParameters par;
+    par.sorting = plainBKW;
+    par.startIndex = 0;
+    par.numPositions = 2;
+
+    categoryIndexer table;
+    if (categoryIndexerInitialize(&table, &lwe, &par) || !table.plainTable)
+    {
+        timeStamp(start);
+        printf("Error: plain BKW table not built for q = %d\n", q);
+        return 1;
+    }
+    categoryIndexer arithmetic = table;
+    arithmetic.plainTable = NULL; /* shares the remaining (read-only) members */
+
+    /* both variants must agree on all position values */
+    short a[2];
+    for (a[0]=0; a[0]<q; a[0]++)
+    {
+        for (a[1]=0; a[1]<q; a[1]++)
+        {
+            if (categoryIndexerIndex(&table, a) != categoryIndexerIndex(&arithmetic, a))
+            {
+                timeStamp(start);
+                printf("Error: table and arithmetic category index differ for (%d,%d)\n", a[0], a[1]);
+                return 1;
+            }
+        }
+    }
+
+    /* microbenchmark on random position values */
+    short *pairs = MALLOC(2 * NUM_LOOKUPS * sizeof(short));
+    srand(time(NULL));
+    for (int i=0; i<2*NUM_LOOKUPS; i++)
+    {
+        pairs[i] = rand() % q;
+    }
+    u64 sumTable, sumArithmetic;
+    double nsTable = timeLookups(&table, pairs, &sumTable);
+    double nsArithmetic = timeLookups(&arithmetic, pairs, &sumArithmetic);
+    timeStamp(start);
+    printf("q = %d: table (%.1f MB) %.2f ns/lookup, arithmetic %.2f ns/lookup, cost model selects %s\n", q, (double)q * q * sizeof(u32) / (1024 * 1024), nsTable, nsArithmetic, plain_bkw_use_table(q) ? "table" : "arithmetic");
+    if (sumTable != sumArithmetic)
+    {
+        timeStamp(start);
+        printf("Error: checksums differ\n");
+        return 1;
+    }
+
+    /* generic mixed-radix layout for wide plain BKW and LMS steps: the additive inverse of a
+       category 2i+1 is category 2i+2, and singletons are their own inverses (checked for plain
+       BKW, LMS rounding does not commute with negation for all values) */
+    lweInstance smallLwe;
+    lweInit(&smallLwe, n, 11, 0.01);
+    lweInstance *wideLwe[2] = {&smallLwe, &lwe};
+    bkwStepParameters widePar[2];
+    widePar[0].sorting = plainBKW;
+    widePar[0].numPositions = 5; /* 11^5 categories */
+    widePar[1].sorting = LMS;
+    widePar[1].numPositions = 8;
+    widePar[1].sortingPar.LMS.p = 200; /* c = 6, 6^8 categories, 2^8 singletons */
+    for (int w=0; w<2; w++)
+    {
+        widePar[w].startIndex = 0;
+        int wq = wideLwe[w]->q;
+        categoryIndexer wide;
+        if (categoryIndexerInitialize(&wide, wideLwe[w], &widePar[w]))
+        {
+            timeStamp(start);
+            printf("Error: could not build indexer for %d positions\n", widePar[w].numPositions);
+            return 1;
+        }
+        for (int i=0; i<100000; i++)
+        {
+            short v[MAX_LMS_POSITIONS], negV[MAX_LMS_POSITIONS];
+            for (int j=0; j<widePar[w].numPositions; j++)
+            {
+                v[j] = rand() % wq;
+                negV[j] = (wq - v[j]) % wq;
+            }
+            u64 cat = categoryIndexerIndex(&wide, v), negCat = categoryIndexerIndex(&wide, negV);
+            u64 partner = categoryIndexerIsSingleton(&wide, cat) ? cat : (cat & 1) ? cat + 1 : cat - 1;
+            if (cat >= wide.numCategories || (widePar[w].sorting == plainBKW && negCat != partner))
+            {
+                timeStamp(start);
+                printf("Error: inverse of category %" PRIu64 " is %" PRIu64 " (%d positions)\n", cat, negCat, widePar[w].numPositions);
+                return 1;
+            }
+        }
+        categoryIndexerFree(&wide);
+    }
+    lweDestroy(&smallLwe);
+
+    FREE(pairs);
+    categoryIndexerFree(&table);
+    lweDestroy(&lwe);
+    timeStamp(start);
+    printf("Test passed\n");
+
+    return 0;
+}
@@ -42,6 +42,7 @@
 #include "transition_times2_modq.h"
 #include "transition_mod2.h"
 #include "solve_fwht.h"
+#include "storage_writer.h"
 
 #define NUM_REDUCTION_STEPS 5
 #define BRUTE_FORCE_POSITIONS 0
@@ -54,6 +55,7 @@ int main()
     time_t start = time(NULL);
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     lweInstance lwe, lpn;
     int ret;
@@ -177,7 +179,8 @@ int main()
     printf("  dst folder: %s\n", dstFolderName);
 
     u64 numSamplesStored;
-    ret = transition_bkw_step_final(srcFolderName, dstFolderName, &bkwStepPar[i], &numSamplesStored, start);
+    solverInputParameters solverInputPar = {solverInputFwht, 0, fwht_positions}; /* precompute the fwht indices for the solving phase */
+    ret = transition_bkw_step_final_with_solver_input(srcFolderName, dstFolderName, &bkwStepPar[i], &solverInputPar, &numSamplesStored, start);
     switch (ret)
     {
     case 0: /* reduction computed ok */
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <unistd.h>
@@ -23,6 +24,7 @@
 #include <dirent.h>
 #include <inttypes.h>
 #include <sys/stat.h>
+#include <stdatomic.h>
 
 #include "lwe_sorting.h"
 #include "memory_utils.h"
@@ -39,10 +41,49 @@
 #include "random_utils.h"
 #include "transform_secret.h"
 #include "position_values_2_category_index.h"
+#include "scratch_arena.h"
+#include "storage_writer.h"
+#include "storage_reader.h"
+#include "transition_bkw_step_smooth_lms.h"
+#include "bkw_metrics.h"
+#include "unnatural_selection.h"
+#include "planner.h"
+#include "transition_bkw_step_final.h"
+#include "guess_scheduler.h"
 
 #define NUM_REDUCTION_STEPS 5
 #define BRUTE_FORCE_POSITIONS 0
 
+/* guess scheduler workers of TEST 17, every second worker (or every worker) cannot be initialized */
+typedef struct
+{
+    int failAll;
+    atomic_int numInits;
+    atomic_int numEvaluated;
+} testSchedulerContext;
+
+static void *testSchedulerWorkerInit(void *ctx)
+{
+    testSchedulerContext *tc = ctx;
+    int k = atomic_fetch_add(&tc->numInits, 1);
+    return tc->failAll || k % 2 ? NULL : MALLOC(1);
+}
+
+static double testSchedulerEvaluate(void *ctx, void *workerState, u64 guess, u64 *index)
+{
+    testSchedulerContext *tc = ctx;
+    (void)workerState;
+    atomic_fetch_add(&tc->numEvaluated, 1);
+    *index = guess;
+    return (double)guess;
+}
+
+static void testSchedulerWorkerFree(void *ctx, void *workerState)
+{
+    (void)ctx;
+    FREE(workerState);
+}
+
 int main()
 {
 
@@ -208,6 +249,7 @@ int main()
     lweSample *emptySample, *randomSample;
     srand(time(NULL));
     randomUtilRandomize();
+    storageWriterSetDefaultVerification(STORAGE_WRITER_SAMPLED_VERIFICATION_RATE, STORAGE_WRITER_BACKGROUND_VERIFICATION);
 
     emptySample = lwe.newEmptySample();
     randomSample = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
@@ -235,6 +277,588 @@ int main()
 
     }
     free_table_plain_bkw_2_positions();
+
+    // TEST 6 - singleton categories written to and read from the sample info file
+    bkwStepParameters lmsPar;
+    lmsPar.sorting = LMS;
+    lmsPar.startIndex = 0;
+    lmsPar.numPositions = 2;
+    lmsPar.sortingPar.LMS.p = 20; /* c = 6 is even, so there are 4 singleton categories */
+    u64 singletons[MAX_NUM_SINGLETON_CATEGORIES], singletonsFromFile[MAX_NUM_SINGLETON_CATEGORIES];
+    int numSingletons = singleton_categories(&lwe, &lmsPar, singletons), numSingletonsFromFile;
+    u64 numCategories = num_categories(&lwe, &lmsPar);
+    u64 *numSamplesPerCategory = CALLOC(numCategories, sizeof(u64));
+    char singletonFolder[256];
+    sprintf(singletonFolder, "%s/singletons", outputfolder);
+    mkdir(singletonFolder, 0777);
+    if (numSingletons != 4 ||
+            sampleInfoToFile(singletonFolder, &lmsPar, numCategories, 1, 0, singletons, numSingletons, numSamplesPerCategory, NULL) ||
+            sampleInfoSingletonsFromFile(singletonFolder, singletonsFromFile, &numSingletonsFromFile) ||
+            numSingletonsFromFile != numSingletons)
+    {
+        timeStamp(start);
+        printf("Error in singleton categories in sample info file\n");
+        return 1;
+    }
+    u8 *singletonBitmap = singletonBitmapCreate(numCategories, singletonsFromFile, numSingletonsFromFile);
+    for (int i = 0; i < 4; ++i)
+    {
+        a[0] = (i & 1) ? q/2 : 0;
+        a[1] = (i & 2) ? q/2 : 0;
+        if (!singletonBitmapTest(singletonBitmap, position_values_2_category_index_lms(&lwe, &lmsPar, a)))
+        {
+            timeStamp(start);
+            printf("Error in singleton bitmap\n");
+            return 1;
+        }
+    }
+    FREE(singletonBitmap);
+    FREE(numSamplesPerCategory);
+    free_table_plain_bkw_2_positions();
+
+    // TEST 7 - scratch arena
+    scratchArena sa;
+    if (scratchArenaInitialize(&sa, 4 * LWE_SAMPLE_SIZE_IN_BYTES))
+    {
+        timeStamp(start);
+        printf("Error allocating scratch arena\n");
+        return 1;
+    }
+    lweSample *s1 = scratchArenaAlloc(&sa, LWE_SAMPLE_SIZE_IN_BYTES);
+    size_t mark = scratchArenaMark(&sa);
+    lweSample *s2 = scratchArenaAlloc(&sa, 2 * LWE_SAMPLE_SIZE_IN_BYTES);
+    scratchArenaRewind(&sa, mark);
+    lweSample *s3 = scratchArenaAlloc(&sa, LWE_SAMPLE_SIZE_IN_BYTES);
+    if (!s1 || !s2 || s3 != s2 || (size_t)s2 % _Alignof(max_align_t) || scratchArenaAlloc(&sa, 4 * LWE_SAMPLE_SIZE_IN_BYTES) || sa.peak < 3 * LWE_SAMPLE_SIZE_IN_BYTES)
+    {
+        timeStamp(start);
+        printf("Error in scratch arena\n");
+        return 1;
+    }
+    scratchArenaReset(&sa);
+    if (scratchArenaAlloc(&sa, 4 * LWE_SAMPLE_SIZE_IN_BYTES) != s1)
+    {
+        timeStamp(start);
+        printf("Error in scratch arena reset\n");
+        return 1;
+    }
+    scratchArenaFree(&sa);
+
+    // TEST 8 - linear column hash combined from the hashes of two samples
+    lweSample *sumSample = lwe.newEmptySample();
+    for (int i = 0; i < 1000; ++i)
+    {
+        lweSample *x = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
+        lweSample *y = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
+        int startRow = rand() % n;
+        for (int k = 0; k < 2; ++k)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                sumSample->col.a[j] = k ? (x->col.a[j] + y->col.a[j]) % q : (x->col.a[j] - y->col.a[j] + q) % q;
+            }
+            u64 hx = bkwColumnComputeHash(x, n, q, startRow), hy = bkwColumnComputeHash(y, n, q, startRow);
+            u64 combined = k ? columnHashAdd(hx, hy, q) : columnHashSubtract(hx, hy, q);
+            if (combined != bkwColumnComputeHash(sumSample, n, q, startRow))
+            {
+                timeStamp(start);
+                printf("Error in linear column hash\n");
+                return 1;
+            }
+        }
+        lwe.freeSample(x);
+        lwe.freeSample(y);
+    }
+    lwe.freeSample(sumSample);
+
+    // TEST 9 - duplicate samples discarded by the storage writer
+    bkwStepParameters plainPar;
+    plainPar.sorting = plainBKW;
+    plainPar.startIndex = 0;
+    plainPar.numPositions = 2;
+    char dedupFolder[256];
+    sprintf(dedupFolder, "%s/dedup", outputfolder);
+    deleteStorageFolder(dedupFolder, 1, 1, 1);
+    storageWriter sw;
+    if (storageWriterInitialize(&sw, dedupFolder, &lwe, &plainPar, 4) || storageWriterEnableDeduplication(&sw))
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer\n");
+        return 1;
+    }
+    lweSample *x = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
+    lweSample *y = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
+    lweSample *dedupSamples[5] = {x, y, x, x, y};
+    int storageWriterStatus;
+    for (int i = 0; i < 5; ++i)
+    {
+        if (i == 3)
+        {
+            storageWriterFlush(&sw); /* duplicates of samples already on file */
+        }
+        lweSample *d = storageWriterAddSample(&sw, 0, &storageWriterStatus);
+        MEMCPY(d, dedupSamples[i], LWE_SAMPLE_SIZE_IN_BYTES);
+    }
+    storageWriterFlush(&sw);
+    if (sw.numStoredFile[0] != 2 || sw.totalNumDuplicatesDiscarded != 3 || sw.totalNumSamplesAddedToStorageWriter != 2)
+    {
+        timeStamp(start);
+        printf("Error in storage writer deduplication\n");
+        return 1;
+    }
+    storageWriterFree(&sw);
+    lwe.freeSample(x);
+    lwe.freeSample(y);
+
+    // TEST 10 - unnatural selection pre-filter against the squared norm of each combined sample
+    bkwStepParameters usPar;
+    usPar.sorting = smoothLMS;
+    usPar.startIndex = 2;
+    usPar.numPositions = 3;
+    usPar.sortingPar.smoothLMS.unnatural_selection_ts = 30;
+    usPar.sortingPar.smoothLMS.unnatural_selection_start_index = 1;
+    int numUsSamples = 300;
+    lweSample *usSamples = MALLOC(numUsSamples * LWE_SAMPLE_SIZE_IN_BYTES);
+    for (int i = 0; i < numUsSamples; ++i)
+    {
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, s);
+        MEMCPY(&usSamples[i], r, LWE_SAMPLE_SIZE_IN_BYTES);
+        lwe.freeSample(r);
+    }
+    unnaturalSelectionFilter us;
+    if (unnaturalSelectionInitialize(&us, &lwe, &usPar, numUsSamples))
+    {
+        timeStamp(start);
+        printf("Error initializing unnatural selection filter\n");
+        return 1;
+    }
+    unnaturalSelectionLoad(&us, usSamples, 100);
+    unnaturalSelectionLoad(&us, usSamples + 100, numUsSamples - 100);
+    u64 numAccepted = 0;
+    for (int i = 0; i < numUsSamples; ++i)
+    {
+        for (int add = 0; add < 2; ++add)
+        {
+            const u8 *accept = unnaturalSelectionFilterPairs(&us, i, 0, numUsSamples, add);
+            for (int j = 0; j < numUsSamples; ++j)
+            {
+                int normSquared = 0;
+                for (int k = 1; k < 5; ++k)
+                {
+                    int v = add ? (usSamples[i].col.a[k] + usSamples[j].col.a[k]) % q : (usSamples[i].col.a[k] - usSamples[j].col.a[k] + q) % q;
+                    v = v < q - v ? v : q - v;
+                    normSquared += v * v;
+                }
+                if (accept[j] != (normSquared < 4 * 30 * 30))
+                {
+                    timeStamp(start);
+                    printf("Error in unnatural selection filter\n");
+                    return 1;
+                }
+                numAccepted += accept[j];
+            }
+        }
+    }
+    timeStamp(start);
+    printf("Unnatural selection accepted %" PRIu64 " of %d pairs\n", numAccepted, 2 * numUsSamples * numUsSamples);
+    unnaturalSelectionFree(&us);
+    FREE(usSamples);
+
+    // TEST 11 - sampled verification in the storage writer, on a background thread
+    char verifyFolder[256];
+    sprintf(verifyFolder, "%s/verify", outputfolder);
+    deleteStorageFolder(verifyFolder, 1, 1, 1);
+    categoryIndexer plainIndexer;
+    if (storageWriterInitialize(&sw, verifyFolder, &lwe, &plainPar, 4) || storageWriterEnableVerification(&sw, &lwe, 1, 1) || categoryIndexerInitialize(&plainIndexer, &lwe, &plainPar))
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer verification\n");
+        return 1;
+    }
+    for (int i = 0; i < 3 * STORAGE_WRITER_VERIFICATION_BATCH_SIZE; ++i)
+    {
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, lwe.s); /* the secret the writer verifies against */
+        u64 categoryIndex = categoryIndexerSampleIndex(&plainIndexer, r);
+        if (i == 0)
+        {
+            categoryIndex = (categoryIndex + 1) % sw.numCategories; /* misplaced sample */
+        }
+        lweSample *d = storageWriterAddSample(&sw, categoryIndex, &storageWriterStatus);
+        if (d)
+        {
+            MEMCPY(d, r, LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+        lwe.freeSample(r);
+    }
+    storageWriterFree(&sw);
+    if (sw.totalNumSamplesVerified != sw.totalNumSamplesWrittenToFile || sw.totalNumVerificationErrors != 1)
+    {
+        timeStamp(start);
+        printf("Error in storage writer verification (%" PRIu64 " of %" PRIu64 " samples verified, %" PRIu64 " errors)\n", sw.totalNumSamplesVerified, sw.totalNumSamplesWrittenToFile, sw.totalNumVerificationErrors);
+        return 1;
+    }
+
+    // TEST 12 - per-step metrics of a storage writer
+    char metricsFolder[256], metricsFile[512];
+    sprintf(metricsFolder, "%s/metrics", outputfolder);
+    deleteStorageFolder(metricsFolder, 1, 1, 1);
+    bkwMetrics metrics;
+    bkwMetricsBegin(&metrics, metricsFolder);
+    if (storageWriterInitialize(&sw, metricsFolder, &lwe, &plainPar, 4))
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer\n");
+        return 1;
+    }
+    u64 numDiscarded[4] = {0, 0, 0, 0};
+    for (u64 i = 0; i < 10 * sw.numCategories; ++i)
+    {
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, lwe.s);
+        u64 categoryIndex = categoryIndexerSampleIndex(&plainIndexer, r);
+        lweSample *d = storageWriterAddSample(&sw, categoryIndex, &storageWriterStatus);
+        numDiscarded[storageWriterStatus] += !d;
+        if (d && i == 0)
+        {
+            storageWriterUndoAddSample(&sw, categoryIndex); /* as for a zero column */
+        }
+        else if (d)
+        {
+            MEMCPY(d, r, LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+        lwe.freeSample(r);
+    }
+    storageWriterFree(&sw);
+    bkwMetricsEnd(&metrics);
+    metricsFileName(metricsFile, metricsFolder);
+    if (metrics.numPairsConsidered != 10 * sw.numCategories || metrics.numZeroColumnRejects != 1 ||
+        metrics.numWriterDiscardsCacheFull != numDiscarded[2] || metrics.numWriterDiscardsCategoryFull != numDiscarded[3] || !numDiscarded[3] ||
+        metrics.numSamplesWritten != sw.totalNumSamplesWrittenToFile || !metrics.numFlushes ||
+        metrics.numFlushBytes < sw.totalNumSamplesWrittenToFile * LWE_SAMPLE_SIZE_IN_BYTES || bkwMetricsCurrent() ||
+        bkwMetricsToFile(&metrics, metricsFile) || !fileExists(metricsFile))
+    {
+        timeStamp(start);
+        printf("Error in storage writer metrics\n");
+        return 1;
+    }
+    bkwMetrics quotedMetrics;
+    bkwMetricsBegin(&quotedMetrics, "a\"b\\c\nd\001");
+    bkwMetricsEnd(&quotedMetrics);
+    char metricsJson[4096] = "";
+    FILE *metricsJsonFile = NULL;
+    if (bkwMetricsToFile(&quotedMetrics, metricsFile) || !(metricsJsonFile = fopen(metricsFile, "r")))
+    {
+        timeStamp(start);
+        printf("Error writing metrics with a quoted stage\n");
+        return 1;
+    }
+    metricsJson[fread(metricsJson, 1, sizeof(metricsJson) - 1, metricsJsonFile)] = 0;
+    fclose(metricsJsonFile);
+    if (!strstr(metricsJson, "\"stage\": \"a\\\"b\\\\c\\nd\\u0001\","))
+    {
+        timeStamp(start);
+        printf("Error escaping the metrics stage\n");
+        return 1;
+    }
+    categoryIndexerFree(&plainIndexer);
+
+    // TEST 13 - planner, a plan for the instance of the pipeline test
+    plannerBudget budget = { 0, 0, 0 };
+    pipelinePlan plan, planFromFile;
+    plannerEstimate est, estFromFile;
+    if (plannerSearch(n, q, 0.01, 10000, &budget, &plan, &est) || !est.success || est.numStages != plan.numSteps + 1)
+    {
+        timeStamp(start);
+        printf("Error: no plan found for n = %d, q = %d\n", n, q);
+        return 1;
+    }
+    for (int i = 0, position = 0; i < plan.numSteps; position += plan.step[i++].numPositions)
+    {
+        if (plan.step[i].startIndex != position || num_categories(&lwe, &plan.step[i]) != est.stage[i].numCategories ||
+            (i == plan.numSteps - 1 && position + plan.step[i].numPositions + plan.bruteForcePositions != n))
+        {
+            timeStamp(start);
+            printf("Error: planned step %d does not follow the previous steps\n", i);
+            return 1;
+        }
+    }
+    char planFileName[512];
+    sprintf(plan.folderName, "%s/planned", outputfolder);
+    sprintf(planFileName, "%s/planned.txt", outputfolder);
+    if (pipelinePlanToFile(planFileName, &plan) || pipelinePlanFromFile(planFileName, &planFromFile) ||
+        plannerEstimatePlan(&planFromFile, &estFromFile) || estFromFile.seconds != est.seconds)
+    {
+        timeStamp(start);
+        printf("Error: planned plan not read back from %s\n", planFileName);
+        return 1;
+    }
+    budget.maxRamBytes = 1;
+    if (plannerSearch(n, q, 0.01, 10000, &budget, &plan, &est) != 2)
+    {
+        timeStamp(start);
+        printf("Error: plan found within an impossible budget\n");
+        return 1;
+    }
+    timeStamp(start);
+    printf("Test on planner: success\n");
+
+    // TEST 14 - variable category capacities, written with an offset table (densely by default) and read back
+    char extentsFolder[256];
+    sprintf(extentsFolder, "%s/extents", outputfolder);
+    deleteStorageFolder(extentsFolder, 1, 1, 1);
+    u64 numPlainCategories = num_categories(&lwe, &plainPar);
+    u64 *capacities = MALLOC(numPlainCategories * sizeof(u64));
+    u64 totalCapacity = 0;
+    for (u64 i = 0; i < numPlainCategories; ++i)
+    {
+        capacities[i] = 1 + i % 3;
+        totalCapacity += capacities[i];
+    }
+    if (storageWriterInitializeWithCapacities(&sw, extentsFolder, &lwe, &plainPar, 0, capacities) || categoryIndexerInitialize(&plainIndexer, &lwe, &plainPar))
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer with category capacities\n");
+        return 1;
+    }
+    for (u64 i = 0; i < 4 * numPlainCategories; ++i)
+    {
+        if (i == numPlainCategories)
+        {
+            storageWriterFlush(&sw);
+        }
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, lwe.s);
+        u64 categoryIndex = categoryIndexerSampleIndex(&plainIndexer, r);
+        lweSample *d = storageWriterAddSample(&sw, categoryIndex, &storageWriterStatus);
+        if (d)
+        {
+            MEMCPY(d, r, LWE_SAMPLE_SIZE_IN_BYTES);
+        }
+        lwe.freeSample(r);
+    }
+    storageWriterFree(&sw);
+    u64 *categoryOffsets = MALLOC((numPlainCategories + 1) * sizeof(u64));
+    u64 numSamplesOnFile = STORAGE_WRITER_DENSE_CATEGORIES ? sw.totalNumSamplesWrittenToFile : totalCapacity;
+    if (sampleInfoCategoryOffsetsFromFile(extentsFolder, numPlainCategories, categoryOffsets) || categoryOffsets[numPlainCategories] != numSamplesOnFile ||
+        numSamplesInSampleFile(extentsFolder) != categoryOffsets[numPlainCategories])
+    {
+        timeStamp(start);
+        printf("Error: category offsets not written to %s\n", extentsFolder);
+        return 1;
+    }
+    storageReader sr;
+    if (storageReaderInitialize(&sr, extentsFolder))
+    {
+        timeStamp(start);
+        printf("Error initializing storage reader\n");
+        return 1;
+    }
+    lweSample *buf[2];
+    u64 numSamplesInBuf[2];
+    u64 category = 0, numSamplesRead = 0;
+    int numReadCategories;
+    while ((numReadCategories = storageReaderGetNextAdjacentCategoryPair(&sr, &buf[0], &numSamplesInBuf[0], &buf[1], &numSamplesInBuf[1])))
+    {
+        for (int c = 0; c < numReadCategories; ++c, ++category)
+        {
+            for (u64 i = 0; i < numSamplesInBuf[c]; ++i)
+            {
+                if (numSamplesInBuf[c] > capacities[category] || categoryIndexerSampleIndex(&plainIndexer, &buf[c][i]) != category)
+                {
+                    timeStamp(start);
+                    printf("Error: unexpected sample in category %" PRIu64 "\n", category);
+                    return 1;
+                }
+            }
+            numSamplesRead += numSamplesInBuf[c];
+        }
+    }
+    storageReaderFree(&sr);
+    if (category != numPlainCategories || numSamplesRead != sw.totalNumSamplesWrittenToFile || sr.totalNumBytesReadFromFile != categoryOffsets[numPlainCategories] * LWE_SAMPLE_SIZE_IN_BYTES)
+    {
+        timeStamp(start);
+        printf("Error: %" PRIu64 " samples in %" PRIu64 " categories read back (%" PRIu64 " written)\n", numSamplesRead, category, sw.totalNumSamplesWrittenToFile);
+        return 1;
+    }
+
+    /* pilot pass for a smooth LMS step on the next two positions */
+    bkwStepParameters pilotPar;
+    pilotPar.sorting = smoothLMS;
+    pilotPar.startIndex = 2;
+    pilotPar.numPositions = 2;
+    pilotPar.selection = LF2;
+    pilotPar.sortingPar.smoothLMS.p = 21;
+    pilotPar.sortingPar.smoothLMS.p1 = 38;
+    pilotPar.sortingPar.smoothLMS.p2 = 21;
+    pilotPar.sortingPar.smoothLMS.prev_p1 = 38;
+    pilotPar.sortingPar.smoothLMS.meta_skipped = 0;
+    pilotPar.sortingPar.smoothLMS.unnatural_selection_ts = 0;
+    u64 numPilotCategories = num_categories(&lwe, &pilotPar);
+    u64 *pilotCapacities = MALLOC(numPilotCategories * sizeof(u64));
+    u64 pilotTotals[3] = { numPilotCategories, 10 * numPilotCategories, 10 * numPilotCategories + numPilotCategories / 2 + 1 };
+    for (int t = 0; t < 3; ++t)
+    {
+        if (smoothLmsPilotCapacities(extentsFolder, &pilotPar, 50, pilotTotals[t], pilotCapacities))
+        {
+            timeStamp(start);
+            printf("Error in smooth LMS pilot pass\n");
+            return 1;
+        }
+        u64 pilotTotal = 0;
+        int pilotEmptyCategory = 0;
+        for (u64 i = 0; i < numPilotCategories; ++i)
+        {
+            pilotTotal += pilotCapacities[i];
+            pilotEmptyCategory |= !pilotCapacities[i];
+        }
+        if (pilotEmptyCategory || pilotTotal != pilotTotals[t])
+        {
+            timeStamp(start);
+            printf("Error: pilot capacities add up to %" PRIu64 " samples (expected %" PRIu64 ")\n", pilotTotal, pilotTotals[t]);
+            return 1;
+        }
+    }
+    if (!smoothLmsPilotCapacities(extentsFolder, &pilotPar, 50, numPilotCategories - 1, pilotCapacities))
+    {
+        timeStamp(start);
+        printf("Error: pilot pass accepted less than one sample per category\n");
+        return 1;
+    }
+    FREE(pilotCapacities);
+    FREE(categoryOffsets);
+    FREE(capacities);
+    categoryIndexerFree(&plainIndexer);
+
+    // TEST 15 - samples kept ordered by sub-bucket over several flushes (plain BKW on 3 positions)
+    bkwStepParameters plain3Par;
+    plain3Par.sorting = plainBKW;
+    plain3Par.startIndex = 0;
+    plain3Par.numPositions = 3;
+    char subBucketFolder[256];
+    sprintf(subBucketFolder, "%s/sub_buckets", outputfolder);
+    deleteStorageFolder(subBucketFolder, 1, 1, 1);
+    subBucketIndexer sbi;
+    if (storageWriterInitialize(&sw, subBucketFolder, &lwe, &plain3Par, 200) || storageWriterEnableVerification(&sw, &lwe, 0, 0) || subBucketIndexerInitialize(&sbi, &lwe, &plain3Par)) /* the samples are not in their own categories */
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer with sub-buckets\n");
+        return 1;
+    }
+    for (int i = 0; i < 4 * 150; ++i)
+    {
+        if (i % 100 == 99)
+        {
+            storageWriterFlush(&sw);
+        }
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, lwe.s);
+        lweSample *d = storageWriterAddSample(&sw, i % 4, &storageWriterStatus);
+        MEMCPY(d, r, LWE_SAMPLE_SIZE_IN_BYTES);
+        lwe.freeSample(r);
+    }
+    storageWriterFree(&sw);
+    if (storageReaderInitialize(&sr, subBucketFolder))
+    {
+        timeStamp(start);
+        printf("Error initializing storage reader\n");
+        return 1;
+    }
+    category = 0;
+    while ((numReadCategories = storageReaderGetNextAdjacentCategoryPair(&sr, &buf[0], &numSamplesInBuf[0], &buf[1], &numSamplesInBuf[1])))
+    {
+        for (int c = 0; c < numReadCategories; ++c, ++category)
+        {
+            for (u64 i = 1; i < numSamplesInBuf[c]; ++i)
+            {
+                if (subBucketIndexerKey(&sbi, &buf[c][i - 1]) > subBucketIndexerKey(&sbi, &buf[c][i]))
+                {
+                    timeStamp(start);
+                    printf("Error: category %" PRIu64 " not ordered by sub-bucket\n", category);
+                    return 1;
+                }
+            }
+            if (numSamplesInBuf[c] != (category < 4 ? 150 : 0))
+            {
+                timeStamp(start);
+                printf("Error: %" PRIu64 " samples in category %" PRIu64 "\n", numSamplesInBuf[c], category);
+                return 1;
+            }
+        }
+    }
+    storageReaderFree(&sr);
+
+    // TEST 16 - pair and write counts of the final step (duplicated and negated samples cancel to zero columns)
+    bkwStepParameters finalPar;
+    MEMSET(&finalPar, 0, sizeof(finalPar));
+    finalPar.sorting = plainBKW;
+    finalPar.startIndex = 0;
+    finalPar.numPositions = 2;
+    finalPar.selection = LF2;
+    char finalSrcFolder[256], finalDstFolder[256];
+    sprintf(finalSrcFolder, "%s/final_src", outputfolder);
+    sprintf(finalDstFolder, "%s/final_dst", outputfolder);
+    deleteStorageFolder(finalSrcFolder, 1, 1, 1);
+    deleteStorageFolder(finalDstFolder, 1, 1, 1);
+    categoryIndexer finalIndexer;
+    if (storageWriterInitialize(&sw, finalSrcFolder, &lwe, &finalPar, 8) || categoryIndexerInitialize(&finalIndexer, &lwe, &finalPar))
+    {
+        timeStamp(start);
+        printf("Error initializing storage writer for the final step\n");
+        return 1;
+    }
+    lweSample zeroSample, negatedSample;
+    MEMSET(&zeroSample, 0, sizeof(zeroSample));
+    zeroSample.col.hash = bkwColumnComputeHash(&zeroSample, n, q, 0);
+    for (int i = 0; i < 200; ++i)
+    {
+        lweSample *r = lwe.newRandomSample(n, q, alpha*q, &lwe.rnd, lwe.s);
+        lweSampleSubtract(&negatedSample, &zeroSample, r, n, q);
+        lweSample *copies[3] = { r, r, &negatedSample }; /* cancel when subtracted and when added */
+        for (int copy = 0; copy < 3; ++copy)
+        {
+            lweSample *d = storageWriterAddSample(&sw, categoryIndexerSampleIndex(&finalIndexer, copies[copy]), &storageWriterStatus);
+            if (d)
+            {
+                MEMCPY(d, copies[copy], LWE_SAMPLE_SIZE_IN_BYTES);
+            }
+        }
+        lwe.freeSample(r);
+    }
+    storageWriterFree(&sw);
+    categoryIndexerFree(&finalIndexer);
+    u64 numFinalSamples;
+    if (transition_bkw_step_final(finalSrcFolder, finalDstFolder, &finalPar, &numFinalSamples, start))
+    {
+        timeStamp(start);
+        printf("Error in the final step\n");
+        return 1;
+    }
+    const bkwMetrics *finalMetrics = bkwMetricsLast();
+    if (!finalMetrics->numZeroColumnRejects || !finalMetrics->numSamplesWritten ||
+        finalMetrics->numPairsConsidered != finalMetrics->numSamplesWritten + finalMetrics->numZeroColumnRejects + finalMetrics->numUnnaturalSelectionRejects ||
+        finalMetrics->numSamplesWritten != numSamplesInSampleFile(finalDstFolder) || finalMetrics->numFlushBytes != numSamplesInSampleFile(finalDstFolder) * LWE_SAMPLE_SIZE_IN_BYTES)
+    {
+        timeStamp(start);
+        printf("Error in final step metrics (%" PRIu64 " pairs, %" PRIu64 " written, %" PRIu64 " zero columns, %" PRIu64 " rejected)\n", finalMetrics->numPairsConsidered, finalMetrics->numSamplesWritten, finalMetrics->numZeroColumnRejects, finalMetrics->numUnnaturalSelectionRejects);
+        return 1;
+    }
+
+    // TEST 17 - guess scheduler with workers that cannot be initialized, the others evaluate their guesses
+    for (int failAll = 0; failAll < 2; ++failAll)
+    {
+        testSchedulerContext tc;
+        tc.failAll = failAll;
+        atomic_init(&tc.numInits, 0);
+        atomic_init(&tc.numEvaluated, 0);
+        guessScheduler gs = { 4, SOLVER_TOP_K_CANDIDATES, 0, &tc, testSchedulerWorkerInit, testSchedulerEvaluate, testSchedulerWorkerFree };
+        guessCandidate candidates[SOLVER_TOP_K_CANDIDATES];
+        int numCandidates = 0;
+        int ret = guessSchedulerRun(&gs, 1000, candidates, &numCandidates, NULL);
+        if (failAll ? ret != 3 || atomic_load(&tc.numEvaluated) : ret || atomic_load(&tc.numEvaluated) != 1000 || !numCandidates || candidates[0].guess != 999)
+        {
+            timeStamp(start);
+            printf("Error: guess scheduler returned %d after %d evaluations with %s workers failing\n", ret, atomic_load(&tc.numEvaluated), failAll ? "all" : "half of the");
+            return 1;
+        }
+    }
+
     lwe.freeSample(emptySample);
     lwe.freeSample(randomSample);
 